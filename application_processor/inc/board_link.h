@@ -16,6 +16,8 @@
 
 #include "simple_i2c_controller.h"
 #include "simple_crypto.h"
+#include "key_epoch.h"
+#include "packet_pool.h"
 
 /******************************** MACRO DEFINITIONS ********************************/
 // Last byte of the component ID is the I2C address
@@ -23,6 +25,82 @@
 #define SUCCESS_RETURN 0
 #define ERROR_RETURN -1
 
+// Secure frame layout:
+// [payload length][key epoch][counter, big endian][tag][ciphertext padded
+// to BLOCK_SIZE]
+// The tag covers length, epoch, counter and ciphertext and is checked before
+// any decryption. 15 AES blocks keep the whole frame under the 255 byte I2C
+// length register. Counters keep running across key epochs
+#define FRAME_EPOCH_OFFSET 1
+#define FRAME_COUNTER_OFFSET 2
+#define FRAME_COUNTER_LEN 4
+#define FRAME_TAG_OFFSET (FRAME_COUNTER_OFFSET + FRAME_COUNTER_LEN)
+#define FRAME_HEADER_LEN (FRAME_TAG_OFFSET + TAG_SIZE)
+#define MAX_FRAME_PAYLOAD 240
+
+// Frames are sent from and received into pool buffers in place. Write
+// headroom and read header are the same size, so the payload sits at the
+// same offset either way and a received buffer can be answered from
+#if I2C_TX_HEADROOM != BURST_READ_HEADER_LEN
+#error "secure frames need I2C_TX_HEADROOM == BURST_READ_HEADER_LEN"
+#endif
+#define FRAME_PAYLOAD_OFFSET (BURST_READ_HEADER_LEN + FRAME_HEADER_LEN)
+#define FRAME_PAYLOAD(buf) (&(buf)->data[FRAME_PAYLOAD_OFFSET])
+
+// Direction byte of the frame nonce, so the two sides never share one
+#define FRAME_TO_COMPONENT 0
+#define FRAME_TO_AP 1
+
+// Counters a resumed component skips. It may have sent frames that were
+// never accepted here before it reset, each one waits for the read of the
+// previous one so only a few can be outstanding
+#define RESUME_COUNTER_GAP 256
+
+// Frames sent between automatic key rotations, see board_link_rotate_key()
+#define KEY_ROTATE_FRAMES 1024
+// Frames sent before a rotation a lagging component held up is tried again
+#define KEY_ROTATE_RETRY_FRAMES 64
+
+// Adaptive polling limits in microseconds
+#define POLL_TIMEOUT_US 100000
+#define POLL_MIN_DELAY_US 20
+#define POLL_MAX_DELAY_US 2000
+// Approximate bus time of one TRANSMIT_DONE + TRANSMIT_LEN status read,
+// used to start the first poll early enough
+#define POLL_TRANSACTION_US(freq) ((5 * 9 + 4) * 1000000 / (freq))
+
+// Status reads that must all succeed before a speed is accepted
+#define SPEED_PROBE_READS 4
+
+/******************************** TYPE DEFINITIONS ********************************/
+// Secure frame statistics, times in core clock cycles. A rejected frame
+// would have cost about decrypt_cycles / decrypted_blocks per block it
+// carried, the difference to reject_cycles is what the early check saved
+typedef struct {
+    uint32_t accepted;         // Frames whose tag matched
+    uint32_t bad_header;       // Rejected on length or counter, no crypto run
+    uint32_t bad_tag;          // Rejected on the tag, never decrypted
+    uint32_t rejected_blocks;  // Ciphertext blocks in rejected frames
+    uint32_t decrypted_blocks; // Ciphertext blocks in accepted frames
+    uint64_t reject_cycles;    // Time spent on rejected frames
+    uint64_t decrypt_cycles;   // Time spent decrypting accepted frames
+    uint32_t rotations;        // Key epochs switched to
+    uint32_t old_epoch;        // Accepted under the epoch before the current one
+} frame_stats_t;
+
+// Per-address polling statistics, times in microseconds
+typedef struct {
+    uint32_t srtt;      // Smoothed round trip from first poll to response ready
+    uint32_t rttvar;    // Smoothed mean deviation of the round trip
+    uint32_t max_rtt;   // Largest round trip seen
+    uint32_t polls;     // Status reads issued
+    uint32_t responses; // Polls that ended with a response
+    uint32_t busy;      // Polls that saw TRANSMIT_BUSY
+    uint32_t dropped;   // Requests the component abandoned (BUSY then IDLE)
+    uint32_t absent;    // Polls that were not acknowledged
+    uint32_t timeouts;  // Polls that ran out of time
+} poll_stats_t;
+
 /******************************** FUNCTION PROTOTYPES ********************************/
 /**
  * @brief Initialize the board link connection
@@ -31,6 +109,77 @@
 */
 void board_link_init(void);
 
+/**
+ * @brief Expand the synced key once for all secure packets
+ * 
+ * @param key: uint8_t*, 16 byte key, the caller keeps passing the same key
+ * to the secure packet functions
+ * 
+ * @return int: SUCCESS_RETURN if success, ERROR_RETURN if error
+ * Call after key_sync(). Until then, and after board_link_clear_key(),
+ * every packet expands its key again
+*/
+int board_link_set_key(uint8_t* key);
+
+/**
+ * @brief Pick the frame counters and key epoch a resumed component continues from
+ * 
+ * @param address: i2c_addr_t, address of the component
+ * @param send_base: uint32_t*, set to the counter the component sends after
+ * @param recv_base: uint32_t*, set to the counter the component accepts after
+ * @param epoch: uint32_t*, set to the key epoch frames are sent under
+ * 
+ * Both counters are past every frame sent under the key before the reset,
+ * so a resumed component never repeats a frame nonce
+*/
+void board_link_resume_counters(i2c_addr_t address, uint32_t* send_base, uint32_t* recv_base,
+                                uint32_t* epoch);
+
+/**
+ * @brief Switch to the next key epoch without stopping traffic
+ * 
+ * @return int: SUCCESS_RETURN once frames go out under the next epoch,
+ * ERROR_RETURN before board_link_set_key() or while a component that got a
+ * frame under the current epoch has not answered under it yet. A component
+ * whose last exchange failed, or that no longer acknowledges its address,
+ * does not count
+ *
+ * Frames still under way under the old epoch are accepted until the
+ * following rotation. secure_send_frame() calls this every
+ * KEY_ROTATE_FRAMES frames, components follow on the first frame they get
+ * under the new epoch
+*/
+int board_link_rotate_key(void);
+
+/**
+ * @brief Drop the expanded key
+ * 
+ * Call whenever the key changes
+*/
+void board_link_clear_key(void);
+
+/**
+ * @brief Negotiate the fastest bus speed a component handles
+ * 
+ * @param address: i2c_addr_t, i2c address
+ * 
+ * @return uint32_t: negotiated frequency, 0 if the component never answered
+ * Tries Fast-mode Plus, Fast-mode then standard mode and keeps the first
+ * speed where every probe read returns a valid status
+*/
+uint32_t board_link_negotiate_speed(i2c_addr_t address);
+
+/**
+ * @brief Look for a component at an address
+ * 
+ * @param address: i2c_addr_t, i2c address
+ * @param component_id: uint32_t*, set to the ID of the component found
+ * 
+ * @return int: SUCCESS_RETURN if a component answered, ERROR_RETURN if not
+ * An address probe, then a read of the IDENTITY register for present ones
+*/
+int identify_component(i2c_addr_t address, uint32_t* component_id);
+
 /**
  * @brief Convert 4-byte component ID to I2C address
  * 
@@ -51,7 +200,33 @@ i2c_addr_t component_id_to_i2c_addr(uint32_t component_id);
  * Function sends an arbitrary packet over i2c to a specified component
 */
 int send_packet(i2c_addr_t address, uint8_t len, uint8_t* packet);
-int secure_send_packet(i2c_addr_t address, uint8_t* buffer, uint8_t* GLOBAL_KEY);
+
+/**
+ * @brief Encrypt and send a length-framed packet over I2C
+ * 
+ * @param address: i2c_addr_t, i2c address
+ * @param buffer: uint8_t*, pointer to the plaintext payload
+ * @param len: uint8_t, payload length, at most MAX_FRAME_PAYLOAD
+ * @param GLOBAL_KEY: uint8_t*, 16 byte global key
+ * 
+ * @return status: SUCCESS_RETURN if success, ERROR_RETURN if error
+ * Only the payload rounded up to the next AES block is encrypted and sent
+*/
+int secure_send_packet(i2c_addr_t address, uint8_t* buffer, uint8_t len, uint8_t* GLOBAL_KEY);
+
+/**
+ * @brief Encrypt and send a frame built in a pool buffer
+ * 
+ * @param address: i2c_addr_t, i2c address
+ * @param buf: packet_buf_t*, plaintext payload at FRAME_PAYLOAD(buf)
+ * @param len: uint8_t, payload length, at most MAX_FRAME_PAYLOAD
+ * @param GLOBAL_KEY: uint8_t*, 16 byte global key
+ * 
+ * @return status: SUCCESS_RETURN if success, ERROR_RETURN if error
+ * The buffer is borrowed. Everything happens in place, so the payload is
+ * ciphertext once this returns
+*/
+int secure_send_frame(i2c_addr_t address, packet_buf_t* buf, uint8_t len, uint8_t* GLOBAL_KEY);
 /**
  * @brief Poll a component and receive a packet
  * 
@@ -61,5 +236,92 @@ int secure_send_packet(i2c_addr_t address, uint8_t* buffer, uint8_t* GLOBAL_KEY)
  * @return int: size of data received, ERROR_RETURN if error
 */
 int poll_and_receive_packet(i2c_addr_t address, uint8_t* packet);
+
+/**
+ * @brief Get the polling statistics for a component
+ * 
+ * @param address: i2c_addr_t, i2c address
+ * 
+ * @return const poll_stats_t*: statistics gathered by poll_and_receive_packet
+*/
+const poll_stats_t* get_poll_stats(i2c_addr_t address);
+
+/**
+ * @brief Get the secure frame statistics
+ * 
+ * @return const frame_stats_t*: accepted and rejected frame counts
+*/
+const frame_stats_t* get_frame_stats(void);
+
+/**
+ * @brief Estimate the cycles saved by rejecting frames before decryption
+ * 
+ * @return int64_t: decryption cost of the rejected blocks at the measured
+ * rate minus the time spent rejecting them, 0 until a frame was decrypted
+*/
+int64_t frame_cycles_saved(void);
+
+/**
+ * @brief Check once whether a component has a response waiting
+ * 
+ * @param address: i2c_addr_t, i2c address
+ * @param len: uint8_t*, set to the response length
+ * 
+ * @return int: TRANSMIT_READY, TRANSMIT_BUSY or TRANSMIT_IDLE,
+ * ERROR_RETURN if the read was not acknowledged
+ * Single status read without waiting, lets the caller service several
+ * components at once
+*/
+int poll_transmit_status(i2c_addr_t address, uint8_t* len);
+
+/**
+ * @brief Receive a packet after poll_transmit_status() returned TRANSMIT_READY
+ * 
+ * @param address: i2c_addr_t, i2c address
+ * @param len: uint8_t, length reported by poll_transmit_status()
+ * @param packet: uint8_t*, pointer to a buffer where a packet will be received 
+ * 
+ * @return int: size of data received, ERROR_RETURN if error
+ * A single burst read, without polling the status again
+*/
+int receive_ready_packet(i2c_addr_t address, uint8_t len, uint8_t* packet);
+
+/**
+ * @brief Poll a component and receive and decrypt a length-framed packet
+ * 
+ * @param address: i2c_addr_t, i2c address
+ * @param buffer: uint8_t*, MAX_I2C_MESSAGE_LEN buffer for the plaintext payload
+ * @param GLOBAL_KEY: uint8_t*, 16 byte global key
+ * 
+ * @return int: payload length, ERROR_RETURN if error or malformed frame
+ * Bytes past the payload are zeroed so the buffer never holds stale data
+*/
 int secure_poll_and_receive_packet(i2c_addr_t address, uint8_t *buffer, uint8_t* GLOBAL_KEY);
+
+/**
+ * @brief Poll a component and receive a frame into a pool buffer
+ * 
+ * @param address: i2c_addr_t, i2c address
+ * @param buf: packet_buf_t*, receives the frame
+ * @param GLOBAL_KEY: uint8_t*, 16 byte global key
+ * 
+ * @return int: payload length, ERROR_RETURN if error or malformed frame
+ * The buffer is borrowed. The payload is verified and decrypted in place at
+ * FRAME_PAYLOAD(buf) and zero padded up to MAX_FRAME_PAYLOAD
+*/
+int secure_receive_frame(i2c_addr_t address, packet_buf_t* buf, uint8_t* GLOBAL_KEY);
+
+/**
+ * @brief Receive a frame after poll_transmit_status() returned TRANSMIT_READY
+ * 
+ * @param address: i2c_addr_t, i2c address
+ * @param len: uint8_t, length reported by poll_transmit_status()
+ * @param buf: packet_buf_t*, receives the frame
+ * @param GLOBAL_KEY: uint8_t*, 16 byte global key
+ * 
+ * @return int: payload length, ERROR_RETURN if error or malformed frame
+ * As secure_receive_frame(), with a single burst read and no second poll
+*/
+int secure_receive_ready_frame(i2c_addr_t address, uint8_t len, packet_buf_t* buf,
+                               uint8_t* GLOBAL_KEY);
 #endif
@@ -75,6 +75,16 @@
 // Print a message through USB UART and then receive a line over USB UART
 void recv_input(const char *msg, char *buf);
 
+// Print a message, run idle() until input starts, then receive the line.
+// idle() may run for as long as one key sync, about 100 ms. The UART FIFO
+// holds only 8 characters, so anything that waits that long must call
+// console_drain() while it waits
+void recv_input_idle(const char *msg, char *buf, void (*idle)(void));
+
+// Move whatever the console UART FIFO holds into the line buffer the next
+// recv_input() or recv_input_idle() reads first. Returns at once
+void console_drain(void);
+
 // Prints a buffer of bytes as a hex string
 void print_hex(uint8_t *buf, size_t len);
 
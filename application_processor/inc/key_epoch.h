@@ -0,0 +1,92 @@
+/**
+ * @file "key_epoch.h"
+ * @brief Key Epoch Ratchet Header
+ * @date 2024
+ *
+ * The synced key is rotated through a one-way chain of epochs, the key of
+ * epoch e + 1 is AES_k(e)("EPCH" | e + 1). Two consecutive epochs are kept
+ * expanded at all times, so frames already under way under the old key are
+ * still accepted after the switch and the switch itself expands nothing.
+ * Frames carry the low byte of the epoch they were sealed under.
+ */
+
+#ifndef __KEY_EPOCH__
+#define __KEY_EPOCH__
+
+#include <stdint.h>
+
+#include "simple_crypto.h"
+
+/******************************** TYPE DEFINITIONS ********************************/
+// Keys of two consecutive epochs, epoch e lives in slot e & 1
+typedef struct {
+    uint32_t epoch;               // Epoch frames are sent under
+    uint32_t slot_epoch[2];       // Epoch held by each slot
+    uint8_t keys[2][KEY_SIZE];    // Raw keys, the next epoch derives from them
+    crypto_session_t sessions[2]; // Their expanded schedules
+} key_epochs_t;
+
+/******************************** FUNCTION PROTOTYPES ********************************/
+/**
+ * @brief Start the chain from the synced key
+ * 
+ * @param ke: key_epochs_t*, epochs to set up
+ * @param key: uint8_t*, 16 byte synced key, epoch 0
+ * @param epoch: uint32_t, epoch to send under, derived forward from the key
+ * 
+ * @return int: 0 on success, non-zero for error and ke is left cleared
+ * Expands the epoch and the one after it
+*/
+int key_epochs_init(key_epochs_t* ke, uint8_t* key, uint32_t epoch);
+
+/**
+ * @brief Wipe every key and schedule
+ * 
+ * @param ke: key_epochs_t*, epochs to clear
+*/
+void key_epochs_clear(key_epochs_t* ke);
+
+/**
+ * @brief Get the schedule to seal a frame with
+ * 
+ * @param ke: key_epochs_t*, epochs
+ * 
+ * @return crypto_session_t*: session of the current epoch, NULL before
+ * key_epochs_init()
+*/
+crypto_session_t* key_epochs_send(key_epochs_t* ke);
+
+/**
+ * @brief Get the schedule a received frame was sealed with
+ * 
+ * @param ke: key_epochs_t*, epochs
+ * @param epoch_byte: uint8_t, epoch byte from the frame header
+ * @param epoch: uint32_t*, set to the full epoch
+ * 
+ * @return crypto_session_t*: session of the matching slot, NULL if neither
+ * slot holds that epoch
+*/
+crypto_session_t* key_epochs_find(key_epochs_t* ke, uint8_t epoch_byte, uint32_t* epoch);
+
+/**
+ * @brief Derive and expand the epoch after the current one
+ * 
+ * @param ke: key_epochs_t*, epochs
+ * 
+ * @return int: 0 on success, non-zero for error
+ * Replaces the epoch before the current one, nothing sealed under it is
+ * accepted afterwards. Does nothing when the next epoch is already there
+*/
+int key_epochs_prepare(key_epochs_t* ke);
+
+/**
+ * @brief Send under the prepared next epoch from now on
+ * 
+ * @param ke: key_epochs_t*, epochs
+ * 
+ * @return int: 0 on success, -1 if the next epoch is not prepared
+ * The old epoch stays accepted until the next key_epochs_prepare()
+*/
+int key_epochs_switch(key_epochs_t* ke);
+
+#endif
@@ -8,13 +8,81 @@
 #include "key.h"
 // include random generator from Zack's API
 
-// premise the simple write and receive is sufficient to send a 16 byte stream
-// this assumes the key is 16 bytes
-int key_exchange1(unsigned char *dest, uint32_t component_id);
-// we may need a add a tag to it...
-int key_exchange2(unsigned char *dest, char *random1, char *random2, uint32_t component_id1,
-                    uint32_t component_id2);
-int key_sync(unsigned char *dest, uint32_t component_cnt,
-               uint32_t component_id1, uint32_t component_id2);
+// Length of KEY_SHARE, the masks and the synced key
+#define KEY_SHARE_LEN 16
+// DEAD repeated 16 times, all the component checks
+#define KEY_SYNC_TRIGGER_LEN 64
+// Same as the flash_entry component list
+#define KEY_SYNC_MAX_COMPONENTS 32
+
+// Messages of one component's exchange after the trigger, see key_exchange()
+#if KEY_SYNC_X25519
+// Public keys both ways, then the key and its tag
+#define KEY_SHARE_REQUEST_LEN X25519_KEY_SIZE
+#define KEY_SHARE_REPLY_LEN X25519_KEY_SIZE
+#define KEY_SHARE_FINAL_LEN (KEY_SHARE_LEN + TAG_SIZE)
+#else
+// [r ^ k2][0]['2'], then k ^ M1 back and the final XOR share
+#define KEY_SHARE_REQUEST_LEN 18
+#define KEY_SHARE_REPLY_LEN KEY_SHARE_LEN
+#define KEY_SHARE_FINAL_LEN KEY_SHARE_LEN
+#endif
+
+// Session resumption, see key_resume(). Same values as on the component
+#define RESUME_MAGIC "RSUM"
+#define RESUME_MAGIC_LEN 4
+#define RESUME_NONCE_LEN 16
+// "RSUM" and the AP nonce, shorter than any secure frame
+#define RESUME_REQUEST_LEN (RESUME_MAGIC_LEN + RESUME_NONCE_LEN)
+// Component nonce and its tag under the ticket
+#define RESUME_PROOF_LEN (RESUME_NONCE_LEN + TAG_SIZE)
+// Key, both counter bases, the key epoch and zero padding encrypted under
+// the resumption key, then the tag
+#define RESUME_GRANT_BODY_LEN (KEY_SHARE_LEN + BLOCK_SIZE)
+#define RESUME_GRANT_LEN (RESUME_GRANT_BODY_LEN + TAG_SIZE)
+
+/**
+ * @brief Agree on one key with components that are already in key sync
+ * 
+ * @param dest: unsigned char*, 16 byte key output
+ * @param component_cnt: uint32_t, number of components
+ * @param component_ids: uint32_t*, their IDs
+ * 
+ * @return int: 0 on success, -1 if any component failed
+*/
+int key_exchange(unsigned char *dest, uint32_t component_cnt, uint32_t *component_ids);
+/**
+ * @brief Put every provisioned component into key sync and agree on a key
+ * 
+ * @param dest: unsigned char*, 16 byte key output
+ * @param component_cnt: uint32_t, number of components
+ * @param component_ids: uint32_t*, their IDs
+ * 
+ * @return int: 0 on success, -1 if any component failed
+ *
+ * Four messages per component: the DEAD trigger, then key_exchange()
+*/
+int key_sync(unsigned char *dest, uint32_t component_cnt, uint32_t *component_ids);
+
+/**
+ * @brief Set what key_sync() runs while it waits on the components
+ * 
+ * @param hook: void (*)(void), must return at once, NULL for nothing
+ *
+ * Runs between reply sweeps and before each final message, so a sync of
+ * about 100 ms never goes more than a few ms without it
+*/
+void key_sync_set_wait_hook(void (*hook)(void));
+
+/**
+ * @brief Give a component that reset the synced key back
+ * 
+ * @param key: unsigned char*, 16 byte synced key
+ * @param component_id: uint32_t, the component
+ * 
+ * @return int: 0 once the key is sent, -1 if the component has no ticket for
+ * it or did not answer. Fall back to key_sync() then
+*/
+int key_resume(unsigned char *key, uint32_t component_id);
 
 #endif
@@ -21,16 +21,35 @@
 #include "nvic_table.h"
 #include "i2c.h"
 #include "string.h"
+#if I2C_USE_DMA
+#include "dma.h"
+#endif
 
 /******************************** MACRO DEFINITIONS ********************************/
-// I2C frequency in HZ
+// I2C frequency in HZ, standard mode is used until a component is negotiated
 #define I2C_FREQ 100000
+// Fast-mode and Fast-mode Plus frequencies in HZ
+#define I2C_FREQ_FAST 400000
+#define I2C_FREQ_FAST_PLUS 1000000
+// Consecutive NACKs or bad frames before an address drops one speed
+#define I2C_SPEED_FAULT_LIMIT 3
 // Physical I2C interface
 #define I2C_INTERFACE MXC_I2C1
 // Last register for out-of-bounds checking
-#define MAX_REG TRANSMIT_LEN 
+#define MAX_REG IDENTITY
 // Maximum length of an I2C register
 #define MAX_I2C_MESSAGE_LEN 256
+// BURST header bytes: [len] on writes, [status][len] on reads
+#define BURST_WRITE_HEADER_LEN 1
+#define BURST_READ_HEADER_LEN 2
+// IDENTITY register: component ID, big endian
+#define IDENTITY_LEN 4
+// Bytes reserved in front of a buffer passed to i2c_simple_write_burst_inplace()
+#define I2C_TX_HEADROOM (1 + BURST_WRITE_HEADER_LEN)
+// Transactions at least this long use DMA when built with I2C_USE_DMA=1
+#define I2C_DMA_MIN_LEN 16
+// Number of register operations that can be pending on the async queue
+#define I2C_ASYNC_QUEUE_LEN 4
 
 /******************************** TYPE DEFINITIONS ********************************/
 /* ECTF_I2C_REGS
@@ -43,10 +62,23 @@ typedef enum {
     TRANSMIT,
     TRANSMIT_DONE,
     TRANSMIT_LEN,
+    BURST, // Write: [len][data], sets RECEIVE_DONE. Read: [status][len][data]
+    IDENTITY, // Read only: component ID
 } ECTF_I2C_REGS;
 
+// TRANSMIT_DONE register values
+#define TRANSMIT_READY 0 // A response is waiting to be read
+#define TRANSMIT_IDLE 1  // No response pending and no request being processed
+#define TRANSMIT_BUSY 2  // A request arrived and its response is being prepared
+
 typedef uint8_t i2c_addr_t;
 
+/* i2c_async_cb_t
+ * Completion callback for a queued register operation
+ * Runs from the I2C interrupt with the MXC_I2C result and the caller context
+*/
+typedef void (*i2c_async_cb_t)(int result, void* ctx);
+
 /******************************** FUNCTION PROTOTYPES ********************************/
 /**
  * @brief Initialize the I2C Connection
@@ -100,6 +132,40 @@ int i2c_simple_read_transmit_done(i2c_addr_t addr);
  * and return the value 
 */
 int i2c_simple_read_transmit_len(i2c_addr_t addr);
+/**
+ * @brief Read TRANSMIT_DONE and TRANSMIT_LEN regs
+ * 
+ * @param addr: i2c_addr_t, address of I2C device
+ * @param len: uint8_t*, set to the TRANSMIT_LEN value
+ * 
+ * @return int: TRANSMIT_DONE value, negative if error
+ *
+ * A TRANSMIT_DONE read that continues for a second byte returns
+ * TRANSMIT_LEN, so one transaction gives both
+*/
+int i2c_simple_read_transmit_status(i2c_addr_t addr, uint8_t* len);
+
+/**
+ * @brief Probe an address
+ * 
+ * @param addr: i2c_addr_t, address of I2C device
+ * 
+ * @return int: 0 if the address was acknowledged, negative otherwise
+ * 
+ * Address-only write with no register byte, absent addresses cost a
+ * single byte on the bus
+*/
+int i2c_simple_probe(i2c_addr_t addr);
+
+/**
+ * @brief Read IDENTITY reg
+ * 
+ * @param addr: i2c_addr_t, address of I2C device
+ * @param component_id: uint32_t*, set to the component ID
+ * 
+ * @return int: negative if error, 0 if success
+*/
+int i2c_simple_read_identity(i2c_addr_t addr, uint32_t* component_id);
 
 /**
  * @brief Write RECEIVE_DONE reg
@@ -178,6 +244,44 @@ int i2c_simple_read_data_generic(i2c_addr_t addr, ECTF_I2C_REGS reg, uint8_t len
  * Can be used to write the PARAMS or RESULT register
 */
 int i2c_simple_write_data_generic(i2c_addr_t addr, ECTF_I2C_REGS reg, uint8_t len, uint8_t* buf);
+/**
+ * @brief Write BURST reg
+ * 
+ * @param addr: i2c_addr_t, address of I2C device
+ * @param len: uint8_t, length of data to write
+ * @param buf: uint8_t*, buffer to write data from
+ * 
+ * @return int: negative if error, 0 if success
+ * 
+ * Write RECEIVE_LEN, RECEIVE and RECEIVE_DONE in a single transaction
+*/
+int i2c_simple_write_burst(i2c_addr_t addr, uint8_t len, uint8_t* buf);
+/**
+ * @brief Write BURST reg from a buffer with headroom
+ * 
+ * @param addr: i2c_addr_t, address of I2C device
+ * @param len: uint8_t, length of data to write
+ * @param frame: uint8_t*, I2C_TX_HEADROOM + len buffer, data at frame + I2C_TX_HEADROOM
+ * 
+ * @return int: negative if error, 0 if success
+ * 
+ * The register byte and length are written into the headroom so the
+ * caller buffer goes on the bus as is, with no copy
+*/
+int i2c_simple_write_burst_inplace(i2c_addr_t addr, uint8_t len, uint8_t* frame);
+/**
+ * @brief Read BURST reg
+ * 
+ * @param addr: i2c_addr_t, address of I2C device
+ * @param len: uint8_t, length of data to read
+ * @param buf: uint8_t*, BURST_READ_HEADER_LEN + len buffer to read into
+ * 
+ * @return int: negative if error, 0 if success
+ * 
+ * Read TRANSMIT_DONE, TRANSMIT_LEN and TRANSMIT in a single transaction.
+ * Reading all len bytes acknowledges the response, no TRANSMIT_DONE write follows
+*/
+int i2c_simple_read_burst(i2c_addr_t addr, uint8_t len, uint8_t* buf);
 /**
  * @brief Read generic status reg
  * 
@@ -202,4 +306,87 @@ int i2c_simple_read_status_generic(i2c_addr_t addr, ECTF_I2C_REGS reg);
 */
 int i2c_simple_write_status_generic(i2c_addr_t addr, ECTF_I2C_REGS reg, uint8_t value);
 
+/**
+ * @brief Queue a register read
+ * 
+ * @param addr: i2c_addr_t, address of I2C device
+ * @param reg: ECTF_I2C_REGS, register to read from
+ * @param len: uint8_t, length of data to read
+ * @param buf: uint8_t*, buffer to read data into, must stay valid until completion
+ * @param cb: i2c_async_cb_t, completion callback, may be NULL
+ * @param ctx: void*, passed through to cb
+ * 
+ * @return int: negative if the queue is full, 0 if queued
+ *
+ * Returns immediately; the transaction runs from the I2C interrupt once
+ * every operation queued before it has finished
+*/
+int i2c_simple_async_read(i2c_addr_t addr, ECTF_I2C_REGS reg, uint8_t len, uint8_t* buf,
+                          i2c_async_cb_t cb, void* ctx);
+/**
+ * @brief Queue a register write
+ * 
+ * @param addr: i2c_addr_t, address of I2C device
+ * @param reg: ECTF_I2C_REGS, register to write to
+ * @param len: uint8_t, length of data to write
+ * @param buf: uint8_t*, data to write, copied into the queue before returning
+ * @param cb: i2c_async_cb_t, completion callback, may be NULL
+ * @param ctx: void*, passed through to cb
+ * 
+ * @return int: negative if the queue is full, 0 if queued
+*/
+int i2c_simple_async_write(i2c_addr_t addr, ECTF_I2C_REGS reg, uint8_t len, uint8_t* buf,
+                           i2c_async_cb_t cb, void* ctx);
+/**
+ * @brief Check for queued register operations
+ * 
+ * @return bool: true while any queued operation has not completed
+*/
+bool i2c_simple_async_busy(void);
+/**
+ * @brief Wait for the async queue to drain
+ * 
+ * @return int: negative if any operation since the last wait failed, 0 otherwise
+ *
+ * The synchronous helpers call this before touching the bus so the two
+ * APIs can be mixed freely
+*/
+int i2c_simple_async_wait(void);
+
+/**
+ * @brief Get the SCL frequency used for an address
+ * 
+ * @param addr: i2c_addr_t, address of I2C device
+ * 
+ * @return uint32_t: frequency in Hz, I2C_FREQ until negotiated
+*/
+uint32_t i2c_simple_get_speed(i2c_addr_t addr);
+/**
+ * @brief Set the SCL frequency used for an address
+ * 
+ * @param addr: i2c_addr_t, address of I2C device
+ * @param speed: uint32_t, I2C_FREQ, I2C_FREQ_FAST or I2C_FREQ_FAST_PLUS
+ * 
+ * Clears the fault count, takes effect on the next transaction
+*/
+void i2c_simple_set_speed(i2c_addr_t addr, uint32_t speed);
+/**
+ * @brief Record a failed exchange with an address
+ * 
+ * @param addr: i2c_addr_t, address of I2C device
+ * 
+ * Failed transactions are recorded automatically, callers add frames
+ * that arrived but did not validate. After I2C_SPEED_FAULT_LIMIT faults
+ * in a row the address drops to the next slower speed
+*/
+void i2c_simple_speed_fault(i2c_addr_t addr);
+/**
+ * @brief Record a successful exchange with an address
+ * 
+ * @param addr: i2c_addr_t, address of I2C device
+ * 
+ * Resets the consecutive fault count
+*/
+void i2c_simple_speed_ok(i2c_addr_t addr);
+
 #endif
@@ -36,6 +36,7 @@
 #include "ectf_params.h"
 
 #include "simple_flash.h"
+#include "timebase.h"
 
 /********************************* Global Variables **********************************/
 
@@ -53,18 +54,37 @@
 // data is the output
 // 12 byte number
 #define RAND_Z_SIZE 8
-uint8_t RAND_Z[RAND_Z_SIZE];
-uint8_t RAND_Y[RAND_Z_SIZE];
+// opcode + comp_ID + rand_z + rand_y
+#define MESSAGE_HEADER_LEN (1 + 4 + 2 * RAND_Z_SIZE)
+// Largest post-boot payload that still fits in one secure frame
+#define MAX_POSTBOOT_LEN (MAX_FRAME_PAYLOAD - MESSAGE_HEADER_LEN)
+// Stream fragment: [seq][total length], both 16-bit big endian, then data
+#define STREAM_HEADER_LEN 4
+#define MAX_STREAM_FRAGMENT (MAX_POSTBOOT_LEN - STREAM_HEADER_LEN)
+// Fragments in flight, matches the two component receive banks
+#define STREAM_WINDOW 2
+// postboot_confirm(): the peer refused the message and wants a handshake
+#define POSTBOOT_REJECTED 1
 
 
 // AES Macros
 #define AES_SIZE 16 // 16 bytes
 
+// Most components the flash entry can hold
+#define MAX_COMPONENTS 32
+#if MAX_COMPONENTS > KEY_SYNC_MAX_COMPONENTS
+#error "key_sync() cannot handle every provisioned component"
+#endif
+
+// A successful presence check is trusted for this long
+#define PRESENCE_FRESH_US 2000000
+// Wait before retrying a failed key sync, doubled on every failure
+#define SYNC_BACKOFF_MIN_US 500000
+#define SYNC_BACKOFF_MAX_US 8000000
+
 uint8_t synthesized = 0; // when you initiate any command from the host machine, check if the
                          // thing is synthesized yet or not, if not, synthesize the whole thing.
 uint8_t GLOBAL_KEY[AES_SIZE];
-uint8_t receive_buffer[MAX_I2C_MESSAGE_LEN];
-uint8_t transmit_buffer[MAX_I2C_MESSAGE_LEN];
 
 /******************************** TYPE DEFINITIONS *********************************/
 // Data structure for sending commands to component
@@ -78,18 +98,65 @@ typedef struct {
     uint8_t comp_ID[4];
     uint8_t rand_z[RAND_Z_SIZE];
     uint8_t rand_y[RAND_Z_SIZE];
-    uint8_t remain[MAX_I2C_MESSAGE_LEN - 21];
+    uint8_t remain[MAX_I2C_MESSAGE_LEN - MESSAGE_HEADER_LEN];
 } message;
 
 // Datatype for information stored in flash
 typedef struct {
     uint32_t flash_magic;
     uint32_t component_cnt;
-    uint32_t component_ids[32];
+    uint32_t component_ids[MAX_COMPONENTS];
 } flash_entry;
 
 flash_entry flash_status;
 
+// Result of the last presence check of the provisioned components
+typedef struct {
+    uint32_t generation;     // Bumped whenever the provisioned set changes
+    uint32_t checked;        // Generation the result belongs to
+    uint64_t checked_at;     // timebase_now_us() of the check
+    bool present;            // Every provisioned component answered with its ID
+    uint32_t found;          // Components that answered with their ID
+    uint32_t hits;           // Checks answered from the cache
+    uint32_t misses;         // Checks that went to the bus
+} presence_cache_t;
+
+presence_cache_t presence_cache;
+
+// Everything the AP tracks for one component between messages, so an
+// exchange with one component never overwrites the nonces another exchange
+// is waiting to check. The key schedule is the synced one in board_link
+typedef struct {
+    // Nonce of the outstanding validate or attest command
+    uint8_t command_z[RAND_Z_SIZE];
+    // Post-boot challenge/answer in progress, also the nonces of a stream
+    uint8_t exchange_z[RAND_Z_SIZE];
+    uint8_t exchange_y[RAND_Z_SIZE];
+    // Post-boot session opened by the first completed exchange. comp_ID
+    // carries the message counter in session frames
+    bool open;
+    uint8_t rand_z[RAND_Z_SIZE];
+    uint8_t rand_y[RAND_Z_SIZE];
+    uint32_t send_ctr; // Last counter sent
+    uint32_t recv_ctr; // Last counter accepted
+} component_session_t;
+
+// Sessions indexed by 7-bit address
+component_session_t sessions[128];
+
+// Key sync retry state
+uint32_t sync_backoff_us = 0;
+deadline_t sync_retry_at = 0;
+
+// Cold start figures, reported with the first command
+typedef struct {
+    uint64_t ready_us;      // timebase_now_us() when key sync first succeeded
+    uint32_t sync_attempts; // key_sync() runs until then
+    bool reported;
+} startup_stats_t;
+
+startup_stats_t startup_stats;
+
 // Datatype for commands sent to components
 typedef enum {
     COMPONENT_CMD_NONE,
@@ -100,10 +167,14 @@ typedef enum {
     COMPONENT_CMD_SECURE_SEND_VALIDATE,
     COMPONENT_CMD_SECURE_SEND_CONFIMRED,
     COMPONENT_CMD_POSTBOOT_VALIDATE,
+    COMPONENT_CMD_POSTBOOT_STREAM,
+    COMPONENT_CMD_POSTBOOT_SESSION,
+    COMPONENT_CMD_KEY_RESYNC,
 } component_cmd_t;
 
 // forward declaration
-int issue_cmd(i2c_addr_t addr, uint8_t *transmit, uint8_t *receive);
+int issue_cmd(i2c_addr_t addr, packet_buf_t *buf, uint8_t len);
+static void key_sync_step(bool quiet);
 void flash_simple_init(void);
 int flash_simple_erase_page(uint32_t address);
 void flash_simple_read(uint32_t address, uint32_t *buffer, uint32_t size);
@@ -150,41 +221,50 @@ int random_checker(uint8_t target[RAND_Z_SIZE], uint8_t control[RAND_Z_SIZE]) {
     return 1;
 }
 
+/**
+ * @brief Session table entry of a component
+ * 
+ * @param address: i2c_addr_t, I2C address of the component
+ * 
+ * @return component_session_t*: its entry
+*/
+static component_session_t* session_of(i2c_addr_t address) {
+    return &sessions[address & 0x7F];
+}
+
 /******************************* POST BOOT FUNCTIONALITY *********************************/
 /**
- * @brief Secure Send 
+ * @brief Open a post-boot transfer to a component
  * 
  * @param address: i2c_addr_t, I2C address of recipient
- * @param transmit_buffer: uint8_t*, pointer to data to be send
- * @param len: uint8_t, size of data to be sent 
+ * @param buf: packet_buf_t*, scratch buffer of the caller
  * 
- * Securely send data over I2C. This function is utilized in POST_BOOT functionality.
- * This function must be implemented by your team to align with the security requirements.
-
+ * @return int: SUCCESS_RETURN once the component answered the challenge
+ * 
+ * Challenge/answer exchange shared by secure_send and secure_send_stream.
+ * Leaves the nonces in the component's exchange_z and exchange_y. The
+ * challenge goes out of buf and the answer comes back into it
 */
-int secure_send(uint8_t address, uint8_t *buffer, uint8_t len) {
-    uint8_t challenge_buffer[MAX_I2C_MESSAGE_LEN];
-    uint8_t answer_buffer[MAX_I2C_MESSAGE_LEN];
-    uint8_t transmit_buffer[MAX_I2C_MESSAGE_LEN];
-
-    message* challenge = (message*)challenge_buffer;
-    Rand_NASYC(RAND_Z, RAND_Z_SIZE);
+static int postboot_open_send(uint8_t address, packet_buf_t* buf) {
+    component_session_t* session = session_of(address);
+    message* challenge = (message*)FRAME_PAYLOAD(buf);
+    Rand_NASYC(session->exchange_z, RAND_Z_SIZE);
     challenge->opcode = COMPONENT_CMD_POSTBOOT_VALIDATE;
-    uint8Arr_to_uint8Arr(challenge->rand_z, RAND_Z);
+    uint8Arr_to_uint8Arr(challenge->rand_z, session->exchange_z);
 
-    int len_chlg = secure_send_packet(address, challenge_buffer, GLOBAL_KEY);
+    int len_chlg = secure_send_frame(address, buf, MESSAGE_HEADER_LEN, GLOBAL_KEY);
     if (len_chlg == ERROR_RETURN) {
         print_error("The AP failed to send the challenge buffer during post boot\n");
         return ERROR_RETURN;
     }
     
-    int len_ans = secure_poll_and_receive_packet(address, answer_buffer, GLOBAL_KEY);
+    int len_ans = secure_receive_frame(address, buf, GLOBAL_KEY);
     if (len_ans == ERROR_RETURN) {
         print_error("The AP failed to receive the answer buffer during post boot\n");
         return ERROR_RETURN;
     }
 
-    message* response_ans = (message*)answer_buffer;
+    message* response_ans = (message*)FRAME_PAYLOAD(buf);
     // compare cmd code
     if (response_ans->opcode != COMPONENT_CMD_POSTBOOT_VALIDATE) {
         print_error("Invalid command in answer message from component during post boot");
@@ -192,31 +272,332 @@ int secure_send(uint8_t address, uint8_t *buffer, uint8_t len) {
     }
 
     // compare Z value
-    int z_check = random_checker(response_ans->rand_z, RAND_Z);
+    int z_check = random_checker(response_ans->rand_z, session->exchange_z);
     if (z_check != 1) {
         print_error("AP received expired answer message in post boot");
         return ERROR_RETURN;
     }
+    uint8Arr_to_uint8Arr(session->exchange_y, response_ans->rand_y);
+    return SUCCESS_RETURN;
+}
 
-    message* command = (message*)transmit_buffer;
+/**
+ * @brief Answer a post-boot challenge from a component
+ * 
+ * @param address: i2c_addr_t, I2C address of sender
+ * @param buf: packet_buf_t*, challenge already received, the answer is
+ * built over it
+ * 
+ * @return int: SUCCESS_RETURN once the answer was sent
+*/
+static int postboot_answer(i2c_addr_t address, packet_buf_t* buf) {
+    component_session_t* session = session_of(address);
+    message* challenge = (message*)FRAME_PAYLOAD(buf);
+    // compare cmd code
+    if (challenge->opcode != COMPONENT_CMD_POSTBOOT_VALIDATE) {
+        print_error("Invalid command in challenge message from component during post boot");
+        return ERROR_RETURN;
+    }
+
+    // Same buffer, rand_y is taken before rand_z is overwritten
+    message* answer = challenge;
 
-    uint8Arr_to_uint8Arr(RAND_Y, response_ans->rand_y);
-    uint8Arr_to_uint8Arr(command->rand_z, RAND_Z);
-    uint8Arr_to_uint8Arr(command->rand_y, RAND_Y);
-    if(len > MAX_I2C_MESSAGE_LEN-21){
+    Rand_NASYC(session->exchange_z, RAND_Z_SIZE);
+    uint8Arr_to_uint8Arr(session->exchange_y, challenge->rand_y);
+    answer->opcode = COMPONENT_CMD_POSTBOOT_VALIDATE;
+    uint8Arr_to_uint8Arr(answer->rand_z, session->exchange_z);
+    uint8Arr_to_uint8Arr(answer->rand_y, session->exchange_y);
+
+    int len_ans = secure_send_frame(address, buf, MESSAGE_HEADER_LEN, GLOBAL_KEY);
+    if (len_ans == ERROR_RETURN) {
+        print_error("The AP failed to send the answer message during post boot\n");
+        return ERROR_RETURN;
+    }
+    return SUCCESS_RETURN;
+}
+
+/**
+ * @brief Open a post-boot transfer from a component
+ * 
+ * @param address: i2c_addr_t, I2C address of sender
+ * @param buf: packet_buf_t*, scratch buffer of the caller
+ * 
+ * @return int: SUCCESS_RETURN once the component challenge was answered
+ * 
+ * Challenge/answer exchange shared by secure_receive and secure_receive_stream.
+ * Leaves the nonces in the component's exchange_z and exchange_y
+*/
+static int postboot_open_receive(i2c_addr_t address, packet_buf_t* buf) {
+    int len_chlg = secure_receive_frame(address, buf, GLOBAL_KEY);
+    if (len_chlg == ERROR_RETURN) {
+        print_error("The AP failed to receive the challenge buffer during post boot\n");
+        return ERROR_RETURN;
+    }
+    return postboot_answer(address, buf);
+}
+
+/**
+ * @brief Start a counter session on the nonces of a completed handshake
+ * 
+ * @param session: component_session_t*, session of the component
+*/
+static void postboot_session_start(component_session_t* session) {
+    uint8Arr_to_uint8Arr(session->rand_z, session->exchange_z);
+    uint8Arr_to_uint8Arr(session->rand_y, session->exchange_y);
+    session->send_ctr = 0;
+    session->recv_ctr = 0;
+    session->open = true;
+}
+
+/**
+ * @brief Close the post-boot session of every component
+ * 
+ * Sessions ride on the link key, after a new key every component starts
+ * over with a challenge
+*/
+static void postboot_sessions_close(void) {
+    for (int i = 0; i < 128; i++) {
+        sessions[i].open = false;
+    }
+}
+
+/**
+ * @brief Tell a component whether its post-boot message was taken
+ * 
+ * @param address: i2c_addr_t, I2C address of sender
+ * @param buf: packet_buf_t*, the reply is built over the message
+ * @param counter: uint32_t, session counter of the message, 0 when it
+ * closed a handshake
+ * @param accepted: bool, false sends the component back to the
+ * challenge/answer exchange
+ * 
+ * @return int: SUCCESS_RETURN once the reply was sent
+ * 
+ * An accepted message is echoed by its counter under the session nonces
+*/
+static int postboot_reply(i2c_addr_t address, packet_buf_t* buf, uint32_t counter,
+                          bool accepted) {
+    component_session_t* session = session_of(address);
+    message* reply = (message*)FRAME_PAYLOAD(buf);
+    memset(reply, 0, MESSAGE_HEADER_LEN);
+    if (accepted) {
+        reply->opcode = COMPONENT_CMD_POSTBOOT_SESSION;
+        uint32_to_uint8(reply->comp_ID, counter);
+        uint8Arr_to_uint8Arr(reply->rand_z, session->rand_z);
+        uint8Arr_to_uint8Arr(reply->rand_y, session->rand_y);
+    }
+
+    if (secure_send_frame(address, buf, MESSAGE_HEADER_LEN, GLOBAL_KEY) == ERROR_RETURN) {
+        print_error("The AP failed to send the confirmation during post boot\n");
+        return ERROR_RETURN;
+    }
+    return SUCCESS_RETURN;
+}
+
+/**
+ * @brief Wait for a component to take a post-boot message
+ * 
+ * @param address: i2c_addr_t, I2C address of recipient
+ * @param buf: packet_buf_t*, receives the reply
+ * @param counter: uint32_t, session counter of the message, 0 when it
+ * closed a handshake
+ * @param rand_z: uint8_t*, nonces the message was sent under
+ * @param rand_y: uint8_t*
+ * 
+ * @return int: SUCCESS_RETURN once the component confirmed the message,
+ * POSTBOOT_REJECTED if it has no session for it, ERROR_RETURN otherwise
+*/
+static int postboot_confirm(i2c_addr_t address, packet_buf_t* buf, uint32_t counter,
+                            uint8_t* rand_z, uint8_t* rand_y) {
+    int len_reply = secure_receive_frame(address, buf, GLOBAL_KEY);
+    if (len_reply < MESSAGE_HEADER_LEN) {
+        print_error("The AP failed to receive the confirmation during post boot\n");
+        return ERROR_RETURN;
+    }
+
+    message* reply = (message*)FRAME_PAYLOAD(buf);
+    if (reply->opcode == COMPONENT_CMD_NONE) {
+        return POSTBOOT_REJECTED;
+    }
+    uint32_t echoed;
+    uint8_to_uint32(reply->comp_ID, &echoed);
+    if (reply->opcode != COMPONENT_CMD_POSTBOOT_SESSION || echoed != counter ||
+        random_checker(reply->rand_z, rand_z) != 1 ||
+        random_checker(reply->rand_y, rand_y) != 1) {
+        print_error("Invalid confirmation from component during post boot");
+        return ERROR_RETURN;
+    }
+    return SUCCESS_RETURN;
+}
+
+/**
+ * @brief Take the packet buffer for a post-boot call
+ * 
+ * @return packet_buf_t*: buffer owned by the caller, NULL if none is free
+*/
+static packet_buf_t* postboot_alloc(void) {
+    packet_buf_t* buf = packet_alloc();
+    if (buf == NULL) {
+        print_error("No packet buffer free during post boot\n");
+    }
+    return buf;
+}
+
+/**
+ * @brief secure_send on a packet buffer owned by the caller
+ * 
+ * A session frame the component refuses is sent again after a handshake
+*/
+static int postboot_send(uint8_t address, packet_buf_t* buf, uint8_t *buffer, uint8_t len) {
+    component_session_t* session = session_of(address);
+    message* command = (message*)FRAME_PAYLOAD(buf);
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        bool handshake = !session->open;
+        // The handshake runs through the same buffer, so it goes first
+        if (handshake && postboot_open_send(address, buf) == ERROR_RETURN) {
+            return ERROR_RETURN;
+        }
+        uint32_t counter = 0;
+        uint8_t* rand_z = session->exchange_z;
+        uint8_t* rand_y = session->exchange_y;
+        if (handshake) {
+            command->opcode = COMPONENT_CMD_POSTBOOT_VALIDATE;
+        } else {
+            command->opcode = COMPONENT_CMD_POSTBOOT_SESSION;
+            counter = ++session->send_ctr;
+            rand_z = session->rand_z;
+            rand_y = session->rand_y;
+        }
+        uint32_to_uint8(command->comp_ID, counter);
+        uint8Arr_to_uint8Arr(command->rand_z, rand_z);
+        uint8Arr_to_uint8Arr(command->rand_y, rand_y);
+        for(int x = 0; x < len; x++){
+            command->remain[x] = buffer[x];
+        }
+
+        int len_msg = secure_send_frame(address, buf, MESSAGE_HEADER_LEN + len, GLOBAL_KEY);
+        if (len_msg == ERROR_RETURN) {
+            print_error("The AP failed to send the buffer message during post boot\n");
+            return ERROR_RETURN;
+        }
+
+        // The session opens, or stays open, only on the component's word
+        int confirmed = postboot_confirm(address, buf, counter, rand_z, rand_y);
+        if (confirmed == SUCCESS_RETURN) {
+            if (handshake) {
+                postboot_session_start(session);
+            }
+            print_success("Secure Send Success\n");
+            return len_msg;
+        }
+        session->open = false;
+        if (handshake || confirmed != POSTBOOT_REJECTED) {
+            print_error("The component did not take the message during post boot\n");
+            return ERROR_RETURN;
+        }
+    }
+    return ERROR_RETURN;
+}
+
+/**
+ * @brief Secure Send 
+ * 
+ * @param address: i2c_addr_t, I2C address of recipient
+ * @param transmit_buffer: uint8_t*, pointer to data to be send
+ * @param len: uint8_t, size of data to be sent 
+ * 
+ * Securely send data over I2C. This function is utilized in POST_BOOT functionality.
+ * This function must be implemented by your team to align with the security requirements.
+ * 
+ * The first message to a component runs the challenge/answer exchange and
+ * opens a session on its nonces once the component confirms it. Later
+ * messages are a single frame under the session nonces with a send counter
+ * the component requires to grow, each confirmed by an echo of the counter.
+ * A component that lost the session refuses the frame and the message goes
+ * again after a fresh handshake
+*/
+int secure_send(uint8_t address, uint8_t *buffer, uint8_t len) {
+    if(len > MAX_POSTBOOT_LEN){
         print_error("The message buffer is too long during post boot\n");
         return ERROR_RETURN;
     }
-    for(int x = 0; x < len; x++){
-        command->remain[x] = buffer[x];
+    packet_buf_t* buf = postboot_alloc();
+    if (buf == NULL) {
+        return ERROR_RETURN;
     }
+    int result = postboot_send(address, buf, buffer, len);
+    packet_free(buf);
+    return result;
+}
 
-    int len_msg = secure_send_packet(address, transmit_buffer, GLOBAL_KEY);
-    if (len_msg == ERROR_RETURN) {
-        print_error("The AP failed to send the buffer message during post boot\n");
+/**
+ * @brief secure_receive on a packet buffer owned by the caller
+ * 
+ * A session frame that does not match the session is refused, and the
+ * component sends the message again after a handshake
+*/
+static int postboot_receive(i2c_addr_t address, packet_buf_t* buf, uint8_t *buffer) {
+    component_session_t* session = session_of(address);
+    message* command = (message*)FRAME_PAYLOAD(buf);
+    uint32_t counter = 0;
+
+    int len_msg = secure_receive_frame(address, buf, GLOBAL_KEY);
+    if (len_msg >= MESSAGE_HEADER_LEN && command->opcode == COMPONENT_CMD_POSTBOOT_SESSION) {
+        uint8_to_uint32(command->comp_ID, &counter);
+        // Same session nonces and a counter never seen before
+        if (session->open && random_checker(command->rand_z, session->rand_z) == 1 &&
+            random_checker(command->rand_y, session->rand_y) == 1 &&
+            counter > session->recv_ctr) {
+            session->recv_ctr = counter;
+        } else {
+            print_error("AP received expired command message in post boot");
+            session->open = false;
+            if (postboot_reply(address, buf, 0, false) == ERROR_RETURN) {
+                return ERROR_RETURN;
+            }
+            len_msg = secure_receive_frame(address, buf, GLOBAL_KEY);
+        }
+    }
+    if (len_msg < MESSAGE_HEADER_LEN) {
+        print_error("The AP failed to receive the message buffer during post boot\n");
         return ERROR_RETURN;
     }
-    print_success("Secure Send Success\n");
+
+    if (!session->open || command->opcode != COMPONENT_CMD_POSTBOOT_SESSION) {
+        // The component starts over with a challenge
+        session->open = false;
+        counter = 0;
+        if (postboot_answer(address, buf) == ERROR_RETURN) {
+            return ERROR_RETURN;
+        }
+
+        len_msg = secure_receive_frame(address, buf, GLOBAL_KEY);
+        if (len_msg < MESSAGE_HEADER_LEN) {
+            print_error("The AP failed to receive the message buffer during post boot\n");
+            return ERROR_RETURN;
+        }
+
+        // compare cmd code and Z value
+        if (command->opcode != COMPONENT_CMD_POSTBOOT_VALIDATE ||
+            random_checker(command->rand_z, session->exchange_z) != 1) {
+            print_error("AP received expired command message in post boot");
+            postboot_reply(address, buf, 0, false);
+            return ERROR_RETURN;
+        }
+        postboot_session_start(session);
+    }
+    len_msg -= MESSAGE_HEADER_LEN;
+    for(int x = 0; x < len_msg; x++){
+        buffer[x] = command->remain[x];
+    }
+
+    // The component keeps its session only once it hears the message arrived
+    if (postboot_reply(address, buf, counter, true) == ERROR_RETURN) {
+        session->open = false;
+        return ERROR_RETURN;
+    }
+    print_success("Secure Receive Success\n");
     return len_msg;
 }
 
@@ -230,64 +611,168 @@ int secure_send(uint8_t address, uint8_t *buffer, uint8_t len) {
  * 
  * Securely receive data over I2C. This function is utilized in POST_BOOT functionality.
  * This function must be implemented by your team to align with the security requirements.
+ * 
+ * Accepts a single session frame, or a fresh challenge when the component
+ * has no session with the AP, which then replaces the session. Every
+ * message is confirmed to the component, a stale session frame is refused
+ * so the component sends it again after a handshake
 */
 int secure_receive(i2c_addr_t address, uint8_t *buffer) {
-    uint8_t challenge_buffer[MAX_I2C_MESSAGE_LEN];
-    uint8_t answer_buffer[MAX_I2C_MESSAGE_LEN];
-    uint8_t receive_buffer[MAX_I2C_MESSAGE_LEN];
-    
-    int len_chlg = secure_poll_and_receive_packet(address, challenge_buffer, GLOBAL_KEY);
-    if (len_chlg == ERROR_RETURN) {
-        print_error("The AP failed to receive the challenge buffer during post boot\n");
+    packet_buf_t* buf = postboot_alloc();
+    if (buf == NULL) {
         return ERROR_RETURN;
     }
+    int result = postboot_receive(address, buf, buffer);
+    packet_free(buf);
+    return result;
+}
 
-    message* challenge = (message*)challenge_buffer;
-    // compare cmd code
-    if (challenge->opcode != COMPONENT_CMD_POSTBOOT_VALIDATE) {
-        print_error("Invalid command in challenge message from component during post boot");
+/**
+ * @brief secure_send_stream on a packet buffer owned by the caller
+ * 
+ * Every fragment is built from scratch, the previous one was encrypted in
+ * place and its buffer then took an acknowledgement
+*/
+static int postboot_send_stream(uint8_t address, packet_buf_t* buf, uint8_t *buffer, uint16_t len) {
+    component_session_t* session = session_of(address);
+    if (postboot_open_send(address, buf) == ERROR_RETURN) {
         return ERROR_RETURN;
     }
 
-    message* answer = (message*)answer_buffer;
+    uint16_t count = (len + MAX_STREAM_FRAGMENT - 1) / MAX_STREAM_FRAGMENT;
+    uint16_t sent = 0;
+    uint16_t acked = 0;
+    message* fragment = (message*)FRAME_PAYLOAD(buf);
+    message* ack = fragment;
+
+    while (acked < count) {
+        while (sent < count && sent - acked < STREAM_WINDOW) {
+            uint16_t offset = sent * MAX_STREAM_FRAGMENT;
+            uint16_t frag_len = len - offset;
+            if (frag_len > MAX_STREAM_FRAGMENT) {
+                frag_len = MAX_STREAM_FRAGMENT;
+            }
+            fragment->opcode = COMPONENT_CMD_POSTBOOT_STREAM;
+            memset(fragment->comp_ID, 0, sizeof(fragment->comp_ID));
+            uint8Arr_to_uint8Arr(fragment->rand_z, session->exchange_z);
+            uint8Arr_to_uint8Arr(fragment->rand_y, session->exchange_y);
+            fragment->remain[0] = sent >> 8;
+            fragment->remain[1] = sent & 0xFF;
+            fragment->remain[2] = len >> 8;
+            fragment->remain[3] = len & 0xFF;
+            memcpy(&fragment->remain[STREAM_HEADER_LEN], buffer + offset, frag_len);
+            if (secure_send_frame(address, buf,
+                                  MESSAGE_HEADER_LEN + STREAM_HEADER_LEN + frag_len,
+                                  GLOBAL_KEY) == ERROR_RETURN) {
+                print_error("The AP failed to send stream fragment %u\n", sent);
+                return ERROR_RETURN;
+            }
+            sent++;
+        }
 
-    Rand_NASYC(RAND_Z, RAND_Z_SIZE);
-    uint8Arr_to_uint8Arr(RAND_Y, challenge->rand_y);
-    answer->opcode = COMPONENT_CMD_POSTBOOT_VALIDATE;
-    uint8Arr_to_uint8Arr(answer->rand_z, RAND_Z);
-    uint8Arr_to_uint8Arr(answer->rand_y, RAND_Y);
+        // Fragments are acknowledged in order
+        int len_ack = secure_receive_frame(address, buf, GLOBAL_KEY);
+        if (len_ack < MESSAGE_HEADER_LEN + 2 || ack->opcode != COMPONENT_CMD_POSTBOOT_STREAM ||
+            random_checker(ack->rand_z, session->exchange_z) != 1 ||
+            ((ack->remain[0] << 8) | ack->remain[1]) != acked) {
+            print_error("Invalid acknowledgement for stream fragment %u\n", acked);
+            return ERROR_RETURN;
+        }
+        acked++;
+    }
 
-    int len_ans = secure_send_packet(address, answer_buffer, GLOBAL_KEY);
-    if (len_ans == ERROR_RETURN) {
-        print_error("The AP failed to send the answer message during post boot\n");
+    print_success("Secure Send Stream Success\n");
+    return SUCCESS_RETURN;
+}
+
+/**
+ * @brief Secure Send Stream
+ * 
+ * @param address: i2c_addr_t, I2C address of recipient
+ * @param buffer: uint8_t*, pointer to data to be send
+ * @param len: uint16_t, size of data to be sent, may exceed one frame
+ * 
+ * @return int: SUCCESS_RETURN if every fragment was acknowledged
+ * 
+ * One challenge/answer exchange, then the data goes out as numbered
+ * fragments under the same nonces. Up to STREAM_WINDOW fragments are in
+ * flight, one per component receive bank, and each is acknowledged by seq
+*/
+int secure_send_stream(uint8_t address, uint8_t *buffer, uint16_t len) {
+    if (len == 0) {
         return ERROR_RETURN;
     }
-
-    int len_msg = secure_poll_and_receive_packet(address, receive_buffer, GLOBAL_KEY);
-    if (len_msg == ERROR_RETURN) {
-        print_error("The AP failed to receive the message buffer during post boot\n");
+    packet_buf_t* buf = postboot_alloc();
+    if (buf == NULL) {
         return ERROR_RETURN;
     }
+    int result = postboot_send_stream(address, buf, buffer, len);
+    packet_free(buf);
+    return result;
+}
 
-    message* command = (message*)receive_buffer;
-
-    // compare cmd code
-    if (command->opcode != COMPONENT_CMD_POSTBOOT_VALIDATE) {
-        print_error("Invalid opcode in command message from component during post boot");
+/**
+ * @brief secure_receive_stream on a packet buffer owned by the caller
+*/
+static int postboot_receive_stream(i2c_addr_t address, packet_buf_t* buf, uint8_t *buffer,
+                                   uint16_t max_len) {
+    component_session_t* session = session_of(address);
+    if (postboot_open_receive(address, buf) == ERROR_RETURN) {
         return ERROR_RETURN;
     }
-    // compare Z value
-    int z_check = random_checker(command->rand_z, RAND_Z);
-    if (z_check != 1) {
-        print_error("AP received expired command message in post boot");
+
+    message* fragment = (message*)FRAME_PAYLOAD(buf);
+    uint16_t total = 0;
+    uint16_t received = 0;
+    uint16_t seq = 0;
+    do {
+        int len_frag = secure_receive_frame(address, buf, GLOBAL_KEY);
+        if (len_frag <= MESSAGE_HEADER_LEN + STREAM_HEADER_LEN ||
+            fragment->opcode != COMPONENT_CMD_POSTBOOT_STREAM ||
+            random_checker(fragment->rand_z, session->exchange_z) != 1 ||
+            ((fragment->remain[0] << 8) | fragment->remain[1]) != seq) {
+            print_error("Invalid stream fragment %u\n", seq);
+            return ERROR_RETURN;
+        }
+
+        uint16_t frag_total = (fragment->remain[2] << 8) | fragment->remain[3];
+        uint16_t frag_len = len_frag - MESSAGE_HEADER_LEN - STREAM_HEADER_LEN;
+        if (seq == 0) {
+            total = frag_total;
+        }
+        if (frag_total != total || total > max_len || received + frag_len > total) {
+            print_error("Stream length mismatch at fragment %u\n", seq);
+            return ERROR_RETURN;
+        }
+        memcpy(buffer + received, &fragment->remain[STREAM_HEADER_LEN], frag_len);
+        received += frag_len;
+        seq++;
+    } while (received < total);
+
+    print_success("Secure Receive Stream Success\n");
+    return received;
+}
+
+/**
+ * @brief Secure Receive Stream
+ * 
+ * @param address: i2c_addr_t, I2C address of sender
+ * @param buffer: uint8_t*, pointer to buffer to receive data to
+ * @param max_len: uint16_t, size of buffer
+ * 
+ * @return int: number of bytes received, negative if error
+ * 
+ * Counterpart of the component secure_send_stream. Reading each fragment
+ * acknowledges it, so the component pushes the next one straight away
+*/
+int secure_receive_stream(i2c_addr_t address, uint8_t *buffer, uint16_t max_len) {
+    packet_buf_t* buf = postboot_alloc();
+    if (buf == NULL) {
         return ERROR_RETURN;
     }
-    for(int x = 0; x < MAX_I2C_MESSAGE_LEN-21; x++){
-        buffer[x] = command->remain[x];
-    }
-
-    print_success("Secure Receive Success\n");
-    return len_msg;
+    int result = postboot_receive_stream(address, buf, buffer, max_len);
+    packet_free(buf);
+    return result;
 }
 
 /**
@@ -335,49 +820,47 @@ void init() {
                            sizeof(flash_entry));
     }
 
-    // Initialize board link interface
-    board_link_init();
-}
+    // Start the clock used for every timeout
+    timebase_init();
 
-// Send a command to a component and receive the result
-int issue_cmd(i2c_addr_t addr, uint8_t *transmit, uint8_t *receive) {
-    // Send message
-    //These are reserved address for the Board, we should not use these
-    if (addr == 0x18 || addr == 0x28 || addr == 0x36) {
-            return ERROR_RETURN;
-    }
-    int result = secure_send_packet(addr, transmit, GLOBAL_KEY); 
-    if (result == ERROR_RETURN) {
-        print_info("Error in sending the packet\n");
-        return ERROR_RETURN;
+    // Refuse to run with a crypto backend that gives wrong answers
+    if (crypto_self_test() != SUCCESS_RETURN) {
+        print_error("Crypto self test failed\n");
+        while (1);
     }
 
-    // Receive message
-    int len = secure_poll_and_receive_packet(addr, receive, GLOBAL_KEY); // Use secure custom function
-    if (len == ERROR_RETURN) {
-        print_info("Error in receiving the packet\n");
-        return ERROR_RETURN;
+    // Initialize board link interface
+    board_link_init();
+
+    // Run every provisioned component at the fastest speed it handles
+    for (unsigned i = 0; i < flash_status.component_cnt; i++) {
+        i2c_addr_t addr = component_id_to_i2c_addr(flash_status.component_ids[i]);
+        uint32_t speed = board_link_negotiate_speed(addr);
+        print_debug("0x%08x: %u Hz\n", flash_status.component_ids[i], (unsigned)speed);
     }
-    return len;
 }
 
-int insecure_issue_cmd(i2c_addr_t addr, uint8_t *transmit, uint8_t *receive) {
+// Send the command at FRAME_PAYLOAD(buf) to a component and receive the
+// result into the same buffer
+int issue_cmd(i2c_addr_t addr, packet_buf_t *buf, uint8_t len) {
     // Send message
     //These are reserved address for the Board, we should not use these
     if (addr == 0x18 || addr == 0x28 || addr == 0x36) {
             return ERROR_RETURN;
     }
-    int result = send_packet(addr, MAX_I2C_MESSAGE_LEN-1, transmit); 
+    int result = secure_send_frame(addr, buf, len, GLOBAL_KEY);
     if (result == ERROR_RETURN) {
+        print_info("Error in sending the packet\n");
         return ERROR_RETURN;
     }
 
     // Receive message
-    int len = poll_and_receive_packet(addr, receive); // Use secure custom function
-    if (len == ERROR_RETURN) {
+    int recv_len = secure_receive_frame(addr, buf, GLOBAL_KEY); // Use secure custom function
+    if (recv_len < MESSAGE_HEADER_LEN) {
+        print_info("Error in receiving the packet\n");
         return ERROR_RETURN;
     }
-    return len;
+    return recv_len;
 }
 
 /******************************** COMPONENT COMMS ********************************/
@@ -389,10 +872,6 @@ int scan_components() {
         print_info("P>0x%08x\n", flash_status.component_ids[i]);
     }
 
-    // Buffers for board link communication
-    uint8_t receive_buffer[MAX_I2C_MESSAGE_LEN];
-    uint8_t transmit_buffer[MAX_I2C_MESSAGE_LEN];
-
     int check = 0;
 
     // Scan scan command to each component
@@ -403,24 +882,9 @@ int scan_components() {
             continue;
         }
 
-        // Create command message
-        for(int i = 0; i < 16; ++i){
-            transmit_buffer[4 * i + 0] = 'B';
-            transmit_buffer[4 * i + 1] = 'E';
-            transmit_buffer[4 * i + 2] = 'E';
-            transmit_buffer[4 * i + 3] = 'F';
-        }
-
-        // Send out command and receive result
-        int len = insecure_issue_cmd(addr, transmit_buffer, receive_buffer);
-
-        // Success, device is present
-        if (len > 0) {
-            message* scan = (message*)receive_buffer;
-            uint32_t comp_id = 0;
-            for(int i = 0; i < 4; i++) {
-                comp_id = (comp_id << 8) | scan->comp_ID[i];
-            }
+        // Probe the address and read the ID of whatever answers
+        uint32_t comp_id = 0;
+        if (identify_component(addr, &comp_id) == SUCCESS_RETURN) {
             print_info("F>0x%08x\n", comp_id);
             check += 1;
         }
@@ -435,47 +899,42 @@ int scan_components() {
     }
 }
 
-int preboot_validate_component_id(){
-    uint8_t receive_buffer[MAX_I2C_MESSAGE_LEN];
-    uint8_t transmit_buffer[MAX_I2C_MESSAGE_LEN];
-
-    int check = 0;
-
-    // Scan scan command to each component
-    for (i2c_addr_t addr = 0x8; addr < 0x78; addr++) {
-        // I2C Blacklist:
-        // 0x18, 0x28, and 0x36 conflict with separate devices on MAX78000FTHR
-        if (addr == 0x18 || addr == 0x28 || addr == 0x36) {
-            continue;
-        }
+/**
+ * @brief Get the presence cache counters
+ * 
+ * @return const presence_cache_t*: cache state with hit and miss counts
+*/
+const presence_cache_t* get_presence_cache(void) {
+    return &presence_cache;
+}
 
-        // Create command message
-        for(int i = 0; i < 16; ++i){
-            transmit_buffer[4 * i + 0] = 'B';
-            transmit_buffer[4 * i + 1] = 'E';
-            transmit_buffer[4 * i + 2] = 'E';
-            transmit_buffer[4 * i + 3] = 'F';
-        }
+// Presence check without console output, for background key sync
+static int check_presence(void) {
+    // A recent check of the same provisioned set still holds
+    if (presence_cache.present && presence_cache.checked == presence_cache.generation &&
+        timebase_now_us() - presence_cache.checked_at < PRESENCE_FRESH_US) {
+        presence_cache.hits++;
+        return SUCCESS_RETURN;
+    }
+    presence_cache.misses++;
 
-        // Send out command and receive result
-        int len = insecure_issue_cmd(addr, transmit_buffer, receive_buffer);
-
-        // Success, device is present
-        if (len > 0) {
-            message* scan = (message*)receive_buffer;
-            uint32_t comp_id = 0;
-            for(int i = 0; i < 4; i++) {
-                comp_id = (comp_id << 8) | scan->comp_ID[i];
-            }
-            for(int i = 0; i < flash_status.component_cnt; i++) {
-                if(flash_status.component_ids[i] == comp_id){
-                    check += 1;
-                    break;
-                }
-            }
+    // Only the provisioned addresses matter, probe those and check the ID
+    // each one reports
+    int check = 0;
+    for (unsigned i = 0; i < flash_status.component_cnt; i++) {
+        i2c_addr_t addr = component_id_to_i2c_addr(flash_status.component_ids[i]);
+        uint32_t comp_id = 0;
+        if (identify_component(addr, &comp_id) == SUCCESS_RETURN &&
+            comp_id == flash_status.component_ids[i]) {
+            check += 1;
         }
     }
-    if(check == flash_status.component_cnt){
+
+    presence_cache.checked = presence_cache.generation;
+    presence_cache.checked_at = timebase_now_us();
+    presence_cache.present = check == flash_status.component_cnt;
+    presence_cache.found = check;
+    if(presence_cache.present){
         return SUCCESS_RETURN;
     }
     else{
@@ -483,10 +942,21 @@ int preboot_validate_component_id(){
     }
 }
 
-int validate_and_boot_components() {
-    // Buffers for board link communication
-    uint8_t receive_buffer[MAX_I2C_MESSAGE_LEN];
-    uint8_t transmit_buffer[MAX_I2C_MESSAGE_LEN];
+int preboot_validate_component_id(){
+    uint32_t misses = presence_cache.misses;
+    int result = check_presence();
+    if (presence_cache.misses != misses) {
+        print_debug("Presence %u/%u, cache %u hits %u misses\n", (unsigned)presence_cache.found,
+                    (unsigned)flash_status.component_cnt, (unsigned)presence_cache.hits,
+                    (unsigned)presence_cache.misses);
+    }
+    return result;
+}
+
+// validate_and_boot_components on a packet buffer owned by the caller,
+// every command is built in it and every response lands in it
+static int validate_and_boot_on(packet_buf_t* buf) {
+    uint32_t pending = 0;
 
     // If the two provisioned ids are not matched with exisiting ids, abort booting
     if(preboot_validate_component_id() == ERROR_RETURN){
@@ -494,14 +964,15 @@ int validate_and_boot_components() {
         return ERROR_RETURN;
     }
 
-    // Send validate command to each component
+    // Send validate command to each component first so they all decrypt
+    // and answer in parallel
     for (unsigned i = 0; i < flash_status.component_cnt; i++) {
         // Set the I2C address of the component
         uint32_t component_id = flash_status.component_ids[i];
         i2c_addr_t addr = component_id_to_i2c_addr(component_id);
 
         // Create Validate and boot message
-        message* command = (message*)transmit_buffer;
+        message* command = (message*)FRAME_PAYLOAD(buf);
 
         // opcode
         command->opcode = COMPONENT_CMD_VALIDATE;
@@ -509,44 +980,161 @@ int validate_and_boot_components() {
         // comp_ID
         uint32_to_uint8(command->comp_ID, component_id);
 
-        Rand_NASYC(RAND_Z, RAND_Z_SIZE);
+        // rand_z, checked against this component's own response
+        component_session_t* session = session_of(addr);
+        Rand_NASYC(session->command_z, RAND_Z_SIZE);
+        uint8Arr_to_uint8Arr(command->rand_z, session->command_z);
 
-        // rand_z
-        uint8Arr_to_uint8Arr(command->rand_z, RAND_Z);
-
-        // Send out command and receive result
-        int len = issue_cmd(addr, transmit_buffer, receive_buffer);
-        if (len == ERROR_RETURN) {
+        //These are reserved address for the Board, we should not use these
+        if (addr == 0x18 || addr == 0x28 || addr == 0x36 ||
+            secure_send_frame(addr, buf, MESSAGE_HEADER_LEN, GLOBAL_KEY) == ERROR_RETURN) {
             print_info("Could not validate or boot component:%08x\n",flash_status.component_ids[i]);
-           return ERROR_RETURN;
+            return ERROR_RETURN;
         }
+        pending |= 1u << i;
+    }
 
-        message* response = (message* )receive_buffer;
-
-        // compare cmd code
-        if (response->opcode != COMPONENT_CMD_BOOT) {
-            print_error("Invalid command message from component");
+    // Collect the responses in the order the components finish
+    deadline_t timeout = deadline_in_us(POLL_TIMEOUT_US);
+    while (pending != 0) {
+        uint32_t swept = pending;
+        if (deadline_expired(timeout)) {
+            deadline_finish(timeout);
+            print_info("Could not validate or boot component:%08x\n",
+                       flash_status.component_ids[__builtin_ctz(pending)]);
             return ERROR_RETURN;
         }
 
-        // compare cid
-        if (!uint8_uint32_cmp(response->comp_ID, component_id)) {
-            print_error("Component ID: 0x%08x invalid\n",
-                        flash_status.component_ids[i]);
-            return ERROR_RETURN;
+        for (unsigned i = 0; i < flash_status.component_cnt; i++) {
+            if (!(pending & (1u << i))) {
+                continue;
+            }
+            uint32_t component_id = flash_status.component_ids[i];
+            i2c_addr_t addr = component_id_to_i2c_addr(component_id);
+
+            uint8_t ready_len;
+            int status = poll_transmit_status(addr, &ready_len);
+            if (status == TRANSMIT_BUSY) {
+                continue;
+            }
+            // Absent, or went back to idle without answering
+            if (status != TRANSMIT_READY ||
+                secure_receive_ready_frame(addr, ready_len, buf, GLOBAL_KEY) <
+                    MESSAGE_HEADER_LEN) {
+                deadline_finish(timeout);
+                print_info("Could not validate or boot component:%08x\n",component_id);
+                return ERROR_RETURN;
+            }
+            pending &= ~(1u << i);
+
+            message* response = (message* )FRAME_PAYLOAD(buf);
+
+            // compare cmd code
+            if (response->opcode != COMPONENT_CMD_BOOT) {
+                deadline_finish(timeout);
+                print_error("Invalid command message from component");
+                return ERROR_RETURN;
+            }
+
+            // compare cid
+            if (!uint8_uint32_cmp(response->comp_ID, component_id)) {
+                deadline_finish(timeout);
+                print_error("Component ID: 0x%08x invalid\n", component_id);
+                return ERROR_RETURN;
+            }
+            else{
+                print_info("0x%08x>%s\n", component_id, response->remain);
+            }
+
+            // compare Z value
+            int z_check = random_checker(response->rand_z, session_of(addr)->command_z);
+            if (z_check != 1) {
+                deadline_finish(timeout);
+                print_error("Random number provided is invalid");
+                return ERROR_RETURN;
+            }
         }
-        else{
-            print_info("0x%08x>%s\n", flash_status.component_ids[i], response->remain);
+
+        // Nobody was ready, give the components some time
+        if (pending == swept) {
+            wait_until(deadline_in_us(POLL_MIN_DELAY_US));
         }
+    }
+    deadline_finish(timeout);
+    return SUCCESS_RETURN;
+}
+
+int validate_and_boot_components() {
+    packet_buf_t* buf = packet_alloc();
+    if (buf == NULL) {
+        return ERROR_RETURN;
+    }
+    int result = validate_and_boot_on(buf);
+    packet_free(buf);
+    return result;
+}
+
+/**
+ * @brief Ask every component to take the next key sync trigger
+ *
+ * @return int: SUCCESS_RETURN, ERROR_RETURN if no packet buffer is free
+ *
+ * The trigger itself is plaintext, components that hold a key ignore it
+ * until this COMPONENT_CMD_KEY_RESYNC under the current key. One that reset
+ * has no key, drops the frame and takes the trigger anyway, so a failed
+ * send is not an error
+ */
+static int request_resync(void) {
+    packet_buf_t* buf = packet_alloc();
+    if (buf == NULL) {
+        return ERROR_RETURN;
+    }
+    for (unsigned i = 0; i < flash_status.component_cnt; i++) {
+        uint32_t component_id = flash_status.component_ids[i];
+        // Built again for every component since the frame is encrypted in place
+        message* command = (message*)FRAME_PAYLOAD(buf);
+        memset(command, 0, MESSAGE_HEADER_LEN);
+        command->opcode = COMPONENT_CMD_KEY_RESYNC;
+        uint32_to_uint8(command->comp_ID, component_id);
+        secure_send_frame(component_id_to_i2c_addr(component_id), buf, MESSAGE_HEADER_LEN,
+                          GLOBAL_KEY);
+    }
+    packet_free(buf);
+    return SUCCESS_RETURN;
+}
 
-        // compare Z value
-        int z_check = random_checker(response->rand_z, RAND_Z);
-        if (z_check != 1) {
-            print_error("Random number provided is invalid");
+/**
+ * @brief Bring a component that lost its key back into the session
+ *
+ * @param component_id: uint32_t, the component that stopped answering
+ * @param full: bool, run a full key sync with every component instead of
+ * resuming this one
+ *
+ * @return int: SUCCESS_RETURN once the exchange went through
+ */
+static int recover_component(uint32_t component_id, bool full) {
+    uint64_t start = timebase_now_us();
+    if (!full) {
+        if (key_resume(GLOBAL_KEY, component_id) != SUCCESS_RETURN) {
             return ERROR_RETURN;
         }
+        // A post-boot session with it did not survive the reset
+        session_of(component_id_to_i2c_addr(component_id))->open = false;
+        print_debug("Resumed 0x%08x in %u us\n", component_id,
+                    (unsigned)(timebase_now_us() - start));
+        return SUCCESS_RETURN;
     }
-    return SUCCESS_RETURN;
+    if (request_resync() != SUCCESS_RETURN) {
+        return ERROR_RETURN;
+    }
+    synthesized = 0;
+    board_link_clear_key();
+    postboot_sessions_close();
+    sync_backoff_us = 0;
+    key_sync_step(true);
+    print_debug("Key sync %s in %u us\n", synthesized == 1 ? "done" : "failed",
+                (unsigned)(timebase_now_us() - start));
+    return synthesized == 1 ? SUCCESS_RETURN : ERROR_RETURN;
 }
 
 int attest_component(uint32_t component_id) {
@@ -561,40 +1149,55 @@ int attest_component(uint32_t component_id) {
         print_error("Could not attest\n");
         return ERROR_RETURN;
     }
-    // Buffers for board link communication
-    uint8_t receive_buffer[MAX_I2C_MESSAGE_LEN];
-    uint8_t transmit_buffer[MAX_I2C_MESSAGE_LEN];
+    // Buffer for board link communication, the response replaces the command
+    packet_buf_t* buf = packet_alloc();
+    if (buf == NULL) {
+        return ERROR_RETURN;
+    }
 
     // Set the I2C address of the component
     i2c_addr_t addr = component_id_to_i2c_addr(component_id);
+    component_session_t* session = session_of(addr);
 
-    // Create Validate and boot message
-    message* command = (message*)transmit_buffer;
+    // A component that reset drops the command. Resume it and try again,
+    // then fall back to a full key sync
+    int len = ERROR_RETURN;
+    for (int attempt = 0; attempt < 3 && len == ERROR_RETURN; attempt++) {
+        if (attempt > 0 && recover_component(component_id, attempt == 2) != SUCCESS_RETURN) {
+            break;
+        }
 
-    // op_code
-    command->opcode = COMPONENT_CMD_ATTEST;
+        // Create Validate and boot message, again on every attempt since
+        // the buffer is encrypted in place
+        message* command = (message*)FRAME_PAYLOAD(buf);
 
-    // comp_ID
-    uint32_to_uint8(command->comp_ID, component_id);
+        // op_code
+        command->opcode = COMPONENT_CMD_ATTEST;
 
-    Rand_NASYC(RAND_Z, RAND_Z_SIZE);
+        // comp_ID
+        uint32_to_uint8(command->comp_ID, component_id);
 
-    // rand_z
-    uint8Arr_to_uint8Arr(command->rand_z, RAND_Z);
+        Rand_NASYC(session->command_z, RAND_Z_SIZE);
+
+        // rand_z
+        uint8Arr_to_uint8Arr(command->rand_z, session->command_z);
 
-    // Send out command and receive result
-    int len = issue_cmd(addr, transmit_buffer, receive_buffer);
+        // Send out command and receive result
+        len = issue_cmd(addr, buf, MESSAGE_HEADER_LEN);
+    }
     if (len == ERROR_RETURN) {
+        packet_free(buf);
         print_error("Could not attest\n");
         return ERROR_RETURN;
     }
 
     // decrypt attestation data
-    message* response = (message*)receive_buffer;
+    message* response = (message*)FRAME_PAYLOAD(buf);
 
     // compare Z value
-    int z_check = random_checker(response->rand_z, RAND_Z);
+    int z_check = random_checker(response->rand_z, session->command_z);
     if (z_check != 1) {
+        packet_free(buf);
         print_error("Random number provided is invalid");
         return ERROR_RETURN;
     }
@@ -602,6 +1205,7 @@ int attest_component(uint32_t component_id) {
     print_info("C>0x%08x\n", component_id);
     print_info("%s", response->remain);
 
+    packet_free(buf);
     return SUCCESS_RETURN;
 }
 
@@ -735,6 +1339,7 @@ void attempt_replace() {
             flash_simple_erase_page(FLASH_ADDR);
             flash_simple_write(FLASH_ADDR, (uint32_t *)&flash_status,
                                sizeof(flash_entry));
+            presence_cache.generation++;
 
             print_debug("Replaced 0x%08x with 0x%08x\n", component_id_out,
                         component_id_in);
@@ -766,51 +1371,81 @@ void attempt_attest() {
 
 /*********************************** MAIN *************************************/
 
+/**
+ * @brief Run key sync once, unless the keys are synced or a retry is not due
+ *
+ * @param quiet: bool, keep failures off the host console
+ *
+ * Failures back off from SYNC_BACKOFF_MIN_US doubling to SYNC_BACKOFF_MAX_US
+ */
+static void key_sync_step(bool quiet) {
+    if (synthesized == 1 || (sync_backoff_us != 0 && !deadline_expired(sync_retry_at))) {
+        return;
+    }
+    int present = quiet ? check_presence() : preboot_validate_component_id();
+    if(present == SUCCESS_RETURN){
+        startup_stats.sync_attempts++;
+        if(key_sync(GLOBAL_KEY, flash_status.component_cnt,
+                flash_status.component_ids) == SUCCESS_RETURN){
+            // Expand the synced key once for every later packet
+            board_link_set_key(GLOBAL_KEY);
+            postboot_sessions_close();
+            synthesized = 1;
+            sync_backoff_us = 0;
+            if (startup_stats.ready_us == 0) {
+                startup_stats.ready_us = timebase_now_us();
+            }
+            return;
+        }
+        board_link_clear_key();
+        postboot_sessions_close();
+        Rand_NASYC(GLOBAL_KEY, AES_SIZE);
+        Rand_NASYC(KEY_SHARE, AES_SIZE);
+        if (!quiet) {
+            print_info("Synthesize the keys failed\n");
+        }
+    }
+    // Whatever broke the sync may also have changed the bus
+    presence_cache.present = false;
+    sync_backoff_us = sync_backoff_us == 0 ? SYNC_BACKOFF_MIN_US : sync_backoff_us * 2;
+    if (sync_backoff_us > SYNC_BACKOFF_MAX_US) {
+        sync_backoff_us = SYNC_BACKOFF_MAX_US;
+    }
+    sync_retry_at = deadline_in_us(sync_backoff_us);
+}
+
+// Sync the keys in the background while the AP waits for a command
+static void key_sync_idle(void) {
+    key_sync_step(true);
+}
+
 int main() {
     // Initialize board
     init();
-    Rand_NASYC(RAND_Z, RAND_Z_SIZE);
     Rand_NASYC(GLOBAL_KEY, AES_SIZE);
     Rand_NASYC(KEY_SHARE, AES_SIZE);
     synthesized = 0;
+    // Keep the console line out of the 8 character UART FIFO during a sync
+    key_sync_set_wait_hook(console_drain);
 
     // Print the component IDs to be helpful
     // Your design does not need to do this
     print_info("Application Processor Started\n");
 
-    // Handle commands forever
+    // Handle commands forever, syncing the keys while waiting for one
     char buf[128];
     while (1) {
         memset(buf, 0, 100);
-        recv_input("Enter Command: ", buf);
+        recv_input_idle("Enter Command: ", buf, key_sync_idle);
+        uint64_t command_start = timebase_now_us();
 
         if (!strcmp(buf, "list")) {
             scan_components();
             continue;
         } 
 
-        if (synthesized == 0 ) {
-            if(preboot_validate_component_id() == SUCCESS_RETURN){
-                for(int i = 0; i < 16; ++i){
-                    transmit_buffer[4 * i + 0] = 'D';
-                    transmit_buffer[4 * i + 1] = 'E';
-                    transmit_buffer[4 * i + 2] = 'A';
-                    transmit_buffer[4 * i + 3] = 'D';
-                }
-                send_packet(component_id_to_i2c_addr(flash_status.component_ids[0]), MAX_I2C_MESSAGE_LEN-1, transmit_buffer);
-                send_packet(component_id_to_i2c_addr(flash_status.component_ids[1]), MAX_I2C_MESSAGE_LEN-1, transmit_buffer);
-                if(key_sync(GLOBAL_KEY, flash_status.component_cnt,
-                        flash_status.component_ids[0],
-                        flash_status.component_ids[1]) == SUCCESS_RETURN){
-                    synthesized = 1;
-                }
-                else{
-                    Rand_NASYC(GLOBAL_KEY, AES_SIZE);
-                    Rand_NASYC(KEY_SHARE, AES_SIZE);
-                    print_info("Synthesize the keys failed\n");
-                }
-            }
-        }
+        // Not synced in the background yet, try now unless backing off
+        key_sync_step(false);
 
         // Execute requested command
         if( synthesized == 1){
@@ -827,6 +1462,14 @@ int main() {
         else{
             print_info("Synthesize the keys first\n");
         }
+
+        if (!startup_stats.reported) {
+            startup_stats.reported = true;
+            print_debug("Keys ready %u ms after start (%u syncs), first command %u ms\n",
+                        (unsigned)(startup_stats.ready_us / 1000),
+                        (unsigned)startup_stats.sync_attempts,
+                        (unsigned)((timebase_now_us() - command_start) / 1000));
+        }
     }
 
     // Code never reaches here
@@ -16,6 +16,7 @@
 
 #include "board_link.h"
 #include "mxc_delay.h"
+#include "timebase.h"
 #include "simple_crypto.h"
 
 
@@ -25,6 +26,25 @@ int encrypt_sym(uint8_t *plaintext, size_t len, uint8_t *key,
 int decrypt_sym(uint8_t *ciphertext, size_t len, uint8_t *key,
                 uint8_t *plaintext);
 
+// Polling statistics indexed by 7-bit address
+static poll_stats_t poll_stats[128];
+// Key schedules of the current and the neighbouring key epoch
+static key_epochs_t link_epochs;
+// Highest key epoch accepted from each address, and the addresses that got
+// a frame under the current key. Rotating twice waits for every one of
+// them to answer under the newer epoch. A failed exchange or probe drops an
+// address from the wait
+static uint32_t peer_epoch[128];
+static bool peer_active[128];
+// Frames sent since the last rotation
+static uint32_t frames_since_rotation;
+// Secure frame statistics
+static frame_stats_t frame_stats;
+// Counter of the last frame sent, and of the last frame accepted from each
+// address. Both restart with every key
+static uint32_t send_counter;
+static uint32_t recv_counter[128];
+
 /******************************** FUNCTION DEFINITIONS
  * ********************************/
 /**
@@ -32,7 +52,66 @@ int decrypt_sym(uint8_t *ciphertext, size_t len, uint8_t *key,
  *
  * Initiailize the underlying i2c simple interface
  */
-void board_link_init(void) { i2c_simple_controller_init(); }
+void board_link_init(void) {
+    // Cycle counter for the frame statistics
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    i2c_simple_controller_init();
+}
+
+/**
+ * @brief Negotiate the fastest bus speed a component handles
+ *
+ * @param address: i2c_addr_t, i2c address
+ *
+ * @return uint32_t: negotiated frequency, 0 if the component never answered
+ *
+ * Status reads are harmless at any time, so each candidate speed is probed
+ * with SPEED_PROBE_READS of them. A NACK, bus error or a status value no
+ * component can hold means the speed is not usable
+ */
+uint32_t board_link_negotiate_speed(i2c_addr_t address) {
+    static const uint32_t speeds[] = {I2C_FREQ_FAST_PLUS, I2C_FREQ_FAST, I2C_FREQ};
+
+    for (unsigned i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++) {
+        i2c_simple_set_speed(address, speeds[i]);
+
+        int probe = 0;
+        for (; probe < SPEED_PROBE_READS; probe++) {
+            uint8_t len;
+            int status = i2c_simple_read_transmit_status(address, &len);
+            if (status < SUCCESS_RETURN || status > TRANSMIT_BUSY) {
+                break;
+            }
+        }
+        if (probe == SPEED_PROBE_READS) {
+            return speeds[i];
+        }
+    }
+
+    i2c_simple_set_speed(address, I2C_FREQ);
+    return 0;
+}
+
+/**
+ * @brief Look for a component at an address
+ *
+ * @param address: i2c_addr_t, i2c address
+ * @param component_id: uint32_t*, set to the ID of the component found
+ *
+ * @return int: SUCCESS_RETURN if a component answered, ERROR_RETURN if not
+ * An address probe, then a read of the IDENTITY register for present ones
+ */
+int identify_component(i2c_addr_t address, uint32_t* component_id) {
+    if (i2c_simple_probe(address) < 0) {
+        return ERROR_RETURN;
+    }
+    if (i2c_simple_read_identity(address, component_id) < 0) {
+        return ERROR_RETURN;
+    }
+    return SUCCESS_RETURN;
+}
 
 /**
  * @brief Convert 4-byte component ID to I2C address
@@ -58,101 +137,620 @@ i2c_addr_t component_id_to_i2c_addr(uint32_t component_id) {
  */
 int send_packet(i2c_addr_t address, uint8_t len,  uint8_t *packet) {
 
-    int result;
-    result = i2c_simple_write_receive_len(address, len);
+    // Length, data and RECEIVE_DONE go out in one BURST write
+    int result = i2c_simple_write_burst(address, len, packet);
     if (result < SUCCESS_RETURN) {
         return ERROR_RETURN;
     }
-    result = i2c_simple_write_data_generic(address, RECEIVE, len, packet);
-    if (result < SUCCESS_RETURN) {
+
+    return SUCCESS_RETURN;
+}
+
+/**
+ * @brief Expand the synced key once for all secure packets
+ *
+ * @param key: uint8_t*, 16 byte key, the caller keeps passing the same key
+ * to the secure packet functions
+ *
+ * @return int: SUCCESS_RETURN if success, ERROR_RETURN if error
+ */
+int board_link_set_key(uint8_t* key) {
+    send_counter = 0;
+    memset(recv_counter, 0, sizeof(recv_counter));
+    memset(peer_epoch, 0, sizeof(peer_epoch));
+    memset(peer_active, 0, sizeof(peer_active));
+    frames_since_rotation = 0;
+    if (key_epochs_init(&link_epochs, key, 0) != 0) {
+        return ERROR_RETURN;
+    }
+    return SUCCESS_RETURN;
+}
+
+/**
+ * @brief Switch to the next key epoch without stopping traffic
+ *
+ * @return int: SUCCESS_RETURN once frames go out under the next epoch,
+ * ERROR_RETURN if there is no key or a component still lags an epoch behind
+ *
+ * Components that lag are probed, one that does not acknowledge its address
+ * is dropped from the wait
+ */
+int board_link_rotate_key(void) {
+    if (key_epochs_send(&link_epochs) == NULL) {
+        return ERROR_RETURN;
+    }
+    // Preparing the next epoch drops the previous one, which a component
+    // that has not moved on yet may still be sending under
+    uint32_t next = link_epochs.epoch + 1;
+    if (link_epochs.slot_epoch[next & 1] != next) {
+        for (int i = 0; i < 128; i++) {
+            if (!peer_active[i] || peer_epoch[i] == link_epochs.epoch) {
+                continue;
+            }
+            // A component that is gone does not hold the rotation up
+            if (i2c_simple_probe(i) < 0) {
+                peer_active[i] = false;
+                continue;
+            }
+            return ERROR_RETURN;
+        }
+        if (key_epochs_prepare(&link_epochs) != 0) {
+            return ERROR_RETURN;
+        }
+    }
+    if (key_epochs_switch(&link_epochs) != 0) {
         return ERROR_RETURN;
     }
-    result = i2c_simple_write_receive_done(address, true);
+    frames_since_rotation = 0;
+    frame_stats.rotations++;
+    return SUCCESS_RETURN;
+}
+
+/**
+ * @brief Pick the frame counters a resumed component continues from
+ *
+ * @param address: i2c_addr_t, address of the component
+ * @param send_base: uint32_t*, set to the counter the component sends after
+ * @param recv_base: uint32_t*, set to the counter the component accepts after
+ * @param epoch: uint32_t*, set to the key epoch frames are sent under
+ */
+void board_link_resume_counters(i2c_addr_t address, uint32_t* send_base, uint32_t* recv_base,
+                                uint32_t* epoch) {
+    // Frames the component sent that were never accepted here are skipped
+    recv_counter[address & 0x7F] += RESUME_COUNTER_GAP;
+    *send_base = recv_counter[address & 0x7F];
+    *recv_base = send_counter;
+    // It starts out in the current epoch
+    *epoch = link_epochs.epoch;
+    peer_epoch[address & 0x7F] = link_epochs.epoch;
+}
+
+/**
+ * @brief Drop the expanded key, packets fall back to per-call expansion
+ */
+void board_link_clear_key(void) {
+    send_counter = 0;
+    memset(recv_counter, 0, sizeof(recv_counter));
+    key_epochs_clear(&link_epochs);
+}
+
+/**
+ * @brief Encrypt with the epoch's expanded key, or key before there is one
+ */
+static int link_encrypt(crypto_session_t* session, uint8_t* plaintext, size_t len, uint8_t* key,
+                        uint8_t* ciphertext) {
+    if (session != NULL) {
+        return encrypt_session(session, plaintext, len, ciphertext);
+    }
+    return encrypt_sym(plaintext, len, key, ciphertext);
+}
+
+/**
+ * @brief Decrypt with the epoch's expanded key, or key before there is one
+ */
+static int link_decrypt(crypto_session_t* session, uint8_t* ciphertext, size_t len, uint8_t* key,
+                        uint8_t* plaintext) {
+    if (session != NULL) {
+        return decrypt_session(session, ciphertext, len, plaintext);
+    }
+    return decrypt_sym(ciphertext, len, key, plaintext);
+}
+
+/**
+ * @brief Build the nonce of a frame
+ *
+ * @param nonce: uint8_t*, NONCE_SIZE buffer
+ * @param address: i2c_addr_t, component on the other end
+ * @param direction: uint8_t, FRAME_TO_COMPONENT or FRAME_TO_AP
+ * @param frame: uint8_t*, frame with its counter filled in
+ *
+ * All components share the key, the address keeps their counters apart
+ */
+static void frame_nonce(uint8_t *nonce, i2c_addr_t address, uint8_t direction,
+                        uint8_t *frame) {
+    memset(nonce, 0, NONCE_SIZE);
+    nonce[0] = address;
+    nonce[1] = direction;
+    memcpy(&nonce[2], &frame[FRAME_COUNTER_OFFSET], FRAME_COUNTER_LEN);
+}
+
+/**
+ * @brief Tag the header and ciphertext of a frame
+ *
+ * @param session: crypto_session_t*, schedule of the frame's epoch, NULL
+ * before there is one
+ * @param nonce: uint8_t*, nonce from frame_nonce()
+ * @param frame: uint8_t*, frame with length, epoch, counter and ciphertext
+ * @param padded: int, ciphertext length
+ * @param key: uint8_t*, used when no key is expanded
+ * @param tag: uint8_t*, TAG_SIZE output
+ *
+ * @return int: zero on success
+ */
+static int link_tag(crypto_session_t *session, uint8_t *nonce, uint8_t *frame, int padded,
+                    uint8_t *key, uint8_t *tag) {
+    if (session != NULL) {
+        return tag_session(session, nonce, frame, FRAME_TAG_OFFSET,
+                           &frame[FRAME_HEADER_LEN], padded, tag);
+    }
+    return tag_sym(nonce, frame, FRAME_TAG_OFFSET, &frame[FRAME_HEADER_LEN], padded, key, tag);
+}
+
+/**
+ * @brief Count a rejected frame
+ *
+ * @param reason: uint32_t*, frame_stats counter to bump
+ * @param blocks: int, ciphertext blocks that were not decrypted
+ * @param start: uint32_t, DWT->CYCCNT when the frame arrived
+ */
+static void frame_rejected(uint32_t *reason, int blocks, uint32_t start) {
+    (*reason)++;
+    frame_stats.rejected_blocks += blocks;
+    frame_stats.reject_cycles += DWT->CYCCNT - start;
+}
+
+/**
+ * @brief Get the secure frame statistics
+ *
+ * @return const frame_stats_t*: accepted and rejected frame counts
+ */
+const frame_stats_t* get_frame_stats(void) {
+    return &frame_stats;
+}
+
+/**
+ * @brief Estimate the cycles saved by rejecting frames before decryption
+ *
+ * @return int64_t: decryption cost of the rejected blocks at the measured
+ * rate minus the time spent rejecting them, 0 until a frame was decrypted
+ */
+int64_t frame_cycles_saved(void) {
+    if (frame_stats.decrypted_blocks == 0) {
+        return 0;
+    }
+    uint64_t per_block = frame_stats.decrypt_cycles / frame_stats.decrypted_blocks;
+    return (int64_t)(per_block * frame_stats.rejected_blocks) -
+           (int64_t)frame_stats.reject_cycles;
+}
+
+/**
+ * @brief Get the polling statistics for a component
+ *
+ * @param address: i2c_addr_t, i2c address
+ *
+ * @return const poll_stats_t*: statistics gathered by poll_and_receive_packet
+ */
+const poll_stats_t* get_poll_stats(i2c_addr_t address) {
+    return &poll_stats[address & 0x7F];
+}
+
+/**
+ * @brief Check once whether a component has a response waiting
+ *
+ * @param address: i2c_addr_t, i2c address
+ *
+ * @return int: TRANSMIT_READY, TRANSMIT_BUSY or TRANSMIT_IDLE,
+ * ERROR_RETURN if the read was not acknowledged
+ */
+int poll_transmit_status(i2c_addr_t address, uint8_t *len) {
+    poll_stats_t *stats = &poll_stats[address & 0x7F];
+    int result = i2c_simple_read_transmit_status(address, len);
+    stats->polls++;
+
     if (result < SUCCESS_RETURN) {
+        stats->absent++;
         return ERROR_RETURN;
     }
+    if (result == TRANSMIT_BUSY) {
+        stats->busy++;
+    }
+    return result;
+}
 
-    return SUCCESS_RETURN;
+/**
+ * @brief Fold a new round trip sample into the estimate for a component
+ *
+ * Same smoothing as the TCP retransmission timer: srtt gains 1/8 of the
+ * error and rttvar 1/4 of the deviation
+ */
+static void update_rtt(poll_stats_t *stats, uint32_t rtt) {
+    if (stats->responses == 0) {
+        stats->srtt = rtt;
+        stats->rttvar = rtt / 2;
+    } else {
+        int32_t err = (int32_t)rtt - (int32_t)stats->srtt;
+        stats->srtt += err / 8;
+        stats->rttvar += ((err < 0 ? -err : err) - (int32_t)stats->rttvar) / 4;
+    }
+    if (rtt > stats->max_rtt) {
+        stats->max_rtt = rtt;
+    }
+    stats->responses++;
 }
 
 /**
- * @brief Poll a component and receive a packet
+ * @brief Wait until a component has a response ready
  *
  * @param address: i2c_addr_t, i2c address
- * @param packet: uint8_t*, pointer to a buffer where a packet will be received
  *
- * @return int: size of data received, ERROR_RETURN if error
+ * @return int: response length once TRANSMIT_READY, ERROR_RETURN if the
+ * component is absent, dropped the request or the poll timed out
+ *
+ * The first status read is held back until just before the smoothed round
+ * trip is expected to end, then the gap between reads doubles from
+ * POLL_MIN_DELAY_US up to POLL_MAX_DELAY_US so a slow component is not
+ * flooded with status reads
  */
-int poll_and_receive_packet(i2c_addr_t address, uint8_t *packet) {
+static int wait_transmit_ready(i2c_addr_t address) {
+    poll_stats_t *stats = &poll_stats[address & 0x7F];
+    uint32_t poll_us = POLL_TRANSACTION_US(i2c_simple_get_speed(address));
+    uint64_t start = timebase_now_us();
+    deadline_t timeout = deadline_in_us(POLL_TIMEOUT_US);
+    uint32_t delay = POLL_MIN_DELAY_US;
+    bool seen_busy = false;
+
+    // Skip the part of the round trip the component always needs
+    if (stats->responses != 0 && stats->srtt > stats->rttvar + poll_us) {
+        wait_until(deadline_in_us(stats->srtt - stats->rttvar - poll_us));
+    }
 
-    int result = SUCCESS_RETURN;
+    while (!deadline_expired(timeout)) {
+        uint8_t len = 0;
+        int result = i2c_simple_read_transmit_status(address, &len);
+        stats->polls++;
 
-    int time_fail = -1;
-    for(int i = 0; i < 2000; i++){
-        result = i2c_simple_read_transmit_done(address);
         if (result < SUCCESS_RETURN) {
+            stats->absent++;
             return ERROR_RETURN;
         }
-        else if (result == SUCCESS_RETURN){
-            time_fail = 0;
-            break;
+        if (result == TRANSMIT_READY) {
+            deadline_finish(timeout);
+            update_rtt(stats, (uint32_t)(timebase_now_us() - start));
+            return len;
+        }
+        if (result == TRANSMIT_BUSY) {
+            stats->busy++;
+            seen_busy = true;
+        } else if (seen_busy) {
+            // Went back to idle without a response
+            stats->dropped++;
+            return ERROR_RETURN;
+        }
+
+        wait_until(deadline_in_us(delay));
+        if (delay < POLL_MAX_DELAY_US) {
+            delay *= 2;
         }
-        MXC_Delay(50);// Dont really understand this delay
     }
 
-    if(time_fail < 0){ //exceeded timeframe
+    deadline_finish(timeout);
+    stats->timeouts++;
+    return ERROR_RETURN;
+}
+
+/**
+ * @brief Read a response burst the caller already saw TRANSMIT_READY for
+ *
+ * @param address: i2c_addr_t, i2c address
+ * @param len: int, response length from the status read
+ * @param burst: uint8_t*, BURST_READ_HEADER_LEN + MAX_I2C_MESSAGE_LEN buffer,
+ * the data lands at burst + BURST_READ_HEADER_LEN
+ *
+ * @return int: size of data received, ERROR_RETURN if error
+ */
+static int read_ready_burst(i2c_addr_t address, int len, uint8_t *burst) {
+    // Status, length and data in one read, reading it all acknowledges it
+    int result = i2c_simple_read_burst(address, (uint8_t)len, burst);
+    if (result < SUCCESS_RETURN) {
+        return ERROR_RETURN;
+    }
+    if (burst[0] != TRANSMIT_READY || burst[1] != len) {
+        i2c_simple_speed_fault(address);
         return ERROR_RETURN;
     }
 
+    return len;
+}
 
-    int len = i2c_simple_read_transmit_len(address);
+/**
+ * @brief Poll a component and read its response burst
+ *
+ * @param address: i2c_addr_t, i2c address
+ * @param burst: uint8_t*, as for read_ready_burst()
+ *
+ * @return int: size of data received, ERROR_RETURN if error
+ */
+static int poll_and_receive_burst(i2c_addr_t address, uint8_t *burst) {
+    int len = wait_transmit_ready(address);
     if (len < SUCCESS_RETURN) {
         return ERROR_RETURN;
     }
-    result = i2c_simple_read_data_generic(address, TRANSMIT, (uint8_t)len, packet);
-    if (result < SUCCESS_RETURN) {
+    return read_ready_burst(address, len, burst);
+}
+
+/**
+ * @brief Poll a component and receive a packet
+ *
+ * @param address: i2c_addr_t, i2c address
+ * @param packet: uint8_t*, pointer to a buffer where a packet will be received
+ *
+ * @return int: size of data received, ERROR_RETURN if error
+ */
+int poll_and_receive_packet(i2c_addr_t address, uint8_t *packet) {
+    packet_buf_t *buf = packet_alloc();
+    if (buf == NULL) {
         return ERROR_RETURN;
     }
-    result = i2c_simple_write_transmit_done(address, true);
-    if (result < SUCCESS_RETURN) {
+
+    int len = poll_and_receive_burst(address, buf->data);
+    if (len != ERROR_RETURN) {
+        memcpy(packet, &buf->data[BURST_READ_HEADER_LEN], len);
+    }
+    packet_free(buf);
+    return len;
+}
+
+/**
+ * @brief Receive a packet after poll_transmit_status() returned TRANSMIT_READY
+ *
+ * @param address: i2c_addr_t, i2c address
+ * @param len: uint8_t, length reported by poll_transmit_status()
+ * @param packet: uint8_t*, pointer to a buffer where a packet will be received
+ *
+ * @return int: size of data received, ERROR_RETURN if error
+ */
+int receive_ready_packet(i2c_addr_t address, uint8_t len, uint8_t *packet) {
+    packet_buf_t *buf = packet_alloc();
+    if (buf == NULL) {
         return ERROR_RETURN;
     }
 
-    return len;
+    int result = read_ready_burst(address, len, buf->data);
+    if (result != ERROR_RETURN) {
+        memcpy(packet, &buf->data[BURST_READ_HEADER_LEN], result);
+    }
+    packet_free(buf);
+    return result;
 }
 
 /**
- * @brief encrypt and send an arbitrary packet over I2C
+ * @brief encrypt, tag and send a frame built in a pool buffer
+ *
+ * @param address: i2c_addr_t, i2c address
+ * @param buf: packet_buf_t*, payload at FRAME_PAYLOAD(buf), borrowed
+ * @param len: uint8_t, payload length, at most MAX_FRAME_PAYLOAD
+ * @param GLOBAL_KEY: 16 byte globel key
+ * @return status: SUCCESS_RETURN if success, ERROR_RETURN if error
+ *
+ * Header, encryption and tag are all applied in place and the burst goes
+ * out of the same buffer, the payload is ciphertext afterwards
+ */
+int secure_send_frame(i2c_addr_t address, packet_buf_t *buf, uint8_t len,
+                      uint8_t *GLOBAL_KEY) {
+    uint8_t *frame = &buf->data[I2C_TX_HEADROOM];
+    if (len == 0 || len > MAX_FRAME_PAYLOAD) {
+        return ERROR_RETURN;
+    }
+    // Rotate on schedule. If a component still lags behind this is tried
+    // again KEY_ROTATE_RETRY_FRAMES later, the current epoch stays usable
+    // meanwhile
+    if (++frames_since_rotation > KEY_ROTATE_FRAMES &&
+        board_link_rotate_key() != SUCCESS_RETURN) {
+        frames_since_rotation = KEY_ROTATE_FRAMES - KEY_ROTATE_RETRY_FRAMES;
+    }
+    crypto_session_t *session = key_epochs_send(&link_epochs);
+    peer_active[address & 0x7F] = true;
+
+    // Round up to the next block and zero the padding
+    uint8_t padded = (len + BLOCK_SIZE - 1) & ~(BLOCK_SIZE - 1);
+    uint32_t counter = ++send_counter;
+    frame[0] = len;
+    frame[FRAME_EPOCH_OFFSET] = link_epochs.epoch;
+    frame[FRAME_COUNTER_OFFSET] = counter >> 24;
+    frame[FRAME_COUNTER_OFFSET + 1] = counter >> 16;
+    frame[FRAME_COUNTER_OFFSET + 2] = counter >> 8;
+    frame[FRAME_COUNTER_OFFSET + 3] = counter;
+    memset(&frame[FRAME_HEADER_LEN + len], 0, padded - len);
+
+    // Encrypting the padded payload in place, then tagging the result
+    uint8_t nonce[NONCE_SIZE];
+    frame_nonce(nonce, address, FRAME_TO_COMPONENT, frame);
+    if (link_encrypt(session, &frame[FRAME_HEADER_LEN], padded, GLOBAL_KEY,
+                     &frame[FRAME_HEADER_LEN]) != 0 ||
+        link_tag(session, nonce, frame, padded, GLOBAL_KEY, &frame[FRAME_TAG_OFFSET]) != 0) {
+        return ERROR_RETURN;
+    }
+    int result = i2c_simple_write_burst_inplace(address, FRAME_HEADER_LEN + padded, buf->data);
+    if (result < SUCCESS_RETURN) {
+        peer_active[address & 0x7F] = false;
+        return ERROR_RETURN;
+    }
+    return SUCCESS_RETURN;
+}
+
+/**
+ * @brief encrypt, tag and send a length-framed packet over I2C
  *
  * @param address: i2c_addr_t, i2c address
- * @param len: uint8_t, length of the packet
  * @param buffer: uint8_t*, pointer to data to be send
+ * @param len: uint8_t, payload length, at most MAX_FRAME_PAYLOAD
  * @param GLOBAL_KEY: 16 byte globel key
  * @return status: SUCCESS_RETURN if success, ERROR_RETURN if error
  */
-int secure_send_packet(i2c_addr_t address, uint8_t *buffer,
+int secure_send_packet(i2c_addr_t address, uint8_t *buffer, uint8_t len,
                        uint8_t *GLOBAL_KEY) {
-    uint8_t ciphertext[MAX_I2C_MESSAGE_LEN];
-    // Encrypting message and storing it in ciphertext
-    encrypt_sym(buffer, MAX_I2C_MESSAGE_LEN, GLOBAL_KEY, ciphertext);
-    // uint8_t *plaintext, size_t len, uint8_t *key, uint8_t *ciphertext
-    return send_packet(address, MAX_I2C_MESSAGE_LEN-1, ciphertext);
+    if (len == 0 || len > MAX_FRAME_PAYLOAD) {
+        return ERROR_RETURN;
+    }
+    packet_buf_t *buf = packet_alloc();
+    if (buf == NULL) {
+        return ERROR_RETURN;
+    }
+
+    memcpy(FRAME_PAYLOAD(buf), buffer, len);
+    int result = secure_send_frame(address, buf, len, GLOBAL_KEY);
+    packet_free(buf);
+    return result;
 }
 
 /**
- * @brief Poll a component and receive and decrypt a packet
+ * @brief Verify and decrypt a frame the burst read left in buf
+ *
+ * @param address: i2c_addr_t, i2c address the frame came from
+ * @param buf: packet_buf_t*, holds the burst, borrowed
+ * @param len: int, frame length from the burst read
+ * @param GLOBAL_KEY: 16 byte globel key
+ * @return int: payload length, the payload is at FRAME_PAYLOAD(buf) and
+ * zero padded to MAX_FRAME_PAYLOAD. ERROR_RETURN if error
+ *
+ * Length, counter and tag are all checked before anything is decrypted
+ */
+static int open_frame(i2c_addr_t address, packet_buf_t *buf, int len, uint8_t *GLOBAL_KEY) {
+    // The frame is decrypted where the burst read left it
+    uint8_t *frame = &buf->data[BURST_READ_HEADER_LEN];
+    uint32_t start = DWT->CYCCNT;
+
+    // Reject anything that is not a whole number of blocks or claims
+    // more payload than was actually transferred
+    int padded = len - FRAME_HEADER_LEN;
+    uint8_t payload = frame[0];
+    if (padded < BLOCK_SIZE || padded > MAX_FRAME_PAYLOAD ||
+        padded % BLOCK_SIZE || payload == 0 || payload > padded) {
+        // A corrupted frame counts against the bus speed like a NACK
+        i2c_simple_speed_fault(address);
+        frame_rejected(&frame_stats.bad_header, 0, start);
+        return ERROR_RETURN;
+    }
+    i2c_simple_speed_ok(address);
+
+    // A replayed or reordered frame is dropped before any crypto
+    uint32_t counter = (uint32_t)frame[FRAME_COUNTER_OFFSET] << 24 |
+                       (uint32_t)frame[FRAME_COUNTER_OFFSET + 1] << 16 |
+                       (uint32_t)frame[FRAME_COUNTER_OFFSET + 2] << 8 |
+                       frame[FRAME_COUNTER_OFFSET + 3];
+    if (counter <= recv_counter[address & 0x7F]) {
+        frame_rejected(&frame_stats.bad_header, padded / BLOCK_SIZE, start);
+        return ERROR_RETURN;
+    }
+
+    // The current epoch, or the one before while the component catches up
+    uint32_t epoch = 0;
+    crypto_session_t *session = NULL;
+    if (key_epochs_send(&link_epochs) != NULL) {
+        session = key_epochs_find(&link_epochs, frame[FRAME_EPOCH_OFFSET], &epoch);
+        if (session == NULL) {
+            frame_rejected(&frame_stats.bad_header, padded / BLOCK_SIZE, start);
+            return ERROR_RETURN;
+        }
+    } else if (frame[FRAME_EPOCH_OFFSET] != 0) {
+        frame_rejected(&frame_stats.bad_header, padded / BLOCK_SIZE, start);
+        return ERROR_RETURN;
+    }
+
+    uint8_t nonce[NONCE_SIZE];
+    uint8_t tag[TAG_SIZE];
+    frame_nonce(nonce, address, FRAME_TO_AP, frame);
+    if (link_tag(session, nonce, frame, padded, GLOBAL_KEY, tag) != 0 ||
+        !tag_equal(tag, &frame[FRAME_TAG_OFFSET])) {
+        frame_rejected(&frame_stats.bad_tag, padded / BLOCK_SIZE, start);
+        return ERROR_RETURN;
+    }
+    recv_counter[address & 0x7F] = counter;
+    if (epoch > peer_epoch[address & 0x7F]) {
+        peer_epoch[address & 0x7F] = epoch;
+    }
+    if (epoch < link_epochs.epoch) {
+        frame_stats.old_epoch++;
+    }
+
+    start = DWT->CYCCNT;
+    if (link_decrypt(session, &frame[FRAME_HEADER_LEN], padded, GLOBAL_KEY,
+                     &frame[FRAME_HEADER_LEN]) != 0) {
+        return ERROR_RETURN;
+    }
+    frame_stats.accepted++;
+    frame_stats.decrypted_blocks += padded / BLOCK_SIZE;
+    frame_stats.decrypt_cycles += DWT->CYCCNT - start;
+    memset(&frame[FRAME_HEADER_LEN + payload], 0, MAX_FRAME_PAYLOAD - payload);
+    return payload;
+}
+
+/**
+ * @brief Poll a component and receive, verify and decrypt a frame in place
  *
  * @param address: i2c_addr_t, i2c address
- * @param packet: uint8_t*, pointer to a buffer where a packet will be received
+ * @param buf: packet_buf_t*, receives the frame, borrowed
  * @param GLOBAL_KEY: 16 byte globel key
- * @return int: size of data received, ERROR_RETURN if error
+ * @return int: payload length as for open_frame(), ERROR_RETURN if error
+ */
+int secure_receive_frame(i2c_addr_t address, packet_buf_t *buf, uint8_t *GLOBAL_KEY) {
+    int len = poll_and_receive_burst(address, buf->data);
+    if (len == ERROR_RETURN) {
+        peer_active[address & 0x7F] = false;
+        return ERROR_RETURN;
+    }
+    return open_frame(address, buf, len, GLOBAL_KEY);
+}
+
+/**
+ * @brief Receive, verify and decrypt a frame after poll_transmit_status()
+ * returned TRANSMIT_READY
+ *
+ * @param address: i2c_addr_t, i2c address
+ * @param len: uint8_t, length reported by poll_transmit_status()
+ * @param buf: packet_buf_t*, receives the frame, borrowed
+ * @param GLOBAL_KEY: 16 byte globel key
+ * @return int: payload length as for open_frame(), ERROR_RETURN if error
+ */
+int secure_receive_ready_frame(i2c_addr_t address, uint8_t len, packet_buf_t *buf,
+                               uint8_t *GLOBAL_KEY) {
+    if (read_ready_burst(address, len, buf->data) == ERROR_RETURN) {
+        peer_active[address & 0x7F] = false;
+        return ERROR_RETURN;
+    }
+    return open_frame(address, buf, len, GLOBAL_KEY);
+}
+
+/**
+ * @brief Poll a component and receive, verify and decrypt a length-framed packet
+ *
+ * @param address: i2c_addr_t, i2c address
+ * @param buffer: uint8_t*, MAX_I2C_MESSAGE_LEN buffer for the payload
+ * @param GLOBAL_KEY: 16 byte globel key
+ * @return int: payload length, ERROR_RETURN if error
  */
 int secure_poll_and_receive_packet(i2c_addr_t address, uint8_t *buffer,
                                    uint8_t *GLOBAL_KEY) {
-    uint8_t plaintext[MAX_I2C_MESSAGE_LEN];
-    int len = poll_and_receive_packet(
-        address, buffer); // buf is gonna be 256 long(MAX_I2C_MESSAGE_LEN)
-    decrypt_sym(buffer, MAX_I2C_MESSAGE_LEN, GLOBAL_KEY, plaintext);
-    memmove(buffer, plaintext, MAX_I2C_MESSAGE_LEN);
-    return len;
+    packet_buf_t *buf = packet_alloc();
+    if (buf == NULL) {
+        return ERROR_RETURN;
+    }
+
+    int payload = secure_receive_frame(address, buf, GLOBAL_KEY);
+    if (payload != ERROR_RETURN) {
+        memcpy(buffer, FRAME_PAYLOAD(buf), payload);
+        memset(buffer + payload, 0, MAX_I2C_MESSAGE_LEN - payload);
+    }
+    packet_free(buf);
+    return payload;
 }
@@ -15,15 +15,64 @@
 #include "host_messaging.h"
 #include <string.h>
 
+#include "board.h"
+#include "uart.h"
+
+// Longest line fgets() reads below
+#define CONSOLE_LINE_LEN 100
+
+// Console bytes console_drain() took out of the UART FIFO, not read yet
+static char drained[CONSOLE_LINE_LEN];
+static size_t drained_len;
+
+void console_drain(void) {
+    mxc_uart_regs_t *console = MXC_UART_GET_UART(CONSOLE_UART);
+    while (drained_len < sizeof(drained) && MXC_UART_GetRXFIFOAvailable(console) > 0) {
+        drained[drained_len++] = (char)MXC_UART_ReadCharacterRaw(console);
+    }
+}
+
+// Receive a line, the drained bytes first and the rest from stdin
+static void read_line(char *buf) {
+    size_t n = 0;
+    while (n < drained_len && drained[n] != '\r' && drained[n] != '\n') {
+        n++;
+    }
+    memcpy(buf, drained, n);
+    if (n < drained_len) {
+        // The whole line was drained, keep whatever follows it
+        drained_len -= n + 1;
+        memmove(drained, &drained[n + 1], drained_len);
+        buf[n] = '\0';
+    } else {
+        drained_len = 0;
+        fgets(&buf[n], CONSOLE_LINE_LEN - n, stdin);
+    }
+    buf[127] = '\0';
+    buf[strcspn(buf, "\n")] = '\0';
+    puts("");
+}
+
 // Print a message through USB UART and then receive a line over USB UART
 void recv_input(const char *msg, char *buf) {
     print_debug(msg);
     fflush(0);
     print_ack();
-    fgets(buf, 100, stdin);
-    buf[127] = '\0';
-    buf[strcspn(buf, "\n")] = '\0';
-    puts("");
+    read_line(buf);
+}
+
+// Same as recv_input, but runs idle() until the first character of the line
+// arrives. The console UART keeps the line in its FIFO meanwhile, or
+// console_drain() takes it out while idle() waits on a key sync
+void recv_input_idle(const char *msg, char *buf, void (*idle)(void)) {
+    print_debug(msg);
+    fflush(0);
+    print_ack();
+    mxc_uart_regs_t *console = MXC_UART_GET_UART(CONSOLE_UART);
+    while (drained_len == 0 && MXC_UART_GetRXFIFOAvailable(console) == 0) {
+        idle();
+    }
+    read_line(buf);
 }
 
 // Prints a buffer of bytes as a hex string
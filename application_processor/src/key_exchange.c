@@ -1,96 +1,400 @@
 // extern flash_status;
 
 #include "key_exchange.h"
+#include "packet_pool.h"
+#include "timebase.h"
 
+// See key_sync_set_wait_hook()
+static void (*wait_hook)(void);
 
+void key_sync_set_wait_hook(void (*hook)(void)) {
+    wait_hook = hook;
+}
 
-// premise the simple write and receive is sufficient to send a 16 byte stream
-// this assumes the key is 16 bytes
-int key_exchange1(unsigned char *dest, uint32_t component_id) {
-    char cache[18];
-    i2c_addr_t addr = component_id_to_i2c_addr(component_id);
-    XOR_secure(M1, KEY_SHARE, 16, cache);
-    cache[17] = '1';
+static void key_sync_waiting(void) {
+    if (wait_hook != NULL) {
+        wait_hook();
+    }
+}
 
-    int return_status = send_packet(addr, 18, cache);
-    if(return_status < 0) {
+#if KEY_SYNC_X25519
+// Ephemeral key pair of one sync, every component gets the same public key
+static uint8_t sync_private[X25519_KEY_SIZE];
+static uint8_t sync_public[X25519_KEY_SIZE];
+// Each component's public key, until its final message is built
+static uint8_t peers[KEY_SYNC_MAX_COMPONENTS][X25519_KEY_SIZE];
+
+/**
+ * @brief Derive the key that wraps the synced key for one component
+ * 
+ * @param shared: uint8_t*, X25519 shared secret with the component
+ * @param peer: uint8_t*, the component's public key
+ * @param wrap: uint8_t*, 16 byte output
+ * 
+ * @return int: 0 on success, -1 otherwise
+ *
+ * AES_M1(MD5(shared | AP public | component public)). The build-time mask
+ * keeps a man in the middle, who knows shared, from deriving it
+*/
+static int wrap_derive(uint8_t *shared, uint8_t *peer, uint8_t *wrap) {
+    uint8_t transcript[3 * X25519_KEY_SIZE];
+    memcpy(transcript, shared, X25519_KEY_SIZE);
+    memcpy(&transcript[X25519_KEY_SIZE], sync_public, X25519_KEY_SIZE);
+    memcpy(&transcript[2 * X25519_KEY_SIZE], peer, X25519_KEY_SIZE);
+    int result = hash(transcript, sizeof(transcript), wrap);
+    memset(transcript, 0, sizeof(transcript));
+    if (result != 0) {
         return -1;
     }
-    
-    memset(cache, 0, 18);
-    int len = poll_and_receive_packet(addr, cache);
-    if(len != 16){
-        return -1;
+    return encrypt_sym(wrap, KEY_SHARE_LEN, (uint8_t *)M1, wrap) != 0 ? -1 : 0;
+}
+
+// A fresh key pair and a random key for every component to end up with
+static int key_share_begin(unsigned char *dest) {
+    Rand_NASYC(sync_private, X25519_KEY_SIZE);
+    Rand_NASYC(dest, KEY_SHARE_LEN);
+    return x25519_make_public(sync_private, sync_public) != 0 ? -1 : 0;
+}
+
+// The AP public key
+static uint8_t key_share_request(uint32_t i, uint8_t *msg) {
+    memcpy(msg, sync_public, X25519_KEY_SIZE);
+    return KEY_SHARE_REQUEST_LEN;
+}
+
+// Keep the component's public key, the secret is computed for the final
+// message so a slow scalar multiplication does not count against the
+// reply timeout
+static void key_share_reply(unsigned char *dest, uint32_t i, uint8_t *msg) {
+    memcpy(peers[i], msg, X25519_KEY_SIZE);
+}
+
+// The key under the component's wrap key, tagged over its public key
+static int key_share_final(unsigned char *dest, uint32_t i, uint8_t *msg) {
+    uint8_t shared[X25519_KEY_SIZE];
+    uint8_t wrap[KEY_SHARE_LEN];
+    int result = -1;
+    if (x25519_shared(sync_private, peers[i], shared) == 0 &&
+        wrap_derive(shared, peers[i], wrap) == 0 &&
+        encrypt_sym(dest, KEY_SHARE_LEN, wrap, msg) == 0 &&
+        tag_sym(sync_public, peers[i], X25519_KEY_SIZE, msg, KEY_SHARE_LEN, wrap,
+                &msg[KEY_SHARE_LEN]) == 0) {
+        result = KEY_SHARE_FINAL_LEN;
     }
-    
-    XOR_secure(KEY_SHARE, cache, 16, cache);
-    XOR_secure(cache, F1, 16, dest); // Should be the dest for the fourth
-                                // argument?
+    memset(shared, 0, sizeof(shared));
+    memset(wrap, 0, sizeof(wrap));
+    return result;
+}
+
+static void key_share_end(unsigned char *dest) {
+    memset(sync_private, 0, sizeof(sync_private));
+    memset(peers, 0, sizeof(peers));
+}
+#else
+// Per component pad, r_i while the requests are out and r_i ^ k_i once the
+// reply is in. Static so a 32 component sync does not need 512 bytes of stack
+static uint8_t pads[KEY_SYNC_MAX_COMPONENTS][KEY_SHARE_LEN];
+
+// dest collects k_1 ^ ... ^ k_n
+static int key_share_begin(unsigned char *dest) {
+    memset(dest, 0, KEY_SHARE_LEN);
     return 0;
 }
 
-int key_exchange2(unsigned char *dest, char *random1, char *random2,
-                   uint32_t component_id1, uint32_t component_id2) {
-    // Allocation Temp Caches
-    char cache1[18]; // this stores K1
-    char cache2[18]; // this stores k3
+// [r_i ^ k2][0]['2']
+static uint8_t key_share_request(uint32_t i, uint8_t *msg) {
+    Rand_NASYC(pads[i], KEY_SHARE_LEN);
+    XOR_secure(pads[i], KEY_SHARE, KEY_SHARE_LEN, msg);
+    msg[16] = 0;
+    msg[17] = '2';
+    return KEY_SHARE_REQUEST_LEN;
+}
+
+// k_i ^ M1 in
+static void key_share_reply(unsigned char *dest, uint32_t i, uint8_t *msg) {
+    XOR_secure(M1, msg, KEY_SHARE_LEN, msg); // k_i
+    XOR_secure(dest, msg, KEY_SHARE_LEN, dest);
+    XOR_secure(pads[i], msg, KEY_SHARE_LEN, pads[i]); // r_i ^ k_i
+}
+
+// k_1 ^ ... ^ k_n ^ r_i ^ k_i ^ F1
+static int key_share_final(unsigned char *dest, uint32_t i, uint8_t *msg) {
+    XOR_secure(dest, pads[i], KEY_SHARE_LEN, msg);
+    XOR_secure(msg, F1, KEY_SHARE_LEN, msg);
+    return KEY_SHARE_FINAL_LEN;
+}
+
+// k2 ^ k_1 ^ ... ^ k_n
+static void key_share_end(unsigned char *dest) {
+    XOR_secure(dest, KEY_SHARE, KEY_SHARE_LEN, dest);
+    memset(pads, 0, sizeof(pads));
+}
+#endif
+
+/**
+ * @brief Send the DEAD trigger that puts every component into key_sync()
+ * 
+ * @param component_cnt: uint32_t, number of components
+ * @param component_ids: uint32_t*, their IDs
+ * 
+ * @return int: 0 if every trigger was sent, -1 otherwise
+*/
+static int key_sync_trigger(uint32_t component_cnt, uint32_t *component_ids) {
+    packet_buf_t *buf = packet_alloc();
+    if (buf == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < KEY_SYNC_TRIGGER_LEN / 4; ++i) {
+        buf->data[4 * i + 0] = 'D';
+        buf->data[4 * i + 1] = 'E';
+        buf->data[4 * i + 2] = 'A';
+        buf->data[4 * i + 3] = 'D';
+    }
+    int result = 0;
+    for (uint32_t i = 0; i < component_cnt && result == 0; i++) {
+        i2c_addr_t addr = component_id_to_i2c_addr(component_ids[i]);
+        result = send_packet(addr, KEY_SYNC_TRIGGER_LEN, buf->data);
+    }
+    packet_free(buf);
+    return result < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Collect every component's reply in the order they are ready
+ * 
+ * @param dest: unsigned char*, key_share_reply() accumulates here
+ * @param msg: uint8_t*, MAX_I2C_MESSAGE_LEN scratch
+ * @param component_cnt: uint32_t, number of components
+ * @param component_ids: uint32_t*, their IDs
+ * 
+ * @return int: 0 once all replies are in, -1 if one is absent, dropped the
+ * request or did not answer within POLL_TIMEOUT_US
+ *
+ * Sweeps the pending components with single status reads, so a slow one
+ * does not hold up reading the others
+*/
+static int key_exchange_collect(unsigned char *dest, uint8_t *msg, uint32_t component_cnt,
+                                uint32_t *component_ids) {
+    uint32_t pending = component_cnt == 32 ? 0xFFFFFFFF : (1u << component_cnt) - 1;
+    deadline_t timeout = deadline_in_us(POLL_TIMEOUT_US);
+    int result = 0;
 
-    // deal with the first component to obtain k1
-    i2c_addr_t addr = component_id_to_i2c_addr(component_id1);
-    XOR_secure(random1, KEY_SHARE, 16, cache1);
-    cache1[17] = '2';
-    int result = send_packet(addr, 18, cache1);
-    if(result < 0) {
+    while (pending != 0 && result == 0) {
+        uint32_t swept = pending;
+        if (deadline_expired(timeout)) {
+            result = -1;
+            break;
+        }
+
+        for (uint32_t i = 0; i < component_cnt; i++) {
+            if (!(pending & (1u << i))) {
+                continue;
+            }
+            i2c_addr_t addr = component_id_to_i2c_addr(component_ids[i]);
+            uint8_t len = 0;
+            int status = poll_transmit_status(addr, &len);
+            if (status == TRANSMIT_BUSY) {
+                continue;
+            }
+            // Absent, or went back to idle without answering
+            if (status != TRANSMIT_READY || len != KEY_SHARE_REPLY_LEN ||
+                receive_ready_packet(addr, len, msg) != KEY_SHARE_REPLY_LEN) {
+                result = -1;
+                break;
+            }
+            pending &= ~(1u << i);
+            key_share_reply(dest, i, msg);
+        }
+
+        // Nobody was ready, give the components some time
+        if (result == 0 && pending == swept) {
+            key_sync_waiting();
+            wait_until(deadline_in_us(POLL_MIN_DELAY_US));
+        }
+    }
+    deadline_finish(timeout);
+    return result;
+}
+
+static int key_exchange_rounds(unsigned char *dest, uint8_t *msg, uint32_t component_cnt,
+                               uint32_t *component_ids) {
+    if (key_share_begin(dest) != 0) {
         return -1;
     }
-    int len = poll_and_receive_packet(addr, cache1); 
-    if (len == 16) {
-        XOR_secure(M1, cache1, 16, cache1); // k1 == cach1
-    } else {
+
+    // Every request first
+    for (uint32_t i = 0; i < component_cnt; i++) {
+        i2c_addr_t addr = component_id_to_i2c_addr(component_ids[i]);
+        uint8_t len = key_share_request(i, msg);
+        if (send_packet(addr, len, msg) < 0) {
+            return -1;
+        }
+    }
+
+    // Then the replies, in the order the components finish
+    if (key_exchange_collect(dest, msg, component_cnt, component_ids) != 0) {
         return -1;
     }
 
-    // deal with the second component to obtain k2
-    i2c_addr_t addr2 = component_id_to_i2c_addr(component_id2);
-    XOR_secure(random2, KEY_SHARE, 16, cache2);
-    cache2[17] = '2';
+    // And each component's final message
+    for (uint32_t i = 0; i < component_cnt; i++) {
+        i2c_addr_t addr = component_id_to_i2c_addr(component_ids[i]);
+        key_sync_waiting();
+        int len = key_share_final(dest, i, msg);
+        if (len < 0 || send_packet(addr, len, msg) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Agree on one key with n components
+ * 
+ * @param dest: unsigned char*, 16 byte key output
+ * @param component_cnt: uint32_t, number of components, at most
+ * KEY_SYNC_MAX_COMPONENTS
+ * @param component_ids: uint32_t*, their IDs
+ * 
+ * @return int: 0 once every component has its final message, -1 otherwise
+ *
+ * Request, reply and final message per component, four messages with the
+ * DEAD trigger key_sync() sends first. Every request goes out before the
+ * first reply is collected so the components work in parallel.
+ *
+ * XOR exchange: component i gets r_i ^ k2, answers k_i ^ M1 and finally
+ * gets F1 ^ r_i ^ (k_1 ^ ... ^ k_n without k_i), which its sync2() turns
+ * into k2 ^ k_1 ^ ... ^ k_n.
+ *
+ * KEY_SYNC_X25519: component i gets the AP's ephemeral public key, answers
+ * its own and finally gets a random key encrypted and tagged under a wrap
+ * key derived from their shared secret and M1
+*/
+int key_exchange(unsigned char *dest, uint32_t component_cnt, uint32_t *component_ids) {
+    packet_buf_t *buf = packet_alloc();
+    if (buf == NULL) {
+        return -1;
+    }
+    int result = key_exchange_rounds(dest, buf->data, component_cnt, component_ids);
+    key_share_end(dest);
+    memset(buf->data, 0, sizeof(buf->data));
+    packet_free(buf);
+    return result;
+}
 
-    int return_status = send_packet(addr2, 18, cache2);
-    if(return_status < 0) {
+int key_sync(unsigned char *dest, uint32_t component_cnt, uint32_t *component_ids) {
+    if (component_cnt == 0 || component_cnt > KEY_SYNC_MAX_COMPONENTS) {
         return -1;
     }
-    int len2 = poll_and_receive_packet(addr2, cache2);
-    if (len2 == 16) {
-        XOR_secure(M1, cache2, 16, cache2); // k3 == cach2
-        XOR_secure(cache1, cache2, 16, dest); // k1 * k3 == dest
-        XOR_secure(dest, KEY_SHARE, 16, dest); // k1 * k3 * k2 == dest
-    } else {
+    if (key_sync_trigger(component_cnt, component_ids) != 0) {
         return -1;
     }
+    return key_exchange(dest, component_cnt, component_ids);
+}
 
-    // send out the last few pieces of keys to both sides
-    // sends k_Comp2 f1 R
-    XOR_secure(F1, cache2, 16, cache2);
-    XOR_secure(cache2, random1, 16, cache2); // cach2 == k3 * f1 * r
-    int result2 = send_packet(addr, 16, cache2);
+/**
+ * @brief Derive the resumption ticket of a key
+ * 
+ * @param key: unsigned char*, 16 byte synced key
+ * @param component_id: uint32_t, component the ticket is for
+ * @param secret: uint8_t*, 16 byte output
+ *
+ * AES_key("RTKT" | component ID), the component saves the same after a sync
+*/
+static void ticket_derive(unsigned char *key, uint32_t component_id, uint8_t *secret) {
+    uint8_t block[KEY_SHARE_LEN] = {'R', 'T', 'K', 'T'};
+    block[4] = component_id >> 24;
+    block[5] = component_id >> 16;
+    block[6] = component_id >> 8;
+    block[7] = component_id;
+    encrypt_sym(block, KEY_SHARE_LEN, key, secret);
+}
 
-    // sends k_Comp1 f2 R
-    XOR_secure(F1, cache1, 16, cache1);
-    XOR_secure(cache1, random2, 16, cache1); // cach1 == k1 * f2 * r
-    int result3 = send_packet(addr2, 16, cache1);
+static void store_be32(uint8_t *out, uint32_t value) {
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
 
-    return 0;
+/**
+ * @brief The resumption exchange, key_resume() wipes the scratch afterwards
+ * 
+ * @param key: unsigned char*, 16 byte synced key
+ * @param component_id: uint32_t, the component
+ * @param msg: uint8_t*, MAX_I2C_MESSAGE_LEN scratch for the messages
+ * @param secrets: uint8_t*, 32 byte scratch for the ticket and the
+ * resumption key
+ * 
+ * @return int: 0 once the key is sent, -1 otherwise
+*/
+static int key_resume_exchange(unsigned char *key, uint32_t component_id, uint8_t *msg,
+                               uint8_t *secrets) {
+    i2c_addr_t addr = component_id_to_i2c_addr(component_id);
+    uint8_t *ticket = secrets;
+    uint8_t *session = &secrets[KEY_SHARE_LEN];
+    uint8_t nonce_a[RESUME_NONCE_LEN];
+    uint8_t nonce_c[RESUME_NONCE_LEN];
+    uint8_t tag[TAG_SIZE];
+
+    ticket_derive(key, component_id, ticket);
+    Rand_NASYC(nonce_a, RESUME_NONCE_LEN);
+    memcpy(msg, RESUME_MAGIC, RESUME_MAGIC_LEN);
+    memcpy(&msg[RESUME_MAGIC_LEN], nonce_a, RESUME_NONCE_LEN);
+    if (send_packet(addr, RESUME_REQUEST_LEN, msg) < 0) {
+        return -1;
+    }
+
+    // The component proves it holds the ticket for this key
+    if (poll_and_receive_packet(addr, msg) != RESUME_PROOF_LEN) {
+        return -1;
+    }
+    memcpy(nonce_c, msg, RESUME_NONCE_LEN);
+    if (tag_sym(nonce_c, nonce_a, RESUME_NONCE_LEN, nonce_c, RESUME_NONCE_LEN, ticket, tag) != 0 ||
+        !tag_equal(tag, &msg[RESUME_NONCE_LEN])) {
+        return -1;
+    }
+
+    // Key, counter bases and key epoch under AES_ticket(nonce_a ^ nonce_c)
+    uint32_t send_base, recv_base, epoch;
+    XOR_secure(nonce_a, nonce_c, RESUME_NONCE_LEN, session);
+    encrypt_sym(session, KEY_SHARE_LEN, ticket, session);
+    board_link_resume_counters(addr, &send_base, &recv_base, &epoch);
+    memset(msg, 0, RESUME_GRANT_BODY_LEN);
+    memcpy(msg, key, KEY_SHARE_LEN);
+    store_be32(&msg[KEY_SHARE_LEN], send_base);
+    store_be32(&msg[KEY_SHARE_LEN + 4], recv_base);
+    store_be32(&msg[KEY_SHARE_LEN + 8], epoch);
+    encrypt_sym(msg, RESUME_GRANT_BODY_LEN, session, msg);
+    if (tag_sym(nonce_a, nonce_c, RESUME_NONCE_LEN, msg, RESUME_GRANT_BODY_LEN, session,
+                &msg[RESUME_GRANT_BODY_LEN]) != 0) {
+        return -1;
+    }
+    return send_packet(addr, RESUME_GRANT_LEN, msg) < 0 ? -1 : 0;
 }
 
-int key_sync(unsigned char *dest, uint32_t component_cnt,
-               uint32_t component_id1, uint32_t component_id2) {
-    char random_number1[18];
-    char random_number2[18];
-    Rand_NASYC(random_number1, 16);
-    Rand_NASYC(random_number2, 16);
-    if (component_cnt == 2) {
-        return key_exchange2(dest, random_number1, random_number2 ,component_id1, component_id2);
-    } else {
-        return key_exchange1(dest, component_id1);
+/**
+ * @brief Give a component that reset the synced key back
+ * 
+ * @param key: unsigned char*, 16 byte synced key
+ * @param component_id: uint32_t, the component
+ * 
+ * @return int: 0 once the key is sent, -1 if the component has no ticket for
+ * it or did not answer
+ *
+ * One round trip with a single component instead of key_sync()'s four
+ * messages with every component: "RSUM" | nonce_a out, nonce_c and a tag under the ticket
+ * back, then the key, the counters and the key epoch to continue from out,
+ * encrypted and tagged under AES_ticket(nonce_a ^ nonce_c)
+*/
+int key_resume(unsigned char *key, uint32_t component_id) {
+    packet_buf_t *buf = packet_alloc();
+    if (buf == NULL) {
+        return -1;
     }
+    uint8_t secrets[2 * KEY_SHARE_LEN];
+    int result = key_resume_exchange(key, component_id, buf->data, secrets);
+    memset(secrets, 0, sizeof(secrets));
+    packet_free(buf);
+    return result;
 }
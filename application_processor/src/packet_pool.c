@@ -0,0 +1,67 @@
+/**
+ * @file "packet_pool.c"
+ * @brief Static Packet Buffer Pool Implementation
+ * @date 2024
+ */
+
+#include "packet_pool.h"
+
+#include <string.h>
+
+/******************************** GLOBAL DEFINITIONS ********************************/
+static packet_buf_t pool[PACKET_POOL_SIZE];
+// Bit i set while pool[i] is owned
+static uint32_t owned = 0;
+
+static packet_pool_stats_t pool_stats;
+
+/******************************** FUNCTION DEFINITIONS ********************************/
+/**
+ * @brief Take a buffer from the pool
+ * 
+ * @return packet_buf_t*: zeroed buffer owned by the caller, NULL if the
+ * pool is exhausted
+*/
+packet_buf_t* packet_alloc(void) {
+    for (int i = 0; i < PACKET_POOL_SIZE; i++) {
+        if (!(owned & (1u << i))) {
+            owned |= 1u << i;
+            pool_stats.allocs++;
+            if (++pool_stats.in_use > pool_stats.high_water) {
+                pool_stats.high_water = pool_stats.in_use;
+            }
+            return &pool[i];
+        }
+    }
+    pool_stats.failures++;
+    return NULL;
+}
+
+/**
+ * @brief Return a buffer to the pool
+ * 
+ * @param buf: packet_buf_t*, buffer from packet_alloc(), NULL is ignored
+ * 
+ * The buffer is wiped so no plaintext outlives its owner
+*/
+void packet_free(packet_buf_t* buf) {
+    if (buf == NULL) {
+        return;
+    }
+    int i = buf - pool;
+    if (i < 0 || i >= PACKET_POOL_SIZE || !(owned & (1u << i))) {
+        return;
+    }
+    memset(buf->data, 0, PACKET_BUF_LEN);
+    owned &= ~(1u << i);
+    pool_stats.in_use--;
+}
+
+/**
+ * @brief Get the pool usage
+ * 
+ * @return const packet_pool_stats_t*: allocation counts and high water mark
+*/
+const packet_pool_stats_t* get_packet_pool_stats(void) {
+    return &pool_stats;
+}
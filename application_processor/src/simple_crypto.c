@@ -14,6 +14,7 @@
 #if CRYPTO_EXAMPLE
 
 #include "simple_crypto.h"
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 
@@ -90,6 +91,315 @@ int decrypt_sym(uint8_t *ciphertext, size_t len, uint8_t *key, uint8_t *plaintex
     return 0;
 }
 
+/** @brief Expands a key into a crypto session
+ *
+ * @param session The session to set up
+ * @param key A pointer to a buffer of length KEY_SIZE (16 bytes) containing
+ *          the key, it is not referenced after the call
+ *
+ * @return 0 on success, non-zero for error, the session is left invalid
+ */
+int crypto_session_init(crypto_session_t *session, uint8_t *key) {
+    int result; // Library result
+
+    session->valid = false;
+    result = wc_AesSetKey(&session->enc, key, KEY_SIZE, NULL, AES_ENCRYPTION);
+    if (result != 0)
+        return result; // Report error
+
+    // The decryption schedule is the expensive one, build it once here
+    result = wc_AesSetKey(&session->dec, key, KEY_SIZE, NULL, AES_DECRYPTION);
+    if (result != 0)
+        return result; // Report error
+
+    session->valid = true;
+    return 0;
+}
+
+/** @brief Wipes the key schedules of a crypto session
+ *
+ * @param session The session to invalidate, call on every rekey
+ */
+void crypto_session_invalidate(crypto_session_t *session) {
+    session->valid = false;
+    // Do not leave the old round keys in RAM
+    volatile uint8_t *p = (volatile uint8_t *)session;
+    for (size_t i = 0; i < offsetof(crypto_session_t, valid); i++)
+        p[i] = 0;
+}
+
+/** @brief Encrypts plaintext with the schedule of a crypto session
+ *
+ * Same as encrypt_sym without the per-call key expansion
+ *
+ * @return 0 on success, -1 on bad length or invalid session, other non-zero
+ *          for other error
+ */
+int encrypt_session(crypto_session_t *session, uint8_t *plaintext, size_t len, uint8_t *ciphertext) {
+    int result; // Library result
+
+    // Ensure valid length and key
+    if (!session->valid || len == 0 || len % BLOCK_SIZE)
+        return -1;
+
+    // Encrypt each block
+    for (size_t i = 0; i < len - 1; i += BLOCK_SIZE) {
+        result = wc_AesEncryptDirect(&session->enc, ciphertext + i, plaintext + i);
+        if (result != 0)
+            return result; // Report error
+    }
+    return 0;
+}
+
+/** @brief Decrypts ciphertext with the schedule of a crypto session
+ *
+ * Same as decrypt_sym without the per-call key expansion
+ *
+ * @return 0 on success, -1 on bad length or invalid session, other non-zero
+ *          for other error
+ */
+int decrypt_session(crypto_session_t *session, uint8_t *ciphertext, size_t len, uint8_t *plaintext) {
+    int result; // Library result
+
+    // Ensure valid length and key
+    if (!session->valid || len == 0 || len % BLOCK_SIZE)
+        return -1;
+
+    // Decrypt each block
+    for (size_t i = 0; i < len - 1; i += BLOCK_SIZE) {
+        result = wc_AesDecryptDirect(&session->dec, plaintext + i, ciphertext + i);
+        if (result != 0)
+            return result; // Report error
+    }
+    return 0;
+}
+
+/** @brief Computes a tag with an expanded encryption schedule
+ *
+ * Shared by tag_sym and tag_session
+ */
+static int tag_with(Aes *ctx, uint8_t *nonce, uint8_t *aad, size_t aad_len,
+                    uint8_t *data, size_t len, uint8_t *tag) {
+    Poly1305 poly; // Context for the MAC
+    uint8_t one_time_key[2 * BLOCK_SIZE];
+    uint8_t counter_block[BLOCK_SIZE];
+    uint8_t full_tag[POLY1305_DIGEST_SIZE];
+    int result; // Library result
+
+    // r from AES(nonce || 0), s from AES(nonce || 1)
+    memcpy(counter_block, nonce, NONCE_SIZE);
+    memset(counter_block + NONCE_SIZE, 0, BLOCK_SIZE - NONCE_SIZE);
+    result = wc_AesEncryptDirect(ctx, one_time_key, counter_block);
+    if (result != 0)
+        return result; // Report error
+    counter_block[BLOCK_SIZE - 1] = 1;
+    result = wc_AesEncryptDirect(ctx, one_time_key + BLOCK_SIZE, counter_block);
+    if (result != 0)
+        return result; // Report error
+
+    result = wc_Poly1305SetKey(&poly, one_time_key, sizeof(one_time_key));
+    if (result == 0 && aad_len)
+        result = wc_Poly1305Update(&poly, aad, aad_len);
+    if (result == 0 && len)
+        result = wc_Poly1305Update(&poly, data, len);
+    if (result == 0)
+        result = wc_Poly1305Final(&poly, full_tag);
+    if (result == 0)
+        memcpy(tag, full_tag, TAG_SIZE);
+
+    // Do not leave the one-time key in RAM
+    volatile uint8_t *p = one_time_key;
+    for (size_t i = 0; i < sizeof(one_time_key); i++)
+        p[i] = 0;
+    return result;
+}
+
+/** @brief Computes a tag over aad || data
+ *
+ * The one-time Poly1305 key is AES(nonce || 0) || AES(nonce || 1), the same
+ * construction as Poly1305-AES with r also taken from the nonce. Two AES
+ * blocks plus a Poly1305 pass cost a fraction of decrypting the data
+ *
+ * @param nonce A pointer to a buffer of length NONCE_SIZE (12 bytes), must
+ *          never repeat under the same key
+ * @param aad A pointer to aad_len bytes authenticated in front of data
+ * @param aad_len The length of aad, may be 0
+ * @param data A pointer to a buffer of length len, usually ciphertext
+ * @param len The length of data
+ * @param key A pointer to a buffer of length KEY_SIZE (16 bytes)
+ * @param tag A pointer to a buffer of length TAG_SIZE (8 bytes) where the
+ *          tag will be written to
+ *
+ * @return 0 on success, non-zero for error
+ */
+int tag_sym(uint8_t *nonce, uint8_t *aad, size_t aad_len, uint8_t *data, size_t len,
+            uint8_t *key, uint8_t *tag) {
+    Aes ctx; // Context for the one-time key
+    int result; // Library result
+
+    // Set the key for encryption
+    result = wc_AesSetKey(&ctx, key, KEY_SIZE, NULL, AES_ENCRYPTION);
+    if (result != 0)
+        return result; // Report error
+
+    return tag_with(&ctx, nonce, aad, aad_len, data, len, tag);
+}
+
+/** @brief Computes a tag with the schedule of a crypto session
+ *
+ * Same as tag_sym without the per-call key expansion
+ *
+ * @return 0 on success, -1 on invalid session, other non-zero for error
+ */
+int tag_session(crypto_session_t *session, uint8_t *nonce, uint8_t *aad, size_t aad_len,
+                uint8_t *data, size_t len, uint8_t *tag) {
+    if (!session->valid)
+        return -1;
+    return tag_with(&session->enc, nonce, aad, aad_len, data, len, tag);
+}
+
+/** @brief Compares two tags in constant time
+ *
+ * @return true if all TAG_SIZE bytes match
+ */
+bool tag_equal(const uint8_t *a, const uint8_t *b) {
+    uint8_t diff = 0;
+    for (int i = 0; i < TAG_SIZE; i++)
+        diff |= a[i] ^ b[i];
+    return diff == 0;
+}
+
+#ifdef HAVE_CURVE25519
+/** @brief Computes the X25519 public key of a private key
+ *
+ * @param private_key A pointer to a buffer of length X25519_KEY_SIZE (32 bytes)
+ *          of random bytes, clamped in place
+ * @param public_key A pointer to a buffer of length X25519_KEY_SIZE where the
+ *          public key will be written to
+ *
+ * @return 0 on success, non-zero for error
+ */
+int x25519_make_public(uint8_t *private_key, uint8_t *public_key) {
+    // RFC 7748 section 5, wolfSSL only takes clamped scalars
+    private_key[0] &= 248;
+    private_key[X25519_KEY_SIZE - 1] &= 127;
+    private_key[X25519_KEY_SIZE - 1] |= 64;
+    return wc_curve25519_make_pub(X25519_KEY_SIZE, public_key, X25519_KEY_SIZE, private_key);
+}
+
+/** @brief Computes the X25519 shared secret with a peer's public key
+ *
+ * @param private_key A pointer to a buffer of length X25519_KEY_SIZE (32 bytes)
+ *          clamped by x25519_make_public
+ * @param peer_key A pointer to a buffer of length X25519_KEY_SIZE containing
+ *          the peer's public key
+ * @param shared A pointer to a buffer of length X25519_KEY_SIZE where the
+ *          shared secret will be written to
+ *
+ * @return 0 on success, -1 if the peer key is a low order point, other
+ *          non-zero for error
+ */
+int x25519_shared(uint8_t *private_key, uint8_t *peer_key, uint8_t *shared) {
+    int result; // Library result
+    uint8_t any = 0;
+
+    // The peer key is taken as a point, same as the base point of make_pub
+    result = wc_curve25519_generic(X25519_KEY_SIZE, shared, X25519_KEY_SIZE, private_key,
+                                   X25519_KEY_SIZE, peer_key);
+    if (result != 0)
+        return result; // Report error
+
+    // A low order point gives zero whatever the private key
+    for (int i = 0; i < X25519_KEY_SIZE; i++)
+        any |= shared[i];
+    return any ? 0 : -1;
+}
+
+/** @brief Known-answer test of X25519
+ *
+ * RFC 7748 section 6.1, Alice's private key with Bob's public key
+ *
+ * @return 0 on success, -1 on a wrong answer
+ */
+static int x25519_self_test(void) {
+    static const uint8_t alice_private[X25519_KEY_SIZE] = {
+        0x77, 0x07, 0x6d, 0x0a, 0x73, 0x18, 0xa5, 0x7d,
+        0x3c, 0x16, 0xc1, 0x72, 0x51, 0xb2, 0x66, 0x45,
+        0xdf, 0x4c, 0x2f, 0x87, 0xeb, 0xc0, 0x99, 0x2a,
+        0xb1, 0x77, 0xfb, 0xa5, 0x1d, 0xb9, 0x2c, 0x2a};
+    static const uint8_t alice_public[X25519_KEY_SIZE] = {
+        0x85, 0x20, 0xf0, 0x09, 0x89, 0x30, 0xa7, 0x54,
+        0x74, 0x8b, 0x7d, 0xdc, 0xb4, 0x3e, 0xf7, 0x5a,
+        0x0d, 0xbf, 0x3a, 0x0d, 0x26, 0x38, 0x1a, 0xf4,
+        0xeb, 0xa4, 0xa9, 0x8e, 0xaa, 0x9b, 0x4e, 0x6a};
+    static const uint8_t bob_public[X25519_KEY_SIZE] = {
+        0xde, 0x9e, 0xdb, 0x7d, 0x7b, 0x7d, 0xc1, 0xb4,
+        0xd3, 0x5b, 0x61, 0xc2, 0xec, 0xe4, 0x35, 0x37,
+        0x3f, 0x83, 0x43, 0xc8, 0x5b, 0x78, 0x67, 0x4d,
+        0xad, 0xfc, 0x7e, 0x14, 0x6f, 0x88, 0x2b, 0x4f};
+    static const uint8_t expected[X25519_KEY_SIZE] = {
+        0x4a, 0x5d, 0x9d, 0x5b, 0xa4, 0xce, 0x2d, 0xe1,
+        0x72, 0x8e, 0x3b, 0xf4, 0x80, 0x35, 0x0f, 0x25,
+        0xe0, 0x7e, 0x21, 0xc9, 0x47, 0xd1, 0x9e, 0x33,
+        0x76, 0xf0, 0x9b, 0x3c, 0x1e, 0x16, 0x17, 0x42};
+    uint8_t private_key[X25519_KEY_SIZE];
+    uint8_t public_key[X25519_KEY_SIZE];
+    uint8_t shared[X25519_KEY_SIZE];
+    int ok;
+
+    memcpy(private_key, alice_private, X25519_KEY_SIZE);
+    ok = x25519_make_public(private_key, public_key) == 0 &&
+         !memcmp(public_key, alice_public, X25519_KEY_SIZE) &&
+         x25519_shared(private_key, (uint8_t *)bob_public, shared) == 0 &&
+         !memcmp(shared, expected, X25519_KEY_SIZE);
+    memset(private_key, 0, sizeof(private_key));
+
+    return ok ? 0 : -1;
+}
+#endif
+
+/** @brief Known-answer test of the AES backend, and of X25519 when built
+ *
+ * FIPS-197 appendix C.1 through encrypt_sym/decrypt_sym and through a
+ * crypto session, so a miscompiled or misconfigured backend (generic C or
+ * thumb2 assembly) is caught before any key is used
+ *
+ * @return 0 on success, -1 on a wrong answer
+ */
+int crypto_self_test(void) {
+    static const uint8_t key[KEY_SIZE] = {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+        0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+    static const uint8_t plaintext[BLOCK_SIZE] = {
+        0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+        0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff};
+    static const uint8_t expected[BLOCK_SIZE] = {
+        0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30,
+        0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a};
+    static crypto_session_t session;
+    uint8_t out[BLOCK_SIZE];
+    uint8_t back[BLOCK_SIZE];
+    int ok;
+
+    ok = encrypt_sym((uint8_t *)plaintext, BLOCK_SIZE, (uint8_t *)key, out) == 0 &&
+         !memcmp(out, expected, BLOCK_SIZE) &&
+         decrypt_sym(out, BLOCK_SIZE, (uint8_t *)key, back) == 0 &&
+         !memcmp(back, plaintext, BLOCK_SIZE);
+
+    ok = ok && crypto_session_init(&session, (uint8_t *)key) == 0 &&
+         encrypt_session(&session, (uint8_t *)plaintext, BLOCK_SIZE, out) == 0 &&
+         !memcmp(out, expected, BLOCK_SIZE) &&
+         decrypt_session(&session, out, BLOCK_SIZE, back) == 0 &&
+         !memcmp(back, plaintext, BLOCK_SIZE);
+    crypto_session_invalidate(&session);
+
+#ifdef HAVE_CURVE25519
+    ok = ok && x25519_self_test() == 0;
+#endif
+
+    return ok ? 0 : -1;
+}
+
 /** @brief Hashes arbitrary-length data
  *
  * @param data A pointer to a buffer of length len containing the data
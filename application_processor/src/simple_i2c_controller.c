@@ -13,6 +13,7 @@
 
 
 #include "simple_i2c_controller.h"
+#include "packet_pool.h"
 
 /******************************** FUNCTION PROTOTYPES ********************************/
 /**
@@ -23,6 +24,172 @@
  */
 static void I2C_Handler(void) { MXC_I2C_AsyncHandler(I2C_INTERFACE); }
 
+#if I2C_USE_DMA
+/**
+ * @brief Built-In DMA Interrupt Handler
+ *
+ * MXC_I2C_MasterTransactionDMA() completes from the DMA channel interrupts
+ */
+static void DMA_Handler(void) { MXC_DMA_Handler(); }
+
+static volatile bool dma_done;
+static volatile int dma_result;
+
+static void i2c_dma_complete(mxc_i2c_req_t* req, int result) {
+    dma_result = result;
+    dma_done = true;
+}
+#endif
+
+/******************************** SPEED TABLE ********************************/
+// Negotiated SCL frequency and consecutive faults, indexed by 7-bit address
+static uint32_t speed_table[128];
+static uint8_t speed_faults[128];
+// Frequency the interface is currently programmed with
+static uint32_t current_speed = 0;
+
+/**
+ * @brief Program the bus for the speed negotiated with an address
+*/
+static void i2c_select_speed(i2c_addr_t addr) {
+    uint32_t speed = i2c_simple_get_speed(addr);
+    if (speed != current_speed) {
+        MXC_I2C_SetFrequency(I2C_INTERFACE, speed);
+        current_speed = speed;
+    }
+}
+
+/**
+ * @brief Run a blocking transaction at the speed of its address
+ * 
+ * @return int: MXC_I2C_MasterTransaction result
+ * 
+ * A failed transaction counts as a fault against the address speed
+*/
+static int i2c_transaction(mxc_i2c_req_t* request) {
+    i2c_select_speed(request->addr);
+#if I2C_USE_DMA
+    int result;
+    if (request->tx_len + request->rx_len >= I2C_DMA_MIN_LEN) {
+        // Data moves without the CPU, sleep until the DMA interrupt
+        dma_done = false;
+        request->callback = i2c_dma_complete;
+        __disable_irq();
+        result = MXC_I2C_MasterTransactionDMA(request);
+        while (result == E_NO_ERROR && !dma_done) {
+            __WFI();
+            __enable_irq();
+            __disable_irq();
+        }
+        __enable_irq();
+        if (result == E_NO_ERROR) {
+            result = dma_result;
+        }
+    } else {
+        result = MXC_I2C_MasterTransaction(request);
+    }
+#else
+    int result = MXC_I2C_MasterTransaction(request);
+#endif
+    if (result < 0) {
+        i2c_simple_speed_fault(request->addr);
+    }
+    return result;
+}
+
+/******************************** ASYNC QUEUE ********************************/
+// One pending register operation
+typedef struct {
+    mxc_i2c_req_t request;
+    uint8_t packet[MAX_I2C_MESSAGE_LEN + 1]; // register byte followed by write data
+    i2c_async_cb_t cb;
+    void* ctx;
+} i2c_async_op;
+
+static i2c_async_op async_queue[I2C_ASYNC_QUEUE_LEN];
+static volatile uint8_t async_head = 0;
+static volatile uint8_t async_count = 0;
+static volatile int async_error = E_NO_ERROR;
+
+static void i2c_async_start(void);
+
+/**
+ * @brief Completion handler for the operation at the head of the queue
+ * 
+ * Called by MXC_I2C_AsyncHandler from the I2C interrupt. Hands the result
+ * to the caller and starts the next queued operation
+*/
+static void i2c_async_complete(mxc_i2c_req_t* req, int result) {
+    i2c_async_cb_t cb = async_queue[async_head].cb;
+    void* ctx = async_queue[async_head].ctx;
+
+    if (result != E_NO_ERROR) {
+        async_error = result;
+        i2c_simple_speed_fault(req->addr);
+    }
+    async_head = (async_head + 1) % I2C_ASYNC_QUEUE_LEN;
+    async_count--;
+
+    if (cb != NULL) {
+        cb(result, ctx);
+    }
+    if (async_count != 0) {
+        i2c_async_start();
+    }
+}
+
+/**
+ * @brief Put the operation at the head of the queue on the bus
+*/
+static void i2c_async_start(void) {
+    i2c_select_speed(async_queue[async_head].request.addr);
+    int result = MXC_I2C_MasterTransactionAsync(&async_queue[async_head].request);
+    if (result != E_NO_ERROR) {
+        // The transaction never started so complete it here
+        i2c_async_complete(&async_queue[async_head].request, result);
+    }
+}
+
+/**
+ * @brief Append a register operation to the queue
+ * 
+ * @return int: negative if the queue is full, 0 if queued
+*/
+static int i2c_async_submit(i2c_addr_t addr, ECTF_I2C_REGS reg, uint8_t tx_len, uint8_t* tx_buf,
+                            uint8_t rx_len, uint8_t* rx_buf, i2c_async_cb_t cb, void* ctx) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    if (async_count == I2C_ASYNC_QUEUE_LEN) {
+        __set_PRIMASK(primask);
+        return E_NONE_AVAIL;
+    }
+
+    i2c_async_op* op = &async_queue[(async_head + async_count) % I2C_ASYNC_QUEUE_LEN];
+    op->packet[0] = reg;
+    if (tx_len) {
+        memcpy(&op->packet[1], tx_buf, tx_len);
+    }
+    op->request.i2c = I2C_INTERFACE;
+    op->request.addr = addr;
+    op->request.tx_len = tx_len + 1;
+    op->request.tx_buf = op->packet;
+    op->request.rx_len = rx_len;
+    op->request.rx_buf = rx_buf;
+    op->request.restart = 0;
+    op->request.callback = i2c_async_complete;
+    op->cb = cb;
+    op->ctx = ctx;
+
+    async_count++;
+    if (async_count == 1) {
+        i2c_async_start();
+    }
+
+    __set_PRIMASK(primask);
+    return E_NO_ERROR;
+}
+
 /******************************** FUNCTION DEFINITIONS ********************************/
 /**
  * @brief Initialize the I2C Connection
@@ -39,13 +206,31 @@ int i2c_simple_controller_init(void) {
         printf("Failed to initialize I2C.\n");
         return error;
     }
+    // Every address starts at standard mode until negotiated
+    for (int i = 0; i < 128; i++) {
+        speed_table[i] = I2C_FREQ;
+        speed_faults[i] = 0;
+    }
     // Set frequency to frequency macro
     MXC_I2C_SetFrequency(I2C_INTERFACE, I2C_FREQ);
+    current_speed = I2C_FREQ;
     
     // Set up interrupt
     MXC_NVIC_SetVector(MXC_I2C_GET_IRQ(MXC_I2C_GET_IDX(I2C_INTERFACE)), I2C_Handler);
     NVIC_EnableIRQ(MXC_I2C_GET_IRQ(MXC_I2C_GET_IDX(I2C_INTERFACE)));
 
+#if I2C_USE_DMA
+    // The driver acquires a TX and an RX channel per transaction
+    MXC_NVIC_SetVector(DMA0_IRQn, DMA_Handler);
+    MXC_NVIC_SetVector(DMA1_IRQn, DMA_Handler);
+    MXC_NVIC_SetVector(DMA2_IRQn, DMA_Handler);
+    MXC_NVIC_SetVector(DMA3_IRQn, DMA_Handler);
+    NVIC_EnableIRQ(DMA0_IRQn);
+    NVIC_EnableIRQ(DMA1_IRQn);
+    NVIC_EnableIRQ(DMA2_IRQn);
+    NVIC_EnableIRQ(DMA3_IRQn);
+#endif
+
     return E_NO_ERROR;
 }
 
@@ -105,6 +290,78 @@ int i2c_simple_read_transmit_len(i2c_addr_t addr) {
     return i2c_simple_read_status_generic(addr, TRANSMIT_LEN);
 }
 
+/**
+ * @brief Read TRANSMIT_DONE and TRANSMIT_LEN regs
+ * 
+ * @param addr: i2c_addr_t, address of I2C device
+ * @param len: uint8_t*, set to the TRANSMIT_LEN value
+ * 
+ * @return int: TRANSMIT_DONE value, negative if error
+ *
+ * A TRANSMIT_DONE read that continues for a second byte returns
+ * TRANSMIT_LEN, so one transaction gives both
+*/
+int i2c_simple_read_transmit_status(i2c_addr_t addr, uint8_t* len) {
+    uint8_t status[BURST_READ_HEADER_LEN];
+
+    int result = i2c_simple_read_data_generic(addr, TRANSMIT_DONE, BURST_READ_HEADER_LEN, status);
+    if (result < 0) {
+        return result;
+    }
+    *len = status[1];
+    return status[0];
+}
+
+/**
+ * @brief Probe an address
+ * 
+ * @param addr: i2c_addr_t, address of I2C device
+ * 
+ * @return int: 0 if the address was acknowledged, negative otherwise
+ * 
+ * Address-only write with no register byte, absent addresses cost a
+ * single byte on the bus. A missing device is the expected answer here
+ * so it does not count against the address speed
+*/
+int i2c_simple_probe(i2c_addr_t addr) {
+    while (i2c_simple_async_busy());
+
+    mxc_i2c_req_t request;
+    request.i2c = I2C_INTERFACE;
+    request.addr = addr;
+    request.tx_len = 0;
+    request.tx_buf = NULL;
+    request.rx_len = 0;
+    request.rx_buf = NULL;
+    request.restart = 0;
+    request.callback = NULL;
+
+    i2c_select_speed(addr);
+    return MXC_I2C_MasterTransaction(&request);
+}
+
+/**
+ * @brief Read IDENTITY reg
+ * 
+ * @param addr: i2c_addr_t, address of I2C device
+ * @param component_id: uint32_t*, set to the component ID
+ * 
+ * @return int: negative if error, 0 if success
+*/
+int i2c_simple_read_identity(i2c_addr_t addr, uint32_t* component_id) {
+    uint8_t id[IDENTITY_LEN];
+
+    int result = i2c_simple_read_data_generic(addr, IDENTITY, IDENTITY_LEN, id);
+    if (result < 0) {
+        return result;
+    }
+    *component_id = 0;
+    for (int i = 0; i < IDENTITY_LEN; i++) {
+        *component_id = (*component_id << 8) | id[i];
+    }
+    return E_NO_ERROR;
+}
+
 /**
  * @brief Write RECEIVE_DONE reg
  * 
@@ -180,6 +437,8 @@ int i2c_simple_write_transmit_len(i2c_addr_t addr, uint8_t len) {
 */
 int i2c_simple_read_data_generic(i2c_addr_t addr, ECTF_I2C_REGS reg, uint8_t len, uint8_t* buf)
 {
+    while (i2c_simple_async_busy());
+
     mxc_i2c_req_t request;
     request.i2c = I2C_INTERFACE;
     request.addr = addr;
@@ -190,7 +449,7 @@ int i2c_simple_read_data_generic(i2c_addr_t addr, ECTF_I2C_REGS reg, uint8_t len
     request.restart = 0;
     request.callback = NULL;
 
-    return MXC_I2C_MasterTransaction(&request);
+    return i2c_transaction(&request);
 }
 
 /**
@@ -207,7 +466,13 @@ int i2c_simple_read_data_generic(i2c_addr_t addr, ECTF_I2C_REGS reg, uint8_t len
  * Can be used to write the PARAMS or RESULT register
 */
 int i2c_simple_write_data_generic(i2c_addr_t addr, ECTF_I2C_REGS reg, uint8_t len, uint8_t* buf) {
-    uint8_t packet[257];
+    while (i2c_simple_async_busy());
+
+    packet_buf_t* staging = packet_alloc();
+    if (staging == NULL) {
+        return E_NONE_AVAIL;
+    }
+    uint8_t* packet = staging->data;
     packet[0] = reg;
     memcpy(&packet[1], buf, len);
     
@@ -221,7 +486,108 @@ int i2c_simple_write_data_generic(i2c_addr_t addr, ECTF_I2C_REGS reg, uint8_t le
     request.restart = 0;
     request.callback = NULL;
 
-    return MXC_I2C_MasterTransaction(&request);
+    int result = i2c_transaction(&request);
+    packet_free(staging);
+    return result;
+}
+
+/**
+ * @brief Write BURST reg
+ * 
+ * @param addr: i2c_addr_t, address of I2C device
+ * @param len: uint8_t, length of data to write
+ * @param buf: uint8_t*, buffer to write data from
+ * 
+ * @return int: negative if error, 0 if success
+ * 
+ * Write RECEIVE_LEN, RECEIVE and RECEIVE_DONE in a single transaction
+*/
+int i2c_simple_write_burst(i2c_addr_t addr, uint8_t len, uint8_t* buf) {
+    while (i2c_simple_async_busy());
+
+    packet_buf_t* staging = packet_alloc();
+    if (staging == NULL) {
+        return E_NONE_AVAIL;
+    }
+    uint8_t* packet = staging->data;
+    packet[0] = BURST;
+    packet[1] = len;
+    memcpy(&packet[1 + BURST_WRITE_HEADER_LEN], buf, len);
+
+    mxc_i2c_req_t request;
+    request.i2c = I2C_INTERFACE;
+    request.addr = addr;
+    request.tx_len = 1 + BURST_WRITE_HEADER_LEN + len;
+    request.tx_buf = packet;
+    request.rx_len = 0;
+    request.rx_buf = 0;
+    request.restart = 0;
+    request.callback = NULL;
+
+    int result = i2c_transaction(&request);
+    packet_free(staging);
+    return result;
+}
+
+/**
+ * @brief Write BURST reg from a buffer with headroom
+ * 
+ * @param addr: i2c_addr_t, address of I2C device
+ * @param len: uint8_t, length of data to write
+ * @param frame: uint8_t*, I2C_TX_HEADROOM + len buffer, data at frame + I2C_TX_HEADROOM
+ * 
+ * @return int: negative if error, 0 if success
+ * 
+ * The register byte and length are written into the headroom so the
+ * caller buffer goes on the bus as is, with no copy
+*/
+int i2c_simple_write_burst_inplace(i2c_addr_t addr, uint8_t len, uint8_t* frame) {
+    while (i2c_simple_async_busy());
+
+    frame[0] = BURST;
+    frame[1] = len;
+
+    mxc_i2c_req_t request;
+    request.i2c = I2C_INTERFACE;
+    request.addr = addr;
+    request.tx_len = I2C_TX_HEADROOM + len;
+    request.tx_buf = frame;
+    request.rx_len = 0;
+    request.rx_buf = 0;
+    request.restart = 0;
+    request.callback = NULL;
+
+    return i2c_transaction(&request);
+}
+
+/**
+ * @brief Read BURST reg
+ * 
+ * @param addr: i2c_addr_t, address of I2C device
+ * @param len: uint8_t, length of data to read
+ * @param buf: uint8_t*, BURST_READ_HEADER_LEN + len buffer to read into
+ * 
+ * @return int: negative if error, 0 if success
+ * 
+ * Read TRANSMIT_DONE, TRANSMIT_LEN and TRANSMIT in a single transaction.
+ * Reading all len bytes acknowledges the response, no TRANSMIT_DONE write follows
+*/
+int i2c_simple_read_burst(i2c_addr_t addr, uint8_t len, uint8_t* buf) {
+    while (i2c_simple_async_busy());
+
+    uint8_t reg = BURST;
+
+    mxc_i2c_req_t request;
+    request.i2c = I2C_INTERFACE;
+    request.addr = addr;
+    request.tx_len = 1;
+    request.tx_buf = &reg;
+    request.rx_len = BURST_READ_HEADER_LEN + (unsigned int) len;
+    request.rx_buf = buf;
+    request.restart = 0;
+    request.callback = NULL;
+
+    return i2c_transaction(&request);
 }
 
 /**
@@ -235,6 +601,8 @@ int i2c_simple_write_data_generic(i2c_addr_t addr, ECTF_I2C_REGS reg, uint8_t le
  * Read any register that is 1B in size
 */
 int i2c_simple_read_status_generic(i2c_addr_t addr, ECTF_I2C_REGS reg) {
+    while (i2c_simple_async_busy());
+
     uint8_t value = 0;
 
     mxc_i2c_req_t request;
@@ -247,7 +615,7 @@ int i2c_simple_read_status_generic(i2c_addr_t addr, ECTF_I2C_REGS reg) {
     request.restart = 0;
     request.callback = NULL;
 
-    int result = MXC_I2C_MasterTransaction(&request);
+    int result = i2c_transaction(&request);
     if (result < 0) {
         return result;
     }
@@ -266,6 +634,8 @@ int i2c_simple_read_status_generic(i2c_addr_t addr, ECTF_I2C_REGS reg) {
  * Write any register that is 1B in size
 */
 int i2c_simple_write_status_generic(i2c_addr_t addr, ECTF_I2C_REGS reg, uint8_t value) {
+    while (i2c_simple_async_busy());
+
     uint8_t packet[2];
     packet[0] = (uint8_t) reg;
     packet[1] = value;
@@ -280,5 +650,117 @@ int i2c_simple_write_status_generic(i2c_addr_t addr, ECTF_I2C_REGS reg, uint8_t
     request.restart = 0;
     request.callback = NULL;
 
-    return MXC_I2C_MasterTransaction(&request);
+    return i2c_transaction(&request);
+}
+
+/**
+ * @brief Queue a register read
+ * 
+ * @param addr: i2c_addr_t, address of I2C device
+ * @param reg: ECTF_I2C_REGS, register to read from
+ * @param len: uint8_t, length of data to read
+ * @param buf: uint8_t*, buffer to read data into, must stay valid until completion
+ * @param cb: i2c_async_cb_t, completion callback, may be NULL
+ * @param ctx: void*, passed through to cb
+ * 
+ * @return int: negative if the queue is full, 0 if queued
+*/
+int i2c_simple_async_read(i2c_addr_t addr, ECTF_I2C_REGS reg, uint8_t len, uint8_t* buf,
+                          i2c_async_cb_t cb, void* ctx) {
+    return i2c_async_submit(addr, reg, 0, NULL, len, buf, cb, ctx);
+}
+
+/**
+ * @brief Queue a register write
+ * 
+ * @param addr: i2c_addr_t, address of I2C device
+ * @param reg: ECTF_I2C_REGS, register to write to
+ * @param len: uint8_t, length of data to write
+ * @param buf: uint8_t*, data to write, copied into the queue before returning
+ * @param cb: i2c_async_cb_t, completion callback, may be NULL
+ * @param ctx: void*, passed through to cb
+ * 
+ * @return int: negative if the queue is full, 0 if queued
+*/
+int i2c_simple_async_write(i2c_addr_t addr, ECTF_I2C_REGS reg, uint8_t len, uint8_t* buf,
+                           i2c_async_cb_t cb, void* ctx) {
+    return i2c_async_submit(addr, reg, len, buf, 0, NULL, cb, ctx);
+}
+
+/**
+ * @brief Check for queued register operations
+ * 
+ * @return bool: true while any queued operation has not completed
+*/
+bool i2c_simple_async_busy(void) {
+    return async_count != 0;
+}
+
+/**
+ * @brief Wait for the async queue to drain
+ * 
+ * @return int: negative if any operation since the last wait failed, 0 otherwise
+*/
+int i2c_simple_async_wait(void) {
+    while (i2c_simple_async_busy());
+
+    int error = async_error;
+    async_error = E_NO_ERROR;
+    return error;
+}
+
+/**
+ * @brief Get the SCL frequency used for an address
+ * 
+ * @param addr: i2c_addr_t, address of I2C device
+ * 
+ * @return uint32_t: frequency in Hz
+*/
+uint32_t i2c_simple_get_speed(i2c_addr_t addr) {
+    return speed_table[addr & 0x7F];
+}
+
+/**
+ * @brief Set the SCL frequency used for an address
+ * 
+ * @param addr: i2c_addr_t, address of I2C device
+ * @param speed: uint32_t, I2C_FREQ, I2C_FREQ_FAST or I2C_FREQ_FAST_PLUS
+ * 
+ * Clears the fault count, takes effect on the next transaction
+*/
+void i2c_simple_set_speed(i2c_addr_t addr, uint32_t speed) {
+    speed_table[addr & 0x7F] = speed;
+    speed_faults[addr & 0x7F] = 0;
+}
+
+/**
+ * @brief Record a failed exchange with an address
+ * 
+ * @param addr: i2c_addr_t, address of I2C device
+ * 
+ * After I2C_SPEED_FAULT_LIMIT faults in a row the address drops to the
+ * next slower speed
+*/
+void i2c_simple_speed_fault(i2c_addr_t addr) {
+    addr &= 0x7F;
+    if (++speed_faults[addr] < I2C_SPEED_FAULT_LIMIT) {
+        return;
+    }
+    speed_faults[addr] = 0;
+    if (speed_table[addr] > I2C_FREQ_FAST) {
+        speed_table[addr] = I2C_FREQ_FAST;
+    } else {
+        speed_table[addr] = I2C_FREQ;
+    }
+}
+
+/**
+ * @brief Record a successful exchange with an address
+ * 
+ * @param addr: i2c_addr_t, address of I2C device
+ * 
+ * Resets the consecutive fault count
+*/
+void i2c_simple_speed_ok(i2c_addr_t addr) {
+    speed_faults[addr & 0x7F] = 0;
 }
@@ -0,0 +1,145 @@
+/**
+ * @file "timebase.c"
+ * @brief Monotonic Timebase and Deadline Implementation
+ * @date 2024
+ */
+
+#include "timebase.h"
+
+#include "mxc_device.h"
+
+/******************************** GLOBAL DEFINITIONS ********************************/
+// Upper 32 bits of the extended count and the last raw count seen
+static volatile uint32_t count_high = 0;
+static volatile uint32_t count_last = 0;
+// Timer ticks per microsecond
+static uint32_t ticks_per_us = 1;
+
+static deadline_stats_t deadline_stats = {0, 0, UINT32_MAX, 0};
+
+/**
+ * @brief Read the extended tick count
+ * 
+ * A raw count lower than the previous one means the counter wrapped
+*/
+static uint64_t timebase_ticks(void) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t count = MXC_TMR_GetCount(TIMEBASE_TMR);
+    if (count < count_last) {
+        count_high++;
+    }
+    count_last = count;
+    uint64_t ticks = ((uint64_t)count_high << 32) | count;
+    __set_PRIMASK(primask);
+    return ticks;
+}
+
+/******************************** FUNCTION DEFINITIONS ********************************/
+/**
+ * @brief Start the timebase
+ * 
+ * Continuous 32-bit mode counts up to cmp_cnt and restarts, so the compare
+ * value is set to the full range
+*/
+void timebase_init(void) {
+    mxc_tmr_cfg_t cfg;
+    cfg.pres = TMR_PRES_1;
+    cfg.mode = TMR_MODE_CONTINUOUS;
+    cfg.bitMode = TMR_BIT_MODE_32;
+    cfg.clock = MXC_TMR_APB_CLK;
+    cfg.cmp_cnt = UINT32_MAX;
+    cfg.pol = 0;
+
+    MXC_TMR_Shutdown(TIMEBASE_TMR);
+    MXC_TMR_Init(TIMEBASE_TMR, &cfg, false);
+    MXC_TMR_SetCount(TIMEBASE_TMR, 0);
+    count_high = 0;
+    count_last = 0;
+    ticks_per_us = PeripheralClock / 1000000;
+    MXC_TMR_Start(TIMEBASE_TMR);
+}
+
+/**
+ * @brief Get the current time
+ * 
+ * @return uint64_t: microseconds since timebase_init()
+*/
+uint64_t timebase_now_us(void) {
+    return timebase_ticks() / ticks_per_us;
+}
+
+/**
+ * @brief Create a deadline relative to now
+ * 
+ * @param us: uint32_t, microseconds from now
+ * 
+ * @return deadline_t: the deadline
+*/
+deadline_t deadline_in_us(uint32_t us) {
+    return timebase_ticks() + (uint64_t)us * ticks_per_us;
+}
+
+/**
+ * @brief Check a deadline
+ * 
+ * @param deadline: deadline_t, deadline to check
+ * 
+ * @return bool: true once the deadline has passed
+*/
+bool deadline_expired(deadline_t deadline) {
+    return timebase_ticks() >= deadline;
+}
+
+/**
+ * @brief Get the time left before a deadline
+ * 
+ * @param deadline: deadline_t, deadline to check
+ * 
+ * @return uint32_t: microseconds left, 0 once expired
+*/
+uint32_t deadline_remaining_us(deadline_t deadline) {
+    uint64_t now = timebase_ticks();
+    if (now >= deadline) {
+        return 0;
+    }
+    return (uint32_t)((deadline - now) / ticks_per_us);
+}
+
+/**
+ * @brief Spin until a deadline passes
+ * 
+ * @param deadline: deadline_t, deadline to wait for
+*/
+void wait_until(deadline_t deadline) {
+    while (!deadline_expired(deadline));
+}
+
+/**
+ * @brief Record how a wait on a deadline ended
+ * 
+ * @param deadline: deadline_t, deadline of the wait
+*/
+void deadline_finish(deadline_t deadline) {
+    uint32_t slack = deadline_remaining_us(deadline);
+    if (slack == 0) {
+        deadline_stats.expired++;
+        return;
+    }
+    deadline_stats.waits++;
+    if (slack < deadline_stats.min_slack) {
+        deadline_stats.min_slack = slack;
+    }
+    if (slack > deadline_stats.max_slack) {
+        deadline_stats.max_slack = slack;
+    }
+}
+
+/**
+ * @brief Get the deadline statistics
+ * 
+ * @return const deadline_stats_t*: slack of every finished wait
+*/
+const deadline_stats_t* get_deadline_stats(void) {
+    return &deadline_stats;
+}
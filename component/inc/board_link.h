@@ -15,12 +15,73 @@
 
 #include "simple_i2c_peripheral.h"
 #include "simple_crypto.h"
+#include "key_epoch.h"
 
 /******************************** MACRO DEFINITIONS ********************************/
 // Last byte of the component ID is the I2C address
 #define COMPONENT_ADDR_MASK 0x000000FF             
 #define SUCCESS_RETURN 0
 #define ERROR_RETURN -1
+
+// Secure frame layout:
+// [payload length][key epoch][counter, big endian][tag][ciphertext padded
+// to BLOCK_SIZE]
+// The tag covers length, epoch, counter and ciphertext and is checked before
+// any decryption. 15 AES blocks keep the whole frame under the 255 byte I2C
+// length register. Counters keep running across key epochs
+#define FRAME_EPOCH_OFFSET 1
+#define FRAME_COUNTER_OFFSET 2
+#define FRAME_COUNTER_LEN 4
+#define FRAME_TAG_OFFSET (FRAME_COUNTER_OFFSET + FRAME_COUNTER_LEN)
+#define FRAME_HEADER_LEN (FRAME_TAG_OFFSET + TAG_SIZE)
+#define MAX_FRAME_PAYLOAD 240
+
+// Direction byte of the frame nonce, so the two sides never share one
+#define FRAME_TO_COMPONENT 0
+#define FRAME_TO_AP 1
+
+// Longest time from a request STOP to the component picking it up. The AP
+// backs off no less than POLL_MIN_DELAY_US between polls, staying under it
+// keeps a response from slipping past a poll
+#define WAKE_LATENCY_BUDGET_US 20
+
+// secure_wait_and_receive_packet() results for the two plaintext requests
+#define KEY_SYNC_REQUEST 2
+#define KEY_RESUME_REQUEST 3
+
+// Resume request, "RSUM" and the AP nonce. Shorter than any secure frame
+#define RESUME_MAGIC "RSUM"
+#define RESUME_MAGIC_LEN 4
+#define RESUME_NONCE_LEN 16
+#define RESUME_REQUEST_LEN (RESUME_MAGIC_LEN + RESUME_NONCE_LEN)
+
+// How long the timed receives wait for the AP to follow up, in microseconds
+#define TIMED_RECEIVE_TIMEOUT_US 300000
+
+/******************************** TYPE DEFINITIONS ********************************/
+// Secure frame statistics, times in core clock cycles. A rejected frame
+// would have cost about decrypt_cycles / decrypted_blocks per block it
+// carried, the difference to reject_cycles is what the early check saved
+typedef struct {
+    uint32_t accepted;         // Frames whose tag matched
+    uint32_t bad_header;       // Rejected on length or counter, no crypto run
+    uint32_t bad_tag;          // Rejected on the tag, never decrypted
+    uint32_t rejected_blocks;  // Ciphertext blocks in rejected frames
+    uint32_t decrypted_blocks; // Ciphertext blocks in accepted frames
+    uint64_t reject_cycles;    // Time spent on rejected frames
+    uint64_t decrypt_cycles;   // Time spent decrypting accepted frames
+    uint32_t rotations;        // Key epochs followed the AP to
+} frame_stats_t;
+
+// Sleep and wake-up statistics, times in core clock cycles
+typedef struct {
+    uint32_t wakeups;      // Requests picked up after sleeping
+    uint32_t last_latency; // Request STOP to pickup of the last request
+    uint32_t max_latency;  // Largest request STOP to pickup
+    uint32_t late;         // Pickups slower than WAKE_LATENCY_BUDGET_US
+    uint64_t sleep_cycles; // Time spent in WFI
+    uint64_t wait_cycles;  // Time spent waiting for the AP, asleep or not
+} wake_stats_t;
 #endif
 /******************************** FUNCTION PROTOTYPES ********************************/
 
@@ -35,6 +96,63 @@
 */
 int board_link_init(i2c_addr_t addr);
 
+/**
+ * @brief Get the sleep and wake-up statistics
+ * 
+ * @return const wake_stats_t*: statistics gathered while waiting on the AP
+ * The idle current is roughly sleep_cycles / wait_cycles of the waiting
+ * time at sleep current
+*/
+const wake_stats_t* get_wake_stats(void);
+
+/**
+ * @brief Get the secure frame statistics
+ * 
+ * @return const frame_stats_t*: accepted and rejected frame counts
+*/
+const frame_stats_t* get_frame_stats(void);
+
+/**
+ * @brief Estimate the cycles saved by rejecting frames before decryption
+ * 
+ * @return int64_t: decryption cost of the rejected blocks at the measured
+ * rate minus the time spent rejecting them, 0 until a frame was decrypted
+*/
+int64_t frame_cycles_saved(void);
+
+/**
+ * @brief Expand the synced key once for all secure packets
+ * 
+ * @param key: uint8_t*, 16 byte key, the caller keeps passing the same key
+ * to the secure packet functions
+ * 
+ * @return int: SUCCESS_RETURN if success, ERROR_RETURN if error
+ * Call after key_sync(). Until then, and after board_link_clear_key(),
+ * every packet expands its key again
+*/
+int board_link_set_key(uint8_t* key);
+
+/**
+ * @brief Expand a resumed key and continue its frame counters
+ * 
+ * @param key: uint8_t*, 16 byte key from key_resume()
+ * @param send_base: uint32_t, counter of the last frame sent to the AP
+ * @param recv_base: uint32_t, counter of the last frame accepted from the AP
+ * @param epoch: uint32_t, key epoch the AP sends under
+ * 
+ * @return int: SUCCESS_RETURN if success, ERROR_RETURN if error
+ * The AP picks both bases past every frame sent under the key before the
+ * reset, so no frame nonce repeats
+*/
+int board_link_resume(uint8_t* key, uint32_t send_base, uint32_t recv_base, uint32_t epoch);
+
+/**
+ * @brief Drop the expanded key
+ * 
+ * Call whenever the key changes
+*/
+void board_link_clear_key(void);
+
 /**
  * @brief Convert 4-byte component ID to I2C address
  * 
@@ -53,7 +171,17 @@ i2c_addr_t component_id_to_i2c_addr(uint32_t component_id);
  * send a packet to the AP and wait for the message to be received
 */
 void send_packet_and_ack(uint8_t len, uint8_t* packet);
-void secure_send_packet_and_ack(uint8_t* packet, uint8_t* GLOBAL_KEY);
+
+/**
+ * @brief Encrypt a length-framed packet, send it to the AP and wait for ACK
+ * 
+ * @param packet: uint8_t*, plaintext payload to be sent
+ * @param len: uint8_t, payload length, at most MAX_FRAME_PAYLOAD
+ * @param GLOBAL_KEY: uint8_t*, 16 byte global key
+ * 
+ * @return int: SUCCESS_RETURN if sent, ERROR_RETURN on a bad length
+*/
+int secure_send_packet_and_ack(uint8_t* packet, uint8_t len, uint8_t* GLOBAL_KEY);
 /**
  * @brief Wait for a new message from AP and process the message
  * 
@@ -65,6 +193,17 @@ void secure_send_packet_and_ack(uint8_t* packet, uint8_t* GLOBAL_KEY);
  * once the message is available it is returned in the buffer pointer to by packet 
 */
 uint8_t wait_and_receive_packet(uint8_t* packet);
+
+/**
+ * @brief Wait for a length-framed packet from the AP and decrypt it
+ * 
+ * @param packet: uint8_t*, MAX_I2C_MESSAGE_LEN buffer for the payload
+ * @param GLOBAL_KEY: uint8_t*, 16 byte global key
+ * 
+ * @return uint8_t: payload length, KEY_SYNC_REQUEST or KEY_RESUME_REQUEST
+ * for the plaintext requests and 0 for a malformed frame. A resume request
+ * is copied to packet as it arrived
+*/
 uint8_t secure_wait_and_receive_packet(uint8_t* packet, uint8_t* GLOBAL_KEY);
 int timed_wait_and_receive_packet(uint8_t* packet);
 int secure_timed_wait_and_receive_packet(uint8_t* packet, uint8_t* GLOBAL_KEY);
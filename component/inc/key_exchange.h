@@ -1,10 +1,79 @@
 #ifndef KEY_EXCHANGE
 #define KEY_EXCHANGE
+#include "board_link.h"
 #include "key.h"
+
+// Length of KEY_SHARE, the masks and the synced key
+#define KEY_SHARE_LEN 16
+
+// Messages of the exchange after the trigger, same values as on the AP
+#if KEY_SYNC_X25519
+// Public keys both ways, then the key and its tag
+#define KEY_SHARE_REQUEST_LEN X25519_KEY_SIZE
+#define KEY_SHARE_REPLY_LEN X25519_KEY_SIZE
+#define KEY_SHARE_FINAL_LEN (KEY_SHARE_LEN + TAG_SIZE)
+#else
+// [r ^ k2][0]['1' or '2'], then k ^ MASK back and the final XOR share
+#define KEY_SHARE_REQUEST_LEN 18
+#define KEY_SHARE_REPLY_LEN KEY_SHARE_LEN
+#define KEY_SHARE_FINAL_LEN KEY_SHARE_LEN
+#endif
+
+// Session resumption, see key_resume(). Same values as on the AP, the
+// request is in board_link.h
+
+// Component nonce and its tag under the ticket
+#define RESUME_PROOF_LEN (RESUME_NONCE_LEN + TAG_SIZE)
+// Key, both counter bases, the key epoch and zero padding encrypted under
+// the resumption key, then the tag
+#define RESUME_GRANT_BODY_LEN (KEY_SHARE_LEN + BLOCK_SIZE)
+#define RESUME_GRANT_LEN (RESUME_GRANT_BODY_LEN + TAG_SIZE)
+
+#if !KEY_SYNC_X25519
 uint8_t sync2(char* dest, char* k2_m1);
 
 void sync1(char* dest, char* k2_m1);
+#endif
 
+/**
+ * @brief Answer the AP's key exchange after its DEAD trigger
+ * 
+ * @param dest: char*, 16 byte key output
+ * 
+ * @return uint8_t: length of the last message on success, (uint8_t)-1
+ * otherwise
+*/
 uint8_t key_sync(char* dest);
 
-#endif
\ No newline at end of file
+/**
+ * @brief Load the resumption ticket saved by the last key sync
+ * 
+ * Call once at boot, after flash_simple_init()
+*/
+void ticket_load(void);
+
+/**
+ * @brief Save the resumption ticket of a freshly synced key
+ * 
+ * @param key: uint8_t*, 16 byte synced key
+ * @param component_id: uint32_t, this component's ID
+ * 
+ * @return int: 0 once the ticket is in flash, -1 if the erase or the write
+ * failed. A reset then needs a full key sync
+ *
+ * The flash page is only erased and written when the ticket changed
+*/
+int ticket_store(uint8_t* key, uint32_t component_id);
+
+/**
+ * @brief Get the synced key back from the AP with the saved ticket
+ * 
+ * @param dest: uint8_t*, 16 byte key output
+ * @param request: uint8_t*, RESUME_REQUEST_LEN request from the AP
+ * @param component_id: uint32_t, this component's ID
+ * 
+ * @return int: 0 once the key and counters are restored, -1 otherwise
+*/
+int key_resume(uint8_t* dest, uint8_t* request, uint32_t component_id);
+
+#endif
@@ -0,0 +1,65 @@
+/**
+ * @file "packet_pool.h"
+ * @brief Static Packet Buffer Pool Header
+ * @date 2024
+ *
+ * Fixed set of buffers for whole I2C packets, so no function needs a
+ * packet-sized array on the stack. Whoever allocates a buffer owns it until
+ * packet_free(). Functions that are handed a buffer only borrow it, unless
+ * their description says it is consumed. Not for use from interrupts.
+ */
+
+#ifndef __PACKET_POOL__
+#define __PACKET_POOL__
+
+#include <stdint.h>
+
+#include "simple_i2c_peripheral.h"
+
+/******************************** MACRO DEFINITIONS ********************************/
+// Same size as on the AP: a full BURST read, [status][len] and the largest
+// register contents
+#define PACKET_BUF_LEN (BURST_READ_HEADER_LEN + MAX_I2C_MESSAGE_LEN)
+// Deepest nesting is a post-boot message held across its handshake and
+// stream acknowledgements
+#define PACKET_POOL_SIZE 4
+
+/******************************** TYPE DEFINITIONS ********************************/
+typedef struct {
+    uint8_t data[PACKET_BUF_LEN];
+} packet_buf_t;
+
+// Pool usage, to size PACKET_POOL_SIZE
+typedef struct {
+    uint32_t allocs;     // Buffers handed out
+    uint32_t failures;   // Allocations with every buffer in use
+    uint8_t in_use;      // Buffers currently owned
+    uint8_t high_water;  // Most buffers owned at once
+} packet_pool_stats_t;
+
+/******************************** FUNCTION PROTOTYPES ********************************/
+/**
+ * @brief Take a buffer from the pool
+ * 
+ * @return packet_buf_t*: zeroed buffer owned by the caller, NULL if the
+ * pool is exhausted
+*/
+packet_buf_t* packet_alloc(void);
+
+/**
+ * @brief Return a buffer to the pool
+ * 
+ * @param buf: packet_buf_t*, buffer from packet_alloc(), NULL is ignored
+ * 
+ * The buffer is wiped so no plaintext outlives its owner
+*/
+void packet_free(packet_buf_t* buf);
+
+/**
+ * @brief Get the pool usage
+ * 
+ * @return const packet_pool_stats_t*: allocation counts and high water mark
+*/
+const packet_pool_stats_t* get_packet_pool_stats(void);
+
+#endif
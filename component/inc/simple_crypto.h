@@ -15,13 +15,35 @@
 #ifndef ECTF_CRYPTO_H
 #define ECTF_CRYPTO_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "wolfssl/wolfcrypt/aes.h"
 #include "wolfssl/wolfcrypt/hash.h"
+#include "wolfssl/wolfcrypt/poly1305.h"
+#ifdef HAVE_CURVE25519
+#include "wolfssl/wolfcrypt/curve25519.h"
+#endif
 
 /******************************** MACRO DEFINITIONS ********************************/
 #define BLOCK_SIZE AES_BLOCK_SIZE
 #define KEY_SIZE 16
 #define HASH_SIZE MD5_DIGEST_SIZE
+// Frame tags: truncated Poly1305 under a one-time key derived from a nonce
+#define NONCE_SIZE 12
+#define TAG_SIZE 8
+#ifdef HAVE_CURVE25519
+// X25519 private keys, public keys and shared secrets
+#define X25519_KEY_SIZE CURVE25519_KEYSIZE
+#endif
+
+/******************************** TYPE DEFINITIONS ********************************/
+// Key schedules expanded once and reused for every packet under that key
+typedef struct {
+    Aes enc;
+    Aes dec;
+    bool valid;
+} crypto_session_t;
 
 /******************************** FUNCTION PROTOTYPES ********************************/
 /** @brief Encrypts plaintext using a symmetric cipher
@@ -54,6 +76,109 @@ int encrypt_sym(uint8_t *plaintext, size_t len, uint8_t *key, uint8_t *ciphertex
  */
 int decrypt_sym(uint8_t *ciphertext, size_t len, uint8_t *key, uint8_t *plaintext);
 
+/** @brief Expands a key into a crypto session
+ *
+ * @param session The session to set up
+ * @param key A pointer to a buffer of length KEY_SIZE (16 bytes) containing
+ *           the key, it is not referenced after the call
+ *
+ * @return 0 on success, non-zero for error, the session is left invalid
+ */
+int crypto_session_init(crypto_session_t *session, uint8_t *key);
+
+/** @brief Wipes the key schedules of a crypto session
+ *
+ * @param session The session to invalidate, call on every rekey
+ */
+void crypto_session_invalidate(crypto_session_t *session);
+
+/** @brief Encrypts plaintext with the schedule of a crypto session
+ *
+ * Same as encrypt_sym without the per-call key expansion
+ *
+ * @return 0 on success, -1 on bad length or invalid session, other non-zero
+ *           for other error
+ */
+int encrypt_session(crypto_session_t *session, uint8_t *plaintext, size_t len, uint8_t *ciphertext);
+
+/** @brief Decrypts ciphertext with the schedule of a crypto session
+ *
+ * Same as decrypt_sym without the per-call key expansion
+ *
+ * @return 0 on success, -1 on bad length or invalid session, other non-zero
+ *           for other error
+ */
+int decrypt_session(crypto_session_t *session, uint8_t *ciphertext, size_t len, uint8_t *plaintext);
+
+/** @brief Computes a tag over aad || data
+ *
+ * The one-time Poly1305 key is AES(nonce || 0) || AES(nonce || 1). A nonce
+ * must never repeat under the same key
+ *
+ * @param nonce A pointer to a buffer of length NONCE_SIZE (12 bytes)
+ * @param aad A pointer to aad_len bytes authenticated in front of data
+ * @param aad_len The length of aad, may be 0
+ * @param data A pointer to a buffer of length len, usually ciphertext
+ * @param len The length of data
+ * @param key A pointer to a buffer of length KEY_SIZE (16 bytes)
+ * @param tag A pointer to a buffer of length TAG_SIZE (8 bytes) where the
+ *           tag will be written to
+ *
+ * @return 0 on success, non-zero for error
+ */
+int tag_sym(uint8_t *nonce, uint8_t *aad, size_t aad_len, uint8_t *data, size_t len,
+            uint8_t *key, uint8_t *tag);
+
+/** @brief Computes a tag with the schedule of a crypto session
+ *
+ * Same as tag_sym without the per-call key expansion
+ *
+ * @return 0 on success, -1 on invalid session, other non-zero for error
+ */
+int tag_session(crypto_session_t *session, uint8_t *nonce, uint8_t *aad, size_t aad_len,
+                uint8_t *data, size_t len, uint8_t *tag);
+
+/** @brief Compares two tags in constant time
+ *
+ * @return true if all TAG_SIZE bytes match
+ */
+bool tag_equal(const uint8_t *a, const uint8_t *b);
+
+#ifdef HAVE_CURVE25519
+/** @brief Computes the X25519 public key of a private key
+ *
+ * @param private_key A pointer to a buffer of length X25519_KEY_SIZE (32 bytes)
+ *          of random bytes, clamped in place
+ * @param public_key A pointer to a buffer of length X25519_KEY_SIZE where the
+ *          public key will be written to
+ *
+ * @return 0 on success, non-zero for error
+ */
+int x25519_make_public(uint8_t *private_key, uint8_t *public_key);
+
+/** @brief Computes the X25519 shared secret with a peer's public key
+ *
+ * @param private_key A pointer to a buffer of length X25519_KEY_SIZE (32 bytes)
+ *          clamped by x25519_make_public
+ * @param peer_key A pointer to a buffer of length X25519_KEY_SIZE containing
+ *          the peer's public key
+ * @param shared A pointer to a buffer of length X25519_KEY_SIZE where the
+ *          shared secret will be written to
+ *
+ * @return 0 on success, -1 if the peer key is a low order point, other
+ *          non-zero for error
+ */
+int x25519_shared(uint8_t *private_key, uint8_t *peer_key, uint8_t *shared);
+#endif
+
+/** @brief Known-answer test of the AES backend, and of X25519 when built
+ *
+ * Run once at startup, before the first key is used
+ *
+ * @return 0 on success, -1 on a wrong answer
+ */
+int crypto_self_test(void);
+
 /** @brief Hashes arbitrary-length data
  *
  * @param data A pointer to a buffer of length len containing the data
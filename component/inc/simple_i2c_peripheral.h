@@ -25,16 +25,18 @@
 #include "i2c.h"
 
 /******************************** MACRO DEFINITIONS ********************************/
-#define I2C_FREQ 100000
+// Highest speed the AP may negotiate, the controller drives SCL so slower
+// speeds are followed automatically
+#define I2C_FREQ 1000000
 #define I2C_INTERFACE MXC_I2C1
-#define MAX_REG TRANSMIT_LEN
+#define MAX_REG IDENTITY
+#define NUM_I2C_REGS (MAX_REG + 1)
 #define MAX_I2C_MESSAGE_LEN 256
-
-/******************************** EXTERN DEFINITIONS ********************************/
-// Extern definition to make I2C_REGS and I2C_REGS_LEN 
-// accessible outside of the implementation
-extern volatile uint8_t* I2C_REGS[6];
-extern int I2C_REGS_LEN[6];
+// BURST header bytes: [len] on writes, [status][len] on reads
+#define BURST_WRITE_HEADER_LEN 1
+#define BURST_READ_HEADER_LEN 2
+// IDENTITY register: component ID, big endian
+#define IDENTITY_LEN 4
 
 /******************************** TYPE DEFINITIONS ********************************/
 // Enumeration with registers on the peripheral device
@@ -45,10 +47,23 @@ typedef enum {
     TRANSMIT,
     TRANSMIT_DONE,
     TRANSMIT_LEN,
+    BURST, // Write: [len][data], sets RECEIVE_DONE. Read: [status][len][data]
+    IDENTITY, // Read only: component ID
 } ECTF_I2C_REGS;
 
+// TRANSMIT_DONE register values
+#define TRANSMIT_READY 0 // A response is waiting to be read
+#define TRANSMIT_IDLE 1  // No response pending and no request being processed
+#define TRANSMIT_BUSY 2  // A request arrived and its response is being prepared
+
 typedef uint8_t i2c_addr_t;
 
+/******************************** EXTERN DEFINITIONS ********************************/
+// Extern definition to make I2C_REGS and I2C_REGS_LEN 
+// accessible outside of the implementation
+extern volatile uint8_t* I2C_REGS[NUM_I2C_REGS];
+extern int I2C_REGS_LEN[NUM_I2C_REGS];
+
 /******************************** FUNCTION PROTOTYPES ********************************/
 /**
  * @brief Initialize the I2C Connection
@@ -62,4 +77,44 @@ typedef uint8_t i2c_addr_t;
 */
 int i2c_simple_peripheral_init(i2c_addr_t addr);
 
+/**
+ * @brief Set the value of the IDENTITY register
+ * 
+ * @param component_id: uint32_t, ID returned to the controller
+*/
+void i2c_simple_set_identity(uint32_t component_id);
+
+/**
+ * @brief Claim the oldest complete request
+ * 
+ * @param len: uint8_t*, set to the request length
+ * 
+ * @return uint8_t*: request data, NULL if no request is waiting
+ *
+ * The request is used in place. The bank belongs to the component until
+ * i2c_simple_receive_release(), requests arriving meanwhile land in the
+ * other bank
+*/
+uint8_t* i2c_simple_receive_claim(uint8_t* len);
+
+/**
+ * @brief Get the cycle count at which the last request completed
+ * 
+ * @return uint32_t: DWT->CYCCNT sampled by the ISR on STOP
+*/
+uint32_t i2c_simple_request_stamp(void);
+
+/**
+ * @brief Return the claimed bank for new requests
+*/
+void i2c_simple_receive_release(void);
+
+/**
+ * @brief Get the TRANSMIT register to build a response in place
+ * 
+ * @return uint8_t*: MAX_I2C_MESSAGE_LEN bytes, only valid to write while
+ * TRANSMIT_DONE is not TRANSMIT_READY
+*/
+uint8_t* i2c_simple_transmit_buffer(void);
+
 #endif
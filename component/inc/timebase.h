@@ -0,0 +1,105 @@
+/**
+ * @file "timebase.h"
+ * @brief Monotonic Timebase and Deadline Header
+ * @date 2024
+ *
+ * Free running 32-bit timer on the APB clock, extended to 64 bits in
+ * software. SysTick is left alone since MXC_Delay() owns it.
+ */
+
+#ifndef __TIMEBASE__
+#define __TIMEBASE__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "tmr.h"
+
+/******************************** MACRO DEFINITIONS ********************************/
+// Timer reserved for the timebase
+#define TIMEBASE_TMR MXC_TMR1
+
+/******************************** TYPE DEFINITIONS ********************************/
+// Absolute point in time in timer ticks
+typedef uint64_t deadline_t;
+
+// How close finished waits came to their deadlines, in microseconds
+typedef struct {
+    uint32_t waits;     // Waits that finished before their deadline
+    uint32_t expired;   // Waits that ran out of time
+    uint32_t min_slack; // Least time left when a wait finished
+    uint32_t max_slack; // Most time left when a wait finished
+} deadline_stats_t;
+
+/******************************** FUNCTION PROTOTYPES ********************************/
+/**
+ * @brief Start the timebase
+ * 
+ * Must run before any deadline is created
+*/
+void timebase_init(void);
+
+/**
+ * @brief Get the current time
+ * 
+ * @return uint64_t: microseconds since timebase_init()
+ *
+ * The hardware counter wraps every 2^32 APB cycles, about 85 s at 50 MHz,
+ * and wraps are caught on read, so the time must be read at least that often
+*/
+uint64_t timebase_now_us(void);
+
+/**
+ * @brief Create a deadline relative to now
+ * 
+ * @param us: uint32_t, microseconds from now
+ * 
+ * @return deadline_t: the deadline
+*/
+deadline_t deadline_in_us(uint32_t us);
+
+/**
+ * @brief Check a deadline
+ * 
+ * @param deadline: deadline_t, deadline to check
+ * 
+ * @return bool: true once the deadline has passed
+*/
+bool deadline_expired(deadline_t deadline);
+
+/**
+ * @brief Get the time left before a deadline
+ * 
+ * @param deadline: deadline_t, deadline to check
+ * 
+ * @return uint32_t: microseconds left, 0 once expired
+*/
+uint32_t deadline_remaining_us(deadline_t deadline);
+
+/**
+ * @brief Spin until a deadline passes
+ * 
+ * @param deadline: deadline_t, deadline to wait for
+*/
+void wait_until(deadline_t deadline);
+
+/**
+ * @brief Record how a wait on a deadline ended
+ * 
+ * @param deadline: deadline_t, deadline of the wait
+ * 
+ * Call when the awaited event happened, or with an expired deadline when
+ * it did not. The slack left feeds the deadline statistics
+*/
+void deadline_finish(deadline_t deadline);
+
+/**
+ * @brief Get the deadline statistics
+ * 
+ * @return const deadline_stats_t*: slack of every finished wait
+ *
+ * A timeout can safely shrink by about min_slack
+*/
+const deadline_stats_t* get_deadline_stats(void);
+
+#endif
@@ -41,3 +41,22 @@ ENTRY=firmware_startup
 
 # Enable Crypto Example
 CRYPTO_EXAMPLE=1
+
+# ****************** Thumb2 AES *******************
+# Set to 1 to build wolfSSL's Cortex-M thumb2 assembly for AES (and the
+# SHA-256/512 and Curve25519 code that WOLFSSL_ARMASM also routes to asm).
+# Requires CRYPTO_EXAMPLE=1, crypto_self_test() checks it at boot.
+# KEY_SYNC_X25519=1 builds it as well
+CRYPTO_THUMB2_AES=0
+
+# ****************** X25519 Key Sync *******************
+# Set to 1 to agree on the synced key with X25519 instead of the XOR mask
+# exchange. Must match on the AP and every component. Requires
+# CRYPTO_EXAMPLE=1. Builds the thumb2 assembly as CRYPTO_THUMB2_AES=1 does,
+# so the scalar multiplications run on thumb2-curve25519_c.c
+KEY_SYNC_X25519=0
+
+# ****************** Stack Usage *******************
+# Set to 1 to emit per-function stack usage and call graphs, then run
+# ectf_stack_report on the build directory for worst-case stack depths
+STACK_USAGE=0
@@ -15,6 +15,20 @@
 #include <stdio.h>
 
 #include "board_link.h"
+#include "timebase.h"
+
+// Sleep and wake-up statistics
+static wake_stats_t wake_stats;
+// Key schedules of the current and the next key epoch
+static key_epochs_t link_epochs;
+// Secure frame statistics
+static frame_stats_t frame_stats;
+// Own address, part of every frame nonce
+static i2c_addr_t link_address;
+// Counter of the last frame sent and of the last frame accepted, both
+// restart with every key
+static uint32_t send_counter;
+static uint32_t recv_counter;
 
 /**
  * @brief Initialize the board link interface
@@ -26,9 +40,181 @@
  * Initialized the underlying i2c_simple interface
 */
 int board_link_init(i2c_addr_t addr) {
+    // Cycle counter for wake-up latency
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    link_address = addr;
     return i2c_simple_peripheral_init(addr);
 }
 
+/**
+ * @brief Expand the synced key once for all secure packets
+ *
+ * @param key: uint8_t*, 16 byte key, the caller keeps passing the same key
+ * to the secure packet functions
+ *
+ * @return int: SUCCESS_RETURN if success, ERROR_RETURN if error
+ */
+int board_link_set_key(uint8_t* key) {
+    send_counter = 0;
+    recv_counter = 0;
+    if (key_epochs_init(&link_epochs, key, 0) != 0) {
+        return ERROR_RETURN;
+    }
+    return SUCCESS_RETURN;
+}
+
+/**
+ * @brief Expand a resumed key and continue its frame counters
+ *
+ * @param key: uint8_t*, 16 byte key from key_resume()
+ * @param send_base: uint32_t, counter of the last frame sent to the AP
+ * @param recv_base: uint32_t, counter of the last frame accepted from the AP
+ * @param epoch: uint32_t, key epoch the AP sends under
+ *
+ * @return int: SUCCESS_RETURN if success, ERROR_RETURN if error
+ */
+int board_link_resume(uint8_t* key, uint32_t send_base, uint32_t recv_base, uint32_t epoch) {
+    if (key_epochs_init(&link_epochs, key, epoch) != 0) {
+        return ERROR_RETURN;
+    }
+    send_counter = send_base;
+    recv_counter = recv_base;
+    return SUCCESS_RETURN;
+}
+
+/**
+ * @brief Drop the expanded key, packets fall back to per-call expansion
+ */
+void board_link_clear_key(void) {
+    send_counter = 0;
+    recv_counter = 0;
+    key_epochs_clear(&link_epochs);
+}
+
+/**
+ * @brief Encrypt with the epoch's expanded key, or key before there is one
+ */
+static int link_encrypt(crypto_session_t* session, uint8_t* plaintext, size_t len, uint8_t* key,
+                        uint8_t* ciphertext) {
+    if (session != NULL) {
+        return encrypt_session(session, plaintext, len, ciphertext);
+    }
+    return encrypt_sym(plaintext, len, key, ciphertext);
+}
+
+/**
+ * @brief Decrypt with the epoch's expanded key, or key before there is one
+ */
+static int link_decrypt(crypto_session_t* session, uint8_t* ciphertext, size_t len, uint8_t* key,
+                        uint8_t* plaintext) {
+    if (session != NULL) {
+        return decrypt_session(session, ciphertext, len, plaintext);
+    }
+    return decrypt_sym(ciphertext, len, key, plaintext);
+}
+
+/**
+ * @brief Build the nonce of a frame
+ * 
+ * @param nonce: uint8_t*, NONCE_SIZE buffer
+ * @param direction: uint8_t, FRAME_TO_COMPONENT or FRAME_TO_AP
+ * @param frame: uint8_t*, frame with its counter filled in
+ * 
+ * All components share the key, the address keeps their counters apart
+*/
+static void frame_nonce(uint8_t* nonce, uint8_t direction, uint8_t* frame) {
+    memset(nonce, 0, NONCE_SIZE);
+    nonce[0] = link_address;
+    nonce[1] = direction;
+    memcpy(&nonce[2], &frame[FRAME_COUNTER_OFFSET], FRAME_COUNTER_LEN);
+}
+
+/**
+ * @brief Tag the header and ciphertext of a frame
+ * 
+ * @param session: crypto_session_t*, schedule of the frame's epoch, NULL
+ * before there is one
+ * @param nonce: uint8_t*, nonce from frame_nonce()
+ * @param frame: uint8_t*, frame with length, epoch, counter and ciphertext
+ * @param padded: int, ciphertext length
+ * @param key: uint8_t*, used when no key is expanded
+ * @param tag: uint8_t*, TAG_SIZE output
+ * 
+ * @return int: zero on success
+*/
+static int link_tag(crypto_session_t* session, uint8_t* nonce, uint8_t* frame, int padded,
+                    uint8_t* key, uint8_t* tag) {
+    if (session != NULL) {
+        return tag_session(session, nonce, frame, FRAME_TAG_OFFSET,
+                           &frame[FRAME_HEADER_LEN], padded, tag);
+    }
+    return tag_sym(nonce, frame, FRAME_TAG_OFFSET, &frame[FRAME_HEADER_LEN], padded, key, tag);
+}
+
+/**
+ * @brief Count a rejected frame
+ * 
+ * @param reason: uint32_t*, frame_stats counter to bump
+ * @param blocks: int, ciphertext blocks that were not decrypted
+ * @param start: uint32_t, DWT->CYCCNT when the frame was claimed
+*/
+static void frame_rejected(uint32_t* reason, int blocks, uint32_t start) {
+    (*reason)++;
+    frame_stats.rejected_blocks += blocks;
+    frame_stats.reject_cycles += DWT->CYCCNT - start;
+}
+
+/**
+ * @brief Get the secure frame statistics
+ * 
+ * @return const frame_stats_t*: accepted and rejected frame counts
+*/
+const frame_stats_t* get_frame_stats(void) {
+    return &frame_stats;
+}
+
+/**
+ * @brief Estimate the cycles saved by rejecting frames before decryption
+ * 
+ * @return int64_t: decryption cost of the rejected blocks at the measured
+ * rate minus the time spent rejecting them, 0 until a frame was decrypted
+*/
+int64_t frame_cycles_saved(void) {
+    if (frame_stats.decrypted_blocks == 0) {
+        return 0;
+    }
+    uint64_t per_block = frame_stats.decrypt_cycles / frame_stats.decrypted_blocks;
+    return (int64_t)(per_block * frame_stats.rejected_blocks) -
+           (int64_t)frame_stats.reject_cycles;
+}
+
+/**
+ * @brief Get the sleep and wake-up statistics
+ * 
+ * @return const wake_stats_t*: statistics gathered while waiting on the AP
+*/
+const wake_stats_t* get_wake_stats(void) {
+    return &wake_stats;
+}
+
+/**
+ * @brief Sleep until the next interrupt, called with interrupts disabled
+ * 
+ * WFI still wakes on an interrupt that is pending while PRIMASK is set, so
+ * checking the wait condition with interrupts off and sleeping here cannot
+ * miss the STOP that satisfies it. The ISR runs before this returns
+*/
+static void sleep_until_interrupt(void) {
+    uint32_t start = DWT->CYCCNT;
+    __WFI();
+    wake_stats.sleep_cycles += DWT->CYCCNT - start;
+    __enable_irq();
+    __disable_irq();
+}
+
 /**
  * @brief Convert 4-byte component ID to I2C address
  * 
@@ -40,6 +226,40 @@ i2c_addr_t component_id_to_i2c_addr(uint32_t component_id) {
     return (uint8_t) component_id & COMPONENT_ADDR_MASK;
 }
 
+/**
+ * @brief Drop a stale TRANSMIT_BUSY status
+ * 
+ * The previous request was handled without a response. Go back to
+ * TRANSMIT_IDLE unless another request has already landed, so the AP
+ * stops waiting for a reply that will never come
+*/
+static void release_busy(void) {
+    __disable_irq();
+    if (!I2C_REGS[RECEIVE_DONE][0] && I2C_REGS[TRANSMIT_DONE][0] == TRANSMIT_BUSY) {
+        I2C_REGS[TRANSMIT_DONE][0] = TRANSMIT_IDLE;
+    }
+    __enable_irq();
+}
+
+/**
+ * @brief Publish the response already in the TRANSMIT register and wait for ACK
+ * 
+ * @param len: uint8_t, length of the response
+*/
+static void publish_and_ack(uint8_t len) {
+    I2C_REGS[TRANSMIT_LEN][0] = len;
+    I2C_REGS[TRANSMIT_DONE][0] = TRANSMIT_READY;
+
+    // Wait for ack from AP, either a complete BURST read or a TRANSMIT_DONE write
+    uint32_t start = DWT->CYCCNT;
+    __disable_irq();
+    while(I2C_REGS[TRANSMIT_DONE][0] == TRANSMIT_READY) {
+        sleep_until_interrupt();
+    }
+    __enable_irq();
+    wake_stats.wait_cycles += DWT->CYCCNT - start;
+}
+
 /**
  * @brief Send a packet to the AP and wait for ACK
  * 
@@ -49,13 +269,45 @@ i2c_addr_t component_id_to_i2c_addr(uint32_t component_id) {
  * send a packet to the AP and wait for the message to be received
 */
 void send_packet_and_ack(uint8_t len, uint8_t* packet) {
-    I2C_REGS[TRANSMIT_LEN][0] = len;
     memcpy((void*)I2C_REGS[TRANSMIT], (void*)packet, len);
-    I2C_REGS[TRANSMIT_DONE][0] = false;
+    publish_and_ack(len);
+}
 
-    // Wait for ack from AP
-    while(!I2C_REGS[TRANSMIT_DONE][0]);
-    I2C_REGS[RECEIVE_DONE][0] = false;
+/**
+ * @brief Wait for a new message from AP and claim it in place
+ * 
+ * @param len: uint8_t*, set to the message length
+ * 
+ * @return uint8_t*: the message, owned until i2c_simple_receive_release()
+*/
+static uint8_t* wait_and_claim_packet(uint8_t* len) {
+    uint8_t* request;
+    bool slept = false;
+    release_busy();
+
+    uint32_t start = DWT->CYCCNT;
+    __disable_irq();
+    while ((request = i2c_simple_receive_claim(len)) == NULL) {
+        sleep_until_interrupt();
+        slept = true;
+    }
+    __enable_irq();
+    uint32_t now = DWT->CYCCNT;
+    wake_stats.wait_cycles += now - start;
+
+    if (slept) {
+        // Time from the request STOP until this loop picked it up
+        uint32_t latency = now - i2c_simple_request_stamp();
+        wake_stats.wakeups++;
+        wake_stats.last_latency = latency;
+        if (latency > wake_stats.max_latency) {
+            wake_stats.max_latency = latency;
+        }
+        if (latency > WAKE_LATENCY_BUDGET_US * (SystemCoreClock / 1000000)) {
+            wake_stats.late++;
+        }
+    }
+    return request;
 }
 
 /**
@@ -67,51 +319,165 @@ void send_packet_and_ack(uint8_t len, uint8_t* packet) {
  * once the message is available it is returned in the buffer pointer to by packet 
 */
 uint8_t wait_and_receive_packet(uint8_t* packet) {
-    while(!I2C_REGS[RECEIVE_DONE][0]);
-
-    uint8_t len = I2C_REGS[RECEIVE_LEN][0];
-    memcpy(packet, (void*)I2C_REGS[RECEIVE], len);
-
-    I2C_REGS[RECEIVE_DONE][0] = false;
+    uint8_t len;
+    uint8_t* request = wait_and_claim_packet(&len);
+    memcpy(packet, request, len);
+    i2c_simple_receive_release();
     return len;
 }
 
+/**
+ * @brief Claim the next message from the AP within TIMED_RECEIVE_TIMEOUT_US
+ * 
+ * @param len: uint8_t*, set to the message length
+ * 
+ * @return uint8_t*: the message, NULL if the deadline passed first
+ *
+ * Spins rather than sleeping since nothing would wake the core at the deadline
+*/
+static uint8_t* timed_claim_packet(uint8_t* len) {
+    deadline_t timeout = deadline_in_us(TIMED_RECEIVE_TIMEOUT_US);
+    release_busy();
+    while (!deadline_expired(timeout)) {
+        uint8_t* request = i2c_simple_receive_claim(len);
+        if (request != NULL) {
+            deadline_finish(timeout);
+            return request;
+        }
+    }
+    deadline_finish(timeout);
+    return NULL;
+}
+
 // This different from the function above for adding timer to it.
 // Waiting that has passed 0.3 seconds will stop to prevent replay attack
 // QUESTIONS: will the I2C_REGS be refreshed everytime we calls this function so we will get the new message? We don't want the old queue message be read and procceed.
 int timed_wait_and_receive_packet(uint8_t* packet) {
-    // while(!I2C_REGS[RECEIVE_DONE][0])
-    // Change the waiting for signal loop
-    for(int i = 0; i < 3000000; ++i){
-        if(!I2C_REGS[RECEIVE_DONE][0]){
-            continue;
-        }
-        else{
-            uint8_t len = I2C_REGS[RECEIVE_LEN][0];
-            memcpy(packet, (void*)I2C_REGS[RECEIVE], len);
-            return (int)len;
-        }
+    uint8_t len;
+    uint8_t* request = timed_claim_packet(&len);
+    if (request == NULL) {
+        return -1;
     }
-
-    return -1;
+    memcpy(packet, request, len);
+    i2c_simple_receive_release();
+    return (int)len;
 }
 
 
 /**
- * @brief Send a encryped packet to the AP and wait for ACK
+ * @brief Send a encryped and tagged length-framed packet to the AP and wait for ACK
  * 
- * @param len: uint8_t, length of the packet
  * @param packet: uint8_t*, message to be sent
+ * @param len: uint8_t, payload length, at most MAX_FRAME_PAYLOAD
  * @param GLOBAL_KEY: 16 byte globel key
  * This function utilizes the simple_i2c_peripheral library to
  * send a packet to the AP and wait for the message to be received
 */
-void secure_send_packet_and_ack(uint8_t* packet, uint8_t* GLOBAL_KEY) {
-    uint8_t ciphertext[MAX_I2C_MESSAGE_LEN];
-    encrypt_sym(packet, MAX_I2C_MESSAGE_LEN, GLOBAL_KEY, ciphertext);
-    send_packet_and_ack(MAX_I2C_MESSAGE_LEN-1, ciphertext);
+int secure_send_packet_and_ack(uint8_t* packet, uint8_t len, uint8_t* GLOBAL_KEY) {
+    if (len == 0 || len > MAX_FRAME_PAYLOAD) {
+        return ERROR_RETURN;
+    }
+    // The frame is built and encrypted directly in the TRANSMIT register
+    uint8_t* frame = i2c_simple_transmit_buffer();
+    // Round up to the next block and zero the padding
+    uint8_t padded = (len + BLOCK_SIZE - 1) & ~(BLOCK_SIZE - 1);
+    uint32_t counter = ++send_counter;
+    crypto_session_t* session = key_epochs_send(&link_epochs);
+    frame[0] = len;
+    frame[FRAME_EPOCH_OFFSET] = link_epochs.epoch;
+    frame[FRAME_COUNTER_OFFSET] = counter >> 24;
+    frame[FRAME_COUNTER_OFFSET + 1] = counter >> 16;
+    frame[FRAME_COUNTER_OFFSET + 2] = counter >> 8;
+    frame[FRAME_COUNTER_OFFSET + 3] = counter;
+    memcpy(&frame[FRAME_HEADER_LEN], packet, len);
+    memset(&frame[FRAME_HEADER_LEN + len], 0, padded - len);
+
+    uint8_t nonce[NONCE_SIZE];
+    frame_nonce(nonce, FRAME_TO_AP, frame);
+    link_encrypt(session, &frame[FRAME_HEADER_LEN], padded, GLOBAL_KEY, &frame[FRAME_HEADER_LEN]);
+    link_tag(session, nonce, frame, padded, GLOBAL_KEY, &frame[FRAME_TAG_OFFSET]);
+    publish_and_ack(FRAME_HEADER_LEN + padded);
+    return SUCCESS_RETURN;
 }
 
+/**
+ * @brief Check, verify and decrypt a received frame
+ * 
+ * @param frame: uint8_t*, raw frame as it arrived over I2C
+ * @param len: int, number of bytes received
+ * @param packet: uint8_t*, MAX_I2C_MESSAGE_LEN buffer for the payload
+ * @param GLOBAL_KEY: 16 byte globel key
+ * 
+ * @return int: payload length, ERROR_RETURN for a malformed, replayed or
+ * forged frame
+ *
+ * Length, counter and tag are all checked before anything is decrypted,
+ * so junk on the bus costs two AES blocks and a Poly1305 pass at most
+*/
+static int open_frame(uint8_t* frame, int len, uint8_t* packet, uint8_t* GLOBAL_KEY) {
+    uint32_t start = DWT->CYCCNT;
+
+    // Reject anything that is not a whole number of blocks or claims
+    // more payload than was actually transferred
+    int padded = len - FRAME_HEADER_LEN;
+    uint8_t payload = frame[0];
+    if (padded < BLOCK_SIZE || padded > MAX_FRAME_PAYLOAD ||
+        padded % BLOCK_SIZE || payload == 0 || payload > padded) {
+        frame_rejected(&frame_stats.bad_header, 0, start);
+        return ERROR_RETURN;
+    }
+
+    // A replayed or reordered frame is dropped before any crypto
+    uint32_t counter = (uint32_t)frame[FRAME_COUNTER_OFFSET] << 24 |
+                       (uint32_t)frame[FRAME_COUNTER_OFFSET + 1] << 16 |
+                       (uint32_t)frame[FRAME_COUNTER_OFFSET + 2] << 8 |
+                       frame[FRAME_COUNTER_OFFSET + 3];
+    if (counter <= recv_counter) {
+        frame_rejected(&frame_stats.bad_header, padded / BLOCK_SIZE, start);
+        return ERROR_RETURN;
+    }
+
+    // The current epoch, or the next one once the AP has rotated
+    uint32_t epoch = 0;
+    crypto_session_t* session = NULL;
+    if (key_epochs_send(&link_epochs) != NULL) {
+        session = key_epochs_find(&link_epochs, frame[FRAME_EPOCH_OFFSET], &epoch);
+        if (session == NULL) {
+            frame_rejected(&frame_stats.bad_header, padded / BLOCK_SIZE, start);
+            return ERROR_RETURN;
+        }
+    } else if (frame[FRAME_EPOCH_OFFSET] != 0) {
+        frame_rejected(&frame_stats.bad_header, padded / BLOCK_SIZE, start);
+        return ERROR_RETURN;
+    }
+
+    uint8_t nonce[NONCE_SIZE];
+    uint8_t tag[TAG_SIZE];
+    frame_nonce(nonce, FRAME_TO_COMPONENT, frame);
+    if (link_tag(session, nonce, frame, padded, GLOBAL_KEY, tag) != 0 ||
+        !tag_equal(tag, &frame[FRAME_TAG_OFFSET])) {
+        frame_rejected(&frame_stats.bad_tag, padded / BLOCK_SIZE, start);
+        return ERROR_RETURN;
+    }
+    recv_counter = counter;
+
+    start = DWT->CYCCNT;
+    if (link_decrypt(session, &frame[FRAME_HEADER_LEN], padded, GLOBAL_KEY, packet) != 0) {
+        return ERROR_RETURN;
+    }
+    // Follow the AP: answer under the new epoch and have the one after it
+    // ready, the old one is not needed again
+    if (session != NULL && epoch != link_epochs.epoch &&
+        key_epochs_switch(&link_epochs) == 0) {
+        key_epochs_prepare(&link_epochs);
+        frame_stats.rotations++;
+    }
+    frame_stats.accepted++;
+    frame_stats.decrypted_blocks += padded / BLOCK_SIZE;
+    frame_stats.decrypt_cycles += DWT->CYCCNT - start;
+    memset(packet + payload, 0, MAX_I2C_MESSAGE_LEN - payload);
+    return payload;
+}
 
 /**
  * @brief Wait for a new message from AP, decrypt and process the message
@@ -122,37 +488,43 @@ void secure_send_packet_and_ack(uint8_t* packet, uint8_t* GLOBAL_KEY) {
  * once the message is available it is returned in the buffer pointer to by packet 
 */
 uint8_t secure_wait_and_receive_packet(uint8_t* packet, uint8_t* GLOBAL_KEY) {
-    uint8_t plaintext[MAX_I2C_MESSAGE_LEN];
-    uint8_t len = wait_and_receive_packet(packet);
-    volatile int lst_cnt = 0;
+    // The frame is checked and decrypted straight out of its receive bank
+    uint8_t len;
+    uint8_t* frame = wait_and_claim_packet(&len);
     volatile int sync_cnt = 0;
-    for(int i = 0; i < 16; ++i){
-        if(packet[i*4] == 'B' && packet[i*4+1] == 'E' && packet[i*4+2] == 'E' && packet[i*4+3] == 'F'){
-            lst_cnt++;
-        }
-        if(packet[i*4] == 'D' && packet[i*4+1] == 'E' && packet[i*4+2] == 'A' && packet[i*4+3] == 'D'){
+    // Sync requests are a 64+ byte plaintext pattern, scans read the
+    // IDENTITY register instead
+    for(int i = 0; i < 16 && len >= 64; ++i){
+        if(frame[i*4] == 'D' && frame[i*4+1] == 'E' && frame[i*4+2] == 'A' && frame[i*4+3] == 'D'){
             sync_cnt++;
         }
     }
-    if (lst_cnt == 16){
-        // process_scan();
-        return 1;
-    }
-    else if(sync_cnt == 16){
+    if(sync_cnt == 16){
         // process_sync();
-        return 2;
+        i2c_simple_receive_release();
+        return KEY_SYNC_REQUEST;
     }
-    decrypt_sym(packet, MAX_I2C_MESSAGE_LEN, GLOBAL_KEY, plaintext);
-    memmove(packet, plaintext, MAX_I2C_MESSAGE_LEN);
-    return len;
+    // Resume requests are shorter than the smallest frame
+    if (len == RESUME_REQUEST_LEN && !memcmp(frame, RESUME_MAGIC, RESUME_MAGIC_LEN)) {
+        memcpy(packet, frame, len);
+        i2c_simple_receive_release();
+        return KEY_RESUME_REQUEST;
+    }
+    int payload = open_frame(frame, len, packet, GLOBAL_KEY);
+    i2c_simple_receive_release();
+    if (payload < 0) {
+        return 0;
+    }
+    return payload;
 }
 
 int secure_timed_wait_and_receive_packet(uint8_t* packet, uint8_t* GLOBAL_KEY) {
-    uint8_t plaintext[MAX_I2C_MESSAGE_LEN];
-    int len = timed_wait_and_receive_packet(packet);
-    if(len > 0){
-        decrypt_sym(packet, MAX_I2C_MESSAGE_LEN, GLOBAL_KEY, plaintext);
-        memmove(packet, plaintext, MAX_I2C_MESSAGE_LEN);
+    uint8_t len;
+    uint8_t* frame = timed_claim_packet(&len);
+    if (frame == NULL) {
+        return ERROR_RETURN;
     }
-    return len;
-}
\ No newline at end of file
+    int payload = open_frame(frame, len, packet, GLOBAL_KEY);
+    i2c_simple_receive_release();
+    return payload;
+}
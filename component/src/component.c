@@ -31,6 +31,9 @@
 #include "Rand_lib.h"
 #include "disable_cache.h"
 #include "key_exchange.h"
+#include "packet_pool.h"
+#include "simple_flash.h"
+#include "timebase.h"
 
 #ifdef POST_BOOT
 #include "led.h"
@@ -54,6 +57,15 @@
 #define AES_SIZE 16 // 16 bytes
 #define RAND_Z_SIZE 8
 #define RAND_Y_SIZE 8
+// opcode + comp_ID + rand_z + rand_y
+#define MESSAGE_HEADER_LEN (1 + 4 + RAND_Z_SIZE + RAND_Y_SIZE)
+// Largest post-boot payload that still fits in one secure frame
+#define MAX_POSTBOOT_LEN (MAX_FRAME_PAYLOAD - MESSAGE_HEADER_LEN)
+// Stream fragment: [seq][total length], both 16-bit big endian, then data
+#define STREAM_HEADER_LEN 4
+#define MAX_STREAM_FRAGMENT (MAX_POSTBOOT_LEN - STREAM_HEADER_LEN)
+// postboot_confirm(): the AP refused the message and wants a handshake
+#define POSTBOOT_REJECTED 1
 uint8_t RAND_Y[RAND_Y_SIZE];
 uint8_t RAND_Z[RAND_Z_SIZE];
 uint8_t GLOBAL_KEY[AES_SIZE];
@@ -72,6 +84,9 @@ typedef enum {
     COMPONENT_CMD_SECURE_SEND_VALIDATE,
     COMPONENT_CMD_SECURE_SEND_CONFIMRED,
     COMPONENT_CMD_POSTBOOT_VALIDATE,
+    COMPONENT_CMD_POSTBOOT_STREAM,
+    COMPONENT_CMD_POSTBOOT_SESSION,
+    COMPONENT_CMD_KEY_RESYNC,
 } component_cmd_t;
 
 /******************************** TYPE DEFINITIONS
@@ -82,24 +97,32 @@ typedef struct {
     uint8_t comp_ID[4];
     uint8_t rand_z[RAND_Z_SIZE];
     uint8_t rand_y[RAND_Z_SIZE];
-    uint8_t remain[MAX_I2C_MESSAGE_LEN - 21];
+    uint8_t remain[MAX_I2C_MESSAGE_LEN - MESSAGE_HEADER_LEN];
 } message;
 
+// Post-boot session with the AP, opened by the first challenge/answer
+// exchange. comp_ID carries the message counter in session frames
+typedef struct {
+    bool open;
+    uint8_t rand_z[RAND_Z_SIZE];
+    uint8_t rand_y[RAND_Y_SIZE];
+    uint32_t send_ctr; // Last counter sent
+    uint32_t recv_ctr; // Last counter accepted
+} postboot_session_t;
+
+postboot_session_t session;
+
 /********************************* FUNCTION DECLARATIONS
  * **********************************/
 // Core function definitions
 void component_process_cmd(void);
-void process_boot(void);
-void process_scan(void);
+int process_boot(packet_buf_t *buf);
 void process_validate(void);
-void process_attest(void);
+void process_attest(packet_buf_t *buf);
 
 /********************************* GLOBAL VARIABLES
  * **********************************/
-// Global varaibles
-uint8_t receive_buffer[MAX_I2C_MESSAGE_LEN];
-uint8_t transmit_buffer[MAX_I2C_MESSAGE_LEN];
-uint8_t string_buffer[MAX_I2C_MESSAGE_LEN - 21];
+// Command and response buffers come from packet_alloc()
 
 /********************************* UTILITIES **********************************/
 void uint32_to_uint8(uint8_t str_uint8[4], uint32_t str_uint32) {
@@ -141,59 +164,307 @@ int random_checker(uint8_t target[RAND_Z_SIZE], uint8_t control[RAND_Z_SIZE]) {
 /******************************* POST BOOT FUNCTIONALITY
  * *********************************/
 /**
- * @brief Secure Send
+ * @brief Open a post-boot transfer to the AP
  *
- * @param buffer: uint8_t*, pointer to data to be send
- * @param len: uint8_t, size of data to be sent
+ * @param buf: packet_buf_t*, borrowed for the challenge and the answer
  *
- * Securely send data over I2C. This function is utilized in POST_BOOT
- * functionality. This function must be implemented by your team to align with
- * the security requirements.
+ * @return int: SUCCESS_RETURN once the AP answered the challenge
+ *
+ * Challenge/answer exchange shared by secure_send and secure_send_stream.
+ * Leaves the session nonces in RAND_Z and RAND_Y
  */
-void secure_send(uint8_t *buffer, uint8_t len) {
-    uint8_t challenge_buffer[MAX_I2C_MESSAGE_LEN];
-    uint8_t answer_buffer[MAX_I2C_MESSAGE_LEN];
-    uint8_t transmit_buffer[MAX_I2C_MESSAGE_LEN];
-
-    message *challenge = (message *)challenge_buffer;
+static int postboot_open_send(packet_buf_t *buf) {
+    message *challenge = (message *)buf->data;
+    memset(challenge, 0, MESSAGE_HEADER_LEN);
     Rand_NASYC(RAND_Y, RAND_Y_SIZE);
     challenge->opcode = COMPONENT_CMD_POSTBOOT_VALIDATE;
     uint8Arr_to_uint8Arr(challenge->rand_y, RAND_Y);
 
-    secure_send_packet_and_ack(challenge_buffer, GLOBAL_KEY);
+    secure_send_packet_and_ack(buf->data, MESSAGE_HEADER_LEN, GLOBAL_KEY);
 
     int len_ans =
-        secure_timed_wait_and_receive_packet(answer_buffer, GLOBAL_KEY);
-    if (len_ans == ERROR_RETURN) {
+        secure_timed_wait_and_receive_packet(buf->data, GLOBAL_KEY);
+    if (len_ans < MESSAGE_HEADER_LEN) {
         return ERROR_RETURN;
     }
 
-    message *response_ans = (message *)answer_buffer;
+    message *response_ans = (message *)buf->data;
     // compare cmd code
     if (response_ans->opcode != COMPONENT_CMD_POSTBOOT_VALIDATE) {
         return ERROR_RETURN;
     }
 
-    // compare Z value
+    // compare Y value
     int y_check = random_checker(response_ans->rand_y, RAND_Y);
     if (y_check != 1) {
         return ERROR_RETURN;
     }
+    uint8Arr_to_uint8Arr(RAND_Z, response_ans->rand_z);
+    return SUCCESS_RETURN;
+}
 
-    message *command = (message *)transmit_buffer;
+/**
+ * @brief Answer a post-boot challenge from the AP
+ *
+ * @param buf: packet_buf_t*, challenge already received, the answer is
+ * built over it
+ *
+ * @return int: SUCCESS_RETURN once the answer was sent
+ */
+static int postboot_answer(packet_buf_t *buf) {
+    message *challenge = (message *)buf->data;
+    // compare cmd code
+    if (challenge->opcode != COMPONENT_CMD_POSTBOOT_VALIDATE) {
+        return ERROR_RETURN;
+    }
 
-    command->opcode = COMPONENT_CMD_POSTBOOT_VALIDATE;
-    uint8Arr_to_uint8Arr(RAND_Z, response_ans->rand_z);
-    uint8Arr_to_uint8Arr(command->rand_z, RAND_Z);
-    uint8Arr_to_uint8Arr(command->rand_y, RAND_Y);
-    if(len > MAX_I2C_MESSAGE_LEN - 21){
-        len = MAX_I2C_MESSAGE_LEN - 21;
+    Rand_NASYC(RAND_Y, RAND_Z_SIZE);
+    uint8Arr_to_uint8Arr(RAND_Z, challenge->rand_z);
+
+    message *answer = (message *)buf->data;
+    memset(answer, 0, MESSAGE_HEADER_LEN);
+    answer->opcode = COMPONENT_CMD_POSTBOOT_VALIDATE;
+    uint8Arr_to_uint8Arr(answer->rand_z, RAND_Z);
+    uint8Arr_to_uint8Arr(answer->rand_y, RAND_Y);
+
+    secure_send_packet_and_ack(buf->data, MESSAGE_HEADER_LEN, GLOBAL_KEY);
+    return SUCCESS_RETURN;
+}
+
+/**
+ * @brief Open a post-boot transfer from the AP
+ *
+ * @param buf: packet_buf_t*, borrowed for the challenge and the answer
+ *
+ * @return int: SUCCESS_RETURN once the AP challenge was answered
+ *
+ * Challenge/answer exchange shared by secure_receive and
+ * secure_receive_stream. Leaves the session nonces in RAND_Z and RAND_Y
+ */
+static int postboot_open_receive(packet_buf_t *buf) {
+    int len_chlg = secure_wait_and_receive_packet(buf->data, GLOBAL_KEY);
+    if (len_chlg < MESSAGE_HEADER_LEN) {
+        return ERROR_RETURN;
+    }
+    return postboot_answer(buf);
+}
+
+/**
+ * @brief Start a counter session on the nonces of a completed handshake
+ */
+static void postboot_session_start(void) {
+    uint8Arr_to_uint8Arr(session.rand_z, RAND_Z);
+    uint8Arr_to_uint8Arr(session.rand_y, RAND_Y);
+    session.send_ctr = 0;
+    session.recv_ctr = 0;
+    session.open = true;
+}
+
+/**
+ * @brief Tell the AP whether its post-boot message was taken
+ *
+ * @param buf: packet_buf_t*, the reply is built over the message
+ * @param counter: uint32_t, session counter of the message, 0 when it
+ * closed a handshake
+ * @param accepted: bool, false sends the AP back to the challenge/answer
+ * exchange
+ *
+ * An accepted message is echoed by its counter under the session nonces
+ */
+static void postboot_reply(packet_buf_t *buf, uint32_t counter, bool accepted) {
+    message *reply = (message *)buf->data;
+    memset(reply, 0, MESSAGE_HEADER_LEN);
+    if (accepted) {
+        reply->opcode = COMPONENT_CMD_POSTBOOT_SESSION;
+        uint32_to_uint8(reply->comp_ID, counter);
+        uint8Arr_to_uint8Arr(reply->rand_z, session.rand_z);
+        uint8Arr_to_uint8Arr(reply->rand_y, session.rand_y);
     }
-    for (int x = 0; x < len; x++) {
-        command->remain[x] = buffer[x];
+    secure_send_packet_and_ack(buf->data, MESSAGE_HEADER_LEN, GLOBAL_KEY);
+}
+
+/**
+ * @brief Wait for the AP to take a post-boot message
+ *
+ * @param buf: packet_buf_t*, receives the reply
+ * @param counter: uint32_t, session counter of the message, 0 when it
+ * closed a handshake
+ * @param rand_z: uint8_t*, nonces the message was sent under
+ * @param rand_y: uint8_t*
+ *
+ * @return int: SUCCESS_RETURN once the AP confirmed the message,
+ * POSTBOOT_REJECTED if it has no session for it, ERROR_RETURN otherwise
+ */
+static int postboot_confirm(packet_buf_t *buf, uint32_t counter, uint8_t *rand_z,
+                            uint8_t *rand_y) {
+    int len_reply = secure_timed_wait_and_receive_packet(buf->data, GLOBAL_KEY);
+    if (len_reply < MESSAGE_HEADER_LEN) {
+        return ERROR_RETURN;
+    }
+
+    message *reply = (message *)buf->data;
+    if (reply->opcode == COMPONENT_CMD_NONE) {
+        return POSTBOOT_REJECTED;
     }
+    uint32_t echoed;
+    uint8_to_uint32(reply->comp_ID, &echoed);
+    if (reply->opcode != COMPONENT_CMD_POSTBOOT_SESSION || echoed != counter ||
+        random_checker(reply->rand_z, rand_z) != 1 ||
+        random_checker(reply->rand_y, rand_y) != 1) {
+        return ERROR_RETURN;
+    }
+    return SUCCESS_RETURN;
+}
+
+/**
+ * @brief Take a packet buffer for a post-boot call
+ *
+ * @return packet_buf_t*: buffer owned by the caller, NULL if none is free
+ */
+static packet_buf_t *postboot_alloc(void) {
+    packet_buf_t *buf = packet_alloc();
+    if (buf == NULL) {
+        printf("No packet buffer free during post boot\n");
+    }
+    return buf;
+}
+
+/**
+ * @brief secure_send on a packet buffer owned by the caller
+ *
+ * A session frame the AP refuses is sent again after a handshake
+ */
+static void postboot_send(packet_buf_t *buf, uint8_t *buffer, uint8_t len) {
+    if(len > MAX_POSTBOOT_LEN){
+        len = MAX_POSTBOOT_LEN;
+    }
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        bool handshake = !session.open;
+        if (handshake && postboot_open_send(buf) == ERROR_RETURN) {
+            return;
+        }
 
-    secure_send_packet_and_ack(transmit_buffer, GLOBAL_KEY);
+        message *command = (message *)buf->data;
+        memset(command, 0, MESSAGE_HEADER_LEN);
+        uint32_t counter = 0;
+        uint8_t *rand_z = RAND_Z;
+        uint8_t *rand_y = RAND_Y;
+        if (handshake) {
+            command->opcode = COMPONENT_CMD_POSTBOOT_VALIDATE;
+        } else {
+            command->opcode = COMPONENT_CMD_POSTBOOT_SESSION;
+            counter = ++session.send_ctr;
+            rand_z = session.rand_z;
+            rand_y = session.rand_y;
+        }
+        uint32_to_uint8(command->comp_ID, counter);
+        uint8Arr_to_uint8Arr(command->rand_z, rand_z);
+        uint8Arr_to_uint8Arr(command->rand_y, rand_y);
+        for (int x = 0; x < len; x++) {
+            command->remain[x] = buffer[x];
+        }
+
+        secure_send_packet_and_ack(buf->data, MESSAGE_HEADER_LEN + len, GLOBAL_KEY);
+
+        // The session opens, or stays open, only on the AP's word
+        int confirmed = postboot_confirm(buf, counter, rand_z, rand_y);
+        if (confirmed == SUCCESS_RETURN) {
+            if (handshake) {
+                postboot_session_start();
+            }
+            return;
+        }
+        session.open = false;
+        if (handshake || confirmed != POSTBOOT_REJECTED) {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Secure Send
+ *
+ * @param buffer: uint8_t*, pointer to data to be send
+ * @param len: uint8_t, size of data to be sent
+ *
+ * Securely send data over I2C. This function is utilized in POST_BOOT
+ * functionality. This function must be implemented by your team to align with
+ * the security requirements.
+ *
+ * The first message runs the challenge/answer exchange and opens a session
+ * once the AP confirms it, later ones are a single frame with a growing send
+ * counter, each confirmed by an echo of the counter. If the AP lost the
+ * session it refuses the frame and the message goes again after a handshake
+ */
+void secure_send(uint8_t *buffer, uint8_t len) {
+    packet_buf_t *buf = postboot_alloc();
+    if (buf == NULL) {
+        return;
+    }
+    postboot_send(buf, buffer, len);
+    packet_free(buf);
+}
+
+/**
+ * @brief secure_receive on a packet buffer owned by the caller
+ *
+ * A session frame that does not match the session is refused, and the AP
+ * sends the message again after a handshake
+ */
+static int postboot_receive(packet_buf_t *buf, uint8_t *buffer) {
+    message *command = (message *)buf->data;
+    uint32_t counter = 0;
+
+    int len_msg = secure_wait_and_receive_packet(buf->data, GLOBAL_KEY);
+    if (len_msg >= MESSAGE_HEADER_LEN &&
+        command->opcode == COMPONENT_CMD_POSTBOOT_SESSION) {
+        uint8_to_uint32(command->comp_ID, &counter);
+        // Same session nonces and a counter never seen before
+        if (session.open && random_checker(command->rand_z, session.rand_z) == 1 &&
+            random_checker(command->rand_y, session.rand_y) == 1 &&
+            counter > session.recv_ctr) {
+            session.recv_ctr = counter;
+        } else {
+            session.open = false;
+            postboot_reply(buf, 0, false);
+            len_msg = secure_timed_wait_and_receive_packet(buf->data, GLOBAL_KEY);
+        }
+    }
+    if (len_msg < MESSAGE_HEADER_LEN) {
+        return ERROR_RETURN;
+    }
+
+    if (!session.open || command->opcode != COMPONENT_CMD_POSTBOOT_SESSION) {
+        // The AP starts over with a challenge
+        session.open = false;
+        counter = 0;
+        if (postboot_answer(buf) == ERROR_RETURN) {
+            return ERROR_RETURN;
+        }
+
+        len_msg =
+            secure_timed_wait_and_receive_packet(buf->data, GLOBAL_KEY);
+        if (len_msg < MESSAGE_HEADER_LEN) {
+            return ERROR_RETURN;
+        }
+
+        // compare cmd code and Y value
+        if (command->opcode != COMPONENT_CMD_POSTBOOT_VALIDATE ||
+            random_checker(command->rand_y, RAND_Y) != 1) {
+            postboot_reply(buf, 0, false);
+            return ERROR_RETURN;
+        }
+        postboot_session_start();
+    }
+    len_msg -= MESSAGE_HEADER_LEN;
+    for (int x = 0; x < len_msg; x++) {
+        buffer[x] = command->remain[x];
+    }
+
+    // The AP keeps its session only once it hears the message arrived
+    postboot_reply(buf, counter, true);
+    return len_msg;
 }
 
 /**
@@ -206,56 +477,152 @@ void secure_send(uint8_t *buffer, uint8_t len) {
  * Securely receive data over I2C. This function is utilized in POST_BOOT
  * functionality. This function must be implemented by your team to align with
  * the security requirements.
+ *
+ * Accepts a single session frame, or a fresh challenge when the AP has no
+ * session with this component, which then replaces the session. Every
+ * message is confirmed to the AP, a stale session frame is refused so the
+ * AP sends it again after a handshake
  */
 int secure_receive(uint8_t *buffer) {
-    uint8_t challenge_buffer[MAX_I2C_MESSAGE_LEN];
-    uint8_t answer_buffer[MAX_I2C_MESSAGE_LEN];
-    uint8_t receive_buffer[MAX_I2C_MESSAGE_LEN];
-
-    int len_chlg = secure_wait_and_receive_packet(challenge_buffer, GLOBAL_KEY);
-    if (len_chlg == ERROR_RETURN) {
+    packet_buf_t *buf = postboot_alloc();
+    if (buf == NULL) {
         return ERROR_RETURN;
     }
+    int result = postboot_receive(buf, buffer);
+    packet_free(buf);
+    return result;
+}
 
-    message *challenge = (message *)challenge_buffer;
-    // compare cmd code
-    if (challenge->opcode != COMPONENT_CMD_POSTBOOT_VALIDATE) {
+/**
+ * @brief secure_send_stream on a packet buffer owned by the caller
+ */
+static int postboot_send_stream(packet_buf_t *buf, uint8_t *buffer, uint16_t len) {
+    if (postboot_open_send(buf) == ERROR_RETURN) {
         return ERROR_RETURN;
     }
 
-    message *answer = (message *)answer_buffer;
+    message *fragment = (message *)buf->data;
+    memset(fragment, 0, MESSAGE_HEADER_LEN);
 
-    Rand_NASYC(RAND_Y, RAND_Z_SIZE);
-    uint8Arr_to_uint8Arr(RAND_Z, challenge->rand_z);
-    answer->opcode = COMPONENT_CMD_POSTBOOT_VALIDATE;
-    uint8Arr_to_uint8Arr(answer->rand_z, RAND_Z);
-    uint8Arr_to_uint8Arr(answer->rand_y, RAND_Y);
-
-    secure_send_packet_and_ack(answer_buffer, GLOBAL_KEY);
-    ;
+    fragment->opcode = COMPONENT_CMD_POSTBOOT_STREAM;
+    uint8Arr_to_uint8Arr(fragment->rand_z, RAND_Z);
+    uint8Arr_to_uint8Arr(fragment->rand_y, RAND_Y);
+    fragment->remain[2] = len >> 8;
+    fragment->remain[3] = len & 0xFF;
 
-    int len_msg =
-        secure_timed_wait_and_receive_packet(receive_buffer, GLOBAL_KEY);
-    if (len_msg == ERROR_RETURN) {
-        return ERROR_RETURN;
+    uint16_t seq = 0;
+    for (uint16_t offset = 0; offset < len; offset += MAX_STREAM_FRAGMENT) {
+        uint16_t frag_len = len - offset;
+        if (frag_len > MAX_STREAM_FRAGMENT) {
+            frag_len = MAX_STREAM_FRAGMENT;
+        }
+        fragment->remain[0] = seq >> 8;
+        fragment->remain[1] = seq & 0xFF;
+        memcpy(&fragment->remain[STREAM_HEADER_LEN], buffer + offset, frag_len);
+        secure_send_packet_and_ack(buf->data,
+                                   MESSAGE_HEADER_LEN + STREAM_HEADER_LEN + frag_len,
+                                   GLOBAL_KEY);
+        seq++;
     }
+    return SUCCESS_RETURN;
+}
 
-    message *command = (message *)receive_buffer;
-
-    // compare cmd code
-    if (command->opcode != COMPONENT_CMD_POSTBOOT_VALIDATE) {
+/**
+ * @brief Secure Send Stream
+ *
+ * @param buffer: uint8_t*, pointer to data to be send
+ * @param len: uint16_t, size of data to be sent, may exceed one frame
+ *
+ * @return int: SUCCESS_RETURN if every fragment was read by the AP
+ *
+ * One challenge/answer exchange, then numbered fragments under the same
+ * nonces. The AP reading a fragment out of TRANSMIT acknowledges it, so
+ * the next one is published as soon as the register frees up
+ */
+int secure_send_stream(uint8_t *buffer, uint16_t len) {
+    if (len == 0) {
         return ERROR_RETURN;
     }
-    // compare Y value
-    int y_check = random_checker(command->rand_y, RAND_Y);
-    if (y_check != 1) {
+    packet_buf_t *buf = postboot_alloc();
+    if (buf == NULL) {
         return ERROR_RETURN;
     }
-    for (int x = 0; x < MAX_I2C_MESSAGE_LEN - 21; x++) {
-        buffer[x] = command->remain[x];
+    int result = postboot_send_stream(buf, buffer, len);
+    packet_free(buf);
+    return result;
+}
+
+/**
+ * @brief secure_receive_stream on a packet buffer owned by the caller
+ *
+ * Each fragment is copied out before its acknowledgement is built over it
+ */
+static int postboot_receive_stream(packet_buf_t *buf, uint8_t *buffer, uint16_t max_len) {
+    if (postboot_open_receive(buf) == ERROR_RETURN) {
+        return ERROR_RETURN;
     }
 
-    return len_msg;
+    message *fragment = (message *)buf->data;
+    message *ack = (message *)buf->data;
+
+    uint16_t total = 0;
+    uint16_t received = 0;
+    uint16_t seq = 0;
+    do {
+        int len_frag =
+            secure_timed_wait_and_receive_packet(buf->data, GLOBAL_KEY);
+        if (len_frag <= MESSAGE_HEADER_LEN + STREAM_HEADER_LEN ||
+            fragment->opcode != COMPONENT_CMD_POSTBOOT_STREAM ||
+            random_checker(fragment->rand_y, RAND_Y) != 1 ||
+            ((fragment->remain[0] << 8) | fragment->remain[1]) != seq) {
+            return ERROR_RETURN;
+        }
+
+        uint16_t frag_total = (fragment->remain[2] << 8) | fragment->remain[3];
+        uint16_t frag_len = len_frag - MESSAGE_HEADER_LEN - STREAM_HEADER_LEN;
+        if (seq == 0) {
+            total = frag_total;
+        }
+        if (frag_total != total || total > max_len ||
+            received + frag_len > total) {
+            return ERROR_RETURN;
+        }
+        memcpy(buffer + received, &fragment->remain[STREAM_HEADER_LEN], frag_len);
+        received += frag_len;
+
+        memset(ack, 0, MESSAGE_HEADER_LEN);
+        ack->opcode = COMPONENT_CMD_POSTBOOT_STREAM;
+        uint8Arr_to_uint8Arr(ack->rand_z, RAND_Z);
+        uint8Arr_to_uint8Arr(ack->rand_y, RAND_Y);
+        ack->remain[0] = seq >> 8;
+        ack->remain[1] = seq & 0xFF;
+        secure_send_packet_and_ack(buf->data, MESSAGE_HEADER_LEN + 2, GLOBAL_KEY);
+        seq++;
+    } while (received < total);
+
+    return received;
+}
+
+/**
+ * @brief Secure Receive Stream
+ *
+ * @param buffer: uint8_t*, pointer to buffer to receive data to
+ * @param max_len: uint16_t, size of buffer
+ *
+ * @return int: number of bytes received, negative if error
+ *
+ * Counterpart of the AP secure_send_stream. The AP keeps STREAM_WINDOW
+ * fragments in flight, one per receive bank, so the next fragment is
+ * already on board while this one is copied out and acknowledged
+ */
+int secure_receive_stream(uint8_t *buffer, uint16_t max_len) {
+    packet_buf_t *buf = postboot_alloc();
+    if (buf == NULL) {
+        return ERROR_RETURN;
+    }
+    int result = postboot_receive_stream(buf, buffer, max_len);
+    packet_free(buf);
+    return result;
 }
 
 // Not sure what the component will send back to AP, for Now I Just assume the
@@ -267,12 +634,16 @@ void secure_receive_and_send(uint8_t *receive_buffer, uint8_t *transmit_buffer,
     secure_wait_and_receive_packet(receive_buffer, GLOBAL_KEY);
     message *command = (message *)receive_buffer;
     Rand_NASYC(RAND_Y, RAND_Y_SIZE);
-    uint8_t validate_buffer[MAX_I2C_MESSAGE_LEN];
-    message *send_packet = (message *)validate_buffer;
+    packet_buf_t *validate_buffer = packet_alloc();
+    if (validate_buffer == NULL) {
+        return;
+    }
+    message *send_packet = (message *)validate_buffer->data;
     send_packet->opcode = COMPONENT_CMD_SECURE_SEND_VALIDATE;
     memcpy(send_packet->rand_z, command->rand_z, RAND_Z_SIZE);
     memcpy(send_packet->rand_y, RAND_Y, RAND_Y_SIZE);
-    secure_send_packet_and_ack(validate_buffer, GLOBAL_KEY);
+    secure_send_packet_and_ack(validate_buffer->data, MESSAGE_HEADER_LEN, GLOBAL_KEY);
+    packet_free(validate_buffer);
     memset(receive_buffer, 0, 256); // Keep eye on all the memset method, Zuhair
                                     // says this could be error pron
     if (secure_timed_wait_and_receive_packet(receive_buffer, GLOBAL_KEY) < 0) {
@@ -287,7 +658,7 @@ void secure_receive_and_send(uint8_t *receive_buffer, uint8_t *transmit_buffer,
     send_packet = (message *)transmit_buffer;
     send_packet->opcode = COMPONENT_CMD_SECURE_SEND_CONFIMRED;
     memcpy(send_packet->rand_z, command->rand_z, RAND_Z_SIZE);
-    secure_send_packet_and_ack(transmit_buffer, GLOBAL_KEY);
+    secure_send_packet_and_ack(transmit_buffer, MESSAGE_HEADER_LEN + len, GLOBAL_KEY);
 }
 /******************************* FUNCTION DEFINITIONS
  * *********************************/
@@ -326,110 +697,134 @@ void boot() {
 
 // Handle a command from the AP
 void component_process_cmd() {
-    memset(receive_buffer, 0, MAX_I2C_MESSAGE_LEN);
-    uint8_t operation =  secure_wait_and_receive_packet(receive_buffer, GLOBAL_KEY);
-    if(operation == 1){
-        process_scan();
+    packet_buf_t *buf = packet_alloc();
+    if (buf == NULL) {
+        printf("No packet buffer free for a command");
         return;
     }
-    else if(operation == 2 && synthesized == 0){
-        if(key_sync(GLOBAL_KEY) != -1){
+    bool booting = false;
+    // Sleeps in WFI until the I2C STOP of the next command
+    uint8_t operation = secure_wait_and_receive_packet(buf->data, GLOBAL_KEY);
+    // The trigger is plaintext, a component with a key only takes it after
+    // the AP asked for a new sync with COMPONENT_CMD_KEY_RESYNC
+    if(operation == KEY_SYNC_REQUEST && synthesized == 0){
+        if(key_sync(GLOBAL_KEY) != (uint8_t)-1){
+            // Expand the synced key once for every later packet
+            board_link_set_key(GLOBAL_KEY);
+            if (ticket_store(GLOBAL_KEY, COMPONENT_ID) != 0) {
+                printf("Ticket not saved, a reset needs a full key sync");
+            }
+            // A session with the AP does not outlive the key
+            session.open = false;
             synthesized = 1;
-            return;
         }
         else{
             printf("Key sync failed");
+            board_link_clear_key();
+            session.open = false;
+            synthesized = 0;
             Rand_NASYC(GLOBAL_KEY, AES_SIZE);
             Rand_NASYC(KEY_SHARE, AES_SIZE);
-            return;
+        }
+    }
+    else if(operation == KEY_SYNC_REQUEST){
+        printf("Key sync trigger ignored, the AP did not ask for a new sync");
+    }
+    else if(operation == KEY_RESUME_REQUEST){
+        // Back after a reset, take the key from the AP with the ticket
+        if(key_resume(GLOBAL_KEY, buf->data, COMPONENT_ID) == 0){
+            session.open = false;
+            synthesized = 1;
         }
     }
     else if(synthesized == 0){
         printf("Key sync not completed");
-        return;
     }
-    message *command = (message *)receive_buffer;
-
-    // Output to application processor dependent on command received
-    switch (command->opcode) {
-    case COMPONENT_CMD_VALIDATE:
-        process_boot();
-        break;
-    // case COMPONENT_CMD_SCAN:
-    //     process_scan();
-    //     break;
-    case COMPONENT_CMD_ATTEST:
-        process_attest();
-        break;
-    default:
-        printf("Error: Unrecognized command received %d\n", command->opcode);
-        break;
+    else {
+        message *command = (message *)buf->data;
+
+        // Output to application processor dependent on command received
+        switch (command->opcode) {
+        case COMPONENT_CMD_VALIDATE:
+            booting = process_boot(buf) == SUCCESS_RETURN;
+            break;
+        // case COMPONENT_CMD_SCAN:
+        //     process_scan();
+        //     break;
+        case COMPONENT_CMD_ATTEST:
+            process_attest(buf);
+            break;
+        case COMPONENT_CMD_KEY_RESYNC:
+            // The AP falls back to a full sync, take its trigger next
+            if (uint8_uint32_cmp(command->comp_ID, COMPONENT_ID) == 1) {
+                synthesized = 0;
+            }
+            break;
+        default:
+            printf("Error: Unrecognized command received %d\n", command->opcode);
+            break;
+        }
+    }
+    packet_free(buf);
+    // boot() never returns, the command buffer goes back to the pool first
+    if (booting) {
+        boot();
     }
 }
 
-// This if for the functionality of Boot
-void process_boot() {
+// This if for the functionality of Boot, the confirmation is built over
+// the command in buf. Returns SUCCESS_RETURN once it was sent
+int process_boot(packet_buf_t *buf) {
     // The AP requested a boot.
     // Validate the Component ID
-    message *command = (message *)receive_buffer;
+    message *command = (message *)buf->data;
 
     if (uint8_uint32_cmp(command->comp_ID, COMPONENT_ID) != 1) {
         printf("The Component ID checks failed at the component sided");
-        return;
+        return ERROR_RETURN;
     }
     // Validation passed
     // Starts Boot
 
-    // Send Boot comfirmation message back to AP
-    memset(transmit_buffer, 0, MAX_I2C_MESSAGE_LEN); // DO WE NEED THIS?
-    message *send_packet = (message *)transmit_buffer;
+    // Send Boot comfirmation message back to AP, rand_z stays in place
+    message *send_packet = command;
     send_packet->opcode = COMPONENT_CMD_BOOT;
-    memcpy(send_packet->rand_z, command->rand_z, RAND_Z_SIZE);
     uint32_to_uint8(send_packet->comp_ID, COMPONENT_ID);
+    memset(send_packet->rand_y, 0, RAND_Y_SIZE);
+    memset(send_packet->remain, 0, sizeof(send_packet->remain));
     memcpy(send_packet->remain, COMPONENT_BOOT_MSG, sizeof(COMPONENT_BOOT_MSG));
-    secure_send_packet_and_ack(transmit_buffer, GLOBAL_KEY);
-    boot();
-}
-
-void process_scan() {
-    // The AP requested a scan. Respond with the Component ID
-
-    message *command = (message *)receive_buffer;
-    memset(transmit_buffer, 0, MAX_I2C_MESSAGE_LEN); // DO WE NEED THIS?
-    message *send_packet = (message *)transmit_buffer;
-    send_packet->opcode = COMPONENT_CMD_SCAN;
-    memcpy(send_packet->rand_z, command->rand_z, RAND_Z_SIZE);
-    uint32_t comp_id = COMPONENT_ID;
-    uint32_to_uint8(send_packet->comp_ID, comp_id);
-    send_packet_and_ack(MAX_I2C_MESSAGE_LEN-1, transmit_buffer);
+    secure_send_packet_and_ack(buf->data,
+                               MESSAGE_HEADER_LEN + sizeof(COMPONENT_BOOT_MSG),
+                               GLOBAL_KEY);
+    return SUCCESS_RETURN;
 }
 
-void process_attest() {
+// The attestation data is built over the command in buf
+void process_attest(packet_buf_t *buf) {
     // The AP requested attestation. Respond with the attestation data
 
     // Validate the Component ID; plaintext[1:4]
-    message *command = (message *)receive_buffer;
+    message *command = (message *)buf->data;
 
     if (uint8_uint32_cmp(command->comp_ID, COMPONENT_ID) != 1) {
         printf("The Component ID checks failed at the component sided");
         return;
     }
 
-    // Start to move atttestation data into the transmit_buffer
-    memset(string_buffer, 0, MAX_I2C_MESSAGE_LEN - 21);
-    uint8_t len =
-        sprintf((char *)string_buffer, "LOC>%s\nDATE>%s\nCUST>%s\n",
-                ATTESTATION_LOC, ATTESTATION_DATE, ATTESTATION_CUSTOMER) +
-        1;
-
-    // Move the cipher text into the transmit_buffer and reday for transfer
-    memset(transmit_buffer, 0, MAX_I2C_MESSAGE_LEN); // DO WE NEED THIS?
-    message *send_packet = (message *)transmit_buffer;
+    // Move the attestation data into the response, rand_z stays in place
+    message *send_packet = command;
     send_packet->opcode = COMPONENT_CMD_ATTEST;
-    memcpy(send_packet->rand_z, command->rand_z, RAND_Z_SIZE);
     uint32_to_uint8(send_packet->comp_ID, COMPONENT_ID);
-    memcpy(send_packet->remain, string_buffer, sizeof(send_packet->remain));
-    secure_send_packet_and_ack(transmit_buffer, GLOBAL_KEY);
+    memset(send_packet->rand_y, 0, RAND_Y_SIZE);
+    memset(send_packet->remain, 0, sizeof(send_packet->remain));
+    int len = snprintf((char *)send_packet->remain, MAX_POSTBOOT_LEN,
+                       "LOC>%s\nDATE>%s\nCUST>%s\n", ATTESTATION_LOC,
+                       ATTESTATION_DATE, ATTESTATION_CUSTOMER) +
+              1;
+    if (len > MAX_POSTBOOT_LEN) {
+        len = MAX_POSTBOOT_LEN;
+    }
+    secure_send_packet_and_ack(buf->data, MESSAGE_HEADER_LEN + len, GLOBAL_KEY);
 }
 
 /*********************************** MAIN *************************************/
@@ -443,7 +838,17 @@ int main(void) {
 
     // Initialize Component
     i2c_addr_t addr = component_id_to_i2c_addr(COMPONENT_ID);
+    timebase_init();
+    // Refuse to run with a crypto backend that gives wrong answers
+    if (crypto_self_test() != 0) {
+        printf("Crypto self test failed\n");
+        while (1);
+    }
     board_link_init(addr);
+    i2c_simple_set_identity(COMPONENT_ID);
+    // Ticket of the last key sync, for resuming after a reset
+    flash_simple_init();
+    ticket_load();
     // memset(GLOBAL_KEY, 0, AES_SIZE);
     Rand_NASYC(GLOBAL_KEY, AES_SIZE);
     Rand_NASYC(KEY_SHARE, AES_SIZE);
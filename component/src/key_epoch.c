@@ -0,0 +1,164 @@
+/**
+ * @file "key_epoch.c"
+ * @brief Key Epoch Ratchet Implementation
+ * @date 2024
+ */
+
+#include "key_epoch.h"
+
+#include <string.h>
+
+/******************************** FUNCTION DEFINITIONS ********************************/
+/**
+ * @brief Derive the key of an epoch from the key of the one before
+ * 
+ * @param key: uint8_t*, 16 byte key of epoch - 1
+ * @param epoch: uint32_t, epoch to derive
+ * @param next: uint8_t*, 16 byte output, may be key
+ * 
+ * @return int: 0 on success, non-zero for error
+*/
+static int epoch_derive(uint8_t* key, uint32_t epoch, uint8_t* next) {
+    uint8_t block[KEY_SIZE] = {'E', 'P', 'C', 'H'};
+    block[4] = epoch >> 24;
+    block[5] = epoch >> 16;
+    block[6] = epoch >> 8;
+    block[7] = epoch;
+    return encrypt_sym(block, KEY_SIZE, key, next);
+}
+
+/**
+ * @brief Put the key of an epoch into its slot and expand it
+ * 
+ * @param ke: key_epochs_t*, epochs
+ * @param epoch: uint32_t, epoch of the key
+ * @param key: uint8_t*, 16 byte key
+ * 
+ * @return int: 0 on success, non-zero for error
+*/
+static int epoch_load(key_epochs_t* ke, uint32_t epoch, uint8_t* key) {
+    int slot = epoch & 1;
+    crypto_session_invalidate(&ke->sessions[slot]);
+    memcpy(ke->keys[slot], key, KEY_SIZE);
+    ke->slot_epoch[slot] = epoch;
+    return crypto_session_init(&ke->sessions[slot], ke->keys[slot]);
+}
+
+/**
+ * @brief Start the chain from the synced key
+ * 
+ * @param ke: key_epochs_t*, epochs to set up
+ * @param key: uint8_t*, 16 byte synced key, epoch 0
+ * @param epoch: uint32_t, epoch to send under
+ * 
+ * @return int: 0 on success, non-zero for error
+*/
+int key_epochs_init(key_epochs_t* ke, uint8_t* key, uint32_t epoch) {
+    uint8_t current[KEY_SIZE];
+    int result = 0;
+
+    key_epochs_clear(ke);
+    memcpy(current, key, KEY_SIZE);
+    for (uint32_t e = 1; e <= epoch && result == 0; e++) {
+        result = epoch_derive(current, e, current);
+    }
+    if (result == 0) {
+        ke->epoch = epoch;
+        result = epoch_load(ke, epoch, current);
+    }
+    memset(current, 0, sizeof(current));
+    if (result == 0) {
+        result = key_epochs_prepare(ke);
+    }
+    if (result != 0) {
+        key_epochs_clear(ke);
+    }
+    return result;
+}
+
+/**
+ * @brief Wipe every key and schedule
+ * 
+ * @param ke: key_epochs_t*, epochs to clear
+*/
+void key_epochs_clear(key_epochs_t* ke) {
+    crypto_session_invalidate(&ke->sessions[0]);
+    crypto_session_invalidate(&ke->sessions[1]);
+    memset(ke->keys, 0, sizeof(ke->keys));
+    ke->slot_epoch[0] = 0;
+    ke->slot_epoch[1] = 0;
+    ke->epoch = 0;
+}
+
+/**
+ * @brief Get the schedule to seal a frame with
+ * 
+ * @param ke: key_epochs_t*, epochs
+ * 
+ * @return crypto_session_t*: session of the current epoch, NULL if none
+*/
+crypto_session_t* key_epochs_send(key_epochs_t* ke) {
+    crypto_session_t* session = &ke->sessions[ke->epoch & 1];
+    return session->valid ? session : NULL;
+}
+
+/**
+ * @brief Get the schedule a received frame was sealed with
+ * 
+ * @param ke: key_epochs_t*, epochs
+ * @param epoch_byte: uint8_t, epoch byte from the frame header
+ * @param epoch: uint32_t*, set to the full epoch
+ * 
+ * @return crypto_session_t*: session of the matching slot, NULL if none
+*/
+crypto_session_t* key_epochs_find(key_epochs_t* ke, uint8_t epoch_byte, uint32_t* epoch) {
+    // The two slots hold consecutive epochs, their low bytes never match
+    for (int slot = 0; slot < 2; slot++) {
+        if (ke->sessions[slot].valid && (uint8_t)ke->slot_epoch[slot] == epoch_byte) {
+            *epoch = ke->slot_epoch[slot];
+            return &ke->sessions[slot];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Derive and expand the epoch after the current one
+ * 
+ * @param ke: key_epochs_t*, epochs
+ * 
+ * @return int: 0 on success, non-zero for error
+*/
+int key_epochs_prepare(key_epochs_t* ke) {
+    uint32_t next = ke->epoch + 1;
+    uint8_t key[KEY_SIZE];
+
+    if (!ke->sessions[ke->epoch & 1].valid) {
+        return -1;
+    }
+    if (ke->sessions[next & 1].valid && ke->slot_epoch[next & 1] == next) {
+        return 0;
+    }
+    int result = epoch_derive(ke->keys[ke->epoch & 1], next, key);
+    if (result == 0) {
+        result = epoch_load(ke, next, key);
+    }
+    memset(key, 0, sizeof(key));
+    return result;
+}
+
+/**
+ * @brief Send under the prepared next epoch from now on
+ * 
+ * @param ke: key_epochs_t*, epochs
+ * 
+ * @return int: 0 on success, -1 if the next epoch is not prepared
+*/
+int key_epochs_switch(key_epochs_t* ke) {
+    uint32_t next = ke->epoch + 1;
+    if (!ke->sessions[next & 1].valid || ke->slot_epoch[next & 1] != next) {
+        return -1;
+    }
+    ke->epoch = next;
+    return 0;
+}
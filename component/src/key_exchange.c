@@ -4,11 +4,117 @@ extern flash_status;
 #include "simple_i2c_peripheral.h"
 #include "xor_secure.h"
 
+#include "Rand_lib.h"
 #include "key_exchange.h"
+#include "mxc_device.h"
+#include "packet_pool.h"
+#include "simple_flash.h"
 #include <stdio.h>
-uint8_t transmit_buffer1[MAX_I2C_MESSAGE_LEN];
-uint8_t receive_buffer1[MAX_I2C_MESSAGE_LEN];
+#include <string.h>
 
+// Resumption ticket page, the last but one page like the AP's flash_entry
+#define TICKET_ADDR ((MXC_FLASH_MEM_BASE + MXC_FLASH_MEM_SIZE) - (2 * MXC_FLASH_PAGE_SIZE))
+#define TICKET_MAGIC 0x5253554D
+
+// Resumption ticket, AES_key("RTKT" | component ID). Only the AP and a
+// component that took part in the sync of key can compute it
+typedef struct {
+    uint32_t magic;
+    uint8_t secret[KEY_SHARE_LEN];
+} resume_ticket_t;
+
+static resume_ticket_t ticket;
+
+#if KEY_SYNC_X25519
+/**
+ * @brief Derive the key the AP wraps the synced key with
+ * 
+ * @param shared: uint8_t*, X25519 shared secret with the AP
+ * @param ap_public: uint8_t*, the AP's public key
+ * @param own_public: uint8_t*, this component's public key
+ * @param wrap: uint8_t*, 16 byte output
+ * 
+ * @return int: 0 on success, -1 otherwise
+ *
+ * AES_MASK(MD5(shared | AP public | component public)), same as the AP
+*/
+static int wrap_derive(uint8_t *shared, uint8_t *ap_public, uint8_t *own_public,
+                       uint8_t *wrap) {
+    uint8_t transcript[3 * X25519_KEY_SIZE];
+    memcpy(transcript, shared, X25519_KEY_SIZE);
+    memcpy(&transcript[X25519_KEY_SIZE], ap_public, X25519_KEY_SIZE);
+    memcpy(&transcript[2 * X25519_KEY_SIZE], own_public, X25519_KEY_SIZE);
+    int result = hash(transcript, sizeof(transcript), wrap);
+    memset(transcript, 0, sizeof(transcript));
+    if (result != 0) {
+        return -1;
+    }
+    return encrypt_sym(wrap, KEY_SHARE_LEN, (uint8_t *)MASK, wrap) != 0 ? -1 : 0;
+}
+
+/**
+ * @brief The X25519 exchange, key_sync() wipes the scratch afterwards
+ * 
+ * @param dest: uint8_t*, 16 byte key output
+ * @param ap_public: uint8_t*, the AP's public key from the request
+ * @param msg: uint8_t*, MAX_I2C_MESSAGE_LEN scratch for the messages
+ * @param secrets: uint8_t*, 2 * X25519_KEY_SIZE + KEY_SHARE_LEN scratch for
+ * the private key, the shared secret and the wrap key
+ * 
+ * @return int: 0 once the key is unwrapped, -1 otherwise
+*/
+static int sync_x25519(uint8_t *dest, uint8_t *ap_public, uint8_t *msg, uint8_t *secrets) {
+    uint8_t *own_private = secrets;
+    uint8_t *shared = &secrets[X25519_KEY_SIZE];
+    uint8_t *wrap = &secrets[2 * X25519_KEY_SIZE];
+    uint8_t own_public[X25519_KEY_SIZE];
+    uint8_t tag[TAG_SIZE];
+
+    Rand_NASYC(own_private, X25519_KEY_SIZE);
+    if (x25519_make_public(own_private, own_public) != 0) {
+        return -1;
+    }
+    memcpy(msg, own_public, X25519_KEY_SIZE);
+    send_packet_and_ack(KEY_SHARE_REPLY_LEN, msg);
+
+    // While the AP collects the other components' replies
+    if (x25519_shared(own_private, ap_public, shared) != 0 ||
+        wrap_derive(shared, ap_public, own_public, wrap) != 0) {
+        return -1;
+    }
+
+    if (wait_and_receive_packet(msg) != KEY_SHARE_FINAL_LEN) {
+        return -1;
+    }
+    if (tag_sym(ap_public, own_public, X25519_KEY_SIZE, msg, KEY_SHARE_LEN, wrap, tag) != 0 ||
+        !tag_equal(tag, &msg[KEY_SHARE_LEN])) {
+        return -1;
+    }
+    return decrypt_sym(msg, KEY_SHARE_LEN, wrap, dest) != 0 ? -1 : 0;
+}
+
+// The AP's public key in, this component's out, then the synced key
+// wrapped under a key only the two of them and holders of MASK can derive
+uint8_t key_sync(char *dest) {
+    packet_buf_t *buf = packet_alloc();
+    if (buf == NULL) {
+        return -1;
+    }
+    uint8_t ap_public[X25519_KEY_SIZE];
+    uint8_t secrets[2 * X25519_KEY_SIZE + KEY_SHARE_LEN];
+    int result = -1;
+    if (wait_and_receive_packet(buf->data) == KEY_SHARE_REQUEST_LEN) {
+        memcpy(ap_public, buf->data, X25519_KEY_SIZE);
+        result = sync_x25519((uint8_t *)dest, ap_public, buf->data, secrets);
+    }
+    memset(secrets, 0, sizeof(secrets));
+    packet_free(buf);
+    return result == 0 ? KEY_SHARE_FINAL_LEN : -1;
+}
+#else
+// Key sync with any number of components: k2_r is r ^ k2 from the AP, the
+// final message is F ^ r ^ the other components' shares, so every
+// component ends up with k2 ^ k_1 ^ ... ^ k_n
 uint8_t sync2(char *dest, char *k2_r) {
     char cash_k2_r[18];
     XOR_secure(k2_r, KEY_SHARE, 16, cash_k2_r); // k2_r_k1
@@ -39,22 +145,143 @@ void sync1(char *dest, char *k2_m1) {
 }
 
 uint8_t key_sync(char *dest) {
-    uint8_t len = wait_and_receive_packet(receive_buffer1);
-    if (len != 18) {
-        // we have an error so just return
+    packet_buf_t *buf = packet_alloc();
+    if (buf == NULL) {
         return -1;
     }
-    char rv = receive_buffer1[17];
-    switch (rv) {
-    case '1':
-        sync1(dest, receive_buffer1);
-        return len;
+    char *msg = (char *)buf->data;
+    uint8_t result = -1;
+    if (wait_and_receive_packet(buf->data) == KEY_SHARE_REQUEST_LEN) {
+        switch (msg[17]) {
+        case '1':
+            sync1(dest, msg);
+            result = KEY_SHARE_REQUEST_LEN;
+            break;
 
-    case '2':
-        return sync2(dest, receive_buffer1);
+        case '2':
+            result = sync2(dest, msg);
+            break;
+
+        default:
+            // default should never be invoked
+            break;
+        }
+    }
+    packet_free(buf);
+    return result;
+}
+#endif
 
-    default:
-        // default should never be invoked
+/**
+ * @brief Derive the resumption ticket of a key
+ * 
+ * @param key: uint8_t*, 16 byte synced key
+ * @param component_id: uint32_t, component the ticket is for
+ * @param secret: uint8_t*, 16 byte output
+*/
+static void ticket_derive(uint8_t *key, uint32_t component_id, uint8_t *secret) {
+    uint8_t block[KEY_SHARE_LEN] = {'R', 'T', 'K', 'T'};
+    block[4] = component_id >> 24;
+    block[5] = component_id >> 16;
+    block[6] = component_id >> 8;
+    block[7] = component_id;
+    encrypt_sym(block, KEY_SHARE_LEN, key, secret);
+}
+
+void ticket_load(void) {
+    flash_simple_read(TICKET_ADDR, (uint32_t *)&ticket, sizeof(ticket));
+}
+
+int ticket_store(uint8_t *key, uint32_t component_id) {
+    uint8_t secret[KEY_SHARE_LEN];
+    ticket_derive(key, component_id, secret);
+    // The key rarely changes between syncs, skip the page erase then
+    if (ticket.magic == TICKET_MAGIC && !memcmp(ticket.secret, secret, KEY_SHARE_LEN)) {
+        memset(secret, 0, sizeof(secret));
+        return 0;
+    }
+    ticket.magic = TICKET_MAGIC;
+    memcpy(ticket.secret, secret, KEY_SHARE_LEN);
+    memset(secret, 0, sizeof(secret));
+    if (flash_simple_erase_page(TICKET_ADDR) != 0 ||
+        flash_simple_write(TICKET_ADDR, (uint32_t *)&ticket, sizeof(ticket)) != 0) {
+        // The next sync writes the page again instead of skipping it
+        ticket.magic = 0;
+        return -1;
+    }
+    return 0;
+}
+
+static uint32_t load_be32(uint8_t *in) {
+    return (uint32_t)in[0] << 24 | (uint32_t)in[1] << 16 | (uint32_t)in[2] << 8 | in[3];
+}
+
+/**
+ * @brief The resumption exchange, key_resume() wipes the scratch afterwards
+ * 
+ * @param dest: uint8_t*, 16 byte key output
+ * @param request: uint8_t*, RESUME_REQUEST_LEN request from the AP
+ * @param component_id: uint32_t, this component's ID
+ * @param msg: uint8_t*, MAX_I2C_MESSAGE_LEN scratch for the messages
+ * @param session: uint8_t*, 16 byte scratch for the resumption key
+ * 
+ * @return int: 0 once the key and counters are restored, -1 otherwise
+*/
+static int key_resume_exchange(uint8_t *dest, uint8_t *request, uint32_t component_id,
+                               uint8_t *msg, uint8_t *session) {
+    uint8_t *nonce_a = &request[RESUME_MAGIC_LEN];
+    uint8_t nonce_c[RESUME_NONCE_LEN];
+    uint8_t tag[TAG_SIZE];
+
+    // Prove the ticket over both nonces
+    Rand_NASYC(nonce_c, RESUME_NONCE_LEN);
+    memcpy(msg, nonce_c, RESUME_NONCE_LEN);
+    if (tag_sym(nonce_c, nonce_a, RESUME_NONCE_LEN, nonce_c, RESUME_NONCE_LEN, ticket.secret,
+                &msg[RESUME_NONCE_LEN]) != 0) {
+        return -1;
+    }
+    send_packet_and_ack(RESUME_PROOF_LEN, msg);
+
+    if (timed_wait_and_receive_packet(msg) != RESUME_GRANT_LEN) {
+        return -1;
+    }
+
+    // Resumption key AES_ticket(nonce_a ^ nonce_c), fresh for both sides
+    XOR_secure(nonce_a, nonce_c, RESUME_NONCE_LEN, session);
+    encrypt_sym(session, KEY_SHARE_LEN, ticket.secret, session);
+    if (tag_sym(nonce_a, nonce_c, RESUME_NONCE_LEN, msg, RESUME_GRANT_BODY_LEN, session, tag) != 0 ||
+        !tag_equal(tag, &msg[RESUME_GRANT_BODY_LEN])) {
+        return -1;
+    }
+    decrypt_sym(msg, RESUME_GRANT_BODY_LEN, session, msg);
+
+    // Only the key the ticket was made from is taken
+    ticket_derive(msg, component_id, session);
+    if (memcmp(session, ticket.secret, KEY_SHARE_LEN)) {
         return -1;
     }
-}
\ No newline at end of file
+    memcpy(dest, msg, KEY_SHARE_LEN);
+    return board_link_resume(dest, load_be32(&msg[KEY_SHARE_LEN]),
+                             load_be32(&msg[KEY_SHARE_LEN + 4]),
+                             load_be32(&msg[KEY_SHARE_LEN + 8]));
+}
+
+// One round trip instead of the four message sync with every component:
+// the AP sends "RSUM" | nonce_a, this component answers nonce_c and a tag
+// under the ticket, and the AP sends the key, the counters and the key
+// epoch to continue from, encrypted and tagged under
+// AES_ticket(nonce_a ^ nonce_c)
+int key_resume(uint8_t *dest, uint8_t *request, uint32_t component_id) {
+    if (ticket.magic != TICKET_MAGIC) {
+        return -1;
+    }
+    packet_buf_t *buf = packet_alloc();
+    if (buf == NULL) {
+        return -1;
+    }
+    uint8_t session[KEY_SHARE_LEN];
+    int result = key_resume_exchange(dest, request, component_id, buf->data, session);
+    memset(session, 0, sizeof(session));
+    packet_free(buf);
+    return result;
+}
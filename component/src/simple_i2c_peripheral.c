@@ -15,33 +15,103 @@
 
 /******************************** GLOBAL DEFINITIONS ********************************/
 // Data for all of the I2C registers
-volatile uint8_t RECEIVE_REG[MAX_I2C_MESSAGE_LEN];
+// Each direction is laid out contiguously so a BURST transfer is simply
+// a longer view of the same memory: [len][data] for the receive side and
+// [status][len][data] for the transmit side
+// The receive side has two banks, the controller writes into the landing
+// bank while the component works on the other one
+volatile uint8_t RECEIVE_BANK[2][BURST_WRITE_HEADER_LEN + MAX_I2C_MESSAGE_LEN];
+volatile uint8_t TRANSMIT_BURST_REG[BURST_READ_HEADER_LEN + MAX_I2C_MESSAGE_LEN];
 volatile uint8_t RECEIVE_DONE_REG[1];
-volatile uint8_t RECEIVE_LEN_REG[1];
-volatile uint8_t TRANSMIT_REG[MAX_I2C_MESSAGE_LEN];
-volatile uint8_t TRANSMIT_DONE_REG[1];
-volatile uint8_t TRANSMIT_LEN_REG[1];
+volatile uint8_t IDENTITY_REG[IDENTITY_LEN];
+#define RECEIVE_LEN_REG (&RECEIVE_BANK[0][0])
+#define RECEIVE_REG (&RECEIVE_BANK[0][BURST_WRITE_HEADER_LEN])
+#define TRANSMIT_DONE_REG (&TRANSMIT_BURST_REG[0])
+#define TRANSMIT_LEN_REG (&TRANSMIT_BURST_REG[1])
+#define TRANSMIT_REG (&TRANSMIT_BURST_REG[BURST_READ_HEADER_LEN])
 
 // Data structure to allow easy reference of I2C registers
-volatile uint8_t* I2C_REGS[6] = {
+volatile uint8_t* I2C_REGS[NUM_I2C_REGS] = {
     [RECEIVE] = RECEIVE_REG,
     [RECEIVE_DONE] = RECEIVE_DONE_REG,
     [RECEIVE_LEN] = RECEIVE_LEN_REG,
     [TRANSMIT] = TRANSMIT_REG,
     [TRANSMIT_DONE] = TRANSMIT_DONE_REG,
     [TRANSMIT_LEN] = TRANSMIT_LEN_REG,
+    [BURST] = RECEIVE_BANK[0],
+    [IDENTITY] = IDENTITY_REG,
 };
 
 // Data structure to allow easy reference to I2C register length
-int I2C_REGS_LEN[6] = {
+int I2C_REGS_LEN[NUM_I2C_REGS] = {
     [RECEIVE] = MAX_I2C_MESSAGE_LEN,
     [RECEIVE_DONE] = 1,
     [RECEIVE_LEN] = 1,
     [TRANSMIT] = MAX_I2C_MESSAGE_LEN,
     [TRANSMIT_DONE] = 1,
     [TRANSMIT_LEN] = 1,
+    [BURST] = BURST_WRITE_HEADER_LEN + MAX_I2C_MESSAGE_LEN,
+    [IDENTITY] = IDENTITY_LEN,
 };
 
+// Registers past this one are read only, writes to them are dropped
+#define MAX_WRITE_REG BURST
+
+// Register views used when the controller reads. A TRANSMIT_DONE read
+// also returns TRANSMIT_LEN so one poll carries status and length, and
+// a BURST read returns the whole transmit side
+static volatile uint8_t* read_reg(ECTF_I2C_REGS reg) {
+    if (reg == BURST || reg == TRANSMIT_DONE) {
+        return TRANSMIT_BURST_REG;
+    }
+    return I2C_REGS[reg];
+}
+
+static int read_reg_len(ECTF_I2C_REGS reg) {
+    if (reg == BURST) {
+        return BURST_READ_HEADER_LEN + MAX_I2C_MESSAGE_LEN;
+    }
+    if (reg == TRANSMIT_DONE) {
+        return BURST_READ_HEADER_LEN;
+    }
+    return I2C_REGS_LEN[reg];
+}
+
+// Receive bank states
+#define BANK_FREE 0
+#define BANK_READY 1 // Holds a complete request
+#define BANK_OWNED 2 // Claimed by the component
+
+static volatile uint8_t bank_state[2] = {BANK_FREE, BANK_FREE};
+static volatile uint8_t landing_bank = 0;
+static volatile uint8_t owned_bank = 0;
+// DWT cycle count at the STOP of the last complete request
+static volatile uint32_t request_stamp = 0;
+
+/**
+ * @brief Point the receive registers at a bank
+*/
+static void select_landing_bank(uint8_t bank) {
+    landing_bank = bank;
+    I2C_REGS[RECEIVE_LEN] = &RECEIVE_BANK[bank][0];
+    I2C_REGS[RECEIVE] = &RECEIVE_BANK[bank][BURST_WRITE_HEADER_LEN];
+    I2C_REGS[BURST] = RECEIVE_BANK[bank];
+}
+
+/**
+ * @brief Hand a complete request to the component, called on STOP
+ * 
+ * The next request lands in the other bank when it is free, otherwise
+ * it overwrites this one as with a single register set
+*/
+static void receive_bank_done(void) {
+    request_stamp = DWT->CYCCNT;
+    bank_state[landing_bank] = BANK_READY;
+    if (bank_state[landing_bank ^ 1] == BANK_FREE) {
+        select_landing_bank(landing_bank ^ 1);
+    }
+}
+
 /******************************** FUNCTION PROTOTYPES ********************************/
 static void i2c_simple_isr(void);
 
@@ -79,11 +149,86 @@ int i2c_simple_peripheral_init(uint8_t addr) {
 
     // Prefix READY values for registers
     I2C_REGS[RECEIVE_DONE][0] = false;
-    I2C_REGS[TRANSMIT_DONE][0] = true;
+    I2C_REGS[TRANSMIT_DONE][0] = TRANSMIT_IDLE;
 
     return E_NO_ERROR;
 }
 
+/**
+ * @brief Set the value of the IDENTITY register
+ * 
+ * @param component_id: uint32_t, ID returned to the controller
+*/
+void i2c_simple_set_identity(uint32_t component_id) {
+    for (int i = 0; i < IDENTITY_LEN; i++) {
+        IDENTITY_REG[i] = component_id >> (8 * (IDENTITY_LEN - 1 - i));
+    }
+}
+
+/**
+ * @brief Claim the oldest complete request
+ * 
+ * @param len: uint8_t*, set to the request length
+ * 
+ * @return uint8_t*: request data, NULL if no request is waiting
+ *
+ * The bank belongs to the component until i2c_simple_receive_release(),
+ * requests arriving meanwhile land in the other bank
+*/
+uint8_t* i2c_simple_receive_claim(uint8_t* len) {
+    uint8_t* data = NULL;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    // The landing bank is the newer one when both are ready
+    uint8_t bank = landing_bank ^ 1;
+    if (bank_state[bank] != BANK_READY) {
+        bank = landing_bank;
+    }
+    if (bank_state[bank] == BANK_READY) {
+        bank_state[bank] = BANK_OWNED;
+        owned_bank = bank;
+        *len = RECEIVE_BANK[bank][0];
+        data = (uint8_t*)&RECEIVE_BANK[bank][BURST_WRITE_HEADER_LEN];
+        I2C_REGS[RECEIVE_DONE][0] = bank_state[bank ^ 1] == BANK_READY;
+    }
+    __set_PRIMASK(primask);
+
+    return data;
+}
+
+/**
+ * @brief Get the TRANSMIT register to build a response in place
+ * 
+ * @return uint8_t*: MAX_I2C_MESSAGE_LEN bytes, only valid to write while
+ * TRANSMIT_DONE is not TRANSMIT_READY
+*/
+uint8_t* i2c_simple_transmit_buffer(void) {
+    return (uint8_t*)TRANSMIT_REG;
+}
+
+/**
+ * @brief Get the cycle count at which the last request completed
+ * 
+ * @return uint32_t: DWT->CYCCNT sampled by the ISR on STOP
+*/
+uint32_t i2c_simple_request_stamp(void) {
+    return request_stamp;
+}
+
+/**
+ * @brief Return the claimed bank for new requests
+*/
+void i2c_simple_receive_release(void) {
+    __disable_irq();
+    bank_state[owned_bank] = BANK_FREE;
+    // A request that arrived while both banks were taken moves out of the way
+    if (bank_state[landing_bank] == BANK_READY) {
+        select_landing_bank(owned_bank);
+    }
+    __enable_irq();
+}
+
 /**
  * @brief ISR for the I2C Peripheral
  * 
@@ -93,6 +238,7 @@ int i2c_simple_peripheral_init(uint8_t addr) {
 void i2c_simple_isr (void) {
     // Variables for state of ISR
     static bool WRITE_START = false;
+    static bool READ_ACTIVE = false;
     static int READ_INDEX = 0;
     static int WRITE_INDEX = 0;
     static ECTF_I2C_REGS ACTIVE_REG = RECEIVE;
@@ -105,10 +251,15 @@ void i2c_simple_isr (void) {
         
         // Ready any remaining data
         if (WRITE_START == true) {
-            MXC_I2C_ReadRXFIFO(I2C_INTERFACE, (volatile unsigned char*) &ACTIVE_REG, 1);
+            // An address-only probe carries no register byte, a read
+            // already took its register byte on the repeated START
+            if (MXC_I2C_ReadRXFIFO(I2C_INTERFACE, (volatile unsigned char*) &ACTIVE_REG, 1) == 0 &&
+                !READ_ACTIVE) {
+                ACTIVE_REG = NUM_I2C_REGS;
+            }
             WRITE_START = false;
         }
-        if (ACTIVE_REG <= MAX_REG) {
+        if (ACTIVE_REG <= MAX_WRITE_REG) {
             int available = MXC_I2C_GetRXFIFOAvailable(I2C_INTERFACE);
             if (available < (I2C_REGS_LEN[ACTIVE_REG]-WRITE_INDEX)) {
                 WRITE_INDEX += MXC_I2C_ReadRXFIFO(I2C_INTERFACE,
@@ -124,6 +275,35 @@ void i2c_simple_isr (void) {
             MXC_I2C_ClearRXFIFO(I2C_INTERFACE);
         }
 
+        bool request_done = false;
+        if (ACTIVE_REG == RECEIVE_DONE && !READ_ACTIVE) {
+            request_done = I2C_REGS[RECEIVE_DONE][0];
+        }
+        if (ACTIVE_REG == BURST) {
+            if (!READ_ACTIVE && WRITE_INDEX >= BURST_WRITE_HEADER_LEN) {
+                // Length and data landed in one write, no RECEIVE_DONE write follows
+                I2C_REGS[RECEIVE_DONE][0] = true;
+                request_done = true;
+            } else if (READ_ACTIVE && I2C_REGS[TRANSMIT_DONE][0] == TRANSMIT_READY) {
+                // Bytes still sitting in the TX FIFO never reached the controller
+                int sent = READ_INDEX - (8 - MXC_I2C_GetTXFIFOAvailable(I2C_INTERFACE));
+                if (sent >= BURST_READ_HEADER_LEN + I2C_REGS[TRANSMIT_LEN][0]) {
+                    // The whole response was read, that is the ACK
+                    I2C_REGS[TRANSMIT_DONE][0] = TRANSMIT_IDLE;
+                }
+            }
+        }
+
+        if (request_done) {
+            receive_bank_done();
+        }
+
+        // A completed request means a response is on its way, let the
+        // controller tell a busy component from one that dropped the request
+        if (request_done && I2C_REGS[TRANSMIT_DONE][0] == TRANSMIT_IDLE) {
+            I2C_REGS[TRANSMIT_DONE][0] = TRANSMIT_BUSY;
+        }
+
         // Disable bulk send/receive interrupts
         MXC_I2C_DisableInt(I2C_INTERFACE, MXC_F_I2C_INTEN0_RX_THD, 0);
         MXC_I2C_DisableInt(I2C_INTERFACE, MXC_F_I2C_INTEN0_TX_THD, 0);
@@ -140,6 +320,7 @@ void i2c_simple_isr (void) {
         READ_INDEX = 0;
         WRITE_INDEX = 0;
         WRITE_START = false;
+        READ_ACTIVE = false;
 
         // Clear ISR flag
         MXC_I2C_ClearFlags(I2C_INTERFACE, MXC_F_I2C_INTFL0_STOP, 0);
@@ -156,9 +337,9 @@ void i2c_simple_isr (void) {
         // More data is needed within the FIFO
         if (ACTIVE_REG <= MAX_REG) {
             READ_INDEX += MXC_I2C_WriteTXFIFO(I2C_INTERFACE,
-                (volatile unsigned char*)&I2C_REGS[ACTIVE_REG][READ_INDEX],
-                I2C_REGS_LEN[ACTIVE_REG]-READ_INDEX);
-            if (I2C_REGS_LEN[ACTIVE_REG]-1 == READ_INDEX) {
+                (volatile unsigned char*)&read_reg(ACTIVE_REG)[READ_INDEX],
+                read_reg_len(ACTIVE_REG)-READ_INDEX);
+            if (read_reg_len(ACTIVE_REG)-1 == READ_INDEX) {
                 MXC_I2C_DisableInt(I2C_INTERFACE, MXC_F_I2C_INTEN0_TX_THD, 0);
             }
         }
@@ -178,11 +359,12 @@ void i2c_simple_isr (void) {
 
             // Select active register
             MXC_I2C_ReadRXFIFO(I2C_INTERFACE, (volatile unsigned char*) &ACTIVE_REG, 1);
+            READ_ACTIVE = true;
             
             // Write data to TX Buf
             if (ACTIVE_REG <= MAX_REG) {
-                READ_INDEX += MXC_I2C_WriteTXFIFO(I2C_INTERFACE, (volatile unsigned char*)I2C_REGS[ACTIVE_REG], I2C_REGS_LEN[ACTIVE_REG]);
-                if (READ_INDEX < I2C_REGS_LEN[ACTIVE_REG]) {
+                READ_INDEX += MXC_I2C_WriteTXFIFO(I2C_INTERFACE, (volatile unsigned char*)read_reg(ACTIVE_REG), read_reg_len(ACTIVE_REG));
+                if (READ_INDEX < read_reg_len(ACTIVE_REG)) {
                     MXC_I2C_EnableInt(I2C_INTERFACE, MXC_F_I2C_INTEN0_TX_THD, 0);
                 }
             }
@@ -209,7 +391,7 @@ void i2c_simple_isr (void) {
             WRITE_START = false;
         }
         // Read remaining data
-        if (ACTIVE_REG <= MAX_REG) {
+        if (ACTIVE_REG <= MAX_WRITE_REG) {
             int available = MXC_I2C_GetRXFIFOAvailable(I2C_INTERFACE);
             if (available < (I2C_REGS_LEN[ACTIVE_REG]-WRITE_INDEX)) {
                 WRITE_INDEX += MXC_I2C_ReadRXFIFO(I2C_INTERFACE,
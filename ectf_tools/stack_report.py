@@ -0,0 +1,168 @@
+# @file stack_report.py
+# @brief host tool for worst-case stack usage of a firmware build
+# @date 2024
+#
+# Reads the call graphs gcc writes with -fcallgraph-info=su (STACK_USAGE=1
+# in project.mk) and prints the deepest stack reachable from every entry
+# point. Functions with a dynamic frame, calls through pointers, recursion
+# and callees without stack information only give a lower bound, which is
+# marked next to the depth.
+
+import argparse
+import os
+import re
+import sys
+
+# VCG node and edge records in a .ci file
+NODE_RE = re.compile(r'node: \{ title: "([^"]*)" label: "([^"]*)"( shape : ellipse)?')
+EDGE_RE = re.compile(r'edge: \{ sourcename: "([^"]*)" targetname: "([^"]*)"')
+# Frame size line of a node label, "N bytes (static)"
+FRAME_RE = re.compile(r"(\d+) bytes \((\w+)(?:,\w+)*\)")
+
+# Marks for a depth that is only a lower bound
+DYNAMIC = "D"  # frame size depends on the arguments
+INDIRECT = "I"  # call through a function pointer
+RECURSION = "R"  # call cycle
+UNKNOWN = "U"  # callee built without stack information
+
+
+class CallGraph:
+    def __init__(self):
+        self.frames = {}  # node -> frame bytes
+        self.dynamic = set()
+        self.edges = {}  # node -> callees
+        self.globals = {}  # plain name -> node of its definition
+
+    def load(self, path):
+        with open(path) as f:
+            text = f.read()
+        for title, label, ellipse in NODE_RE.findall(text):
+            # Functions defined elsewhere have no frame in this file
+            if ellipse:
+                continue
+            match = FRAME_RE.search(label)
+            self.frames[title] = int(match.group(1)) if match else 0
+            if match and match.group(2) != "static":
+                self.dynamic.add(title)
+            if ":" not in title:
+                self.globals[title] = title
+        for source, target in EDGE_RE.findall(text):
+            self.edges.setdefault(source, []).append(target)
+
+    def resolve(self, node):
+        # A call into another file only names the function
+        return self.globals.get(node, node)
+
+    def roots(self):
+        called = {self.resolve(t) for targets in self.edges.values() for t in targets}
+        return [n for n in self.frames if n not in called]
+
+    def depth(self, node, memo, stack):
+        """Worst-case bytes below and including node, with its marks"""
+        node = self.resolve(node)
+        if node in memo:
+            return memo[node]
+        if node == "__indirect_call":
+            return 0, {INDIRECT}
+        if node in stack:
+            return 0, {RECURSION}
+        if node not in self.frames:
+            return 0, {UNKNOWN}
+
+        stack.add(node)
+        deepest, marks = 0, set()
+        for callee in self.edges.get(node, []):
+            bytes_, callee_marks = self.depth(callee, memo, stack)
+            marks |= callee_marks
+            deepest = max(deepest, bytes_)
+        stack.discard(node)
+
+        if node in self.dynamic:
+            marks.add(DYNAMIC)
+        result = (self.frames[node] + deepest, marks)
+        # A depth inside a cycle depends on where the cycle was entered
+        if RECURSION not in marks:
+            memo[node] = result
+        return result
+
+
+def load_graph(build_dir):
+    graph = CallGraph()
+    found = False
+    for dirpath, _, filenames in os.walk(build_dir):
+        for name in filenames:
+            if name.endswith(".ci"):
+                graph.load(os.path.join(dirpath, name))
+                found = True
+    if not found:
+        sys.exit(f"No .ci files under {build_dir}, build with STACK_USAGE=1")
+    return graph
+
+
+def entry_depths(graph, entries):
+    memo = {}
+    depths = {}
+    for entry in entries or graph.roots():
+        if graph.resolve(entry) not in graph.frames:
+            continue
+        bytes_, marks = graph.depth(entry, memo, set())
+        depths[entry.split(":")[-1]] = (bytes_, "".join(sorted(marks)))
+    return depths
+
+
+def report(args):
+    graph = load_graph(args.build_dir)
+    entries = args.entry
+    before = None
+    if args.baseline:
+        baseline = load_graph(args.baseline)
+        # Inlining can change which functions are entry points, compare
+        # the same set in both builds
+        entries = entries or sorted(set(graph.roots()) | set(baseline.roots()))
+        before = entry_depths(baseline, entries)
+    depths = entry_depths(graph, entries)
+
+    names = sorted(depths, key=lambda n: depths[n][0], reverse=True)[: args.top]
+    if before is None:
+        print(f"{'entry point':<40} {'bytes':>8}")
+        for name in names:
+            bytes_, marks = depths[name]
+            print(f"{name:<40} {bytes_:>8} {marks}")
+    else:
+        print(f"{'entry point':<40} {'before':>8}    {'after':>8}    {'change':>8}")
+        for name in names:
+            bytes_, marks = depths[name]
+            old, old_marks = before.get(name, (0, "-"))
+            print(f"{name:<40} {old:>8} {old_marks:<3}{bytes_:>8} {marks:<3}{bytes_ - old:>+8}")
+    print(f"\n{DYNAMIC}: dynamic frame, {INDIRECT}: indirect call, "
+          f"{RECURSION}: recursion, {UNKNOWN}: callee without stack information")
+
+
+# Main function
+def main():
+    parser = argparse.ArgumentParser(
+        prog="eCTF Stack Report Tool",
+        description="Report the worst-case stack usage of each firmware entry point",
+    )
+
+    parser.add_argument(
+        "build_dir", help="Build directory of a firmware built with STACK_USAGE=1"
+    )
+    parser.add_argument(
+        "-b", "--baseline", help="Build directory to compare against"
+    )
+    parser.add_argument(
+        "-e", "--entry", action="append",
+        help="Entry point to report, repeatable. Defaults to every uncalled function"
+    )
+    parser.add_argument(
+        "-n", "--top", type=int, default=40, help="Number of entry points to list"
+    )
+
+    args = parser.parse_args()
+
+    report(args)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,685 @@
+/**
+ * @file link_model.c
+ * @brief Host-side model of the AP <-> component board link wire cost
+ *
+ * Counts the bytes every I2C transaction puts on the bus and converts them
+ * to time at a given SCL frequency. Every byte costs 9 clocks (8 data + ACK)
+ * and every transaction pays START, address and STOP on top.
+ *
+ * The key sync section also runs the XOR key agreement for up to
+ * KEY_SYNC_MAX_COMPONENTS simulated components and checks they all derive
+ * the AP's key. The resumption section compares getting one component that
+ * reset back with its ticket against a full key sync.
+ *
+ * Build and run on the host:
+ *     gcc -O2 -o link_model tests/link_model.c && ./link_model
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_I2C_MESSAGE_LEN 256
+#define BLOCK_SIZE 16
+// [len][epoch][counter, 4][tag, 8]
+#define FRAME_HEADER_LEN 14
+#define MESSAGE_HEADER_LEN 21
+#define BURST_WRITE_HEADER_LEN 1
+#define BURST_READ_HEADER_LEN 2
+#define IDENTITY_LEN 4
+
+#define I2C_FREQ 100000
+#define I2C_FREQ_FAST 400000
+#define I2C_FREQ_FAST_PLUS 1000000
+// Addresses 0x08-0x77 less the three reserved on the MAX78000FTHR
+#define SCAN_ADDRESSES (0x78 - 0x08 - 3)
+#define COMPONENT_CNT 2
+// Shortest transaction put on DMA with I2C_USE_DMA=1
+#define I2C_DMA_MIN_LEN 16
+#define MAX_POSTBOOT_LEN (240 - MESSAGE_HEADER_LEN)
+#define STREAM_HEADER_LEN 4
+#define MAX_STREAM_FRAGMENT (MAX_POSTBOOT_LEN - STREAM_HEADER_LEN)
+// Assumed component time to decrypt, check and answer one frame
+#define COMPONENT_FRAME_US 300
+// Key sync: DEAD trigger, [r ^ k2][0]['2'] request, 16 byte share and final
+#define KEY_SHARE_LEN 16
+#define KEY_SYNC_TRIGGER_LEN 64
+#define KEY_SYNC_REQUEST_LEN 18
+#define KEY_SYNC_MAX_COMPONENTS 32
+// Assumed component time to wake up and answer a key sync message
+#define COMPONENT_SYNC_US 100
+// Resumption: "RSUM" | nonce request, nonce | tag proof, key | counters grant
+#define RESUME_REQUEST_LEN 20
+#define RESUME_PROOF_LEN 24
+#define RESUME_GRANT_LEN 40
+// Assumed component time for the ticket AES and tag of each resume step
+#define COMPONENT_RESUME_US 150
+// First backoff step of the AP's response polling
+#define POLL_MIN_DELAY_US 20
+
+// START + STOP cost roughly two clocks on top of the data bytes,
+// a repeated START about one more
+#define TRANSACTION_OVERHEAD_CLOCKS 2
+#define RESTART_OVERHEAD_CLOCKS 1
+#define CLOCKS_PER_BYTE 9
+
+/******************************** BUS ACCOUNTING ********************************/
+typedef struct {
+    unsigned transactions;
+    unsigned restarts;
+    unsigned bytes; // address bytes included
+} bus_cost;
+
+// Register write: address, register byte, data
+static void reg_write(bus_cost *c, unsigned len) {
+    c->transactions++;
+    c->bytes += 1 + 1 + len;
+}
+
+// Register read: address + register byte, repeated START, address + data
+static void reg_read(bus_cost *c, unsigned len) {
+    c->transactions++;
+    c->restarts++;
+    c->bytes += 1 + 1 + 1 + len;
+}
+
+static double cost_us(const bus_cost *c, unsigned freq) {
+    double clocks = (double)c->bytes * CLOCKS_PER_BYTE +
+                    (double)c->transactions * TRANSACTION_OVERHEAD_CLOCKS +
+                    (double)c->restarts * RESTART_OVERHEAD_CLOCKS;
+    return clocks * 1e6 / freq;
+}
+
+/******************************** WIRE FORMATS ********************************/
+// Bytes that go into the RECEIVE/TRANSMIT data register for a payload
+static unsigned legacy_wire_len(unsigned payload) {
+    (void)payload;
+    return MAX_I2C_MESSAGE_LEN - 1;
+}
+
+static unsigned framed_wire_len(unsigned payload) {
+    unsigned padded = (payload + BLOCK_SIZE - 1) & ~(BLOCK_SIZE - 1);
+    return FRAME_HEADER_LEN + padded;
+}
+
+// send_packet(): RECEIVE_LEN, RECEIVE, RECEIVE_DONE
+static void send_leg(bus_cost *c, unsigned wire) {
+    reg_write(c, 1);
+    reg_write(c, wire);
+    reg_write(c, 1);
+}
+
+// poll_and_receive_packet() with a single successful poll
+static void receive_leg(bus_cost *c, unsigned wire) {
+    reg_read(c, 1);
+    reg_read(c, 1);
+    reg_read(c, wire);
+    reg_write(c, 1);
+}
+
+// send_packet() with the BURST register: [len][data] and RECEIVE_DONE in one write
+static void burst_send_leg(bus_cost *c, unsigned wire) {
+    reg_write(c, BURST_WRITE_HEADER_LEN + wire);
+}
+
+// poll_and_receive_packet() with the BURST register: one status + length
+// poll, then [status][len][data] in one read that also acknowledges it
+static void burst_receive_leg(bus_cost *c, unsigned wire) {
+    reg_read(c, BURST_READ_HEADER_LEN);
+    reg_read(c, BURST_READ_HEADER_LEN + wire);
+}
+
+/******************************** REPORT ********************************/
+typedef struct {
+    const char *name;
+    unsigned request;  // AP -> component payload
+    unsigned response; // component -> AP payload
+} exchange;
+
+static const exchange exchanges[] = {
+    {"validate/boot", MESSAGE_HEADER_LEN, MESSAGE_HEADER_LEN + 32},
+    {"attest", MESSAGE_HEADER_LEN, MESSAGE_HEADER_LEN + 64},
+    {"post-boot 16B", MESSAGE_HEADER_LEN + 16, MESSAGE_HEADER_LEN},
+    {"post-boot 64B", MESSAGE_HEADER_LEN + 64, MESSAGE_HEADER_LEN},
+};
+
+static void report_framing(unsigned freq) {
+    printf("Secure framing at %u Hz (one request/response exchange)\n", freq);
+    printf("%-16s %12s %12s %12s %12s\n", "exchange", "legacy B",
+           "framed B", "legacy ms", "framed ms");
+    for (unsigned i = 0; i < sizeof(exchanges) / sizeof(exchanges[0]); i++) {
+        bus_cost legacy = {0}, framed = {0};
+        send_leg(&legacy, legacy_wire_len(exchanges[i].request));
+        receive_leg(&legacy, legacy_wire_len(exchanges[i].response));
+        send_leg(&framed, framed_wire_len(exchanges[i].request));
+        receive_leg(&framed, framed_wire_len(exchanges[i].response));
+        printf("%-16s %12u %12u %12.2f %12.2f\n", exchanges[i].name,
+               legacy.bytes, framed.bytes, cost_us(&legacy, freq) / 1000,
+               cost_us(&framed, freq) / 1000);
+    }
+    printf("\n");
+}
+
+static void report_burst(unsigned freq) {
+    printf("BURST register at %u Hz (framed exchange, one poll)\n", freq);
+    printf("%-16s %12s %12s %12s %12s\n", "exchange", "regs txn",
+           "burst txn", "regs ms", "burst ms");
+    for (unsigned i = 0; i < sizeof(exchanges) / sizeof(exchanges[0]); i++) {
+        bus_cost regs = {0}, burst = {0};
+        send_leg(&regs, framed_wire_len(exchanges[i].request));
+        receive_leg(&regs, framed_wire_len(exchanges[i].response));
+        burst_send_leg(&burst, framed_wire_len(exchanges[i].request));
+        burst_receive_leg(&burst, framed_wire_len(exchanges[i].response));
+        printf("%-16s %12u %12u %12.2f %12.2f\n", exchanges[i].name,
+               regs.transactions, burst.transactions,
+               cost_us(&regs, freq) / 1000, cost_us(&burst, freq) / 1000);
+    }
+    printf("\n");
+}
+
+/******************************** COMMANDS ********************************/
+// BEEF scan of every address. Absent addresses NACK the address byte of
+// the burst write and stay at standard mode since they were never
+// negotiated, present ones run at the negotiated speed
+static double beef_scan_us(unsigned freq) {
+    bus_cost absent = {0}, present = {0};
+    for (unsigned i = 0; i < SCAN_ADDRESSES - COMPONENT_CNT; i++) {
+        absent.transactions++;
+        absent.bytes++;
+    }
+    for (unsigned i = 0; i < COMPONENT_CNT; i++) {
+        burst_send_leg(&present, legacy_wire_len(0));
+        burst_receive_leg(&present, legacy_wire_len(0));
+    }
+    return cost_us(&absent, I2C_FREQ) + cost_us(&present, freq);
+}
+
+// Address-only probe of every address, then an IDENTITY read of the ones
+// that acknowledged
+static double scan_us(unsigned freq) {
+    bus_cost absent = {0}, present = {0};
+    for (unsigned i = 0; i < SCAN_ADDRESSES - COMPONENT_CNT; i++) {
+        absent.transactions++;
+        absent.bytes++;
+    }
+    for (unsigned i = 0; i < COMPONENT_CNT; i++) {
+        present.transactions++;
+        present.bytes++;
+        reg_read(&present, IDENTITY_LEN);
+    }
+    return cost_us(&absent, I2C_FREQ) + cost_us(&present, freq);
+}
+
+static double exchange_us(const exchange *e, unsigned freq) {
+    bus_cost c = {0};
+    burst_send_leg(&c, framed_wire_len(e->request));
+    burst_receive_leg(&c, framed_wire_len(e->response));
+    return cost_us(&c, freq);
+}
+
+// CPU time of one framed exchange. The blocking driver spins for the whole
+// transaction, with DMA only status polls below I2C_DMA_MIN_LEN keep it busy
+static void report_dma(unsigned freq) {
+    printf("DMA path at %u Hz (framed exchange, one poll)\n", freq);
+    printf("%-16s %12s %12s %12s %12s\n", "exchange", "fifo cpu ms",
+           "dma cpu ms", "copied B", "copied B dma");
+    for (unsigned i = 0; i < sizeof(exchanges) / sizeof(exchanges[0]); i++) {
+        unsigned req = framed_wire_len(exchanges[i].request);
+        unsigned resp = framed_wire_len(exchanges[i].response);
+        bus_cost fifo = {0}, cpu = {0};
+        burst_send_leg(&fifo, req);
+        burst_receive_leg(&fifo, resp);
+        reg_read(&cpu, BURST_READ_HEADER_LEN);
+        // The staging copy into the driver packet and the frame copy out of
+        // the burst are gone, the plaintext still passes through the frame
+        unsigned copied = (1 + BURST_WRITE_HEADER_LEN + req) + resp + exchanges[i].request;
+        printf("%-16s %12.2f %12.2f %12u %12u\n", exchanges[i].name,
+               cost_us(&fifo, freq) / 1000, cost_us(&cpu, freq) / 1000, copied,
+               exchanges[i].request);
+    }
+    printf("\n");
+}
+
+// Pre-boot presence check of the provisioned addresses only
+static double presence_us(unsigned freq) {
+    bus_cost c = {0};
+    for (unsigned i = 0; i < COMPONENT_CNT; i++) {
+        c.transactions++;
+        c.bytes++;
+        reg_read(&c, IDENTITY_LEN);
+    }
+    return cost_us(&c, freq);
+}
+
+static void report_list(unsigned freq) {
+    printf("List at %u Hz (%u components)\n", freq, COMPONENT_CNT);
+    printf("%-16s %12s\n", "scan", "bus ms");
+    printf("%-16s %12.2f\n", "BEEF burst", beef_scan_us(freq) / 1000);
+    printf("%-16s %12.2f\n", "probe+IDENTITY", scan_us(freq) / 1000);
+    printf("%-16s %12.2f\n", "pre-boot check", presence_us(freq) / 1000);
+    printf("%-16s %12.2f\n", "cached check", 0.0);
+    printf("\n");
+}
+
+static void report_speeds(void) {
+    static const unsigned speeds[] = {I2C_FREQ, I2C_FREQ_FAST, I2C_FREQ_FAST_PLUS};
+    printf("Command bus time per negotiated speed (%u components)\n", COMPONENT_CNT);
+    printf("%-10s %12s %12s %12s\n", "speed Hz", "list ms", "boot ms", "attest ms");
+    for (unsigned i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++) {
+        double list = scan_us(speeds[i]);
+        // boot repeats the scan to check IDs, then validates each component
+        double boot = scan_us(speeds[i]) +
+                      COMPONENT_CNT * exchange_us(&exchanges[0], speeds[i]);
+        double attest = exchange_us(&exchanges[1], speeds[i]);
+        printf("%-10u %12.2f %12.2f %12.2f\n", speeds[i], list / 1000,
+               boot / 1000, attest / 1000);
+    }
+    printf("\n");
+}
+
+/******************************** STREAMS ********************************/
+// AP -> component post-boot transfer as repeated secure_send() calls, each
+// paying its own challenge/answer exchange
+static double repeated_send_us(unsigned len, unsigned freq) {
+    double t = 0;
+    for (unsigned off = 0; off < len; off += MAX_POSTBOOT_LEN) {
+        unsigned chunk = len - off < MAX_POSTBOOT_LEN ? len - off : MAX_POSTBOOT_LEN;
+        exchange open = {"", MESSAGE_HEADER_LEN, MESSAGE_HEADER_LEN};
+        bus_cost data = {0};
+        burst_send_leg(&data, framed_wire_len(MESSAGE_HEADER_LEN + chunk));
+        t += exchange_us(&open, freq) + cost_us(&data, freq) + 2 * COMPONENT_FRAME_US;
+    }
+    return t;
+}
+
+// The same transfer as one secure_send_stream(): one challenge/answer, then
+// acknowledged fragments. With a window of two the next fragment is on the
+// wire while the component works on the previous one
+static double stream_send_us(unsigned len, unsigned freq, unsigned window) {
+    exchange open = {"", MESSAGE_HEADER_LEN, MESSAGE_HEADER_LEN};
+    double t = exchange_us(&open, freq) + COMPONENT_FRAME_US;
+    for (unsigned off = 0; off < len; off += MAX_STREAM_FRAGMENT) {
+        unsigned chunk = len - off < MAX_STREAM_FRAGMENT ? len - off : MAX_STREAM_FRAGMENT;
+        bus_cost send = {0}, ack = {0};
+        burst_send_leg(&send, framed_wire_len(MESSAGE_HEADER_LEN + STREAM_HEADER_LEN + chunk));
+        burst_receive_leg(&ack, framed_wire_len(MESSAGE_HEADER_LEN + 2));
+        double send_us = cost_us(&send, freq);
+        if (window > 1 && off > 0) {
+            t += cost_us(&ack, freq) + (send_us > COMPONENT_FRAME_US ? send_us : COMPONENT_FRAME_US);
+        } else {
+            t += send_us + COMPONENT_FRAME_US + cost_us(&ack, freq);
+        }
+    }
+    return t;
+}
+
+static void report_streams(unsigned freq) {
+    static const unsigned sizes[] = {512, 1024, 4096};
+    printf("Post-boot throughput at %u Hz, AP -> component (%u us per frame)\n",
+           freq, COMPONENT_FRAME_US);
+    printf("%-10s %14s %14s %14s\n", "bytes", "repeated B/s", "window 1 B/s",
+           "window 2 B/s");
+    for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        printf("%-10u %14.0f %14.0f %14.0f\n", sizes[i],
+               sizes[i] * 1e6 / repeated_send_us(sizes[i], freq),
+               sizes[i] * 1e6 / stream_send_us(sizes[i], freq, 1),
+               sizes[i] * 1e6 / stream_send_us(sizes[i], freq, 2));
+    }
+    printf("\n");
+}
+
+/******************************** SESSIONS ********************************/
+// One post-boot secure_send(): challenge, answer, then the message
+static double handshake_message_us(unsigned payload, unsigned freq) {
+    exchange open = {"", MESSAGE_HEADER_LEN, MESSAGE_HEADER_LEN};
+    bus_cost data = {0};
+    burst_send_leg(&data, framed_wire_len(MESSAGE_HEADER_LEN + payload));
+    return exchange_us(&open, freq) + cost_us(&data, freq) + 2 * COMPONENT_FRAME_US;
+}
+
+// The same message inside an open session: one frame with a counter
+static double session_message_us(unsigned payload, unsigned freq) {
+    bus_cost data = {0};
+    burst_send_leg(&data, framed_wire_len(MESSAGE_HEADER_LEN + payload));
+    return cost_us(&data, freq) + COMPONENT_FRAME_US;
+}
+
+static void report_sessions(unsigned freq) {
+    static const unsigned sizes[] = {16, 64, MAX_POSTBOOT_LEN};
+    printf("Post-boot messages per second at %u Hz\n", freq);
+    printf("%-10s %14s %14s\n", "payload B", "handshake", "session");
+    for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        printf("%-10u %14.0f %14.0f\n", sizes[i],
+               1e6 / handshake_message_us(sizes[i], freq),
+               1e6 / session_message_us(sizes[i], freq));
+    }
+    printf("\n");
+}
+
+/******************************** BOOT PIPELINE ********************************/
+// Validate phase of boot for n components. Serial issues one command and
+// waits for its answer before the next; pipelined sends every command first
+// and collects the answers as they come, so the components decrypt in parallel
+static void report_boot_pipeline(unsigned freq) {
+    static const unsigned counts[] = {2, 8, 32};
+    bus_cost send = {0}, receive = {0};
+    burst_send_leg(&send, framed_wire_len(exchanges[0].request));
+    burst_receive_leg(&receive, framed_wire_len(exchanges[0].response));
+    double send_us = cost_us(&send, freq);
+    double receive_us = cost_us(&receive, freq);
+
+    printf("Validate and boot at %u Hz (%u us per frame)\n", freq, COMPONENT_FRAME_US);
+    printf("%-12s %12s %12s\n", "components", "serial ms", "pipelined ms");
+    for (unsigned i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        unsigned n = counts[i];
+        double serial = n * (send_us + COMPONENT_FRAME_US + receive_us);
+        // The first component works while the others are being sent to
+        double idle = COMPONENT_FRAME_US - (n - 1) * send_us;
+        double pipelined = n * (send_us + receive_us) + (idle > 0 ? idle : 0);
+        printf("%-12u %12.2f %12.2f\n", n, serial / 1000, pipelined / 1000);
+    }
+    printf("\n");
+}
+
+/******************************** KEY SYNC ********************************/
+static uint32_t rng_state = 0x2024ec7f;
+
+static void fill_random(uint8_t *out, unsigned len) {
+    for (unsigned i = 0; i < len; i++) {
+        rng_state ^= rng_state << 13;
+        rng_state ^= rng_state >> 17;
+        rng_state ^= rng_state << 5;
+        out[i] = rng_state;
+    }
+}
+
+static void xor16(const uint8_t *a, const uint8_t *b, uint8_t *dest) {
+    for (unsigned i = 0; i < KEY_SHARE_LEN; i++) {
+        dest[i] = a[i] ^ b[i];
+    }
+}
+
+// One key_exchange() with n components, the AP side and each component's
+// sync2() step for step. Returns 1 if every component holds the AP's key
+static int key_sync_agrees(unsigned n) {
+    uint8_t ap_share[KEY_SHARE_LEN], mask[KEY_SHARE_LEN], final_mask[KEY_SHARE_LEN];
+    uint8_t share[KEY_SYNC_MAX_COMPONENTS][KEY_SHARE_LEN];
+    uint8_t pad[KEY_SYNC_MAX_COMPONENTS][KEY_SHARE_LEN];
+    uint8_t held[KEY_SYNC_MAX_COMPONENTS][KEY_SHARE_LEN];
+    uint8_t ap_key[KEY_SHARE_LEN] = {0}, msg[KEY_SHARE_LEN];
+    fill_random(ap_share, KEY_SHARE_LEN);
+    fill_random(mask, KEY_SHARE_LEN);
+    fill_random(final_mask, KEY_SHARE_LEN);
+
+    for (unsigned i = 0; i < n; i++) {
+        fill_random(share[i], KEY_SHARE_LEN);
+        fill_random(pad[i], KEY_SHARE_LEN);
+        xor16(pad[i], ap_share, msg);            // AP: r_i ^ k2
+        xor16(msg, share[i], held[i]);           // component: r_i ^ k2 ^ k_i
+    }
+    for (unsigned i = 0; i < n; i++) {
+        xor16(share[i], mask, msg);              // component: k_i ^ M
+        xor16(msg, mask, msg);                   // AP: k_i
+        xor16(ap_key, msg, ap_key);
+        xor16(pad[i], msg, pad[i]);
+    }
+    for (unsigned i = 0; i < n; i++) {
+        xor16(ap_key, pad[i], msg);              // AP: final message
+        xor16(msg, final_mask, msg);
+        xor16(held[i], msg, held[i]);            // component: sync2()
+        xor16(held[i], final_mask, held[i]);
+    }
+    xor16(ap_key, ap_share, ap_key);
+
+    for (unsigned i = 0; i < n; i++) {
+        if (memcmp(held[i], ap_key, KEY_SHARE_LEN)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// key_sync() with n components: 64 byte triggers, every request, the
+// replies and the finals
+static double key_sync_fanned_us(unsigned n, unsigned freq) {
+    bus_cost trigger = {0}, request = {0}, reply = {0}, final = {0};
+    burst_send_leg(&trigger, KEY_SYNC_TRIGGER_LEN);
+    burst_send_leg(&request, KEY_SYNC_REQUEST_LEN);
+    burst_receive_leg(&reply, KEY_SHARE_LEN);
+    burst_send_leg(&final, KEY_SHARE_LEN);
+    double request_us = cost_us(&request, freq);
+    // The first component answers while the others are being sent to
+    double idle = COMPONENT_SYNC_US - (n - 1) * request_us;
+    return n * (cost_us(&trigger, freq) + request_us + cost_us(&reply, freq) +
+                cost_us(&final, freq)) + (idle > 0 ? idle : 0);
+}
+
+// Bus time of key sync with n components. Serial runs request and reply
+// per component after a full-register DEAD trigger, as the old
+// two-component exchange did. Fanned out sends a 64 byte trigger and every
+// request before collecting the first reply
+static void report_key_sync(unsigned freq) {
+    static const unsigned counts[] = {1, 2, 8, 16, 32};
+    bus_cost legacy_trigger = {0}, request = {0}, reply = {0}, final = {0};
+    burst_send_leg(&legacy_trigger, legacy_wire_len(0));
+    burst_send_leg(&request, KEY_SYNC_REQUEST_LEN);
+    burst_receive_leg(&reply, KEY_SHARE_LEN);
+    burst_send_leg(&final, KEY_SHARE_LEN);
+    double legacy_trigger_us = cost_us(&legacy_trigger, freq);
+    double request_us = cost_us(&request, freq);
+    double reply_us = cost_us(&reply, freq);
+    double final_us = cost_us(&final, freq);
+
+    printf("Key sync at %u Hz (%u us per component answer)\n", freq, COMPONENT_SYNC_US);
+    printf("%-12s %10s %12s %12s %8s\n", "components", "messages", "serial ms",
+           "fanned ms", "agrees");
+    for (unsigned i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        unsigned n = counts[i];
+        double serial = n * (legacy_trigger_us + request_us + COMPONENT_SYNC_US +
+                             reply_us + final_us);
+        double fanned = key_sync_fanned_us(n, freq);
+        printf("%-12u %10u %12.2f %12.2f %8s\n", n, 4 * n, serial / 1000,
+               fanned / 1000, key_sync_agrees(n) ? "yes" : "NO");
+    }
+    printf("\n");
+}
+
+// Timeline of one two-component key exchange, AP polling included
+typedef struct {
+    double now;       // AP time, us
+    double busy_poll; // status read that finds TRANSMIT_BUSY
+    double request, reply, final;
+    int print;
+} sync_trace;
+
+static void trace_event(sync_trace *t, double start, double end, const char *who,
+                        const char *what, unsigned component) {
+    if (t->print) {
+        printf("  %8.3f %8.3f  %-4s %s C%u\n", start / 1000, end / 1000, who, what,
+               component + 1);
+    }
+}
+
+static void trace_request(sync_trace *t, unsigned i, double *ready) {
+    trace_event(t, t->now, t->now + t->request, "bus", "request ->", i);
+    t->now += t->request;
+    *ready = t->now + COMPONENT_SYNC_US;
+    trace_event(t, t->now, *ready, "comp", "answers", i);
+}
+
+static void trace_reply(sync_trace *t, unsigned i) {
+    trace_event(t, t->now, t->now + t->reply, "bus", "reply <-", i);
+    t->now += t->reply;
+}
+
+static void trace_finals(sync_trace *t) {
+    for (unsigned i = 0; i < 2; i++) {
+        trace_event(t, t->now, t->now + t->final, "bus", "final ->", i);
+        t->now += t->final;
+    }
+}
+
+// Old key_exchange2(): request, wait_transmit_ready() with backoff, reply,
+// then the next component
+static double trace_serial(sync_trace *t) {
+    double ready[2];
+    unsigned delay = POLL_MIN_DELAY_US;
+    t->now = 0;
+    for (unsigned i = 0; i < 2; i++) {
+        trace_request(t, i, &ready[i]);
+        for (delay = POLL_MIN_DELAY_US; t->now + t->busy_poll < ready[i]; delay *= 2) {
+            trace_event(t, t->now, t->now + t->busy_poll, "bus", "busy poll", i);
+            t->now += t->busy_poll + delay;
+        }
+        trace_reply(t, i);
+    }
+    trace_finals(t);
+    return t->now;
+}
+
+// key_exchange(): both requests, then sweep status reads and take the
+// replies in the order the components finish
+static double trace_parallel(sync_trace *t) {
+    double ready[2];
+    unsigned pending = 3;
+    t->now = 0;
+    for (unsigned i = 0; i < 2; i++) {
+        trace_request(t, i, &ready[i]);
+    }
+    while (pending) {
+        unsigned swept = pending;
+        for (unsigned i = 0; i < 2; i++) {
+            if (!(pending & (1u << i))) {
+                continue;
+            }
+            if (t->now + t->busy_poll < ready[i]) {
+                trace_event(t, t->now, t->now + t->busy_poll, "bus", "busy poll", i);
+                t->now += t->busy_poll;
+                continue;
+            }
+            // The sweep's status read, then receive_ready_packet()
+            trace_reply(t, i);
+            pending &= ~(1u << i);
+        }
+        if (pending == swept) {
+            t->now += POLL_MIN_DELAY_US;
+        }
+    }
+    trace_finals(t);
+    return t->now;
+}
+
+static sync_trace key_sync_timing(unsigned freq, int print) {
+    bus_cost poll = {0}, request = {0}, reply = {0}, final = {0};
+    reg_read(&poll, BURST_READ_HEADER_LEN);
+    burst_send_leg(&request, KEY_SYNC_REQUEST_LEN);
+    // One status read that finds the reply, then the burst read
+    burst_receive_leg(&reply, KEY_SHARE_LEN);
+    burst_send_leg(&final, KEY_SHARE_LEN);
+    sync_trace t = {0, cost_us(&poll, freq), cost_us(&request, freq),
+                    cost_us(&reply, freq), cost_us(&final, freq), print};
+    return t;
+}
+
+static void report_key_sync_trace(unsigned freq) {
+    static const unsigned speeds[] = {I2C_FREQ, I2C_FREQ_FAST, I2C_FREQ_FAST_PLUS};
+    sync_trace t = key_sync_timing(freq, 1);
+
+    printf("Two-component key exchange trace at %u Hz (%u us per answer)\n", freq,
+           COMPONENT_SYNC_US);
+    printf("  %8s %8s  %-4s %s\n", "start ms", "end ms", "who", "event");
+    printf("serial, one round trip after the other\n");
+    trace_serial(&t);
+    printf("parallel, both requests before the first reply\n");
+    trace_parallel(&t);
+
+    printf("%-10s %12s %12s %12s\n", "speed Hz", "serial ms", "parallel ms", "saved ms");
+    for (unsigned i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++) {
+        t = key_sync_timing(speeds[i], 0);
+        double serial = trace_serial(&t);
+        double parallel = trace_parallel(&t);
+        printf("%-10u %12.3f %12.3f %12.3f\n", speeds[i], serial / 1000,
+               parallel / 1000, (serial - parallel) / 1000);
+    }
+    printf("\n");
+}
+
+/******************************** COLD START ********************************/
+// Whole key sync for two components: triggers, then the overlapped exchange
+static double key_sync_us(unsigned freq) {
+    bus_cost trigger = {0};
+    burst_send_leg(&trigger, KEY_SYNC_TRIGGER_LEN);
+    sync_trace t = key_sync_timing(freq, 0);
+    return COMPONENT_CNT * cost_us(&trigger, freq) + trace_parallel(&t);
+}
+
+// Boot command after the keys are synced: presence check, then validate
+// every component
+static double boot_command_us(unsigned freq) {
+    return presence_us(freq) + COMPONENT_CNT * exchange_us(&exchanges[0], freq);
+}
+
+// Lazy syncs when the first command arrives, eager right after init() while
+// the AP waits for input. Ready is when a command would find the keys synced
+static void report_cold_start(unsigned freq) {
+    double sync = presence_us(freq) + key_sync_us(freq);
+    double boot = boot_command_us(freq);
+    printf("Cold start at %u Hz (%u components, after init)\n", freq, COMPONENT_CNT);
+    printf("%-8s %16s %18s\n", "sync", "ready ms", "first boot ms");
+    printf("%-8s %16s %18.2f\n", "lazy", "first command", (sync + boot) / 1000);
+    printf("%-8s %16.2f %18.2f\n", "eager", sync / 1000, boot / 1000);
+    printf("\n");
+}
+
+/******************************** RESUMPTION ********************************/
+// key_resume() with the component that reset: request, one status read
+// after the proof is ready, proof, grant, and the grant check before the
+// component takes the retried command
+static double resume_us(unsigned freq) {
+    bus_cost request = {0}, proof = {0}, grant = {0};
+    burst_send_leg(&request, RESUME_REQUEST_LEN);
+    burst_receive_leg(&proof, RESUME_PROOF_LEN);
+    burst_send_leg(&grant, RESUME_GRANT_LEN);
+    return cost_us(&request, freq) + COMPONENT_RESUME_US + cost_us(&proof, freq) +
+           cost_us(&grant, freq) + COMPONENT_RESUME_US;
+}
+
+// One component reset: resume it, or fall back to key sync with all n
+static void report_resume(void) {
+    static const unsigned speeds[] = {I2C_FREQ, I2C_FREQ_FAST, I2C_FREQ_FAST_PLUS};
+    static const unsigned counts[] = {1, 2, 8, 32};
+    printf("Resume after a component reset (%u us per resume step)\n", COMPONENT_RESUME_US);
+    printf("%-10s %-12s %14s %12s %10s\n", "speed Hz", "components", "full sync ms",
+           "resume ms", "speedup");
+    for (unsigned i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++) {
+        double resume = resume_us(speeds[i]);
+        for (unsigned j = 0; j < sizeof(counts) / sizeof(counts[0]); j++) {
+            double full = key_sync_fanned_us(counts[j], speeds[i]);
+            printf("%-10u %-12u %14.3f %12.3f %9.1fx\n", speeds[i], counts[j], full / 1000,
+                   resume / 1000, full / resume);
+        }
+    }
+    printf("\n");
+}
+
+int main() {
+    report_framing(100000);
+    report_burst(100000);
+    report_dma(100000);
+    report_list(I2C_FREQ);
+    report_speeds();
+    report_streams(I2C_FREQ_FAST);
+    report_boot_pipeline(I2C_FREQ_FAST);
+    report_sessions(I2C_FREQ_FAST);
+    report_key_sync(I2C_FREQ_FAST);
+    report_key_sync_trace(I2C_FREQ_FAST_PLUS);
+    report_cold_start(I2C_FREQ_FAST_PLUS);
+    report_resume();
+    for (unsigned n = 1; n <= KEY_SYNC_MAX_COMPONENTS; n++) {
+        if (!key_sync_agrees(n)) {
+            printf("key sync disagrees with %u components\n", n);
+            return 1;
+        }
+    }
+    return 0;
+}
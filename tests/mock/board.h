@@ -0,0 +1 @@
+#include "msdk_mock.h"
@@ -0,0 +1,15 @@
+// Host stand-in for the ectf_params.h build_ap.py and build_comp.py write,
+// one deployment of two components
+#ifndef __ECTF_PARAMS__
+#define __ECTF_PARAMS__
+#define AP_PIN "123456"
+#define AP_TOKEN "0123456789abcdef"
+#define COMPONENT_IDS 0x11111124, 0x11111125
+#define COMPONENT_CNT 2
+#define AP_BOOT_MSG "Test boot message"
+#define COMPONENT_ID 0x11111124
+#define COMPONENT_BOOT_MSG "Component boot"
+#define ATTESTATION_LOC "McLean"
+#define ATTESTATION_DATE "08/08/08"
+#define ATTESTATION_CUSTOMER "Fritz"
+#endif
@@ -0,0 +1,104 @@
+/**
+ * @file msdk_mock.h
+ * @brief Host stand-ins for the MSDK declarations the firmware sources use
+ *
+ * Just enough of the MSDK types and prototypes to compile the AP and
+ * component sources with gcc on Linux. Each test defines the functions it
+ * calls, so it can script results and record what went on the bus.
+ */
+
+#ifndef MSDK_MOCK_H
+#define MSDK_MOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/******************************** mxc_errors.h ********************************/
+#define E_NO_ERROR 0
+#define E_BAD_PARAM -3
+#define E_BUSY -6
+#define E_COMM_ERR -9
+#define E_TIME_OUT -10
+#define E_NONE_AVAIL -14
+
+/******************************** mxc_device.h ********************************/
+#define MXC_FLASH_MEM_BASE 0x10000000UL
+#define MXC_FLASH_MEM_SIZE 0x00080000UL
+#define MXC_FLASH_PAGE_SIZE 0x00002000UL
+
+/******************************** i2c.h ********************************/
+typedef struct {
+    volatile uint32_t intfl0;
+    volatile uint32_t inten0;
+    volatile uint32_t intfl1;
+    volatile uint32_t inten1;
+} mxc_i2c_regs_t;
+extern mxc_i2c_regs_t *MXC_I2C1;
+
+typedef struct _i2c_req_t mxc_i2c_req_t;
+typedef void (*mxc_i2c_complete_cb_t)(mxc_i2c_req_t *req, int result);
+struct _i2c_req_t {
+    mxc_i2c_regs_t *i2c;
+    uint8_t addr;
+    unsigned char *tx_buf;
+    unsigned int tx_len;
+    unsigned char *rx_buf;
+    unsigned int rx_len;
+    int restart;
+    mxc_i2c_complete_cb_t callback;
+};
+
+#define MXC_I2C_GET_IDX(i2c) 1
+#define MXC_I2C_GET_IRQ(idx) 10
+#define MXC_I2C_STD_MODE 100000
+#define MXC_I2C_FAST_SPEED 400000
+#define MXC_I2C_FASTPLUS_SPEED 1000000
+
+int MXC_I2C_Init(mxc_i2c_regs_t *i2c, int masterMode, unsigned int slaveAddr);
+int MXC_I2C_SetFrequency(mxc_i2c_regs_t *i2c, unsigned int hz);
+int MXC_I2C_MasterTransaction(mxc_i2c_req_t *req);
+int MXC_I2C_MasterTransactionAsync(mxc_i2c_req_t *req);
+int MXC_I2C_MasterTransactionDMA(mxc_i2c_req_t *req);
+void MXC_I2C_AsyncHandler(mxc_i2c_regs_t *i2c);
+
+/******************************** dma.h ********************************/
+#define DMA0_IRQn 28
+#define DMA1_IRQn 29
+#define DMA2_IRQn 30
+#define DMA3_IRQn 31
+
+void MXC_DMA_Handler(void);
+
+/******************************** nvic_table.h ********************************/
+void MXC_NVIC_SetVector(int irqn, void (*irq_handler)(void));
+void NVIC_EnableIRQ(int irqn);
+void NVIC_DisableIRQ(int irqn);
+void __enable_irq(void);
+void __disable_irq(void);
+void __WFI(void);
+uint32_t __get_PRIMASK(void);
+void __set_PRIMASK(uint32_t primask);
+
+/******************************** core_cm4.h ********************************/
+typedef struct {
+    volatile uint32_t CTRL;
+    volatile uint32_t CYCCNT;
+} DWT_Type;
+typedef struct {
+    volatile uint32_t DEMCR;
+} CoreDebug_Type;
+extern DWT_Type *DWT;
+extern CoreDebug_Type *CoreDebug;
+
+#define DWT_CTRL_CYCCNTENA_Msk 1u
+#define CoreDebug_DEMCR_TRCENA_Msk (1u << 24)
+
+/******************************** tmr.h ********************************/
+typedef struct {
+    volatile uint32_t cnt;
+} mxc_tmr_regs_t;
+extern mxc_tmr_regs_t *MXC_TMR1;
+
+#endif
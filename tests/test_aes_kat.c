@@ -0,0 +1,183 @@
+/**
+ * @file test_aes_kat.c
+ * @brief Known-answer tests for the firmware AES backend
+ *
+ * Runs crypto_self_test() and the SP 800-38A ECB-AES128 vectors through
+ * simple_crypto.c with either wolfSSL backend, then times a 256-byte packet
+ * and the tag check of a forged full-size frame against its decryption.
+ *
+ * Generic C backend, on the host:
+ *     W=application_processor/wolfssl
+ *     gcc -O2 -ffunction-sections -Wl,--gc-sections -DCRYPTO_EXAMPLE=1 \
+ *         -DWOLFSSL_AES_DIRECT -DNO_WOLFSSL_DIR -DWOLFSSL_USER_IO -DHAVE_POLY1305 \
+ *         -Iapplication_processor/inc -I$W tests/test_aes_kat.c \
+ *         application_processor/src/simple_crypto.c \
+ *         $W/wolfcrypt/src/{aes,hash,md5,sha,sha256,sha512,sha3,poly1305,memory,error,logging,wc_port}.c \
+ *         -o aes_kat && ./aes_kat
+ *
+ * Thumb2 assembly backend (CRYPTO_THUMB2_AES=1). The firmware's
+ * armv8-aes.c glue is built for the host and thumb2_wolfcrypt.c runs its
+ * AES_* calls on the assembled thumb2-aes-asm.S. poly1305.c loses its 64-bit
+ * helpers under WOLFSSL_ARMASM on a 64-bit host, so it is built without it:
+ *     F="-DCRYPTO_EXAMPLE=1 -DWOLFSSL_AES_DIRECT -DNO_WOLFSSL_DIR -DWOLFSSL_USER_IO -DHAVE_POLY1305"
+ *     A="-DWOLFSSL_ARMASM -DWOLFSSL_ARMASM_NO_HW_CRYPTO -DWOLFSSL_ARMASM_NO_NEON"
+ *     P=$W/wolfcrypt/src/port/arm
+ *     gcc -E -P -x assembler-with-cpp $F $A -D__thumb__ -I$W $P/thumb2-aes-asm.S | \
+ *         llvm-mc --triple=thumbv7em-none-eabi -mcpu=cortex-m4 -filetype=obj -o thumb2-aes.o
+ *     gcc -O2 -ffunction-sections -c $F -I$W $W/wolfcrypt/src/poly1305.c
+ *     gcc -O2 -ffunction-sections -Wl,--gc-sections $F $A -DTHUMB2_AES_OBJ=\"thumb2-aes.o\" \
+ *         -Iapplication_processor/inc -I$W tests/test_aes_kat.c tests/thumb2_{sim,wolfcrypt}.c \
+ *         application_processor/src/simple_crypto.c $P/armv8-aes.c poly1305.o \
+ *         $W/wolfcrypt/src/{aes,hash,md5,sha,sha256,sha512,sha3,memory,error,logging,wc_port}.c \
+ *         -o aes_kat && ./aes_kat
+ *
+ * Host times only compare builds on the same machine. The thumb2 build also
+ * prints the Cortex-M4 model cycles of the assembly per block, the generic
+ * C backend's cycles on the board come from test_crypto_session_cycles() in
+ * test_encryption.c
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "simple_crypto.h"
+#ifdef THUMB2_AES_OBJ
+#include "thumb2_sim.h"
+#endif
+
+#define PACKET_LEN 256
+#define TIMING_ROUNDS 10000
+// Secure frame as in board_link.h: [len][epoch][counter 4][tag][ciphertext]
+#define FRAME_TAG_OFFSET 6
+#define FRAME_PAYLOAD_LEN 240
+
+// NIST SP 800-38A F.1.1 / F.1.2, ECB-AES128
+static uint8_t key[KEY_SIZE] = {
+    0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+    0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+static uint8_t plaintext[4 * BLOCK_SIZE] = {
+    0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96,
+    0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+    0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c,
+    0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+    0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11,
+    0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+    0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17,
+    0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10};
+static const uint8_t ciphertext[4 * BLOCK_SIZE] = {
+    0x3a, 0xd7, 0x7b, 0xb4, 0x0d, 0x7a, 0x36, 0x60,
+    0xa8, 0x9e, 0xca, 0xf3, 0x24, 0x66, 0xef, 0x97,
+    0xf5, 0xd3, 0xd5, 0x85, 0x03, 0xb9, 0x69, 0x9d,
+    0xe7, 0x85, 0x89, 0x5a, 0x96, 0xfd, 0xba, 0xaf,
+    0x43, 0xb1, 0xcd, 0x7f, 0x59, 0x8e, 0xce, 0x23,
+    0x88, 0x1b, 0x00, 0xe3, 0xed, 0x03, 0x06, 0x88,
+    0x7b, 0x0c, 0x78, 0x5e, 0x27, 0xe8, 0xad, 0x3f,
+    0x82, 0x23, 0x20, 0x71, 0x04, 0x72, 0x5d, 0xd4};
+
+static int check(const char *name, int ok) {
+    printf("%-32s %s\n", name, ok ? "ok" : "FAIL");
+    return ok ? 0 : 1;
+}
+
+static double elapsed_ns(struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+}
+
+int main() {
+    static crypto_session_t session;
+    uint8_t out[PACKET_LEN];
+    uint8_t back[PACKET_LEN];
+    int failures = 0;
+
+    failures += check("crypto_self_test", crypto_self_test() == 0);
+
+    failures += check("SP 800-38A encrypt_sym",
+                      encrypt_sym(plaintext, sizeof(plaintext), key, out) == 0 &&
+                      !memcmp(out, ciphertext, sizeof(ciphertext)));
+    failures += check("SP 800-38A decrypt_sym",
+                      decrypt_sym(out, sizeof(ciphertext), key, back) == 0 &&
+                      !memcmp(back, plaintext, sizeof(plaintext)));
+
+    crypto_session_init(&session, key);
+    failures += check("SP 800-38A encrypt_session",
+                      encrypt_session(&session, plaintext, sizeof(plaintext), out) == 0 &&
+                      !memcmp(out, ciphertext, sizeof(ciphertext)));
+    failures += check("SP 800-38A decrypt_session",
+                      decrypt_session(&session, out, sizeof(ciphertext), back) == 0 &&
+                      !memcmp(back, plaintext, sizeof(plaintext)));
+
+    // A full packet round trip, the schedule is used for every block
+    uint8_t packet[PACKET_LEN];
+    for (int i = 0; i < PACKET_LEN; i++) {
+        packet[i] = i;
+    }
+    failures += check("256 byte round trip",
+                      encrypt_session(&session, packet, PACKET_LEN, out) == 0 &&
+                      decrypt_session(&session, out, PACKET_LEN, back) == 0 &&
+                      !memcmp(back, packet, PACKET_LEN));
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < TIMING_ROUNDS; i++) {
+        encrypt_sym(packet, PACKET_LEN, key, out);
+    }
+    double sym_ns = elapsed_ns(&start) / TIMING_ROUNDS;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < TIMING_ROUNDS; i++) {
+        encrypt_session(&session, packet, PACKET_LEN, out);
+    }
+    double session_ns = elapsed_ns(&start) / TIMING_ROUNDS;
+
+    // The work open_frame() does on a forged frame, against decrypting it
+    uint8_t frame[FRAME_TAG_OFFSET + TAG_SIZE + FRAME_PAYLOAD_LEN];
+    uint8_t nonce[NONCE_SIZE] = {0};
+    uint8_t tag[TAG_SIZE];
+    int forged_ok = 0;
+    for (int i = 0; i < sizeof(frame); i++) {
+        frame[i] = i * 7;
+    }
+    uint8_t *payload = &frame[FRAME_TAG_OFFSET + TAG_SIZE];
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < TIMING_ROUNDS; i++) {
+        tag_session(&session, nonce, frame, FRAME_TAG_OFFSET, payload, FRAME_PAYLOAD_LEN, tag);
+        forged_ok |= tag_equal(tag, &frame[FRAME_TAG_OFFSET]);
+    }
+    double tag_ns = elapsed_ns(&start) / TIMING_ROUNDS;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < TIMING_ROUNDS; i++) {
+        decrypt_session(&session, payload, FRAME_PAYLOAD_LEN, back);
+    }
+    double decrypt_ns = elapsed_ns(&start) / TIMING_ROUNDS;
+    crypto_session_invalidate(&session);
+    failures += check("forged frame tag rejected", !forged_ok);
+
+    printf("\nencrypt %d B: encrypt_sym %.0f ns, encrypt_session %.0f ns, %.1f ns/block\n",
+           PACKET_LEN, sym_ns, session_ns, session_ns / (PACKET_LEN / BLOCK_SIZE));
+    printf("forged %d B frame: tag check %.0f ns, decrypt %.0f ns, %.0f%% of decrypt\n",
+           FRAME_PAYLOAD_LEN, tag_ns, decrypt_ns, 100 * tag_ns / decrypt_ns);
+
+#ifdef THUMB2_AES_OBJ
+    // Cycles spent in the assembly only, the wolfSSL glue runs on the host
+    uint64_t before = thumb2_cycles();
+    crypto_session_init(&session, key);
+    uint64_t schedule = thumb2_cycles() - before;
+    before = thumb2_cycles();
+    encrypt_session(&session, packet, PACKET_LEN, out);
+    uint64_t encrypt = thumb2_cycles() - before;
+    before = thumb2_cycles();
+    decrypt_session(&session, out, PACKET_LEN, back);
+    uint64_t decrypt = thumb2_cycles() - before;
+    crypto_session_invalidate(&session);
+    printf("thumb2 AES-128, Cortex-M4 model: key schedules %llu cycles, "
+           "encrypt %llu cycles/block, decrypt %llu cycles/block\n",
+           (unsigned long long)schedule,
+           (unsigned long long)encrypt / (PACKET_LEN / BLOCK_SIZE),
+           (unsigned long long)decrypt / (PACKET_LEN / BLOCK_SIZE));
+#endif
+
+    return failures;
+}
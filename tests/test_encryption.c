@@ -160,7 +160,136 @@ int test_validate_and_boot_protocol(){
     return SUCCESS_RETURN;
 }
 
+// Cycles to encrypt and decrypt one full I2C packet, with a key schedule
+// expanded per call and with one expanded ahead of time
+int test_crypto_session_cycles(){
+    uint8_t plaintext[MAX_I2C_MESSAGE_LEN];
+    uint8_t ciphertext[MAX_I2C_MESSAGE_LEN];
+    uint8_t session_ciphertext[MAX_I2C_MESSAGE_LEN];
+    uint8_t decrypted[MAX_I2C_MESSAGE_LEN];
+    static crypto_session_t session;
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    Rand_NASYC(plaintext, MAX_I2C_MESSAGE_LEN);
+
+    uint32_t start = DWT->CYCCNT;
+    encrypt_sym(plaintext, MAX_I2C_MESSAGE_LEN, GLOBAL_KEY, ciphertext);
+    uint32_t sym_encrypt = DWT->CYCCNT - start;
+    start = DWT->CYCCNT;
+    decrypt_sym(ciphertext, MAX_I2C_MESSAGE_LEN, GLOBAL_KEY, decrypted);
+    uint32_t sym_decrypt = DWT->CYCCNT - start;
+
+    start = DWT->CYCCNT;
+    crypto_session_init(&session, GLOBAL_KEY);
+    uint32_t expand = DWT->CYCCNT - start;
+    start = DWT->CYCCNT;
+    encrypt_session(&session, plaintext, MAX_I2C_MESSAGE_LEN, session_ciphertext);
+    uint32_t session_encrypt = DWT->CYCCNT - start;
+    start = DWT->CYCCNT;
+    decrypt_session(&session, session_ciphertext, MAX_I2C_MESSAGE_LEN, decrypted);
+    uint32_t session_decrypt = DWT->CYCCNT - start;
+    crypto_session_invalidate(&session);
+
+    int same = !memcmp(ciphertext, session_ciphertext, MAX_I2C_MESSAGE_LEN) &&
+               !memcmp(plaintext, decrypted, MAX_I2C_MESSAGE_LEN);
+
+    printf("Cycles per %d byte packet:\n \
+    encrypt_sym = %"PRIu32", decrypt_sym = %"PRIu32"\n \
+    encrypt_session = %"PRIu32", decrypt_session = %"PRIu32"\n \
+    one-time key expansion = %"PRIu32"\n \
+    encrypt_session per block = %"PRIu32"\n \
+    Same ciphertext and plaintext?  %d\n\n", MAX_I2C_MESSAGE_LEN,
+           sym_encrypt, sym_decrypt, session_encrypt, session_decrypt, expand,
+           session_encrypt / (MAX_I2C_MESSAGE_LEN / BLOCK_SIZE), same);
+
+    return same ? SUCCESS_RETURN : ERROR_RETURN;
+}
+
+// Cycles to reject a forged full-size frame on its tag against the cycles
+// to decrypt it, the difference is saved on every junk frame. DWT cycles on
+// the board, test_aes_kat.c times the same pair on the host
+int test_frame_rejection_cycles(){
+    uint8_t frame[FRAME_HEADER_LEN + MAX_FRAME_PAYLOAD];
+    uint8_t decrypted[MAX_FRAME_PAYLOAD];
+    uint8_t nonce[NONCE_SIZE] = {0};
+    uint8_t tag[TAG_SIZE];
+    static crypto_session_t session;
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    Rand_NASYC(frame, sizeof(frame));
+    frame[0] = MAX_FRAME_PAYLOAD;
+    crypto_session_init(&session, GLOBAL_KEY);
+
+    uint32_t start = DWT->CYCCNT;
+    tag_session(&session, nonce, frame, FRAME_TAG_OFFSET,
+                &frame[FRAME_HEADER_LEN], MAX_FRAME_PAYLOAD, tag);
+    int forged_ok = tag_equal(tag, &frame[FRAME_TAG_OFFSET]);
+    uint32_t reject = DWT->CYCCNT - start;
+
+    start = DWT->CYCCNT;
+    decrypt_session(&session, &frame[FRAME_HEADER_LEN], MAX_FRAME_PAYLOAD, decrypted);
+    uint32_t decrypt = DWT->CYCCNT - start;
+    crypto_session_invalidate(&session);
+
+    printf("Cycles per forged %d byte frame:\n \
+    tag check = %"PRIu32", decrypt = %"PRIu32", saved = %"PRId32"\n \
+    Forged tag accepted?  %d\n\n", MAX_FRAME_PAYLOAD,
+           reject, decrypt, (int32_t)(decrypt - reject), forged_ok);
+
+    return forged_ok ? ERROR_RETURN : SUCCESS_RETURN;
+}
+
+#ifdef HAVE_CURVE25519
+// Cycles of the two X25519 scalar multiplications a KEY_SYNC_X25519 key sync
+// costs each side, test_x25519.c only has host times to compare them with
+int test_x25519_cycles(){
+    uint8_t private_key[X25519_KEY_SIZE];
+    uint8_t public_key[X25519_KEY_SIZE];
+    uint8_t peer_private[X25519_KEY_SIZE];
+    uint8_t peer_public[X25519_KEY_SIZE];
+    uint8_t shared[X25519_KEY_SIZE];
+    uint8_t peer_shared[X25519_KEY_SIZE];
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    Rand_NASYC(private_key, X25519_KEY_SIZE);
+    Rand_NASYC(peer_private, X25519_KEY_SIZE);
+
+    uint32_t start = DWT->CYCCNT;
+    x25519_make_public(private_key, public_key);
+    uint32_t make_public = DWT->CYCCNT - start;
+    x25519_make_public(peer_private, peer_public);
+
+    start = DWT->CYCCNT;
+    x25519_shared(private_key, peer_public, shared);
+    uint32_t make_shared = DWT->CYCCNT - start;
+    x25519_shared(peer_private, public_key, peer_shared);
+
+    int same = !memcmp(shared, peer_shared, X25519_KEY_SIZE);
+    memset(private_key, 0, X25519_KEY_SIZE);
+    memset(peer_private, 0, X25519_KEY_SIZE);
+
+    printf("Cycles per X25519 scalar multiplication:\n \
+    x25519_make_public = %"PRIu32", x25519_shared = %"PRIu32"\n \
+    Same shared secret?  %d\n\n", make_public, make_shared, same);
+
+    return same ? SUCCESS_RETURN : ERROR_RETURN;
+}
+#endif
+
 int main() {
+    // Catches a miswired backend, e.g. CRYPTO_THUMB2_AES=1, before timing it
+    if (crypto_self_test() != SUCCESS_RETURN) {
+        printf("Crypto self test failed\n");
+        return ERROR_RETURN;
+    }
     test_validate_and_boot_protocol();
+    test_crypto_session_cycles();
+    test_frame_rejection_cycles();
+#ifdef HAVE_CURVE25519
+    test_x25519_cycles();
+#endif
     return 0;
 }
@@ -0,0 +1,250 @@
+/**
+ * @file test_i2c_async.c
+ * @brief Async register queue of the AP I2C controller against a mocked HAL
+ *
+ * Builds the real simple_i2c_controller.c against tests/mock. The mocked
+ * MXC_I2C_MasterTransactionAsync() only records the request it is given, the
+ * way the driver leaves it on the wire, and the bus finishes it when the test
+ * raises the I2C interrupt: the handler registered by
+ * i2c_simple_controller_init() calls the mocked MXC_I2C_AsyncHandler(), which
+ * completes the in-flight request with a scripted result. Checks that one
+ * operation is on the bus at a time and in submit order, that every callback
+ * gets its own result and context, that a full queue is refused, and that
+ * i2c_simple_async_wait() blocks until the queue drains and reports the
+ * latched error once.
+ *
+ * On the host:
+ *     gcc -O2 -Wall -pthread -Itests/mock -Iapplication_processor/inc \
+ *         tests/test_i2c_async.c application_processor/src/simple_i2c_controller.c \
+ *         application_processor/src/packet_pool.c -o i2c_async && ./i2c_async
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "simple_i2c_controller.h"
+
+#define MAX_STARTED 32
+#define COMPONENT_A 0x24
+#define COMPONENT_B 0x25
+
+/******************************** MOCK HAL ********************************/
+static mxc_i2c_regs_t i2c1;
+mxc_i2c_regs_t *MXC_I2C1 = &i2c1;
+
+static void (*i2c_vector)(void);
+static uint32_t primask;
+static volatile bool in_isr;
+
+// Requests handed to MXC_I2C_MasterTransactionAsync, in order
+static mxc_i2c_req_t started[MAX_STARTED];
+static unsigned started_count;
+static mxc_i2c_req_t *in_flight;
+// Result MXC_I2C_MasterTransactionAsync returns for the next start
+static int start_result;
+// Starts from thread mode made with interrupts enabled
+static unsigned unmasked_starts;
+static unsigned blocking_count;
+
+int MXC_I2C_Init(mxc_i2c_regs_t *i2c, int masterMode, unsigned int slaveAddr) {
+    return E_NO_ERROR;
+}
+
+int MXC_I2C_SetFrequency(mxc_i2c_regs_t *i2c, unsigned int hz) {
+    return (int)hz;
+}
+
+int MXC_I2C_MasterTransaction(mxc_i2c_req_t *req) {
+    blocking_count++;
+    return E_NO_ERROR;
+}
+
+int MXC_I2C_MasterTransactionAsync(mxc_i2c_req_t *req) {
+    if (in_flight != NULL) {
+        return E_BUSY;
+    }
+    if (!primask && !in_isr) {
+        unmasked_starts++;
+    }
+    if (started_count < MAX_STARTED) {
+        started[started_count] = *req;
+        // The copy keeps only the register byte, tx_buf is reused by the queue
+        started[started_count].tx_buf = NULL;
+        started_count++;
+    }
+    if (start_result != E_NO_ERROR) {
+        int result = start_result;
+        start_result = E_NO_ERROR;
+        return result;
+    }
+    in_flight = req;
+    return E_NO_ERROR;
+}
+
+// Result and read data the bus produces for the request in flight
+static int bus_result;
+static uint8_t bus_fill;
+
+void MXC_I2C_AsyncHandler(mxc_i2c_regs_t *i2c) {
+    mxc_i2c_req_t *req = in_flight;
+    if (req == NULL) {
+        return;
+    }
+    in_flight = NULL;
+    memset(req->rx_buf, bus_fill, req->rx_len);
+    req->callback(req, bus_result);
+}
+
+void MXC_NVIC_SetVector(int irqn, void (*irq_handler)(void)) {
+    i2c_vector = irq_handler;
+}
+
+void NVIC_EnableIRQ(int irqn) {}
+void NVIC_DisableIRQ(int irqn) {}
+void __enable_irq(void) { primask = 0; }
+void __disable_irq(void) { primask = 1; }
+void __WFI(void) {}
+uint32_t __get_PRIMASK(void) { return primask; }
+void __set_PRIMASK(uint32_t value) { primask = value; }
+
+// Finish the transaction on the wire with a result
+static void raise_i2c_irq(int result, uint8_t fill) {
+    bus_result = result;
+    bus_fill = fill;
+    in_isr = true;
+    i2c_vector();
+    in_isr = false;
+}
+
+/******************************** TEST ********************************/
+typedef struct {
+    int order[MAX_STARTED];
+    int result[MAX_STARTED];
+    unsigned count;
+} completions_t;
+
+static completions_t done;
+
+// ctx is the operation number
+static void on_complete(int result, void *ctx) {
+    done.order[done.count] = (int)(intptr_t)ctx;
+    done.result[done.count] = result;
+    done.count++;
+}
+
+static void reset(void) {
+    memset(&done, 0, sizeof(done));
+    started_count = 0;
+    unmasked_starts = 0;
+}
+
+static int check(const char *name, int ok) {
+    printf("%-52s %s\n", name, ok ? "ok" : "FAIL");
+    return ok ? 0 : 1;
+}
+
+// The I2C interrupt, completing the in-flight operations one by one
+static void *bus_thread(void *arg) {
+    int *results = arg;
+    for (int i = 0; results[i] != 1; i++) {
+        usleep(1000);
+        raise_i2c_irq(results[i], 0);
+    }
+    return NULL;
+}
+
+int main() {
+    int failures = 0;
+    uint8_t data[3] = {0xA1, 0xA2, 0xA3};
+    uint8_t read_a[8], read_b[8];
+
+    failures += check("i2c_simple_controller_init", i2c_simple_controller_init() == E_NO_ERROR);
+    failures += check("handler registered", i2c_vector != NULL);
+
+    // Write, read, write: only the first goes on the bus
+    reset();
+    i2c_simple_async_write(COMPONENT_A, RECEIVE, sizeof(data), data, on_complete, (void *)1);
+    i2c_simple_async_read(COMPONENT_A, TRANSMIT, sizeof(read_a), read_a, on_complete, (void *)2);
+    i2c_simple_async_write(COMPONENT_B, RECEIVE_DONE, 1, data, on_complete, (void *)3);
+    failures += check("one operation on the bus", started_count == 1 && i2c_simple_async_busy());
+    failures += check("write carries register byte and data",
+                      started[0].addr == COMPONENT_A && started[0].tx_len == 1 + sizeof(data) &&
+                      in_flight->tx_buf[0] == RECEIVE &&
+                      memcmp(&in_flight->tx_buf[1], data, sizeof(data)) == 0 &&
+                      started[0].rx_len == 0);
+    // The queue copied the write data, the caller may reuse it
+    data[0] = 0;
+    failures += check("no callback before the interrupt", done.count == 0);
+
+    raise_i2c_irq(E_NO_ERROR, 0);
+    failures += check("interrupt completes op 1 and starts op 2",
+                      done.count == 1 && done.order[0] == 1 && started_count == 2 &&
+                      started[1].rx_buf == read_a && started[1].rx_len == sizeof(read_a) &&
+                      started[1].tx_len == 1 && in_flight->tx_buf[0] == TRANSMIT);
+    raise_i2c_irq(E_NO_ERROR, 0x5A);
+    failures += check("read lands in the caller buffer", read_a[0] == 0x5A && read_a[7] == 0x5A);
+    raise_i2c_irq(E_NO_ERROR, 0);
+    failures += check("callbacks in submit order",
+                      done.count == 3 && done.order[1] == 2 && done.order[2] == 3 &&
+                      started[2].addr == COMPONENT_B && started[2].tx_len == 2);
+    failures += check("queue idle after the last completion", !i2c_simple_async_busy());
+    failures += check("bus started with interrupts masked", unmasked_starts == 0);
+    failures += check("wait after a clean run", i2c_simple_async_wait() == E_NO_ERROR);
+
+    // A full queue is refused and nothing is lost
+    reset();
+    int queued = 0;
+    for (int i = 0; i < I2C_ASYNC_QUEUE_LEN; i++) {
+        queued += i2c_simple_async_read(COMPONENT_A, TRANSMIT_DONE, 1, read_b, on_complete,
+                                        (void *)(intptr_t)(10 + i)) == E_NO_ERROR;
+    }
+    failures += check("queue accepts I2C_ASYNC_QUEUE_LEN", queued == I2C_ASYNC_QUEUE_LEN);
+    failures += check("full queue returns E_NONE_AVAIL",
+                      i2c_simple_async_read(COMPONENT_A, TRANSMIT_DONE, 1, read_b, on_complete,
+                                            (void *)99) == E_NONE_AVAIL);
+
+    // The error is latched, later operations still run and complete
+    int results[I2C_ASYNC_QUEUE_LEN + 1] = {E_NO_ERROR, E_COMM_ERR, E_NO_ERROR, E_NO_ERROR, 1};
+    pthread_t bus;
+    pthread_create(&bus, NULL, bus_thread, results);
+    int error = i2c_simple_async_wait();
+    pthread_join(bus, NULL);
+    failures += check("wait blocks until the queue drains",
+                      done.count == I2C_ASYNC_QUEUE_LEN && !i2c_simple_async_busy());
+    failures += check("wait returns the latched error", error == E_COMM_ERR);
+    failures += check("failed op gets its own result",
+                      done.order[1] == 11 && done.result[1] == E_COMM_ERR &&
+                      done.result[0] == E_NO_ERROR && done.result[3] == E_NO_ERROR);
+    failures += check("ring wraps in order", done.order[0] == 10 && done.order[3] == 13);
+    failures += check("error reported once", i2c_simple_async_wait() == E_NO_ERROR);
+
+    // A start the driver refuses completes at once and the next one starts
+    reset();
+    start_result = E_BUSY;
+    i2c_simple_async_write(COMPONENT_A, RECEIVE_DONE, 1, data, on_complete, (void *)20);
+    failures += check("refused start completes with its error",
+                      done.count == 1 && done.order[0] == 20 && done.result[0] == E_BUSY &&
+                      !i2c_simple_async_busy());
+    i2c_simple_async_write(COMPONENT_A, RECEIVE_DONE, 1, data, NULL, NULL);
+    raise_i2c_irq(E_NO_ERROR, 0);
+    failures += check("NULL callback allowed", done.count == 1 && !i2c_simple_async_busy());
+    failures += check("refused start latched", i2c_simple_async_wait() == E_BUSY);
+
+    // Failures count against the address speed like blocking ones
+    i2c_simple_set_speed(COMPONENT_B, I2C_FREQ_FAST_PLUS);
+    for (int i = 0; i < I2C_SPEED_FAULT_LIMIT; i++) {
+        i2c_simple_async_read(COMPONENT_B, TRANSMIT_DONE, 1, read_b, NULL, NULL);
+        raise_i2c_irq(E_COMM_ERR, 0);
+    }
+    i2c_simple_async_wait();
+    failures += check("async faults lower the address speed",
+                      i2c_simple_get_speed(COMPONENT_B) == I2C_FREQ_FAST);
+
+    // Blocking helpers still work once the queue is idle
+    failures += check("blocking read after the queue",
+                      i2c_simple_read_transmit_done(COMPONENT_A) >= 0 && blocking_count == 1);
+
+    return failures;
+}
@@ -0,0 +1,227 @@
+/**
+ * @file test_i2c_dma.c
+ * @brief DMA transfer path of the AP I2C controller against a mocked engine
+ *
+ * Builds the real simple_i2c_controller.c with I2C_USE_DMA=1 against
+ * tests/mock. The mocked MXC_I2C_MasterTransactionDMA() arms a TX and an RX
+ * channel on the request buffers and returns, and the engine only moves data
+ * when the core sleeps: the mocked __WFI() raises the DMA interrupt, the
+ * handler registered by i2c_simple_controller_init() calls the mocked
+ * MXC_DMA_Handler(), which copies tx_buf onto the wire, fills rx_buf from the
+ * component and fires the completion callback.
+ *
+ * Checks that a burst written with headroom goes out as one descriptor, the
+ * register byte and length in front of the caller's frame with no staging
+ * copy, that reads land in the caller's buffer, that short status polls keep
+ * the FIFO path, and that DMA errors reach the caller and the speed table.
+ *
+ * On the host:
+ *     gcc -O2 -Wall -DI2C_USE_DMA=1 -Itests/mock -Iapplication_processor/inc \
+ *         tests/test_i2c_dma.c application_processor/src/simple_i2c_controller.c \
+ *         application_processor/src/packet_pool.c -o i2c_dma && ./i2c_dma
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "packet_pool.h"
+#include "simple_i2c_controller.h"
+
+#define COMPONENT 0x24
+#define WIRE_LEN (1 + MAX_I2C_MESSAGE_LEN + BURST_READ_HEADER_LEN)
+
+/******************************** MOCK HAL ********************************/
+static mxc_i2c_regs_t i2c1;
+mxc_i2c_regs_t *MXC_I2C1 = &i2c1;
+
+static void (*vectors[64])(void);
+static int enabled_irqs[64];
+
+// One armed DMA transfer
+typedef struct {
+    mxc_i2c_req_t *req;
+    uint8_t *tx_src; // Address the TX channel reads from
+    unsigned tx_len;
+    uint8_t *rx_dst; // Address the RX channel writes to
+    unsigned rx_len;
+} dma_transfer_t;
+
+static dma_transfer_t armed;
+static unsigned dma_starts;
+static unsigned fifo_starts;
+static unsigned wfi_count;
+// Result the next MXC_I2C_MasterTransactionDMA start and completion give
+static int start_result;
+static int complete_result;
+
+// Bytes the controller clocked out, and what the component answers
+static uint8_t wire[WIRE_LEN];
+static unsigned wire_len;
+static uint8_t response[WIRE_LEN];
+
+int MXC_I2C_Init(mxc_i2c_regs_t *i2c, int masterMode, unsigned int slaveAddr) {
+    return E_NO_ERROR;
+}
+
+int MXC_I2C_SetFrequency(mxc_i2c_regs_t *i2c, unsigned int hz) {
+    return (int)hz;
+}
+
+int MXC_I2C_MasterTransaction(mxc_i2c_req_t *req) {
+    fifo_starts++;
+    memcpy(wire, req->tx_buf, req->tx_len);
+    wire_len = req->tx_len;
+    memcpy(req->rx_buf, response, req->rx_len);
+    return E_NO_ERROR;
+}
+
+int MXC_I2C_MasterTransactionAsync(mxc_i2c_req_t *req) {
+    return E_BUSY;
+}
+
+void MXC_I2C_AsyncHandler(mxc_i2c_regs_t *i2c) {}
+
+int MXC_I2C_MasterTransactionDMA(mxc_i2c_req_t *req) {
+    dma_starts++;
+    if (start_result != E_NO_ERROR) {
+        int result = start_result;
+        start_result = E_NO_ERROR;
+        return result;
+    }
+    armed.req = req;
+    armed.tx_src = req->tx_buf;
+    armed.tx_len = req->tx_len;
+    armed.rx_dst = req->rx_buf;
+    armed.rx_len = req->rx_len;
+    return E_NO_ERROR;
+}
+
+void MXC_DMA_Handler(void) {
+    mxc_i2c_req_t *req = armed.req;
+    if (req == NULL) {
+        return;
+    }
+    memcpy(wire, armed.tx_src, armed.tx_len);
+    wire_len = armed.tx_len;
+    memcpy(armed.rx_dst, response, armed.rx_len);
+    armed.req = NULL;
+    req->callback(req, complete_result);
+}
+
+void MXC_NVIC_SetVector(int irqn, void (*irq_handler)(void)) {
+    vectors[irqn] = irq_handler;
+}
+
+void NVIC_EnableIRQ(int irqn) { enabled_irqs[irqn] = 1; }
+void NVIC_DisableIRQ(int irqn) { enabled_irqs[irqn] = 0; }
+void __enable_irq(void) {}
+void __disable_irq(void) {}
+uint32_t __get_PRIMASK(void) { return 0; }
+void __set_PRIMASK(uint32_t value) {}
+
+// The transfer finishes while the core sleeps
+void __WFI(void) {
+    wfi_count++;
+    if (armed.req != NULL && enabled_irqs[DMA0_IRQn]) {
+        vectors[DMA0_IRQn]();
+    }
+}
+
+/******************************** TEST ********************************/
+static int check(const char *name, int ok) {
+    printf("%-52s %s\n", name, ok ? "ok" : "FAIL");
+    return ok ? 0 : 1;
+}
+
+static void reset(void) {
+    memset(wire, 0, sizeof(wire));
+    wire_len = 0;
+    dma_starts = 0;
+    fifo_starts = 0;
+    wfi_count = 0;
+    complete_result = E_NO_ERROR;
+}
+
+int main() {
+    int failures = 0;
+    static uint8_t frame[I2C_TX_HEADROOM + MAX_I2C_MESSAGE_LEN - 1];
+    static uint8_t buf[BURST_READ_HEADER_LEN + MAX_I2C_MESSAGE_LEN];
+    uint8_t len = 200;
+
+    failures += check("i2c_simple_controller_init", i2c_simple_controller_init() == E_NO_ERROR);
+    failures += check("DMA channel handlers registered",
+                      vectors[DMA0_IRQn] && vectors[DMA3_IRQn] && enabled_irqs[DMA0_IRQn] &&
+                      enabled_irqs[DMA3_IRQn]);
+
+    // Burst write from a frame built after the headroom
+    reset();
+    for (int i = 0; i < len; i++) {
+        frame[I2C_TX_HEADROOM + i] = i ^ 0x5A;
+    }
+    uint32_t allocs = get_packet_pool_stats()->allocs;
+    int result = i2c_simple_write_burst_inplace(COMPONENT, len, frame);
+    failures += check("in place burst goes through DMA",
+                      result == E_NO_ERROR && dma_starts == 1 && fifo_starts == 0);
+    failures += check("descriptor is the caller frame",
+                      armed.tx_src == frame && armed.tx_len == I2C_TX_HEADROOM + len &&
+                      armed.rx_len == 0);
+    failures += check("register byte and length in the headroom",
+                      wire_len == I2C_TX_HEADROOM + len && wire[0] == BURST && wire[1] == len);
+    failures += check("payload on the wire unchanged",
+                      memcmp(&wire[I2C_TX_HEADROOM], &frame[I2C_TX_HEADROOM], len) == 0);
+    failures += check("no staging buffer", get_packet_pool_stats()->allocs == allocs);
+    failures += check("core slept until the DMA interrupt", wfi_count >= 1);
+
+    // The copying burst write stages through the pool, same bytes on the wire
+    reset();
+    memcpy(buf, &frame[I2C_TX_HEADROOM], len);
+    result = i2c_simple_write_burst(COMPONENT, len, buf);
+    failures += check("staged burst stages once",
+                      result == E_NO_ERROR && dma_starts == 1 &&
+                      get_packet_pool_stats()->allocs == allocs + 1 &&
+                      get_packet_pool_stats()->in_use == 0);
+    failures += check("staged burst matches the in place one",
+                      wire_len == I2C_TX_HEADROOM + len && wire[0] == BURST && wire[1] == len &&
+                      memcmp(&wire[I2C_TX_HEADROOM], buf, len) == 0);
+
+    // Burst read: register byte out, [status][len][data] into the caller buffer
+    reset();
+    response[0] = TRANSMIT_READY;
+    response[1] = len;
+    for (int i = 0; i < len; i++) {
+        response[BURST_READ_HEADER_LEN + i] = ~i;
+    }
+    memset(buf, 0, sizeof(buf));
+    result = i2c_simple_read_burst(COMPONENT, len, buf);
+    failures += check("burst read goes through DMA",
+                      result == E_NO_ERROR && dma_starts == 1 && armed.rx_dst == buf &&
+                      armed.rx_len == BURST_READ_HEADER_LEN + len);
+    failures += check("burst read sends the register byte", wire_len == 1 && wire[0] == BURST);
+    failures += check("burst read lands in the caller buffer",
+                      memcmp(buf, response, BURST_READ_HEADER_LEN + len) == 0);
+
+    // Status polls are shorter than I2C_DMA_MIN_LEN and keep the FIFO
+    reset();
+    response[0] = TRANSMIT_BUSY;
+    result = i2c_simple_read_transmit_done(COMPONENT);
+    failures += check("status poll stays on the FIFO",
+                      result == TRANSMIT_BUSY && dma_starts == 0 && fifo_starts == 1 &&
+                      wfi_count == 0);
+
+    // A failed transfer reaches the caller and counts against the speed
+    reset();
+    i2c_simple_set_speed(COMPONENT, I2C_FREQ_FAST_PLUS);
+    complete_result = E_COMM_ERR;
+    failures += check("DMA completion error returned",
+                      i2c_simple_write_burst_inplace(COMPONENT, len, frame) == E_COMM_ERR);
+    start_result = E_BUSY;
+    wfi_count = 0;
+    failures += check("refused DMA start returned without sleeping",
+                      i2c_simple_write_burst_inplace(COMPONENT, len, frame) == E_BUSY &&
+                      wfi_count == 0);
+    i2c_simple_read_burst(COMPONENT, len, buf);
+    failures += check("DMA faults lower the address speed",
+                      i2c_simple_get_speed(COMPONENT) == I2C_FREQ_FAST);
+
+    return failures;
+}
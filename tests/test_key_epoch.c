@@ -0,0 +1,435 @@
+/**
+ * @file test_key_epoch.c
+ * @brief Key rotation of the AP board link against mocked components
+ *
+ * Builds the real board_link.c, simple_i2c_controller.c, packet_pool.c,
+ * key_epoch.c and simple_crypto.c against tests/mock. The mocked
+ * MXC_I2C_MasterTransaction() plays the register side of two components.
+ * Each one opens the AP's burst with its own key_epochs_t the way the
+ * component's board_link.c does and follows the AP on the first frame under
+ * a new epoch. It seals every reply before it sees the AP's next frame, so
+ * each rotation leaves one reply under the old epoch in flight.
+ *
+ * Checks that every frame through secure_send_frame() and
+ * secure_receive_frame() is accepted across the rotations and a reply from
+ * epochs back is not, that a component that went away or failed an exchange
+ * stops holding the rotation up, and that a live one that lags still does
+ * and is only probed every KEY_ROTATE_RETRY_FRAMES. Compares the round trip
+ * throughput of windows with and without a rotation in them.
+ *
+ * On the host:
+ *     W=application_processor/wolfssl
+ *     gcc -O2 -ffunction-sections -Wl,--gc-sections -DCRYPTO_EXAMPLE=1 \
+ *         -DWOLFSSL_AES_DIRECT -DNO_WOLFSSL_DIR -DWOLFSSL_USER_IO -DHAVE_POLY1305 \
+ *         -Itests/mock -Iapplication_processor/inc -I$W tests/test_key_epoch.c \
+ *         application_processor/src/{board_link,simple_i2c_controller,packet_pool}.c \
+ *         application_processor/src/{key_epoch,simple_crypto}.c \
+ *         $W/wolfcrypt/src/{aes,hash,md5,sha,sha256,sha512,sha3,poly1305,memory,error,logging,wc_port}.c \
+ *         -o key_epoch && ./key_epoch
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "board_link.h"
+#include "timebase.h"
+
+#define COMPONENT_A 0x24
+#define COMPONENT_B 0x25
+#define FRAME_LEN (FRAME_HEADER_LEN + MAX_FRAME_PAYLOAD)
+
+#define ROUND_TRIPS 65536
+#define WINDOW 256
+#define WINDOWS (ROUND_TRIPS / WINDOW)
+#define SWITCH_ROUNDS 1000
+// Enough frames for two rotations when nothing holds them up
+#define TWO_ROTATIONS (3 * (KEY_ROTATE_FRAMES + 1))
+
+static uint8_t key[KEY_SIZE] = {
+    0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+    0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+
+/******************************** MOCK HAL ********************************/
+static mxc_i2c_regs_t i2c1;
+mxc_i2c_regs_t *MXC_I2C1 = &i2c1;
+static DWT_Type dwt;
+DWT_Type *DWT = &dwt;
+static CoreDebug_Type core_debug;
+CoreDebug_Type *CoreDebug = &core_debug;
+
+int MXC_I2C_Init(mxc_i2c_regs_t *i2c, int masterMode, unsigned int slaveAddr) {
+    return E_NO_ERROR;
+}
+
+int MXC_I2C_SetFrequency(mxc_i2c_regs_t *i2c, unsigned int hz) {
+    return (int)hz;
+}
+
+int MXC_I2C_MasterTransactionAsync(mxc_i2c_req_t *req) {
+    return E_BUSY;
+}
+
+void MXC_I2C_AsyncHandler(mxc_i2c_regs_t *i2c) {}
+void MXC_NVIC_SetVector(int irqn, void (*irq_handler)(void)) {}
+void NVIC_EnableIRQ(int irqn) {}
+void NVIC_DisableIRQ(int irqn) {}
+void __enable_irq(void) {}
+void __disable_irq(void) {}
+void __WFI(void) {}
+uint32_t __get_PRIMASK(void) { return 0; }
+void __set_PRIMASK(uint32_t value) {}
+
+// The components answer at once, waits never need to sleep
+uint64_t timebase_now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+deadline_t deadline_in_us(uint32_t us) {
+    return timebase_now_us() + us;
+}
+
+bool deadline_expired(deadline_t deadline) {
+    return timebase_now_us() >= deadline;
+}
+
+void wait_until(deadline_t deadline) {}
+void deadline_finish(deadline_t deadline) {}
+
+/******************************** MOCK COMPONENTS ********************************/
+typedef struct {
+    i2c_addr_t addr;
+    bool present;
+    key_epochs_t epochs;
+    uint32_t send_counter;
+    uint32_t recv_counter;
+    uint8_t status;                    // TRANSMIT_DONE register
+    uint8_t tx[FRAME_LEN];             // TRANSMIT register
+    uint8_t next[FRAME_LEN];           // Reply sealed ahead of the AP's next frame
+    unsigned rejected;                 // AP frames it could not open
+    unsigned probes;                   // Address-only writes
+} component_t;
+
+static component_t components[2] = {{.addr = COMPONENT_A}, {.addr = COMPONENT_B}};
+
+static component_t *component_at(i2c_addr_t addr) {
+    for (int i = 0; i < 2; i++) {
+        if (components[i].addr == addr) {
+            return &components[i];
+        }
+    }
+    return NULL;
+}
+
+static void component_nonce(component_t *c, uint8_t direction, uint8_t *frame, uint8_t *nonce) {
+    memset(nonce, 0, NONCE_SIZE);
+    nonce[0] = c->addr;
+    nonce[1] = direction;
+    memcpy(&nonce[2], &frame[FRAME_COUNTER_OFFSET], FRAME_COUNTER_LEN);
+}
+
+// Full payload of i ^ address under the current epoch
+static void component_seal(component_t *c, uint8_t *frame) {
+    crypto_session_t *session = key_epochs_send(&c->epochs);
+    uint32_t counter = ++c->send_counter;
+    uint8_t nonce[NONCE_SIZE];
+    frame[0] = MAX_FRAME_PAYLOAD;
+    frame[FRAME_EPOCH_OFFSET] = c->epochs.epoch;
+    frame[FRAME_COUNTER_OFFSET] = counter >> 24;
+    frame[FRAME_COUNTER_OFFSET + 1] = counter >> 16;
+    frame[FRAME_COUNTER_OFFSET + 2] = counter >> 8;
+    frame[FRAME_COUNTER_OFFSET + 3] = counter;
+    for (int i = 0; i < MAX_FRAME_PAYLOAD; i++) {
+        frame[FRAME_HEADER_LEN + i] = i ^ c->addr;
+    }
+    component_nonce(c, FRAME_TO_AP, frame, nonce);
+    encrypt_session(session, &frame[FRAME_HEADER_LEN], MAX_FRAME_PAYLOAD,
+                    &frame[FRAME_HEADER_LEN]);
+    tag_session(session, nonce, frame, FRAME_TAG_OFFSET, &frame[FRAME_HEADER_LEN],
+                MAX_FRAME_PAYLOAD, &frame[FRAME_TAG_OFFSET]);
+}
+
+// The component's open_frame(), then the reply sealed before this frame
+static void component_receive(component_t *c, uint8_t *frame, int len) {
+    uint32_t counter = (uint32_t)frame[FRAME_COUNTER_OFFSET] << 24 |
+                       (uint32_t)frame[FRAME_COUNTER_OFFSET + 1] << 16 |
+                       (uint32_t)frame[FRAME_COUNTER_OFFSET + 2] << 8 |
+                       frame[FRAME_COUNTER_OFFSET + 3];
+    uint32_t epoch;
+    uint8_t nonce[NONCE_SIZE];
+    uint8_t tag[TAG_SIZE];
+    uint8_t payload[MAX_FRAME_PAYLOAD];
+    crypto_session_t *session = key_epochs_find(&c->epochs, frame[FRAME_EPOCH_OFFSET], &epoch);
+    component_nonce(c, FRAME_TO_COMPONENT, frame, nonce);
+    if (len != FRAME_LEN || counter <= c->recv_counter || session == NULL ||
+        tag_session(session, nonce, frame, FRAME_TAG_OFFSET, &frame[FRAME_HEADER_LEN],
+                    MAX_FRAME_PAYLOAD, tag) != 0 ||
+        !tag_equal(tag, &frame[FRAME_TAG_OFFSET])) {
+        c->rejected++;
+        c->status = TRANSMIT_IDLE;
+        return;
+    }
+    c->recv_counter = counter;
+    decrypt_session(session, &frame[FRAME_HEADER_LEN], MAX_FRAME_PAYLOAD, payload);
+    for (int i = 0; i < MAX_FRAME_PAYLOAD; i++) {
+        if (payload[i] != (uint8_t)i) {
+            c->rejected++;
+        }
+    }
+    if (epoch != c->epochs.epoch && key_epochs_switch(&c->epochs) == 0) {
+        key_epochs_prepare(&c->epochs);
+    }
+    memcpy(c->tx, c->next, FRAME_LEN);
+    c->status = TRANSMIT_READY;
+    component_seal(c, c->next);
+}
+
+// Same key as the AP after board_link_set_key()
+static void component_reset(component_t *c) {
+    key_epochs_init(&c->epochs, key, 0);
+    c->present = true;
+    c->send_counter = 0;
+    c->recv_counter = 0;
+    c->status = TRANSMIT_IDLE;
+    c->rejected = 0;
+    c->probes = 0;
+    component_seal(c, c->next);
+}
+
+int MXC_I2C_MasterTransaction(mxc_i2c_req_t *req) {
+    component_t *c = component_at(req->addr);
+    if (c != NULL && req->tx_len == 0) {
+        c->probes++;
+    }
+    if (c == NULL || !c->present) {
+        return E_COMM_ERR;
+    }
+    if (req->tx_len == 0) {
+        return E_NO_ERROR;
+    }
+
+    uint8_t reg = req->tx_buf[0];
+    if (reg == BURST && req->tx_len > 1) {
+        component_receive(c, &req->tx_buf[I2C_TX_HEADROOM], req->tx_buf[1]);
+    } else if (reg == BURST) {
+        // Reading the whole burst acknowledges the response
+        req->rx_buf[0] = c->status;
+        req->rx_buf[1] = FRAME_LEN;
+        memcpy(&req->rx_buf[BURST_READ_HEADER_LEN], c->tx, req->rx_len - BURST_READ_HEADER_LEN);
+        c->status = TRANSMIT_IDLE;
+    } else if (reg == TRANSMIT_DONE) {
+        req->rx_buf[0] = c->status;
+        if (req->rx_len > 1) {
+            req->rx_buf[1] = FRAME_LEN;
+        }
+    }
+    return E_NO_ERROR;
+}
+
+/******************************** TEST ********************************/
+static int check(const char *name, int ok) {
+    printf("%-52s %s\n", name, ok ? "ok" : "FAIL");
+    return ok ? 0 : 1;
+}
+
+static double now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+// A full frame to the component and its reply back through the board link
+static int round_trip(i2c_addr_t addr) {
+    packet_buf_t *buf = packet_alloc();
+    if (buf == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < MAX_FRAME_PAYLOAD; i++) {
+        FRAME_PAYLOAD(buf)[i] = i;
+    }
+    int ok = secure_send_frame(addr, buf, MAX_FRAME_PAYLOAD, key) == SUCCESS_RETURN &&
+             secure_receive_frame(addr, buf, key) == MAX_FRAME_PAYLOAD;
+    for (int i = 0; ok && i < MAX_FRAME_PAYLOAD; i++) {
+        ok = FRAME_PAYLOAD(buf)[i] == (uint8_t)(i ^ addr);
+    }
+    packet_free(buf);
+    return ok;
+}
+
+// A fresh key on the AP and both components
+static void new_key(void) {
+    board_link_set_key(key);
+    component_reset(&components[0]);
+    component_reset(&components[1]);
+}
+
+static uint32_t rotations(void) {
+    return get_frame_stats()->rotations;
+}
+
+typedef struct {
+    unsigned failures;  // Round trips that did not come back intact
+    unsigned rotations; // AP epoch switches
+    unsigned old_epoch; // Replies the AP accepted under the previous epoch
+    // Window times, split by whether a rotation happened in them
+    double quiet_ns[WINDOWS];
+    double rotating_ns[WINDOWS];
+    unsigned quiet_windows;
+    unsigned rotating_windows;
+} run_stats_t;
+
+static void run(uint8_t *stale, run_stats_t *stats) {
+    new_key();
+    uint32_t rotations_start = rotations();
+    uint32_t old_start = get_frame_stats()->old_epoch;
+    int rotated_in_window = 0;
+
+    double window_start = now_ns();
+    for (unsigned i = 0; i < ROUND_TRIPS; i++) {
+        uint32_t before = rotations();
+        stats->failures += !round_trip(COMPONENT_A);
+        if (rotations() != before) {
+            rotated_in_window = 1;
+            // The reply to the first frame under epoch 1 was sealed under 0
+            if (before == rotations_start) {
+                memcpy(stale, components[0].tx, FRAME_LEN);
+            }
+        }
+
+        if ((i + 1) % WINDOW == 0) {
+            double ns = now_ns() - window_start;
+            if (rotated_in_window) {
+                stats->rotating_ns[stats->rotating_windows++] = ns;
+            } else {
+                stats->quiet_ns[stats->quiet_windows++] = ns;
+            }
+            rotated_in_window = 0;
+            window_start = now_ns();
+        }
+    }
+    stats->rotations = rotations() - rotations_start;
+    stats->old_epoch = get_frame_stats()->old_epoch - old_start;
+    stats->failures += components[0].rejected;
+}
+
+static int compare_ns(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Round trips of two full frames per second in the median window, the
+// host's scheduling noise stays out of it
+static double median_rate(double *ns, unsigned windows) {
+    if (windows == 0) {
+        return 0;
+    }
+    qsort(ns, windows, sizeof(double), compare_ns);
+    return WINDOW / (ns[windows / 2] / 1e9);
+}
+
+// board_link_rotate_key() on its own. Two round trips after each one bring
+// the component up to the new epoch so the next rotation is not held up
+static double switch_ns(void) {
+    double ns = 0;
+    new_key();
+    for (int i = 0; i < SWITCH_ROUNDS; i++) {
+        double start = now_ns();
+        board_link_rotate_key();
+        ns += now_ns() - start;
+        round_trip(COMPONENT_A);
+        round_trip(COMPONENT_A);
+    }
+    return ns / SWITCH_ROUNDS;
+}
+
+int main() {
+    static uint8_t stale[FRAME_LEN];
+    static run_stats_t rotating;
+    int failures = 0;
+
+    failures += check("crypto_self_test", crypto_self_test() == 0);
+    board_link_init();
+
+    run(stale, &rotating);
+    failures += check("rotating, every frame accepted", rotating.failures == 0);
+    failures += check("replies under the old epoch accepted",
+                      rotating.old_epoch == rotating.rotations);
+    failures += check("rotation every KEY_ROTATE_FRAMES",
+                      rotating.rotations == ROUND_TRIPS / (KEY_ROTATE_FRAMES + 1));
+
+    // A reply from epochs back finds no schedule
+    uint32_t rejected = get_frame_stats()->bad_header;
+    memcpy(components[0].tx, stale, FRAME_LEN);
+    components[0].status = TRANSMIT_READY;
+    packet_buf_t *buf = packet_alloc();
+    failures += check("reply from epochs back rejected",
+                      secure_receive_frame(COMPONENT_A, buf, key) == ERROR_RETURN &&
+                      get_frame_stats()->bad_header == rejected + 1);
+    packet_free(buf);
+
+    // Both components get a frame under epoch 0, then B goes away
+    new_key();
+    round_trip(COMPONENT_A);
+    round_trip(COMPONENT_B);
+    components[1].present = false;
+    uint32_t start = rotations();
+    for (int i = 0; i < TWO_ROTATIONS; i++) {
+        round_trip(COMPONENT_A);
+    }
+    failures += check("component that went away does not hold rotation",
+                      rotations() - start >= 2 && components[1].probes >= 1);
+
+    // B stays but is not talked to, its last answer stays under epoch 0
+    new_key();
+    round_trip(COMPONENT_A);
+    round_trip(COMPONENT_B);
+    start = rotations();
+    for (int i = 0; i < TWO_ROTATIONS; i++) {
+        round_trip(COMPONENT_A);
+    }
+    failures += check("lagging component holds the second rotation",
+                      rotations() - start == 1);
+    failures += check("lagging component probed once per retry",
+                      components[1].probes >= 1 &&
+                      components[1].probes <= TWO_ROTATIONS / KEY_ROTATE_RETRY_FRAMES);
+    // The first reply to epoch 1 was sealed under 0, the second is under 1
+    round_trip(COMPONENT_B);
+    round_trip(COMPONENT_B);
+    for (int i = 0; i <= KEY_ROTATE_RETRY_FRAMES; i++) {
+        round_trip(COMPONENT_A);
+    }
+    failures += check("rotation goes on once it caught up", rotations() - start == 2);
+
+    // B fails an exchange, then comes back without the AP talking to it
+    new_key();
+    round_trip(COMPONENT_A);
+    round_trip(COMPONENT_B);
+    components[1].present = false;
+    int lost = round_trip(COMPONENT_B);
+    components[1].present = true;
+    unsigned probes = components[1].probes;
+    start = rotations();
+    for (int i = 0; i < TWO_ROTATIONS; i++) {
+        round_trip(COMPONENT_A);
+    }
+    failures += check("failed exchange drops it from the wait",
+                      !lost && rotations() - start >= 2 && components[1].probes == probes);
+
+    double quiet = median_rate(rotating.quiet_ns, rotating.quiet_windows);
+    double with = median_rate(rotating.rotating_ns, rotating.rotating_windows);
+    double rotation = switch_ns();
+    printf("\n%u round trips of two %d byte frames, %d per window, rotation every %d frames\n",
+           ROUND_TRIPS, MAX_FRAME_PAYLOAD, WINDOW, KEY_ROTATE_FRAMES);
+    printf("%-32s %8s %18s\n", "windows", "count", "round trips/s");
+    printf("%-32s %8u %18.0f\n", "no switch in window", rotating.quiet_windows, quiet);
+    printf("%-32s %8u %18.0f\n", "switch in window", rotating.rotating_windows, with);
+    printf("%u rotations, %u replies accepted under the previous epoch\n", rotating.rotations,
+           rotating.old_epoch);
+    printf("one AP rotation %.0f ns, %.2f%% of a %d round trip window\n", rotation,
+           rotation * 100 * with / WINDOW / 1e9, WINDOW);
+
+    return failures;
+}
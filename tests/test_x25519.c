@@ -0,0 +1,549 @@
+/**
+ * @file test_x25519.c
+ * @brief Key sync of the real AP and component key_exchange.c over pipes
+ *
+ * Builds the AP's key_exchange.c and the component's, renamed so both link
+ * into one program, against tests/mock. Every simulated component is a
+ * forked process running the component's key_sync(), with a pipe each way
+ * standing in for its I2C registers: the mocked send_packet(),
+ * poll_transmit_status() and receive_ready_packet() of the AP and
+ * wait_and_receive_packet() and send_packet_and_ack() of the component
+ * frame each message as [len][data], with the component's thumb2 cycles in
+ * front of its replies. The AP's key_sync() runs in the parent with the
+ * real POLL_TIMEOUT_US, and wait_until() sleeps until its deadline.
+ *
+ * Checks that 1 to 32 components each end up with the AP's key, and that a
+ * component built with another MASK does not while the others still do. In
+ * the X25519 exchange it must also reject the final message. Then prints,
+ * per sync, the status polls and the bus time of every message the AP sent
+ * or read at 100 kHz, counted the same way as link_model.c, and the host
+ * time of each side: the AP's key_sync() less its sleeps, pipe I/O
+ * included, and the slowest component's key_sync() less its waits.
+ *
+ * Generic C backend, once per exchange, KEY_SYNC_X25519=1 below and 0 for XOR:
+ *     W=application_processor/wolfssl
+ *     CFLAGS="-O2 -ffunction-sections -DCRYPTO_EXAMPLE=1 -DWOLFSSL_AES_DIRECT \
+ *         -DNO_WOLFSSL_DIR -DWOLFSSL_USER_IO -DHAVE_POLY1305 -DHAVE_CURVE25519 \
+ *         -DKEY_SYNC_X25519=1 -Itests/mock -I$W"
+ *     gcc $CFLAGS -Icomponent/inc -Dkey_sync=component_key_sync \
+ *         -Dkey_resume=component_key_resume -DKEY_SHARE=COMPONENT_KEY_SHARE \
+ *         -c component/src/key_exchange.c -o component_key_exchange.o
+ *     gcc $CFLAGS -Wl,--gc-sections -Iapplication_processor/inc tests/test_x25519.c \
+ *         component_key_exchange.o \
+ *         application_processor/src/{key_exchange,packet_pool,simple_crypto,xor_secure}.c \
+ *         $W/wolfcrypt/src/{aes,hash,md5,sha,sha256,sha512,sha3,poly1305,curve25519,fe_operations,memory,error,logging,wc_port}.c \
+ *         -o x25519 && ./x25519
+ *
+ * Thumb2 assembly, as the firmware builds KEY_SYNC_X25519=1 (and XOR with
+ * CRYPTO_THUMB2_AES=1): thumb2_wolfcrypt.c runs every scalar multiplication
+ * and AES call on thumb2_sim.c. With $A, thumb2-aes.o and poly1305.o from
+ * test_aes_kat.c:
+ *     P=$W/wolfcrypt/src/port/arm
+ *     gcc -E -P -x assembler-with-cpp $CFLAGS $A -D__thumb__ $P/thumb2-curve25519.S | \
+ *         llvm-mc --triple=thumbv7em-none-eabi -mcpu=cortex-m4 -filetype=obj \
+ *         -o thumb2-curve25519.o
+ *     T="$A -DTHUMB2_AES_OBJ=\"thumb2-aes.o\" -DTHUMB2_CURVE25519_OBJ=\"thumb2-curve25519.o\""
+ *     gcc $CFLAGS $T -Icomponent/inc -Dkey_sync=component_key_sync \
+ *         -Dkey_resume=component_key_resume -DKEY_SHARE=COMPONENT_KEY_SHARE \
+ *         -c component/src/key_exchange.c -o component_key_exchange.o
+ *     gcc $CFLAGS $T -Wl,--gc-sections -Iapplication_processor/inc tests/test_x25519.c \
+ *         tests/thumb2_{sim,wolfcrypt}.c component_key_exchange.o $P/armv8-aes.c poly1305.o \
+ *         application_processor/src/{key_exchange,packet_pool,simple_crypto,xor_secure}.c \
+ *         $W/wolfcrypt/src/{aes,hash,md5,sha,sha256,sha512,sha3,curve25519,fe_operations,memory,error,logging,wc_port}.c \
+ *         -o x25519 && ./x25519
+ *
+ * The times in the first table are host times. The thumb2 build instead
+ * runs the AP on a model clock: the bus time at 100 kHz, the Cortex-M4
+ * model cycles of the AP's assembly at CPU_HZ and the waits of its
+ * deadlines. A component's reply is ready the model cycles of its own
+ * assembly after the AP's message went out, so the components overlap
+ * each other and the bus as they would on the board. The second table's
+ * setup time is that clock at the end of the AP's key_sync(). It leaves
+ * out the C glue (Poly1305, XOR, packet handling), which the assembly
+ * dominates for X25519, and is not a board measurement:
+ * test_x25519_cycles() in test_encryption.c prints the cycles of a scalar
+ * multiplication on the board.
+ */
+
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "key_exchange.h"
+#include "timebase.h"
+#ifdef THUMB2_AES_OBJ
+#include "thumb2_sim.h"
+#endif
+
+// Component i has ID FIRST_ID + i and I2C address FIRST_ADDR + i
+#define FIRST_ID 0x11111108
+#define FIRST_ADDR 0x08
+#define TIMING_ROUNDS 10
+
+// Bus accounting of link_model.c
+#define I2C_FREQ 100000
+#define TRANSACTION_OVERHEAD_CLOCKS 2
+#define RESTART_OVERHEAD_CLOCKS 1
+#define CLOCKS_PER_BYTE 9
+
+// MAX78000 core clock on its internal primary oscillator
+#define CPU_HZ 100000000
+#ifdef THUMB2_AES_OBJ
+// Host time a component may take to interpret its reply
+#define REPLY_WAIT_MS 10000
+#else
+#define REPLY_WAIT_MS 0
+#endif
+
+// Component key_exchange.c, built with the names above
+uint8_t component_key_sync(char *dest);
+
+/******************************** DEPLOYMENT ********************************/
+#define M1_BYTES {0x3c, 0x4f, 0xcf, 0x09, 0x88, 0x15, 0xf7, 0xab, \
+                  0xa6, 0xd2, 0xae, 0x28, 0x16, 0x15, 0x7e, 0x2b}
+#define F1_BYTES {0x71, 0x0f, 0x3b, 0x66, 0x95, 0xd8, 0x24, 0x50, \
+                  0xe3, 0x1e, 0x9a, 0xc4, 0x07, 0x6d, 0x82, 0xbf}
+
+// AP key.h
+uint8_t KEY_SHARE[KEY_SHARE_LEN] = {0x8e, 0x73, 0xb0, 0xf7, 0xda, 0x0e, 0x64, 0x52,
+                                    0xc8, 0x10, 0xf3, 0x2b, 0x80, 0x90, 0x79, 0xe5};
+const uint8_t M1[KEY_SHARE_LEN] = M1_BYTES;
+const uint8_t F1[KEY_SHARE_LEN] = F1_BYTES;
+
+// Component key.h. MASK is const there, it is writable here so a component
+// can play one built with another MASK
+uint8_t COMPONENT_KEY_SHARE[KEY_SHARE_LEN];
+uint8_t MASK[KEY_SHARE_LEN] = M1_BYTES;
+const uint8_t FINAL_MASK[KEY_SHARE_LEN] = F1_BYTES;
+
+/******************************** TEST HELPERS ********************************/
+static uint32_t rng_state = 0x2024ec7f;
+
+void Rand_NASYC(uint8_t *buf, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) {
+        rng_state = rng_state * 1103515245 + 12345;
+        buf[i] = rng_state >> 16;
+    }
+}
+
+static double now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+static void write_all(int fd, const void *data, size_t len) {
+    const uint8_t *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0) {
+            _exit(2);
+        }
+        p += n;
+        len -= n;
+    }
+}
+
+static int read_all(int fd, void *data, size_t len) {
+    uint8_t *p = data;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// One message, [len][data] in a single write
+static void write_message(int fd, uint8_t len, const uint8_t *data) {
+    uint8_t frame[1 + MAX_I2C_MESSAGE_LEN];
+    frame[0] = len;
+    memcpy(&frame[1], data, len);
+    write_all(fd, frame, 1 + len);
+}
+
+// Cortex-M4 model cycles of the thumb2 assembly this process has run
+static uint64_t cycles_now(void) {
+#ifdef THUMB2_AES_OBJ
+    return thumb2_cycles();
+#else
+    return 0;
+#endif
+}
+
+static int check(const char *name, int ok) {
+    printf("%-44s %s\n", name, ok ? "ok" : "FAIL");
+    return ok ? 0 : 1;
+}
+
+/******************************** MOCK TIMEBASE ********************************/
+// Time the AP spent asleep in wait_until()
+static double ap_waited_us;
+
+#ifdef THUMB2_AES_OBJ
+/* The thumb2 build runs the AP on a model clock instead of sleeping on the
+ * host's, which would count the interpreter's speed: the bus time of the
+ * sync so far, the assembly cycles the AP ran at CPU_HZ and its waits
+ */
+static double bus_us(void);
+static uint64_t sync_start_cycles;
+static double model_waited_us;
+
+static double model_us(void) {
+    return bus_us() + (double)(cycles_now() - sync_start_cycles) * 1e6 / CPU_HZ +
+           model_waited_us;
+}
+#endif
+
+uint64_t timebase_now_us(void) {
+#ifdef THUMB2_AES_OBJ
+    return (uint64_t)(model_us() + 0.5);
+#else
+    return (uint64_t)now_us();
+#endif
+}
+
+deadline_t deadline_in_us(uint32_t us) {
+    return timebase_now_us() + us;
+}
+
+bool deadline_expired(deadline_t deadline) {
+    return timebase_now_us() >= deadline;
+}
+
+void wait_until(deadline_t deadline) {
+#ifdef THUMB2_AES_OBJ
+    double model_now = model_us();
+    if (deadline > model_now) {
+        model_waited_us += deadline - model_now;
+    }
+    return;
+#endif
+    double start = now_us();
+    while (!deadline_expired(deadline)) {
+        struct timespec step = {0, 10000};
+        nanosleep(&step, NULL);
+    }
+    ap_waited_us += now_us() - start;
+}
+
+void deadline_finish(deadline_t deadline) {}
+
+/******************************** MOCK AP LINK ********************************/
+typedef struct {
+    pid_t pid;
+    int to;   // AP writes the component's registers
+    int from; // AP reads them
+    bool ready;
+    uint8_t ready_len;
+    double sent_at;  // Model time the last message to it went out
+    double ready_at; // Model time its reply is ready
+} component_t;
+
+static component_t components[KEY_SYNC_MAX_COMPONENTS];
+
+// What the AP put on the bus in one sync
+typedef struct {
+    unsigned transactions;
+    unsigned restarts;
+    unsigned bytes; // address bytes included
+    unsigned polls;
+} bus_cost;
+
+static bus_cost bus;
+
+// Register write: address, register byte, data
+static void reg_write(unsigned len) {
+    bus.transactions++;
+    bus.bytes += 1 + 1 + len;
+}
+
+// Register read: address + register byte, repeated START, address + data
+static void reg_read(unsigned len) {
+    bus.transactions++;
+    bus.restarts++;
+    bus.bytes += 1 + 1 + 1 + len;
+}
+
+static double bus_us(void) {
+    double clocks = (double)bus.bytes * CLOCKS_PER_BYTE +
+                    (double)bus.transactions * TRANSACTION_OVERHEAD_CLOCKS +
+                    (double)bus.restarts * RESTART_OVERHEAD_CLOCKS;
+    return clocks * 1e6 / I2C_FREQ;
+}
+
+i2c_addr_t component_id_to_i2c_addr(uint32_t component_id) {
+    return FIRST_ADDR + (component_id - FIRST_ID);
+}
+
+// [len][data] through BURST
+int send_packet(i2c_addr_t address, uint8_t len, uint8_t *packet) {
+    reg_write(BURST_WRITE_HEADER_LEN + len);
+    write_message(components[address - FIRST_ADDR].to, len, packet);
+#ifdef THUMB2_AES_OBJ
+    components[address - FIRST_ADDR].sent_at = model_us();
+#endif
+    return SUCCESS_RETURN;
+}
+
+// Ready once the component's reply is in the pipe. The thumb2 build waits
+// for it and then for the model time the component spent on it
+int poll_transmit_status(i2c_addr_t address, uint8_t *len) {
+    component_t *c = &components[address - FIRST_ADDR];
+    reg_read(BURST_READ_HEADER_LEN);
+    bus.polls++;
+    if (!c->ready) {
+        struct pollfd reply = {.fd = c->from, .events = POLLIN};
+        uint64_t cycles;
+        if (poll(&reply, 1, REPLY_WAIT_MS) <= 0) {
+            return TRANSMIT_BUSY;
+        }
+        if (read_all(c->from, &cycles, sizeof(cycles)) != 0 ||
+            read_all(c->from, &c->ready_len, 1) != 0) {
+            return ERROR_RETURN;
+        }
+        c->ready = true;
+        c->ready_at = c->sent_at + (double)cycles * 1e6 / CPU_HZ;
+    }
+#ifdef THUMB2_AES_OBJ
+    if (model_us() < c->ready_at) {
+        return TRANSMIT_BUSY;
+    }
+#endif
+    *len = c->ready_len;
+    return TRANSMIT_READY;
+}
+
+// [status][len][data]
+int receive_ready_packet(i2c_addr_t address, uint8_t len, uint8_t *packet) {
+    component_t *c = &components[address - FIRST_ADDR];
+    reg_read(BURST_READ_HEADER_LEN + len);
+    if (!c->ready || len != c->ready_len || read_all(c->from, packet, len) != 0) {
+        return ERROR_RETURN;
+    }
+    c->ready = false;
+    return len;
+}
+
+/******************************** MOCK COMPONENT LINK ********************************/
+// The forked component's ends of its pipes
+static int component_in;
+static int component_out;
+// Time the component spent waiting for the AP
+static double component_waited_us;
+// Assembly cycles when the last message from the AP came in
+static uint64_t received_cycles;
+
+uint8_t wait_and_receive_packet(uint8_t *packet) {
+    double start = now_us();
+    uint8_t len;
+    if (read_all(component_in, &len, 1) != 0 || read_all(component_in, packet, len) != 0) {
+        _exit(2);
+    }
+    component_waited_us += now_us() - start;
+    received_cycles = cycles_now();
+    return len;
+}
+
+// [cycles][len][data], the cycles spent since the AP's message
+void send_packet_and_ack(uint8_t len, uint8_t *packet) {
+    uint64_t cycles = cycles_now() - received_cycles;
+    write_all(component_out, &cycles, sizeof(cycles));
+    write_message(component_out, len, packet);
+}
+
+// What a component reports after its key_sync()
+typedef struct {
+    int ok;
+    uint8_t key[KEY_SHARE_LEN];
+    double cpu_us;
+    uint64_t cycles;
+} sync_result;
+
+// The DEAD trigger, then the component's key_sync(), then the result
+static void component_main(unsigned i, bool other_mask) {
+    uint8_t msg[MAX_I2C_MESSAGE_LEN];
+    sync_result result = {0};
+
+    // Every component draws its own randomness and has its own share
+    rng_state ^= 0x9e3779b9 * (i + 1);
+    Rand_NASYC(COMPONENT_KEY_SHARE, KEY_SHARE_LEN);
+    if (other_mask) {
+        MASK[0] ^= 1;
+    }
+
+    int trigger = wait_and_receive_packet(msg) == KEY_SYNC_TRIGGER_LEN;
+    for (int j = 0; j < KEY_SYNC_TRIGGER_LEN; j++) {
+        trigger &= msg[j] == "DEAD"[j % 4];
+    }
+    if (trigger) {
+        double start = now_us();
+        uint64_t cycles = cycles_now();
+        component_waited_us = 0;
+        result.ok = component_key_sync((char *)result.key) == KEY_SHARE_FINAL_LEN;
+        result.cpu_us = now_us() - start - component_waited_us;
+        result.cycles = cycles_now() - cycles;
+    }
+    write_all(component_out, &result, sizeof(result));
+    _exit(0);
+}
+
+/******************************** ONE SYNC ********************************/
+typedef struct {
+    int ap_ok;
+    uint8_t key[KEY_SHARE_LEN];
+    sync_result components[KEY_SYNC_MAX_COMPONENTS];
+    double ap_cpu_us;
+    double component_cpu_us; // slowest component
+    double wall_us;
+    uint64_t ap_cycles;
+    uint64_t component_cycles; // slowest component
+    double setup_us;           // Model time of the AP's key_sync()
+} sync_run;
+
+// Forks n components, the one at other_mask built with another MASK, and
+// runs the AP's key_sync() with them
+static void run_sync(unsigned n, int other_mask, sync_run *run) {
+    uint32_t ids[KEY_SYNC_MAX_COMPONENTS];
+    memset(run, 0, sizeof(*run));
+    memset(&bus, 0, sizeof(bus));
+
+    for (unsigned i = 0; i < n; i++) {
+        int to[2], from[2];
+        if (pipe(to) != 0 || pipe(from) != 0) {
+            exit(2);
+        }
+        pid_t pid = fork();
+        if (pid == 0) {
+            component_in = to[0];
+            component_out = from[1];
+            close(to[1]);
+            close(from[0]);
+            component_main(i, (int)i == other_mask);
+        }
+        close(to[0]);
+        close(from[1]);
+        components[i] = (component_t){.pid = pid, .to = to[1], .from = from[0]};
+        ids[i] = FIRST_ID + i;
+    }
+
+    ap_waited_us = 0;
+    double start = now_us();
+    uint64_t cycles = cycles_now();
+#ifdef THUMB2_AES_OBJ
+    sync_start_cycles = cycles;
+    model_waited_us = 0;
+#endif
+    run->ap_ok = key_sync(run->key, n, ids) == 0;
+    run->wall_us = now_us() - start;
+    run->ap_cpu_us = run->wall_us - ap_waited_us;
+    run->ap_cycles = cycles_now() - cycles;
+#ifdef THUMB2_AES_OBJ
+    run->setup_us = model_us();
+#endif
+
+    for (unsigned i = 0; i < n; i++) {
+        // A component still waiting on a sync the AP gave up has nothing to say
+        if (!run->ap_ok) {
+            kill(components[i].pid, SIGKILL);
+        } else if (read_all(components[i].from, &run->components[i],
+                            sizeof(sync_result)) != 0) {
+            run->components[i].ok = 0;
+        }
+        if (run->components[i].cpu_us > run->component_cpu_us) {
+            run->component_cpu_us = run->components[i].cpu_us;
+        }
+        if (run->components[i].cycles > run->component_cycles) {
+            run->component_cycles = run->components[i].cycles;
+        }
+        close(components[i].to);
+        close(components[i].from);
+        waitpid(components[i].pid, NULL, 0);
+    }
+}
+
+// The components except skip hold the AP's key
+static int agree(const sync_run *run, unsigned n, int skip) {
+    int ok = run->ap_ok;
+    for (unsigned i = 0; i < n; i++) {
+        if ((int)i != skip) {
+            ok &= run->components[i].ok &&
+                  !memcmp(run->components[i].key, run->key, KEY_SHARE_LEN);
+        }
+    }
+    return ok;
+}
+
+int main() {
+    static const unsigned counts[] = {1, 2, 8, 32};
+    static const unsigned n_counts = sizeof(counts) / sizeof(counts[0]);
+    double setup_ms[n_counts], ap_cycles[n_counts], component_cycles[n_counts];
+    sync_run run;
+    int failures = 0;
+
+    failures += check("crypto_self_test", crypto_self_test() == 0);
+
+    int all_agree = 1;
+    for (unsigned n = 1; n <= KEY_SYNC_MAX_COMPONENTS; n++) {
+        run_sync(n, -1, &run);
+        all_agree &= agree(&run, n, -1);
+    }
+    failures += check("every component agrees, 1 to 32", all_agree);
+
+    // Component 1 was built with another MASK
+    run_sync(3, 1, &run);
+    failures += check("others still agree with one MASK off", agree(&run, 3, 1));
+    failures += check("component with another MASK has no key",
+                      !run.components[1].ok ||
+                          memcmp(run.components[1].key, run.key, KEY_SHARE_LEN) != 0);
+#if KEY_SYNC_X25519
+    // A man in the middle completes X25519 but cannot derive the wrap key
+    failures += check("X25519 final rejected without MASK", !run.components[1].ok);
+#endif
+
+    printf("\n%s key sync, bus at %u Hz, host CPU, averaged over %u syncs\n",
+           KEY_SYNC_X25519 ? "X25519" : "XOR", I2C_FREQ, TIMING_ROUNDS);
+    printf("%-12s %8s %10s %12s %14s %12s\n", "components", "polls", "bus ms", "AP cpu ms",
+           "component ms", "wall ms");
+    for (unsigned i = 0; i < n_counts; i++) {
+        unsigned n = counts[i];
+        double polls = 0, bus_ms = 0, ap_ms = 0, component_ms = 0, wall_ms = 0;
+        setup_ms[i] = ap_cycles[i] = component_cycles[i] = 0;
+        for (int r = 0; r < TIMING_ROUNDS; r++) {
+            run_sync(n, -1, &run);
+            failures += !agree(&run, n, -1);
+            polls += bus.polls;
+            bus_ms += bus_us() / 1000;
+            ap_ms += run.ap_cpu_us / 1000;
+            component_ms += run.component_cpu_us / 1000;
+            wall_ms += run.wall_us / 1000;
+            ap_cycles[i] += (double)run.ap_cycles / TIMING_ROUNDS;
+            component_cycles[i] += (double)run.component_cycles / TIMING_ROUNDS;
+            setup_ms[i] += run.setup_us / 1000 / TIMING_ROUNDS;
+        }
+        printf("%-12u %8.1f %10.2f %12.3f %14.3f %12.3f\n", n, polls / TIMING_ROUNDS,
+               bus_ms / TIMING_ROUNDS, ap_ms / TIMING_ROUNDS, component_ms / TIMING_ROUNDS,
+               wall_ms / TIMING_ROUNDS);
+    }
+
+#ifdef THUMB2_AES_OBJ
+    printf("\n%s key sync, thumb2 assembly on the Cortex-M4 model at %u MHz\n",
+           KEY_SYNC_X25519 ? "X25519" : "XOR", CPU_HZ / 1000000);
+    printf("%-12s %12s %18s %12s\n", "components", "AP cycles", "component cycles",
+           "setup ms");
+    for (unsigned i = 0; i < n_counts; i++) {
+        printf("%-12u %12.0f %18.0f %12.2f\n", counts[i], ap_cycles[i], component_cycles[i],
+               setup_ms[i]);
+    }
+#endif
+
+    return failures;
+}
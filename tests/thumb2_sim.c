@@ -0,0 +1,801 @@
+/**
+ * @file thumb2_sim.c
+ * @brief Host interpreter for the wolfSSL Cortex-M thumb2 assembly
+ *
+ * Covers the ARMv7E-M instructions that thumb2-aes-asm.S and
+ * thumb2-curve25519.S use, without IT blocks, exceptions or the FPU. Any
+ * other encoding stops the test with its address so a new wolfSSL release
+ * cannot be mis-simulated silently.
+ *
+ * Cortex-M4 cycle model (TRM table 3-1, P = 2):
+ *     data processing, MUL, UMULL, UMLAL, UMAAL   1
+ *     MLA, MLS                                    2
+ *     LDR, STR                                    2, 1 after another LDR/STR
+ *     LDRD, STRD                                  3
+ *     LDM, STM, PUSH, POP                         1 + N
+ *     taken branch or write to PC                 + P
+ */
+
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "thumb2_sim.h"
+
+#define PIPELINE_REFILL 2
+#define STACK_SIZE 0x4000u
+// Returning here ends t2_call()
+#define RETURN_MAGIC 0xFFFFFFF0u
+// glibc's <elf.h> still uses the old name for BL relocations
+#ifndef R_ARM_THM_CALL
+#define R_ARM_THM_CALL R_ARM_THM_PC22
+#endif
+
+static void fault(t2_sim_t *sim, const char *what, uint32_t value) {
+    fprintf(stderr, "thumb2_sim: %s 0x%08x at pc 0x%08x\n", what, (unsigned)value,
+            (unsigned)sim->r[15]);
+    exit(1);
+}
+
+static uint8_t *mem(t2_sim_t *sim, uint32_t addr, uint32_t len) {
+    if (addr >= T2_FLASH_BASE && addr - T2_FLASH_BASE + len <= T2_FLASH_SIZE)
+        return sim->flash + (addr - T2_FLASH_BASE);
+    if (addr >= T2_RAM_BASE && addr - T2_RAM_BASE + len <= T2_RAM_SIZE)
+        return sim->ram + (addr - T2_RAM_BASE);
+    fault(sim, "bad access", addr);
+    return NULL;
+}
+
+static uint32_t rd32(t2_sim_t *sim, uint32_t a) {
+    uint8_t *p = mem(sim, a, 4);
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint32_t rd16(t2_sim_t *sim, uint32_t a) {
+    uint8_t *p = mem(sim, a, 2);
+    return p[0] | p[1] << 8;
+}
+
+static void wr32(t2_sim_t *sim, uint32_t a, uint32_t v) {
+    uint8_t *p = mem(sim, a, 4);
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static void wr16(t2_sim_t *sim, uint32_t a, uint32_t v) {
+    uint8_t *p = mem(sim, a, 2);
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+/******************************** LOADER ********************************/
+
+int t2_load(t2_sim_t *sim, const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return -1;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *obj = malloc(size);
+    if (!obj || fread(obj, 1, size, f) != (size_t)size) {
+        fclose(f);
+        free(obj);
+        return -1;
+    }
+    fclose(f);
+
+    memset(sim, 0, sizeof(*sim));
+    Elf32_Ehdr *eh = (Elf32_Ehdr *)obj;
+    if (memcmp(eh->e_ident, ELFMAG, SELFMAG) || eh->e_ident[EI_CLASS] != ELFCLASS32 ||
+        eh->e_machine != EM_ARM || eh->e_type != ET_REL) {
+        free(obj);
+        return -1;
+    }
+    Elf32_Shdr *sh = (Elf32_Shdr *)(obj + eh->e_shoff);
+
+    // Lay the allocated sections out back to back in flash
+    uint32_t base[eh->e_shnum];
+    uint32_t next = T2_FLASH_BASE;
+    for (int i = 0; i < eh->e_shnum; i++) {
+        base[i] = 0;
+        if (!(sh[i].sh_flags & SHF_ALLOC))
+            continue;
+        uint32_t align = sh[i].sh_addralign ? sh[i].sh_addralign : 1;
+        next = (next + align - 1) & ~(align - 1);
+        base[i] = next;
+        if (sh[i].sh_type == SHT_PROGBITS)
+            memcpy(mem(sim, next, sh[i].sh_size), obj + sh[i].sh_offset, sh[i].sh_size);
+        next += sh[i].sh_size;
+    }
+
+    int result = 0;
+    for (int i = 0; i < eh->e_shnum && !result; i++) {
+        if (sh[i].sh_type == SHT_SYMTAB) {
+            Elf32_Sym *sym = (Elf32_Sym *)(obj + sh[i].sh_offset);
+            const char *names = (const char *)(obj + sh[sh[i].sh_link].sh_offset);
+            for (uint32_t s = 0; s < sh[i].sh_size / sizeof(*sym); s++) {
+                if (ELF32_ST_BIND(sym[s].st_info) != STB_GLOBAL ||
+                    sym[s].st_shndx == SHN_UNDEF)
+                    continue;
+                if (sim->nsyms == T2_MAX_SYMBOLS) {
+                    result = -1;
+                    break;
+                }
+                snprintf(sim->syms[sim->nsyms].name, sizeof(sim->syms[0].name), "%s",
+                         names + sym[s].st_name);
+                sim->syms[sim->nsyms++].addr = base[sym[s].st_shndx] + sym[s].st_value;
+            }
+        }
+        if (sh[i].sh_type != SHT_REL || !base[sh[i].sh_info])
+            continue;
+
+        Elf32_Rel *rel = (Elf32_Rel *)(obj + sh[i].sh_offset);
+        Elf32_Sym *symtab = (Elf32_Sym *)(obj + sh[sh[i].sh_link].sh_offset);
+        for (uint32_t k = 0; k < sh[i].sh_size / sizeof(*rel); k++) {
+            Elf32_Sym *sym = &symtab[ELF32_R_SYM(rel[k].r_info)];
+            uint32_t p = base[sh[i].sh_info] + rel[k].r_offset;
+            if (sym->st_shndx == SHN_UNDEF || sym->st_shndx >= eh->e_shnum) {
+                result = -1;
+                break;
+            }
+            uint32_t s = base[sym->st_shndx] + sym->st_value;
+
+            if (ELF32_R_TYPE(rel[k].r_info) == R_ARM_ABS32) {
+                wr32(sim, p, s + rd32(sim, p));
+            } else if (ELF32_R_TYPE(rel[k].r_info) == R_ARM_THM_CALL) {
+                uint32_t hw1 = rd16(sim, p), hw2 = rd16(sim, p + 2);
+                uint32_t sb = (hw1 >> 10) & 1;
+                uint32_t i1 = !(((hw2 >> 13) & 1) ^ sb), i2 = !(((hw2 >> 11) & 1) ^ sb);
+                int32_t addend = (int32_t)((sb << 24 | i1 << 23 | i2 << 22 |
+                                            (hw1 & 0x3ff) << 12 | (hw2 & 0x7ff) << 1)
+                                           << 7) >> 7;
+                uint32_t off = ((s & ~1u) + addend - p) & ~1u;
+                sb = off >> 31;
+                i1 = (off >> 23) & 1;
+                i2 = (off >> 22) & 1;
+                wr16(sim, p, 0xf000 | sb << 10 | ((off >> 12) & 0x3ff));
+                wr16(sim, p + 2, (hw2 & 0xd000) | (!(i1 ^ sb)) << 13 | (!(i2 ^ sb)) << 11 |
+                                     ((off >> 1) & 0x7ff));
+            } else {
+                result = -1;
+                break;
+            }
+        }
+    }
+    free(obj);
+    sim->scratch = T2_RAM_BASE;
+    return result;
+}
+
+uint32_t t2_put(t2_sim_t *sim, const void *data, size_t len) {
+    uint32_t addr = sim->scratch;
+    if (addr - T2_RAM_BASE + len > T2_RAM_SIZE - STACK_SIZE)
+        fault(sim, "argument area full", (uint32_t)len);
+    memcpy(mem(sim, addr, len), data, len);
+    sim->scratch = (addr + len + 3) & ~3u;
+    return addr;
+}
+
+void t2_get(t2_sim_t *sim, uint32_t addr, void *out, size_t len) {
+    memcpy(out, mem(sim, addr, len), len);
+}
+
+/******************************** ALU ********************************/
+
+static uint32_t add_with_carry(t2_sim_t *sim, uint32_t a, uint32_t b, int carry, int setflags) {
+    uint64_t u = (uint64_t)a + b + carry;
+    uint32_t result = (uint32_t)u;
+    if (setflags) {
+        sim->n = result >> 31;
+        sim->z = result == 0;
+        sim->c = u >> 32;
+        sim->v = (~(a ^ b) & (a ^ result)) >> 31;
+    }
+    return result;
+}
+
+// Shift_C() of the ARM ARM, type 0 LSL, 1 LSR, 2 ASR, 3 ROR (RRX for 0)
+static uint32_t shift_c(uint32_t value, int type, int amount, int *carry) {
+    if (type == 3 && amount == 0) {
+        int out = value & 1;
+        value = value >> 1 | (uint32_t)*carry << 31;
+        *carry = out;
+        return value;
+    }
+    if (amount == 0)
+        return value;
+    switch (type) {
+    case 0:
+        *carry = amount <= 32 ? (int)((uint64_t)value >> (32 - amount)) & 1 : 0;
+        return amount < 32 ? value << amount : 0;
+    case 1:
+        *carry = amount <= 32 ? (int)(value >> (amount - 1)) & 1 : 0;
+        return amount < 32 ? value >> amount : 0;
+    case 2:
+        if (amount >= 32) {
+            *carry = value >> 31;
+            return (uint32_t)((int32_t)value >> 31);
+        }
+        *carry = ((int32_t)value >> (amount - 1)) & 1;
+        return (uint32_t)((int32_t)value >> amount);
+    default:
+        amount &= 31;
+        value = amount ? value >> amount | value << (32 - amount) : value;
+        *carry = value >> 31;
+        return value;
+    }
+}
+
+// Shift by the bottom byte of a register, where 0 leaves value and carry alone
+static uint32_t shift_reg(uint32_t value, int type, uint32_t amount, int *carry) {
+    amount &= 0xff;
+    return amount ? shift_c(value, type, amount, carry) : value;
+}
+
+// Shift amount of an immediate shift, LSR/ASR #0 mean #32
+static int imm_shift(int type, int imm5) {
+    return (type == 1 || type == 2) && imm5 == 0 ? 32 : imm5;
+}
+
+static uint32_t expand_imm(uint32_t imm12, int *carry) {
+    uint32_t imm8 = imm12 & 0xff;
+    if ((imm12 >> 10) == 0) {
+        switch ((imm12 >> 8) & 3) {
+        case 0:
+            return imm8;
+        case 1:
+            return imm8 << 16 | imm8;
+        case 2:
+            return imm8 << 24 | imm8 << 8;
+        default:
+            return imm8 << 24 | imm8 << 16 | imm8 << 8 | imm8;
+        }
+    }
+    uint32_t unrotated = 0x80 | (imm12 & 0x7f);
+    int rot = imm12 >> 7;
+    uint32_t value = unrotated >> rot | unrotated << (32 - rot);
+    *carry = value >> 31;
+    return value;
+}
+
+static int condition(t2_sim_t *sim, int cond) {
+    int result;
+    switch (cond >> 1) {
+    case 0: result = sim->z; break;
+    case 1: result = sim->c; break;
+    case 2: result = sim->n; break;
+    case 3: result = sim->v; break;
+    case 4: result = sim->c && !sim->z; break;
+    case 5: result = sim->n == sim->v; break;
+    case 6: result = !sim->z && sim->n == sim->v; break;
+    default: return 1;
+    }
+    return cond & 1 ? !result : result;
+}
+
+/* Data processing operation shared by the shifted register and modified
+ * immediate encodings. Writes Rd unless the op is TST/TEQ/CMN/CMP.
+ */
+static void data_op(t2_sim_t *sim, int op, int s, int rn, int rd, uint32_t b, int carry) {
+    uint32_t a = rn == 15 ? 0 : sim->r[rn];
+    uint32_t result;
+    int logical = 1;
+
+    switch (op) {
+    case 0x0: result = a & b; break;
+    case 0x1: result = a & ~b; break;
+    case 0x2: result = rn == 15 ? b : a | b; break;
+    case 0x3: result = rn == 15 ? ~b : a | ~b; break;
+    case 0x4: result = a ^ b; break;
+    case 0x8: result = add_with_carry(sim, a, b, 0, s); logical = 0; break;
+    case 0xa: result = add_with_carry(sim, a, b, sim->c, s); logical = 0; break;
+    case 0xb: result = add_with_carry(sim, a, ~b, sim->c, s); logical = 0; break;
+    case 0xd: result = add_with_carry(sim, a, ~b, 1, s); logical = 0; break;
+    case 0xe: result = add_with_carry(sim, b, ~a, 1, s); logical = 0; break;
+    default: fault(sim, "data processing op", op); return;
+    }
+    if (s && logical) {
+        sim->n = result >> 31;
+        sim->z = result == 0;
+        sim->c = carry;
+    }
+    // TST, TEQ, CMN and CMP only set the flags
+    if (rd == 15 && s && (op == 0x0 || op == 0x4 || op == 0x8 || op == 0xd))
+        return;
+    if (rd == 15)
+        fault(sim, "data processing to pc", op);
+    sim->r[rd] = result;
+}
+
+/******************************** EXECUTE ********************************/
+
+static void branch(t2_sim_t *sim, uint32_t target) {
+    sim->r[15] = target & ~1u;
+    sim->cycles += PIPELINE_REFILL;
+}
+
+// LDM/STM/PUSH/POP, increment after or decrement before
+static void block_transfer(t2_sim_t *sim, int rn, uint32_t list, int load, int inc, int wback) {
+    int count = __builtin_popcount(list);
+    uint32_t addr = inc ? sim->r[rn] : sim->r[rn] - 4 * count;
+    uint32_t end = inc ? sim->r[rn] + 4 * count : addr;
+    uint32_t pc = 0;
+
+    for (int i = 0; i < 16; i++) {
+        if (!(list & (1u << i)))
+            continue;
+        if (!load)
+            wr32(sim, addr, sim->r[i]);
+        else if (i == 15)
+            pc = rd32(sim, addr);
+        else
+            sim->r[i] = rd32(sim, addr);
+        addr += 4;
+    }
+    if (wback && !(load && (list & (1u << rn))))
+        sim->r[rn] = end;
+    sim->cycles += 1 + count;
+    if (list & 0x8000)
+        branch(sim, pc);
+}
+
+// Single load or store, size 0 byte, 1 halfword, 2 word
+static void single_transfer(t2_sim_t *sim, int load, int size, int sign, int rt, uint32_t addr) {
+    if (load) {
+        uint32_t v = size == 2 ? rd32(sim, addr) : size == 1 ? rd16(sim, addr) : *mem(sim, addr, 1);
+        if (sign)
+            v = size == 1 ? (uint32_t)(int16_t)v : (uint32_t)(int8_t)v;
+        if (rt == 15)
+            branch(sim, v);
+        else
+            sim->r[rt] = v;
+    } else if (size == 2) {
+        wr32(sim, addr, sim->r[rt]);
+    } else if (size == 1) {
+        wr16(sim, addr, sim->r[rt]);
+    } else {
+        *mem(sim, addr, 1) = sim->r[rt];
+    }
+    sim->cycles += sim->last_ldst ? 1 : 2;
+}
+
+static int step16(t2_sim_t *sim, uint32_t hw, uint32_t pc) {
+    uint32_t *r = sim->r;
+    int rd = hw & 7, rn = (hw >> 3) & 7, rm = (hw >> 6) & 7;
+    int carry = sim->c;
+
+    sim->cycles++;
+    switch (hw >> 11) {
+    case 0x00: case 0x01: case 0x02: {
+        // LSL/LSR/ASR #imm5, MOVS Rd, Rm when LSL #0
+        int type = hw >> 11, imm5 = (hw >> 6) & 31;
+        r[rd] = shift_c(r[rn], type, imm_shift(type, imm5), &carry);
+        sim->n = r[rd] >> 31;
+        sim->z = r[rd] == 0;
+        sim->c = carry;
+        return 0;
+    }
+    case 0x03: {
+        uint32_t b = hw & 0x400 ? (uint32_t)rm : r[rm];
+        r[rd] = hw & 0x200 ? add_with_carry(sim, r[rn], ~b, 1, 1)
+                           : add_with_carry(sim, r[rn], b, 0, 1);
+        return 0;
+    }
+    case 0x04: case 0x05: case 0x06: case 0x07: {
+        int rdn = (hw >> 8) & 7;
+        uint32_t imm8 = hw & 0xff;
+        int op = (hw >> 11) & 3;
+        if (op == 0) {
+            r[rdn] = imm8;
+            sim->n = 0;
+            sim->z = imm8 == 0;
+        } else if (op == 1) {
+            add_with_carry(sim, r[rdn], ~imm8, 1, 1);
+        } else if (op == 2) {
+            r[rdn] = add_with_carry(sim, r[rdn], imm8, 0, 1);
+        } else {
+            r[rdn] = add_with_carry(sim, r[rdn], ~imm8, 1, 1);
+        }
+        return 0;
+    }
+    case 0x08:
+        if (!(hw & 0x400)) {
+            uint32_t a = r[rd], b = r[rn], res;
+            int op = (hw >> 6) & 15, flags_only = 0;
+            switch (op) {
+            case 0x0: res = a & b; break;
+            case 0x1: res = a ^ b; break;
+            case 0x2: res = shift_reg(a, 0, b, &carry); break;
+            case 0x3: res = shift_reg(a, 1, b, &carry); break;
+            case 0x4: res = shift_reg(a, 2, b, &carry); break;
+            case 0x5: r[rd] = add_with_carry(sim, a, b, sim->c, 1); return 0;
+            case 0x6: r[rd] = add_with_carry(sim, a, ~b, sim->c, 1); return 0;
+            case 0x7: res = shift_reg(a, 3, b, &carry); break;
+            case 0x8: res = a & b; flags_only = 1; break;
+            case 0x9: r[rd] = add_with_carry(sim, ~b, 0, 1, 1); return 0;
+            case 0xa: add_with_carry(sim, a, ~b, 1, 1); return 0;
+            case 0xb: add_with_carry(sim, a, b, 0, 1); return 0;
+            case 0xc: res = a | b; break;
+            case 0xd: res = a * b; break;
+            case 0xe: res = a & ~b; break;
+            default: res = ~b; break;
+            }
+            sim->n = res >> 31;
+            sim->z = res == 0;
+            sim->c = carry;
+            if (!flags_only)
+                r[rd] = res;
+            return 0;
+        } else {
+            // ADD/CMP/MOV with high registers, BX
+            int dn = (hw & 7) | ((hw >> 4) & 8), m = (hw >> 3) & 15;
+            uint32_t vdn = dn == 15 ? pc + 4 : r[dn], vm = m == 15 ? pc + 4 : r[m];
+            switch ((hw >> 8) & 3) {
+            case 0:
+                if (dn == 15)
+                    branch(sim, vdn + vm);
+                else
+                    r[dn] = vdn + vm;
+                return 0;
+            case 1:
+                add_with_carry(sim, vdn, ~vm, 1, 1);
+                return 0;
+            case 2:
+                if (dn == 15)
+                    branch(sim, vm);
+                else
+                    r[dn] = vm;
+                return 0;
+            default:
+                if (hw & 0x80)
+                    return -1; // BLX register
+                branch(sim, vm);
+                return 0;
+            }
+        }
+    case 0x09: {
+        // LDR Rt, [pc, #imm8]
+        uint32_t addr = ((pc + 4) & ~3u) + (hw & 0xff) * 4;
+        sim->cycles--;
+        single_transfer(sim, 1, 2, 0, (hw >> 8) & 7, addr);
+        return 1;
+    }
+    case 0x0a: case 0x0b: {
+        static const int load[8] = {0, 0, 0, 1, 1, 1, 1, 1};
+        static const int size[8] = {2, 1, 0, 0, 2, 1, 0, 1};
+        static const int sign[8] = {0, 0, 0, 1, 0, 0, 0, 1};
+        int op = (hw >> 9) & 7;
+        sim->cycles--;
+        single_transfer(sim, load[op], size[op], sign[op], rd, r[rn] + r[rm]);
+        return 1;
+    }
+    case 0x0c: case 0x0d: case 0x0e: case 0x0f: {
+        int byte = hw & 0x1000, imm5 = (hw >> 6) & 31;
+        sim->cycles--;
+        single_transfer(sim, (hw >> 11) & 1, byte ? 0 : 2, 0, rd, r[rn] + (byte ? imm5 : imm5 * 4));
+        return 1;
+    }
+    case 0x10: case 0x11:
+        sim->cycles--;
+        single_transfer(sim, (hw >> 11) & 1, 1, 0, rd, r[rn] + ((hw >> 6) & 31) * 2);
+        return 1;
+    case 0x12: case 0x13:
+        sim->cycles--;
+        single_transfer(sim, (hw >> 11) & 1, 2, 0, (hw >> 8) & 7, r[13] + (hw & 0xff) * 4);
+        return 1;
+    case 0x14:
+        r[(hw >> 8) & 7] = ((pc + 4) & ~3u) + (hw & 0xff) * 4;
+        return 0;
+    case 0x15:
+        r[(hw >> 8) & 7] = r[13] + (hw & 0xff) * 4;
+        return 0;
+    case 0x16: case 0x17:
+        if ((hw & 0xff00) == 0xb000) {
+            uint32_t imm = (hw & 0x7f) * 4;
+            r[13] = hw & 0x80 ? r[13] - imm : r[13] + imm;
+        } else if ((hw & 0xf500) == 0xb100) {
+            // CBZ/CBNZ
+            uint32_t off = ((hw >> 9) & 1) << 6 | ((hw >> 3) & 31) << 1;
+            if ((r[rd] == 0) != !!(hw & 0x800))
+                branch(sim, pc + 4 + off);
+        } else if ((hw & 0xfe00) == 0xb400) {
+            sim->cycles--;
+            block_transfer(sim, 13, (hw & 0xff) | (hw & 0x100) << 6, 0, 0, 1);
+        } else if ((hw & 0xfe00) == 0xbc00) {
+            sim->cycles--;
+            block_transfer(sim, 13, (hw & 0xff) | (hw & 0x100) << 7, 1, 1, 1);
+        } else if ((hw & 0xffc0) == 0xba00) {
+            r[rd] = __builtin_bswap32(r[rn]);
+        } else if ((hw & 0xffc0) == 0xba40) {
+            r[rd] = (r[rn] & 0x00ff00ff) << 8 | (r[rn] & 0xff00ff00) >> 8;
+        } else if ((hw & 0xff00) == 0xb200) {
+            // SXTH, SXTB, UXTH, UXTB
+            static const int bits[4] = {16, 8, 16, 8};
+            int op = (hw >> 6) & 3;
+            uint32_t v = r[rn] & ((1u << bits[op]) - 1);
+            r[rd] = op < 2 ? (uint32_t)((int32_t)(v << (32 - bits[op])) >> (32 - bits[op])) : v;
+        } else if (hw == 0xbf00) {
+            // NOP
+        } else {
+            return -1;
+        }
+        return 0;
+    case 0x18: case 0x19: {
+        int base = (hw >> 8) & 7, load = (hw >> 11) & 1;
+        sim->cycles--;
+        block_transfer(sim, base, hw & 0xff, load, 1, 1);
+        return 0;
+    }
+    case 0x1a: case 0x1b: {
+        int cond = (hw >> 8) & 15;
+        if (cond >= 14)
+            return -1;
+        if (condition(sim, cond))
+            branch(sim, pc + 4 + (uint32_t)((int32_t)(int8_t)(hw & 0xff) * 2));
+        return 0;
+    }
+    case 0x1c:
+        branch(sim, pc + 4 + (uint32_t)(((int32_t)(hw << 21)) >> 20));
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+static int step32(t2_sim_t *sim, uint32_t hw1, uint32_t hw2, uint32_t pc) {
+    uint32_t *r = sim->r;
+    int rn = hw1 & 15;
+    int op1 = (hw1 >> 11) & 3, op2 = (hw1 >> 4) & 0x7f;
+    int carry = sim->c;
+
+    if (op1 == 1 && (op2 & 0x64) == 0x00) {
+        // LDM/STM, PUSH/POP
+        int op = (hw1 >> 7) & 3;
+        if (op != 1 && op != 2)
+            return -1;
+        block_transfer(sim, rn, hw2, (hw1 >> 4) & 1, op == 1, (hw1 >> 5) & 1);
+        return 0;
+    }
+    if (op1 == 1 && (op2 & 0x64) == 0x04) {
+        // LDRD/STRD (immediate)
+        int p = (hw1 >> 8) & 1, u = (hw1 >> 7) & 1, w = (hw1 >> 5) & 1, load = (hw1 >> 4) & 1;
+        int rt = (hw2 >> 12) & 15, rt2 = (hw2 >> 8) & 15;
+        if (!p && !w)
+            return -1;
+        uint32_t base = rn == 15 ? (pc + 4) & ~3u : r[rn];
+        uint32_t offset = (hw2 & 0xff) * 4;
+        uint32_t target = u ? base + offset : base - offset;
+        uint32_t addr = p ? target : base;
+        if (load) {
+            r[rt] = rd32(sim, addr);
+            r[rt2] = rd32(sim, addr + 4);
+        } else {
+            wr32(sim, addr, r[rt]);
+            wr32(sim, addr + 4, r[rt2]);
+        }
+        if (w)
+            r[rn] = target;
+        sim->cycles += 3;
+        return 0;
+    }
+    if (op1 == 1 && (op2 & 0x60) == 0x20) {
+        // Data processing (shifted register)
+        int type = (hw2 >> 4) & 3;
+        int amount = imm_shift(type, ((hw2 >> 12) & 7) << 2 | ((hw2 >> 6) & 3));
+        uint32_t b = shift_c(r[hw2 & 15], type, amount, &carry);
+        data_op(sim, (hw1 >> 5) & 15, (hw1 >> 4) & 1, rn, (hw2 >> 8) & 15, b, carry);
+        sim->cycles++;
+        return 0;
+    }
+    if (op1 == 2 && !(hw2 & 0x8000)) {
+        int rd = (hw2 >> 8) & 15;
+        uint32_t imm12 = ((hw1 >> 10) & 1) << 11 | ((hw2 >> 12) & 7) << 8 | (hw2 & 0xff);
+        sim->cycles++;
+        if (!(op2 & 0x20)) {
+            // Data processing (modified immediate)
+            uint32_t b = expand_imm(imm12, &carry);
+            data_op(sim, (hw1 >> 5) & 15, (hw1 >> 4) & 1, rn, rd, b, carry);
+            return 0;
+        }
+        // Data processing (plain binary immediate)
+        int lsb = ((hw2 >> 12) & 7) << 2 | ((hw2 >> 6) & 3), hi = hw2 & 31;
+        switch ((hw1 >> 4) & 0x1f) {
+        case 0x00:
+            r[rd] = (rn == 15 ? (pc + 4) & ~3u : r[rn]) + imm12;
+            return 0;
+        case 0x0a:
+            r[rd] = (rn == 15 ? (pc + 4) & ~3u : r[rn]) - imm12;
+            return 0;
+        case 0x04:
+            r[rd] = (uint32_t)rn << 12 | imm12;
+            return 0;
+        case 0x0c:
+            r[rd] = (r[rd] & 0xffff) | ((uint32_t)rn << 12 | imm12) << 16;
+            return 0;
+        case 0x16: {
+            // BFI, BFC when Rn is pc
+            if (hi < lsb)
+                return -1;
+            uint32_t mask = (uint32_t)(((uint64_t)1 << (hi - lsb + 1)) - 1) << lsb;
+            uint32_t ins = rn == 15 ? 0 : r[rn] << lsb;
+            r[rd] = (r[rd] & ~mask) | (ins & mask);
+            return 0;
+        }
+        case 0x1c:
+            // UBFX
+            r[rd] = (r[rn] >> lsb) & (uint32_t)(((uint64_t)1 << (hi + 1)) - 1);
+            return 0;
+        default:
+            return -1;
+        }
+    }
+    if (op1 == 2) {
+        // Branches and miscellaneous control
+        uint32_t s = (hw1 >> 10) & 1, j1 = (hw2 >> 13) & 1, j2 = (hw2 >> 11) & 1;
+        sim->cycles++;
+        if ((hw2 & 0x5000) == 0x5000 || (hw2 & 0x5000) == 0x1000) {
+            uint32_t i1 = !(j1 ^ s), i2 = !(j2 ^ s);
+            int32_t off = (int32_t)((s << 24 | i1 << 23 | i2 << 22 | (hw1 & 0x3ff) << 12 |
+                                     (hw2 & 0x7ff) << 1) << 7) >> 7;
+            if (hw2 & 0x4000)
+                r[14] = (pc + 4) | 1;
+            branch(sim, pc + 4 + off);
+            return 0;
+        }
+        if ((hw2 & 0x5000) == 0x0000 && ((hw1 >> 7) & 7) != 7) {
+            int32_t off = (int32_t)((s << 20 | j2 << 19 | j1 << 18 | (hw1 & 0x3f) << 12 |
+                                     (hw2 & 0x7ff) << 1) << 11) >> 11;
+            if (condition(sim, (hw1 >> 6) & 15))
+                branch(sim, pc + 4 + off);
+            return 0;
+        }
+        if (hw1 == 0xf3af && hw2 == 0x8000)
+            return 0; // NOP.W
+        return -1;
+    }
+    if (op1 == 3 && (op2 & 0x60) == 0 && ((op2 & 0x71) == 0x00 || (op2 & 1))) {
+        // Load/store single
+        int load = (hw1 >> 4) & 1, size = (hw1 >> 5) & 3, sign = (hw1 >> 8) & 1;
+        int rt = (hw2 >> 12) & 15;
+        uint32_t addr;
+        if (size == 3)
+            return -1;
+        if (rn == 15) {
+            uint32_t base = (pc + 4) & ~3u;
+            addr = hw1 & 0x80 ? base + (hw2 & 0xfff) : base - (hw2 & 0xfff);
+        } else if (hw1 & 0x80) {
+            addr = r[rn] + (hw2 & 0xfff);
+        } else if ((hw2 & 0xfc0) == 0) {
+            addr = r[rn] + (r[hw2 & 15] << ((hw2 >> 4) & 3));
+        } else if (hw2 & 0x800) {
+            int p = (hw2 >> 10) & 1, u = (hw2 >> 9) & 1, w = (hw2 >> 8) & 1;
+            if ((hw2 & 0xf00) == 0xe00)
+                return -1; // unprivileged
+            uint32_t target = u ? r[rn] + (hw2 & 0xff) : r[rn] - (hw2 & 0xff);
+            addr = p ? target : r[rn];
+            single_transfer(sim, load, size, sign, rt, addr);
+            if (w)
+                r[rn] = target;
+            return 1;
+        } else {
+            return -1;
+        }
+        single_transfer(sim, load, size, sign, rt, addr);
+        return 1;
+    }
+    if (op1 == 3 && (op2 & 0x70) == 0x20) {
+        // Data processing (register)
+        int rd = (hw2 >> 8) & 15, rm = hw2 & 15;
+        int op = (hw1 >> 4) & 15, sub = (hw2 >> 4) & 15;
+        sim->cycles++;
+        if ((hw2 & 0xf000) != 0xf000)
+            return -1;
+        if (op < 8 && sub == 0) {
+            // LSL/LSR/ASR/ROR by register
+            r[rd] = shift_reg(r[rn], op >> 1, r[rm], &carry);
+            if (op & 1) {
+                sim->n = r[rd] >> 31;
+                sim->z = r[rd] == 0;
+                sim->c = carry;
+            }
+            return 0;
+        }
+        if (op == 9 && sub == 8) {
+            r[rd] = __builtin_bswap32(r[rm]);
+            return 0;
+        }
+        if (op == 9 && sub == 9) {
+            r[rd] = (r[rm] & 0x00ff00ff) << 8 | (r[rm] & 0xff00ff00) >> 8;
+            return 0;
+        }
+        if (op == 0xb && sub == 8) {
+            r[rd] = r[rm] ? __builtin_clz(r[rm]) : 32;
+            return 0;
+        }
+        return -1;
+    }
+    if (op1 == 3 && (op2 & 0x78) == 0x30) {
+        // MUL, MLA, MLS
+        int ra = (hw2 >> 12) & 15, rd = (hw2 >> 8) & 15, rm = hw2 & 15;
+        int op = (hw1 >> 4) & 7, sub = (hw2 >> 4) & 15;
+        uint32_t product = r[rn] * r[rm];
+        if (op != 0 || sub > 1)
+            return -1;
+        if (ra == 15) {
+            r[rd] = product;
+            sim->cycles += 1;
+        } else {
+            r[rd] = sub ? r[ra] - product : r[ra] + product;
+            sim->cycles += 2;
+        }
+        return 0;
+    }
+    if (op1 == 3 && (op2 & 0x78) == 0x38) {
+        // Long multiply
+        int lo = (hw2 >> 12) & 15, hi = (hw2 >> 8) & 15, rm = hw2 & 15;
+        int op = (hw1 >> 4) & 7, sub = (hw2 >> 4) & 15;
+        uint64_t product = (uint64_t)r[rn] * r[rm];
+        uint64_t result;
+        if (op == 2 && sub == 0)
+            result = product;
+        else if (op == 6 && sub == 0)
+            result = product + ((uint64_t)r[hi] << 32 | r[lo]);
+        else if (op == 6 && sub == 6)
+            result = product + r[hi] + r[lo];
+        else if (op == 0 && sub == 0)
+            result = (uint64_t)((int64_t)(int32_t)r[rn] * (int32_t)r[rm]);
+        else
+            return -1;
+        r[lo] = (uint32_t)result;
+        r[hi] = (uint32_t)(result >> 32);
+        sim->cycles += 1;
+        return 0;
+    }
+    return -1;
+}
+
+uint32_t t2_call(t2_sim_t *sim, const char *name, int argc, const uint32_t *args) {
+    uint32_t entry = 0;
+    for (int i = 0; i < sim->nsyms; i++)
+        if (!strcmp(sim->syms[i].name, name))
+            entry = sim->syms[i].addr;
+    if (!entry) {
+        fprintf(stderr, "thumb2_sim: no symbol %s\n", name);
+        exit(1);
+    }
+
+    uint32_t sp = T2_RAM_BASE + T2_RAM_SIZE;
+    for (int i = argc - 1; i >= 4; i--) {
+        sp -= 4;
+        wr32(sim, sp, args[i]);
+    }
+    for (int i = 0; i < 4; i++)
+        sim->r[i] = i < argc ? args[i] : 0;
+    sim->r[13] = sp;
+    sim->r[14] = RETURN_MAGIC | 1;
+    sim->r[15] = entry & ~1u;
+    sim->last_ldst = 0;
+
+    while (sim->r[15] != RETURN_MAGIC) {
+        uint32_t pc = sim->r[15];
+        uint32_t hw1 = rd16(sim, pc);
+        int is32 = (hw1 >> 11) >= 0x1d;
+        uint32_t hw2 = is32 ? rd16(sim, pc + 2) : 0;
+        int ldst;
+
+        sim->r[15] = pc + (is32 ? 4 : 2);
+        ldst = is32 ? step32(sim, hw1, hw2, pc) : step16(sim, hw1, pc);
+        if (ldst < 0) {
+            sim->r[15] = pc;
+            fault(sim, "unsupported instruction", is32 ? hw1 << 16 | hw2 : hw1);
+        }
+        sim->last_ldst = ldst;
+        sim->instructions++;
+    }
+    sim->scratch = T2_RAM_BASE;
+    return sim->r[0];
+}
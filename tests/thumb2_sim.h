@@ -0,0 +1,77 @@
+/**
+ * @file thumb2_sim.h
+ * @brief Host interpreter for the wolfSSL Cortex-M thumb2 assembly
+ *
+ * Loads an ARM ELF object assembled from a wolfSSL thumb2 .S file, links it
+ * at MAX78000 flash and SRAM addresses and runs its functions one
+ * instruction at a time, so host tests can check the assembly the firmware
+ * builds with CRYPTO_THUMB2_AES=1 or KEY_SYNC_X25519=1 without a board.
+ *
+ * Cycles are counted with the Cortex-M4 TRM instruction timings and zero
+ * flash wait states. They are an estimate, not a measurement: the board's
+ * DWT counter (test_encryption.c) is the reference.
+ */
+
+#ifndef THUMB2_SIM_H
+#define THUMB2_SIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define T2_FLASH_BASE 0x10000000u
+#define T2_FLASH_SIZE 0x00010000u
+#define T2_RAM_BASE 0x20000000u
+#define T2_RAM_SIZE 0x00010000u
+#define T2_MAX_SYMBOLS 64
+
+typedef struct {
+    uint8_t flash[T2_FLASH_SIZE];
+    uint8_t ram[T2_RAM_SIZE];
+    uint32_t r[16];
+    int n, z, c, v;
+    struct {
+        char name[32];
+        uint32_t addr;
+    } syms[T2_MAX_SYMBOLS];
+    int nsyms;
+    uint32_t scratch;       // Next free byte of the argument area in RAM
+    uint64_t cycles;        // Cortex-M4 model cycles since t2_load()
+    uint64_t instructions;  // Instructions executed since t2_load()
+    int last_ldst;          // Previous instruction was a single LDR/STR
+} t2_sim_t;
+
+/** @brief Loads and links a thumb2 ELF object
+ *
+ * @param sim Interpreter state to initialize
+ * @param path Object assembled for thumbv7em, e.g. with llvm-mc
+ *
+ * @return 0 on success, -1 if the object cannot be read or linked
+ */
+int t2_load(t2_sim_t *sim, const char *path);
+
+/** @brief Copies bytes into the argument area of the emulated RAM
+ *
+ * The area is reused once t2_call() returns, so copy results out with
+ * t2_get() before the next t2_put().
+ *
+ * @return Emulated address of the copy, word aligned
+ */
+uint32_t t2_put(t2_sim_t *sim, const void *data, size_t len);
+
+/** @brief Copies bytes out of the emulated memory */
+void t2_get(t2_sim_t *sim, uint32_t addr, void *out, size_t len);
+
+/** @brief Calls a global function of the object with the AAPCS
+ *
+ * @param name Function symbol
+ * @param argc Number of arguments, the ones past four go on the stack
+ * @param args Arguments
+ *
+ * @return r0 on return
+ */
+uint32_t t2_call(t2_sim_t *sim, const char *name, int argc, const uint32_t *args);
+
+/** @brief Model cycles of every thumb2 function thumb2_wolfcrypt.c has run */
+uint64_t thumb2_cycles(void);
+
+#endif
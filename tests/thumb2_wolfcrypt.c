@@ -0,0 +1,95 @@
+/**
+ * @file thumb2_wolfcrypt.c
+ * @brief wolfSSL's thumb2 assembly entry points, run on thumb2_sim.c
+ *
+ * With WOLFSSL_ARMASM the wolfSSL glue the firmware builds (armv8-aes.c,
+ * curve25519.c) calls these instead of its C code. Each copies its buffers
+ * into the interpreter, runs the function of the same name in the object
+ * assembled from the port's .S file and copies the results back. The
+ * objects are THUMB2_AES_OBJ and, with HAVE_CURVE25519,
+ * THUMB2_CURVE25519_OBJ. See test_aes_kat.c for how they are built.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <wolfssl/wolfcrypt/settings.h>
+#include <wolfssl/wolfcrypt/types.h>
+
+#include "thumb2_sim.h"
+
+// Largest AES key schedule, 15 round keys
+#define KEY_SCHEDULE_LEN 240
+#define X25519_KEY_SIZE 32
+
+static t2_sim_t aes_sim;
+#ifdef HAVE_CURVE25519
+static t2_sim_t curve25519_sim;
+#endif
+
+static t2_sim_t *loaded(t2_sim_t *sim, const char *path) {
+    if (!sim->nsyms && t2_load(sim, path) != 0) {
+        fprintf(stderr, "cannot load %s\n", path);
+        exit(1);
+    }
+    return sim;
+}
+
+uint64_t thumb2_cycles(void) {
+    uint64_t cycles = aes_sim.cycles;
+#ifdef HAVE_CURVE25519
+    cycles += curve25519_sim.cycles;
+#endif
+    return cycles;
+}
+
+/******************************** AES ********************************/
+
+void AES_set_encrypt_key(const unsigned char *key, word32 len, unsigned char *ks) {
+    t2_sim_t *s = loaded(&aes_sim, THUMB2_AES_OBJ);
+    uint32_t args[3] = {t2_put(s, key, len / 8), len, t2_put(s, ks, KEY_SCHEDULE_LEN)};
+    t2_call(s, "AES_set_encrypt_key", 3, args);
+    t2_get(s, args[2], ks, KEY_SCHEDULE_LEN);
+}
+
+void AES_invert_key(unsigned char *ks, word32 rounds) {
+    t2_sim_t *s = loaded(&aes_sim, THUMB2_AES_OBJ);
+    uint32_t args[2] = {t2_put(s, ks, KEY_SCHEDULE_LEN), rounds};
+    t2_call(s, "AES_invert_key", 2, args);
+    t2_get(s, args[0], ks, KEY_SCHEDULE_LEN);
+}
+
+static void ecb(const char *name, const unsigned char *in, unsigned char *out,
+                unsigned long len, const unsigned char *ks, int nr) {
+    t2_sim_t *s = loaded(&aes_sim, THUMB2_AES_OBJ);
+    uint32_t args[5] = {t2_put(s, in, len), t2_put(s, out, len), len,
+                        t2_put(s, ks, KEY_SCHEDULE_LEN), nr};
+    t2_call(s, name, 5, args);
+    t2_get(s, args[1], out, len);
+}
+
+void AES_ECB_encrypt(const unsigned char *in, unsigned char *out, unsigned long len,
+                     const unsigned char *ks, int nr) {
+    ecb("AES_ECB_encrypt", in, out, len, ks, nr);
+}
+
+void AES_ECB_decrypt(const unsigned char *in, unsigned char *out, unsigned long len,
+                     const unsigned char *ks, int nr) {
+    ecb("AES_ECB_decrypt", in, out, len, ks, nr);
+}
+
+/******************************** CURVE25519 ********************************/
+#ifdef HAVE_CURVE25519
+void fe_init(void) {
+    t2_call(loaded(&curve25519_sim, THUMB2_CURVE25519_OBJ), "fe_init", 0, NULL);
+}
+
+int curve25519(byte *q, const byte *n, const byte *p) {
+    t2_sim_t *s = loaded(&curve25519_sim, THUMB2_CURVE25519_OBJ);
+    uint32_t args[3] = {t2_put(s, q, X25519_KEY_SIZE), t2_put(s, n, X25519_KEY_SIZE),
+                        t2_put(s, p, X25519_KEY_SIZE)};
+    int result = (int)t2_call(s, "curve25519", 3, args);
+    t2_get(s, args[0], q, X25519_KEY_SIZE);
+    return result;
+}
+#endif